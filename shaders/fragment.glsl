@@ -1,4 +1,5 @@
 #version 460 core
+#extension GL_ARB_bindless_texture : enable
 
 const int LIGHT_TYPE_DIRECTIONAL = 0;
 const int LIGHT_TYPE_POSITIONAL  = 1;
@@ -50,15 +51,114 @@ in vec3 color;
 in vec2 TexCoord;
 in vec3 Normal;  
 in vec3 FragPos; 
+in float ViewDepth;
+flat in int MaterialId;
 
 uniform Material material;
 uniform vec3 viewPos;
 
+// material table, see src/materials.hpp: MaterialId 0 samples material above, otherwise
+// materials[MaterialId - 1] through bindless handles, layers of materialArrays or materialSlots
+#define MATERIAL_MAX_ARRAYS 4
+#define MATERIAL_MAX_SLOTS 6
+struct MaterialData {
+    uvec2 diffuseHandle;    // zero without bindless textures
+    uvec2 specularHandle;
+    int diffuseArray;       // index into materialArrays, -1 when not packed
+    int diffuseLayer;
+    int specularArray;
+    int specularLayer;
+    int diffuseSlot;        // index into materialSlots, -1 when sampled another way
+    int specularSlot;
+    float shininess;
+};
+layout (std430, binding = 3) readonly buffer Materials { MaterialData materials[]; };
+layout (binding = 11) uniform sampler2DArray materialArrays[MATERIAL_MAX_ARRAYS];
+layout (binding = 2) uniform sampler2D materialSlots[MATERIAL_MAX_SLOTS];
+float materialShininess; // of whichever material main samples
+
 #define NR_POINT_LIGHTS 4  // TODO fix this needs to be dynamic
 uniform PointLight pointLights[NR_POINT_LIGHTS];
+uniform int pointLightMask; // bit i set when pointLights[i] reaches the object, from the scene octree
 uniform SpotLight spotLight;
 uniform DirLight dirLight;
 
+#define MAX_CASCADES 4
+uniform sampler2DArrayShadow shadowMap;
+uniform mat4 cascadeMatrices[MAX_CASCADES];
+uniform float cascadeSplits[MAX_CASCADES];     // view depth where each cascade ends
+uniform float cascadeTexelSizes[MAX_CASCADES]; // world units per shadow texel
+uniform int cascadeCount;
+
+// point and spot light tiles in the shadow atlas: xy offset and zw size in atlas uv, zero size when unshadowed
+uniform sampler2DShadow shadowAtlas;
+uniform mat4 pointShadowMatrices[NR_POINT_LIGHTS * 6]; // +X, -X, +Y, -Y, +Z, -Z
+uniform vec4 pointShadowTiles[NR_POINT_LIGHTS * 6];
+uniform mat4 spotShadowMatrices[1];
+uniform vec4 spotShadowTiles[1];
+
+// sky lighting, see src/environment.hpp: irradiance / pi as L2 spherical harmonics with the basis
+// constants folded in, and the sky prefiltered for roughness 0 to 1 across the mips of environmentMap
+uniform vec3 shIrradiance[9];
+uniform samplerCube environmentMap;
+uniform float environmentMips;
+
+// calculates how much of the directional light reaches the fragment, 0 fully shadowed to 1 lit.
+float CalcDirShadow(vec3 normal, vec3 lightDir)
+{
+    int cascade = 0;
+    while (cascade < cascadeCount && ViewDepth > cascadeSplits[cascade]) cascade++;
+    if (cascade == cascadeCount) return 1.0;
+
+    // normal offset: move the lookup off the surface by about a texel, more at grazing angles
+    float grazing = 1.0 - clamp(dot(normal, lightDir), 0.0, 1.0);
+    vec3 samplePos = FragPos + normal * cascadeTexelSizes[cascade] * (1.0 + 2.0 * grazing);
+    vec4 lightSpace = cascadeMatrices[cascade] * vec4(samplePos, 1.0);
+    vec3 coords = lightSpace.xyz * 0.5 + 0.5;
+    coords.z = min(coords.z, 1.0);
+
+    // 3x3 PCF, each tap is already a bilinear 2x2 comparison
+    vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    float lit = 0.0;
+    for (int x = -1; x <= 1; x++)
+        for (int y = -1; y <= 1; y++)
+            lit += texture(shadowMap, vec4(coords.xy + vec2(x, y) * texel, float(cascade), coords.z));
+    return lit / 9.0;
+}
+
+// calculates the lit fraction of the fragment for one perspective tile of the shadow atlas.
+float CalcAtlasShadow(mat4 lightViewProjection, vec4 tile, vec3 normal, vec3 lightPos)
+{
+    if (tile.z == 0.0) return 1.0;
+
+    // normal offset by about a texel at the fragment's distance; row 0 of the matrix scales by 1 / tan(fov / 2)
+    vec2 atlasTexel = 1.0 / vec2(textureSize(shadowAtlas, 0));
+    float tanHalfFov = 1.0 / length(vec3(lightViewProjection[0][0], lightViewProjection[1][0], lightViewProjection[2][0]));
+    float texelSize = 2.0 * length(lightPos - FragPos) * tanHalfFov * atlasTexel.x / tile.z;
+    vec4 clip = lightViewProjection * vec4(FragPos + normal * texelSize * 1.5, 1.0);
+    vec3 ndc = clip.xyz / clip.w;
+    if (clip.w <= 0.0 || abs(ndc.x) > 1.0 || abs(ndc.y) > 1.0) return 1.0;
+
+    vec2 uv = tile.xy + (ndc.xy * 0.5 + 0.5) * tile.zw;
+    float depth = min(ndc.z * 0.5 + 0.5, 1.0);
+    // keep the taps inside the tile, its neighbours belong to other lights
+    vec2 low = tile.xy + atlasTexel * 0.5;
+    vec2 high = tile.xy + tile.zw - atlasTexel * 0.5;
+    float lit = 0.0;
+    for (int x = -1; x <= 1; x++)
+        for (int y = -1; y <= 1; y++)
+            lit += texture(shadowAtlas, vec3(clamp(uv + vec2(x, y) * atlasTexel, low, high), depth));
+    return lit / 9.0;
+}
+
+float CalcPointShadow(int index, vec3 normal)
+{
+    vec3 d = FragPos - pointLights[index].position;
+    vec3 a = abs(d);
+    int face = a.x >= a.y && a.x >= a.z ? (d.x > 0.0 ? 0 : 1) : (a.y >= a.z ? (d.y > 0.0 ? 2 : 3) : (d.z > 0.0 ? 4 : 5));
+    return CalcAtlasShadow(pointShadowMatrices[index * 6 + face], pointShadowTiles[index * 6 + face], normal, pointLights[index].position);
+}
+
 vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec4 diffuseTextureColor, vec4 specularTextureColor)
 {
     vec3 lightDir = normalize(-light.direction);
@@ -66,25 +166,25 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec4 diffuseTexture
     float diff = max(dot(normal, lightDir), 0.0);
     // specular shading
     vec3 halfwayDir = normalize(lightDir + viewDir);
-    float spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), materialShininess);
     if (diff == 0.0) {spec = 0.0;}
 
-    vec3 ambient = light.ambient * vec3(diffuseTextureColor);
     vec3 diffuse = light.diffuse * diff * vec3(diffuseTextureColor);
     vec3 specular = light.specular * spec * vec3(specularTextureColor);
 
-    return (ambient + diffuse + specular);
+    float shadow = CalcDirShadow(normal, lightDir);
+    return (diffuse + specular) * shadow;
 }
 
 // calculates the color when using a point light.
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec4 diffuseTextureColor, vec4 specularTextureColor)
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec4 diffuseTextureColor, vec4 specularTextureColor, float shadow)
 {
     vec3 lightDir = normalize(light.position - fragPos);
     // diffuse shading
     float diff = max(dot(normal, lightDir), 0.0);
     // specular shading
     vec3 halfwayDir = normalize(lightDir + viewDir);
-    float spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), materialShininess);
     if (diff == 0.0) {spec = 0.0;}
 
     // attenuation
@@ -96,21 +196,21 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, v
     vec3 specular = light.specular * spec * vec3(specularTextureColor);
 
     ambient *= attenuation;
-    diffuse *= attenuation;
-    specular *= attenuation;
+    diffuse *= attenuation * shadow;
+    specular *= attenuation * shadow;
 
     return (ambient + diffuse + specular);
 }
 
 // calculates the color when using a spot light.
-vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec4 diffuseTextureColor, vec4 specularTextureColor)
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec4 diffuseTextureColor, vec4 specularTextureColor, float shadow)
 {
     vec3 lightDir = normalize(light.position - fragPos);
     // diffuse shading
     float diff = max(dot(normal, lightDir), 0.0);
     // specular shading
     vec3 halfwayDir = normalize(lightDir + viewDir);
-    float spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), materialShininess);
     if (diff == 0.0) {spec = 0.0;}
 
     // attenuation
@@ -126,28 +226,79 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec
     vec3 specular = light.specular * spec * vec3(specularTextureColor);
 
     ambient *= attenuation * intensity;
-    diffuse *= attenuation * intensity;
-    specular *= attenuation * intensity;
+    diffuse *= attenuation * intensity * shadow;
+    specular *= attenuation * intensity * shadow;
 
     return (ambient + diffuse + specular);
 }
 
+// diffuse sky light reaching a surface facing n, already divided by pi
+vec3 EvaluateSHIrradiance(vec3 n)
+{
+    return shIrradiance[0]
+         + shIrradiance[1] * n.y + shIrradiance[2] * n.z + shIrradiance[3] * n.x
+         + shIrradiance[4] * (n.x * n.y) + shIrradiance[5] * (n.y * n.z)
+         + shIrradiance[6] * (3.0 * n.z * n.z - 1.0)
+         + shIrradiance[7] * (n.x * n.z) + shIrradiance[8] * (n.x * n.x - n.y * n.y);
+}
+
+// the directional light's ambient term scales the sky: SH irradiance for diffuse, the prefiltered map
+// for specular, with the Blinn-Phong exponent mapped to a roughness and Schlick fresnel at F0 = 0.04
+vec3 CalcAmbient(DirLight light, vec3 normal, vec3 viewDir, vec4 diffuseTextureColor, vec4 specularTextureColor)
+{
+    vec3 irradiance = max(EvaluateSHIrradiance(normal), 0.0);
+    float roughness = sqrt(2.0 / (materialShininess + 2.0));
+    vec3 reflected = textureLod(environmentMap, reflect(-viewDir, normal), roughness * (environmentMips - 1.0)).rgb;
+    float fresnel = 0.04 + 0.96 * pow(1.0 - max(dot(normal, viewDir), 0.0), 5.0);
+    return light.ambient * (irradiance * vec3(diffuseTextureColor) + reflected * vec3(specularTextureColor) * fresnel);
+}
+
+vec4 SampleMaterialTexture(uvec2 handle, int array, int layer, int slot)
+{
+#ifdef GL_ARB_bindless_texture
+    if (handle != uvec2(0)) return texture(sampler2D(handle), TexCoord);
+#endif
+    if (slot >= 0) return texture(materialSlots[slot], TexCoord);
+    if (array < 0) return vec4(0.0);
+    return texture(materialArrays[array], vec3(TexCoord, float(layer)));
+}
+
 void main()
 {    
     vec3 norm = normalize(Normal);
     vec3 viewDir = normalize(viewPos - FragPos);
 
-    vec4 diffuseTextureColor = texture(material.texture_diffuse1, TexCoord);
-    vec4 specularTextureColor = texture(material.texture_specular1, TexCoord);
+    vec4 diffuseTextureColor;
+    vec4 specularTextureColor;
+    if (MaterialId == 0)
+    {
+        diffuseTextureColor = texture(material.texture_diffuse1, TexCoord);
+        specularTextureColor = texture(material.texture_specular1, TexCoord);
+        materialShininess = material.shininess;
+    }
+    else
+    {
+        // MaterialId is the same for a whole draw, so indexing the samplers with what it reads stays
+        // dynamically uniform even when the draw is one command of a multi-draw
+        MaterialData data = materials[MaterialId - 1];
+        diffuseTextureColor = SampleMaterialTexture(data.diffuseHandle, data.diffuseArray, data.diffuseLayer, data.diffuseSlot);
+        specularTextureColor = SampleMaterialTexture(data.specularHandle, data.specularArray, data.specularLayer, data.specularSlot);
+        materialShininess = data.shininess;
+    }
 
     float alpha = diffuseTextureColor.a;
 
-    vec3 result = CalcDirLight(dirLight, norm, viewDir, diffuseTextureColor, specularTextureColor);
+    vec3 result = CalcAmbient(dirLight, norm, viewDir, diffuseTextureColor, specularTextureColor);
+    result += CalcDirLight(dirLight, norm, viewDir, diffuseTextureColor, specularTextureColor);
 
     for(int i = 0; i < NR_POINT_LIGHTS; i++)
-        result += CalcPointLight(pointLights[i], norm, FragPos, viewDir, diffuseTextureColor, specularTextureColor);    
+    {
+        if ((pointLightMask & (1 << i)) == 0) continue;
+        result += CalcPointLight(pointLights[i], norm, FragPos, viewDir, diffuseTextureColor, specularTextureColor, CalcPointShadow(i, norm));
+    }
 
-    result += CalcSpotLight(spotLight, norm, FragPos, viewDir, diffuseTextureColor, specularTextureColor);    
+    float spotShadow = CalcAtlasShadow(spotShadowMatrices[0], spotShadowTiles[0], norm, spotLight.position);
+    result += CalcSpotLight(spotLight, norm, FragPos, viewDir, diffuseTextureColor, specularTextureColor, spotShadow);    
 
     FragColor = vec4(result, 1.0);
 }
\ No newline at end of file
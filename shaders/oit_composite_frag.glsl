@@ -0,0 +1,21 @@
+#version 460 core
+out vec4 FragColor;
+
+uniform sampler2DMS accumTexture;
+uniform sampler2DMS revealTexture;
+
+void main()
+{
+    // reading gl_SampleID runs this once per sample, matching the multisampled targets
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    float revealage = texelFetch(revealTexture, texel, gl_SampleID).r;
+    if (revealage >= 1.0) discard; // nothing transparent here
+
+    vec4 accum = texelFetch(accumTexture, texel, gl_SampleID);
+    // keep the sum finite when many bright layers overflow half floats
+    if (isinf(max(max(abs(accum.r), abs(accum.g)), abs(accum.b)))) accum.rgb = vec3(accum.a);
+    vec3 average = accum.rgb / max(accum.a, 0.00001);
+
+    // blended with (1 - src alpha, src alpha): average * coverage + background * revealage
+    FragColor = vec4(average, revealage);
+}
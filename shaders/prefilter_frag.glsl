@@ -0,0 +1,77 @@
+#version 460 core
+// Prefilters the sky for one face and mip of the specular environment map: GGX importance sampling
+// with the view direction taken equal to the normal, so each texel is the lobe for that direction.
+out vec4 FragColor;
+
+uniform samplerCube source;
+uniform float sourceSize;   // face size of the source's base level
+uniform float size;         // face size of the mip being written
+uniform float roughness;
+uniform int face;           // +X, -X, +Y, -Y, +Z, -Z
+
+#define SAMPLE_COUNT 64u
+const float PI = 3.14159265359;
+
+vec3 FaceDirection(vec2 uv)
+{
+    // uv in [-1, 1], rows top down, matching the GL cubemap face layout
+    if (face == 0) return vec3( 1.0, -uv.y, -uv.x);
+    if (face == 1) return vec3(-1.0, -uv.y,  uv.x);
+    if (face == 2) return vec3( uv.x,  1.0,  uv.y);
+    if (face == 3) return vec3( uv.x, -1.0, -uv.y);
+    if (face == 4) return vec3( uv.x, -uv.y,  1.0);
+    return vec3(-uv.x, -uv.y, -1.0);
+}
+
+vec2 Hammersley(uint i)
+{
+    uint bits = bitfieldReverse(i);
+    return vec2(float(i) / float(SAMPLE_COUNT), float(bits) * 2.3283064365386963e-10);
+}
+
+vec3 ImportanceSampleGGX(vec2 xi, vec3 n, float a)
+{
+    float phi = 2.0 * PI * xi.x;
+    float cosTheta = sqrt((1.0 - xi.y) / (1.0 + (a * a - 1.0) * xi.y));
+    float sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+    vec3 h = vec3(cos(phi) * sinTheta, sin(phi) * sinTheta, cosTheta);
+
+    vec3 up = abs(n.z) < 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(1.0, 0.0, 0.0);
+    vec3 tangent = normalize(cross(up, n));
+    vec3 bitangent = cross(n, tangent);
+    return normalize(tangent * h.x + bitangent * h.y + n * h.z);
+}
+
+void main()
+{
+    vec3 n = normalize(FaceDirection(gl_FragCoord.xy / size * 2.0 - 1.0));
+    if (roughness == 0.0)
+    {
+        FragColor = vec4(textureLod(source, n, 0.0).rgb, 1.0);
+        return;
+    }
+
+    float a = roughness * roughness;
+    float texelSolidAngle = 4.0 * PI / (6.0 * sourceSize * sourceSize);
+    vec3 color = vec3(0.0);
+    float totalWeight = 0.0;
+    for (uint i = 0u; i < SAMPLE_COUNT; i++)
+    {
+        vec3 h = ImportanceSampleGGX(Hammersley(i), n, a);
+        vec3 l = reflect(-n, h);
+        float nDotL = dot(n, l);
+        if (nDotL <= 0.0) continue;
+
+        // sample a source mip whose texels cover the solid angle this sample stands for, which hides
+        // the noise of a low sample count
+        float nDotH = max(dot(n, h), 0.0);
+        float d = a * a / (PI * pow(nDotH * nDotH * (a * a - 1.0) + 1.0, 2.0));
+        float pdf = d * 0.25 + 0.0001;
+        float sampleSolidAngle = 1.0 / (float(SAMPLE_COUNT) * pdf);
+        float lod = 0.5 * log2(sampleSolidAngle / texelSolidAngle) + 1.0;
+
+        color += textureLod(source, l, max(lod, 0.0)).rgb * nDotL;
+        totalWeight += nDotL;
+    }
+    FragColor = vec4(color / max(totalWeight, 0.0001), 1.0);
+}
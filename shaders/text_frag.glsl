@@ -0,0 +1,13 @@
+#version 460 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D font;
+uniform vec3 textColor;
+
+void main()
+{
+    float coverage = texture(font, TexCoords).r;
+    FragColor = vec4(textColor, coverage);
+}
@@ -0,0 +1,14 @@
+#version 460 core
+layout (location = 0) in vec2 aPos;       // pixels, origin top-left
+layout (location = 1) in vec2 aTexCoords;
+
+out vec2 TexCoords;
+
+uniform vec2 screenSize;
+
+void main()
+{
+    TexCoords = aTexCoords;
+    vec2 ndc = aPos / screenSize * 2.0 - 1.0;
+    gl_Position = vec4(ndc.x, -ndc.y, 0.0, 1.0);
+}
@@ -0,0 +1,34 @@
+#version 460 core
+out vec4 FragColor;
+
+in vec2 TexCoord;
+in vec3 Normal;
+in vec3 FragPos;
+
+struct Material {
+    sampler2D texture_diffuse1;
+};
+
+struct DirLight {
+    vec3 direction;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+uniform Material material;
+uniform DirLight dirLight;
+uniform vec3 shIrradiance[9]; // see fragment.glsl
+
+void main()
+{
+    vec4 color = texture(material.texture_diffuse1, TexCoord);
+    if (color.a < 0.5) discard;
+
+    float diff = max(dot(normalize(Normal), normalize(-dirLight.direction)), 0.0);
+    // cards stand upright, so the sky light is taken for an up facing normal
+    vec3 sky = shIrradiance[0] + shIrradiance[1] - shIrradiance[6] - shIrradiance[8];
+    vec3 result = (dirLight.ambient * max(sky, 0.0) + dirLight.diffuse * diff) * color.rgb;
+    FragColor = vec4(result, 1.0);
+}
@@ -0,0 +1,53 @@
+#version 460 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoord;
+
+out vec2 TexCoord;
+out vec3 Normal;
+out vec3 FragPos;
+
+struct GrassInstance {
+    vec4 positionRotation; // ground position, yaw
+    vec4 params;           // x scale, y wind phase
+};
+
+layout (std140, binding = 0) uniform Matrices
+{
+    mat4 projection;
+    mat4 view;
+};
+// filled by vegetation_cull.comp, one entry per drawn instance
+layout (std430, binding = 1) readonly buffer Visible { GrassInstance visible[]; };
+
+uniform vec3 cameraPosition;
+uniform float time;
+uniform float fadeStart;
+uniform float fadeEnd;
+uniform float windStrength;
+
+void main()
+{
+    GrassInstance instance = visible[gl_InstanceID];
+    vec3 base = instance.positionRotation.xyz;
+    float scale = instance.params.x;
+    float c = cos(instance.positionRotation.w);
+    float s = sin(instance.positionRotation.w);
+
+    // the card stands on its bottom edge; distant cards sink into the ground instead of popping out
+    float fade = 1.0 - smoothstep(fadeStart, fadeEnd, distance(base, cameraPosition));
+    vec3 local = vec3(aPos.x, (aPos.y + 1.0) * fade, 0.0) * scale;
+    vec3 offset = vec3(local.x * c, local.y, local.x * s);
+
+    // wind: two out of phase waves travelling over the field, bending the top more than the middle
+    float height = aTexCoord.y;
+    float gust = 0.6 * sin(time * 1.7 + instance.params.y + dot(base.xz, vec2(0.35, 0.2)))
+               + 0.4 * sin(time * 0.63 + base.x * 0.11 - base.z * 0.07);
+    offset.xz += vec2(0.8, 0.6) * gust * windStrength * height * height * scale * 2.0;
+
+    FragPos = base + offset;
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+    TexCoord = aTexCoord;
+    // lean the card normal upwards so both sides and grazing angles light like the ground
+    Normal = normalize(vec3(-s, 0.0, c) * 0.4 + vec3(0.0, 1.0, 0.0));
+}
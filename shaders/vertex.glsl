@@ -6,6 +6,8 @@ layout (location = 2) in vec2 aTexCoord;
 out vec2 TexCoord;
 out vec3 Normal;
 out vec3 FragPos; 
+out float ViewDepth; // distance along the view direction, picks the shadow cascade
+flat out int MaterialId; // the draw's base instance: index + 1 in the bound material table, see src/materials.hpp
 
 layout (std140, binding = 0) uniform Matrices
 {
@@ -13,11 +15,14 @@ layout (std140, binding = 0) uniform Matrices
     mat4 view;
 };
 uniform mat4 model;
+uniform mat3 normalMatrix; // inverse transpose of model's upper 3x3, computed on the CPU
 
 void main()
 {
    gl_Position = projection * view * model  * vec4(aPos.xyz, 1.0);
    FragPos = vec3(model * vec4(aPos, 1.0));
+   ViewDepth = -(view * vec4(FragPos, 1.0)).z;
    TexCoord = aTexCoord;
-   Normal = mat3(transpose(inverse(model))) * aNormal;
+   Normal = normalMatrix * aNormal;
+   MaterialId = gl_BaseInstance;
 };
\ No newline at end of file
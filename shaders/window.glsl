@@ -1,7 +1,11 @@
 #version 460 core
-out vec4 FragColor;
+#extension GL_ARB_bindless_texture : enable
+// Weighted blended OIT accumulation, see src/oit.hpp.
+layout (location = 0) out vec4 accum;
+layout (location = 1) out float reveal;
 
 in vec2 TexCoord;
+flat in int MaterialId;
 
 struct Material {
     sampler2D texture_diffuse1;
@@ -9,7 +13,43 @@ struct Material {
 
 uniform Material material;
 
+// material table, see src/materials.hpp and fragment.glsl; only the diffuse texture is read
+#define MATERIAL_MAX_ARRAYS 4
+#define MATERIAL_MAX_SLOTS 6
+struct MaterialData {
+    uvec2 diffuseHandle;
+    uvec2 specularHandle;
+    int diffuseArray;
+    int diffuseLayer;
+    int specularArray;
+    int specularLayer;
+    int diffuseSlot;
+    int specularSlot;
+    float shininess;
+};
+layout (std430, binding = 3) readonly buffer Materials { MaterialData materials[]; };
+layout (binding = 11) uniform sampler2DArray materialArrays[MATERIAL_MAX_ARRAYS];
+layout (binding = 2) uniform sampler2D materialSlots[MATERIAL_MAX_SLOTS];
+
+vec4 SampleDiffuse()
+{
+    if (MaterialId == 0) return texture(material.texture_diffuse1, TexCoord);
+    MaterialData data = materials[MaterialId - 1];
+#ifdef GL_ARB_bindless_texture
+    if (data.diffuseHandle != uvec2(0)) return texture(sampler2D(data.diffuseHandle), TexCoord);
+#endif
+    if (data.diffuseSlot >= 0) return texture(materialSlots[data.diffuseSlot], TexCoord);
+    if (data.diffuseArray < 0) return vec4(0.0);
+    return texture(materialArrays[data.diffuseArray], vec3(TexCoord, float(data.diffuseLayer)));
+}
+
 void main()
 {             
-    FragColor = texture(material.texture_diffuse1, TexCoord);
-}  
\ No newline at end of file
+    vec4 color = SampleDiffuse();
+    if (color.a <= 0.0) discard;
+
+    // weight falls off with depth so nearer layers dominate the average; equation 10 of the paper
+    float weight = clamp(pow(min(1.0, color.a * 10.0) + 0.01, 3.0) * 1e8 * pow(1.0 - gl_FragCoord.z * 0.9, 3.0), 1e-2, 3e3);
+    accum = vec4(color.rgb * color.a, color.a) * weight;
+    reveal = color.a;
+}  
@@ -0,0 +1,92 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+// Named timing series for the periodic benchmark report.
+// Samples are accumulated until benchmarkReport() prints avg / min / max / stddev / variance and resets them.
+
+#define BENCHMARK_MAX_STATS 32
+
+struct BenchmarkStat {
+    const char* name;   // static string
+    double sum;
+    double sumSq;
+    double min;
+    double max;
+    int count;
+};
+
+struct Benchmark {
+    BenchmarkStat stats[BENCHMARK_MAX_STATS];
+    int numStats;
+};
+
+Benchmark g_benchmark;
+
+void benchmarkAdd(Benchmark* bench, const char* name, double ms)
+{
+    BenchmarkStat* stat = NULL;
+    for (int i = 0; i < bench->numStats; i++)
+    {
+        if (bench->stats[i].name == name || strcmp(bench->stats[i].name, name) == 0)
+        {
+            stat = &bench->stats[i];
+            break;
+        }
+    }
+    if (!stat)
+    {
+        if (bench->numStats >= BENCHMARK_MAX_STATS) return;
+        stat = &bench->stats[bench->numStats++];
+        memset(stat, 0, sizeof(*stat));
+        stat->name = name;
+    }
+    if (stat->count == 0 || ms < stat->min) stat->min = ms;
+    if (stat->count == 0 || ms > stat->max) stat->max = ms;
+    stat->sum += ms;
+    stat->sumSq += ms * ms;
+    stat->count++;
+}
+
+double benchmarkAverage(const Benchmark* bench, const char* name)
+{
+    for (int i = 0; i < bench->numStats; i++)
+    {
+        const BenchmarkStat* stat = &bench->stats[i];
+        if (strcmp(stat->name, name) == 0 && stat->count > 0)
+            return stat->sum / stat->count;
+    }
+    return 0.0;
+}
+
+// Drops all samples, e.g. when switching to a configuration that should be measured on its own.
+void benchmarkReset(Benchmark* bench)
+{
+    for (int i = 0; i < bench->numStats; i++)
+    {
+        BenchmarkStat* stat = &bench->stats[i];
+        stat->sum = stat->sumSq = stat->min = stat->max = 0.0;
+        stat->count = 0;
+    }
+}
+
+void benchmarkReport(Benchmark* bench, const char* title)
+{
+    printf("---- %s ----\n", title);
+    printf("%-20s %9s %9s %9s %9s %9s %7s\n", "series (ms)", "avg", "min", "max", "stddev", "variance", "n");
+    for (int i = 0; i < bench->numStats; i++)
+    {
+        BenchmarkStat* stat = &bench->stats[i];
+        if (stat->count == 0) continue;
+        double avg = stat->sum / stat->count;
+        double variance = stat->sumSq / stat->count - avg * avg;
+        if (variance < 0.0) variance = 0.0;
+        printf("%-20s %9.3f %9.3f %9.3f %9.3f %9.3f %7d\n", stat->name, avg, stat->min, stat->max,
+               sqrt(variance), variance, stat->count);
+    }
+    benchmarkReset(bench);
+}
+
+#endif
@@ -0,0 +1,762 @@
+#ifndef BVH_H
+#define BVH_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include "../thirdparty/glm/glm.hpp"
+#include "mesh.hpp"
+#include "jobs.hpp"
+#include "profiler.hpp"
+
+// Bounding volume hierarchy for CPU ray queries (picking, camera collision, line of sight).
+// Built with binned SAH as a binary tree, subtrees above BVH_PARALLEL_THRESHOLD primitives forking
+// into jobs, then collapsed into a 4-wide tree: every node stores the boxes of its four children in
+// structure-of-arrays layout, so one ray is tested against all four with a single pass of SIMD
+// slab tests. Leaves are packed into the child index; triangles are stored in leaf order as
+// (v0, e1, e2) ready for Moller-Trumbore.
+// The same builder makes a top level tree over scene instances, each a mesh tree plus a transform:
+// rays are moved into the instance's model space, which keeps t unchanged.
+// Packets share one traversal: a stack entry carries the mask of rays still inside the node.
+//
+// Once:
+//     bvhBuildMesh(&crateBvh, &cubeMesh);
+//     bvhSceneAdd(&scene, &crateBvh, world, id); ... bvhSceneBuild(&scene);
+// Queries:
+//     if (bvhSceneIntersect(&scene, origin, direction, maxDistance, &hit)) ...
+// Define BVH_SIMD 0 to force the scalar node test.
+
+#ifndef BVH_SIMD
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BVH_SIMD 1
+#else
+#define BVH_SIMD 0
+#endif
+#endif
+
+#if BVH_SIMD
+#include <immintrin.h>
+#endif
+
+#define BVH_BINS 16
+#define BVH_LEAF_SIZE 4                 // ranges this small always become leaves
+#define BVH_MAX_LEAF_SIZE 15            // the 4 count bits of a packed leaf
+#define BVH_TRAVERSAL_COST 1.0f         // of a node visit, in triangle tests
+#define BVH_PARALLEL_THRESHOLD 4096     // subtrees at least this big are built as jobs
+#define BVH_STACK_SIZE 96
+#define BVH_PACKET_SIZE 8
+
+// packed leaf: ~(first << 4 | count), always negative; an empty slot is a leaf of 0 primitives
+#define BVH_LEAF(first, count) (~(int32_t)(((first) << 4) | (count)))
+#define BVH_LEAF_FIRST(child) ((~(child)) >> 4)
+#define BVH_LEAF_COUNT(child) ((~(child)) & 15)
+
+struct BvhNode {
+    float minX[4], minY[4], minZ[4];
+    float maxX[4], maxY[4], maxZ[4];
+    int32_t child[4];       // node index, or a packed leaf when negative
+};
+
+struct BvhTriangle {
+    glm::vec3 v0, e1, e2;
+};
+
+struct Bvh {
+    BvhNode* nodes;         // nodes[0] is the root
+    int numNodes;
+    int* primitives;        // leaf order -> source primitive (triangle or instance)
+    int numPrimitives;
+    BvhTriangle* triangles; // leaf order, NULL for the top level of a scene
+    glm::vec3 boundsMin, boundsMax;
+};
+
+struct BvhHit {
+    float t;
+    int primitive;          // source triangle
+    int instance;           // id given to bvhSceneAdd, -1 for a plain mesh query
+    float u, v;             // barycentrics of v1 and v2
+    glm::vec3 normal;       // facing the ray, world space for scene queries
+};
+
+// ---- build -------------------------------------------------------------------------------------
+
+struct BvhBuildNode {
+    glm::vec3 min, max;
+    int left;               // children are left and left + 1, -1 for a leaf
+    int first, count;
+};
+
+struct BvhBuilder {
+    const glm::vec3* primMin;
+    const glm::vec3* primMax;
+    glm::vec3* centroids;
+    int* order;
+    BvhBuildNode* nodes;
+    std::atomic<int> numNodes;
+};
+
+struct BvhBuildTask {
+    BvhBuilder* builder;
+    int node, first, count;
+};
+
+static float bvhArea(const glm::vec3& min, const glm::vec3& max)
+{
+    glm::vec3 d = glm::max(max - min, glm::vec3(0.0f));
+    return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+static void bvhBuildRecursive(BvhBuilder* b, int nodeIndex, int first, int count);
+
+static void bvhBuildJob(void* data)
+{
+    BvhBuildTask* task = (BvhBuildTask*)data;
+    bvhBuildRecursive(task->builder, task->node, task->first, task->count);
+}
+
+static void bvhBuildRecursive(BvhBuilder* b, int nodeIndex, int first, int count)
+{
+    BvhBuildNode* node = &b->nodes[nodeIndex];
+    glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX), centroidMin(FLT_MAX), centroidMax(-FLT_MAX);
+    for (int i = first; i < first + count; i++)
+    {
+        int p = b->order[i];
+        boundsMin = glm::min(boundsMin, b->primMin[p]);
+        boundsMax = glm::max(boundsMax, b->primMax[p]);
+        centroidMin = glm::min(centroidMin, b->centroids[p]);
+        centroidMax = glm::max(centroidMax, b->centroids[p]);
+    }
+    node->min = boundsMin;
+    node->max = boundsMax;
+    node->first = first;
+    node->count = count;
+    node->left = -1;
+    if (count <= BVH_LEAF_SIZE) return;
+
+    // best split over BVH_BINS bins of the centroid bounds on every axis
+    int bestAxis = -1, bestBin = 0;
+    float bestCost = FLT_MAX;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float extent = centroidMax[axis] - centroidMin[axis];
+        if (extent <= 0.0f) continue;
+        float scale = BVH_BINS / extent;
+        int binCount[BVH_BINS] = {};
+        glm::vec3 binMin[BVH_BINS], binMax[BVH_BINS];
+        for (int i = 0; i < BVH_BINS; i++) { binMin[i] = glm::vec3(FLT_MAX); binMax[i] = glm::vec3(-FLT_MAX); }
+        for (int i = first; i < first + count; i++)
+        {
+            int p = b->order[i];
+            int bin = glm::min((int)((b->centroids[p][axis] - centroidMin[axis]) * scale), BVH_BINS - 1);
+            binCount[bin]++;
+            binMin[bin] = glm::min(binMin[bin], b->primMin[p]);
+            binMax[bin] = glm::max(binMax[bin], b->primMax[p]);
+        }
+
+        // cost of splitting after bin i, swept from both ends
+        float rightCost[BVH_BINS];
+        glm::vec3 sweepMin(FLT_MAX), sweepMax(-FLT_MAX);
+        int sweepCount = 0;
+        for (int i = BVH_BINS - 1; i > 0; i--)
+        {
+            sweepMin = glm::min(sweepMin, binMin[i]);
+            sweepMax = glm::max(sweepMax, binMax[i]);
+            sweepCount += binCount[i];
+            rightCost[i - 1] = sweepCount ? bvhArea(sweepMin, sweepMax) * sweepCount : 0.0f;
+        }
+        sweepMin = glm::vec3(FLT_MAX); sweepMax = glm::vec3(-FLT_MAX);
+        sweepCount = 0;
+        for (int i = 0; i < BVH_BINS - 1; i++)
+        {
+            sweepMin = glm::min(sweepMin, binMin[i]);
+            sweepMax = glm::max(sweepMax, binMax[i]);
+            sweepCount += binCount[i];
+            float cost = (sweepCount ? bvhArea(sweepMin, sweepMax) * sweepCount : 0.0f) + rightCost[i];
+            if (cost < bestCost) { bestCost = cost; bestAxis = axis; bestBin = i; }
+        }
+    }
+
+    int mid = first + count / 2;
+    if (bestAxis >= 0)
+    {
+        float splitCost = BVH_TRAVERSAL_COST + bestCost / bvhArea(boundsMin, boundsMax);
+        if (count <= BVH_MAX_LEAF_SIZE && splitCost >= (float)count) return;
+
+        float scale = BVH_BINS / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+        float base = centroidMin[bestAxis];
+        int* split = std::partition(b->order + first, b->order + first + count, [&](int p) {
+            return glm::min((int)((b->centroids[p][bestAxis] - base) * scale), BVH_BINS - 1) <= bestBin;
+        });
+        if (split != b->order + first && split != b->order + first + count)
+            mid = (int)(split - b->order);
+    }
+    // identical centroids fall through to splitting the range in half
+
+    int left = b->numNodes.fetch_add(2, std::memory_order_relaxed);
+    node->left = left;
+    if (count >= BVH_PARALLEL_THRESHOLD && g_jobs.numWorkers > 1)
+    {
+        BvhBuildTask task = {b, left, first, mid - first};
+        JobCounter counter;
+        jobsSubmit("bvh subtree", bvhBuildJob, &task, &counter);
+        bvhBuildRecursive(b, left + 1, mid, first + count - mid);
+        jobsWait(&counter);
+    }
+    else
+    {
+        bvhBuildRecursive(b, left, first, mid - first);
+        bvhBuildRecursive(b, left + 1, mid, first + count - mid);
+    }
+}
+
+// Turns the binary node `binaryIndex` and up to two levels below it into one 4-wide node, opening
+// the largest child first.
+static int bvhCollapse(Bvh* bvh, const BvhBuilder* b, int binaryIndex)
+{
+    int nodeIndex = bvh->numNodes++;
+    int slots[4];
+    int numSlots = 0;
+    const BvhBuildNode* root = &b->nodes[binaryIndex];
+    if (root->left < 0) slots[numSlots++] = binaryIndex;
+    else
+    {
+        slots[numSlots++] = root->left;
+        slots[numSlots++] = root->left + 1;
+        while (numSlots < 4)
+        {
+            int open = -1;
+            float openArea = -1.0f;
+            for (int i = 0; i < numSlots; i++)
+            {
+                const BvhBuildNode* n = &b->nodes[slots[i]];
+                float area = bvhArea(n->min, n->max);
+                if (n->left >= 0 && area > openArea) { open = i; openArea = area; }
+            }
+            if (open < 0) break;
+            int left = b->nodes[slots[open]].left;
+            slots[open] = left;
+            slots[numSlots++] = left + 1;
+        }
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        BvhNode* node = &bvh->nodes[nodeIndex];
+        if (i >= numSlots)
+        {
+            // inverted box: the slab test can never pass
+            node->minX[i] = node->minY[i] = node->minZ[i] = FLT_MAX;
+            node->maxX[i] = node->maxY[i] = node->maxZ[i] = -FLT_MAX;
+            node->child[i] = BVH_LEAF(0, 0);
+            continue;
+        }
+        const BvhBuildNode* n = &b->nodes[slots[i]];
+        node->minX[i] = n->min.x; node->minY[i] = n->min.y; node->minZ[i] = n->min.z;
+        node->maxX[i] = n->max.x; node->maxY[i] = n->max.y; node->maxZ[i] = n->max.z;
+        node->child[i] = n->left < 0 ? BVH_LEAF(n->first, n->count) : bvhCollapse(bvh, b, slots[i]);
+    }
+    return nodeIndex;
+}
+
+// Builds the tree over primitive boxes; leaves index bvh->primitives.
+static void bvhBuild(Bvh* bvh, const glm::vec3* primMin, const glm::vec3* primMax, int numPrimitives)
+{
+    PROFILE_ZONE("bvhBuild");
+    BvhBuilder b;
+    b.primMin = primMin;
+    b.primMax = primMax;
+    b.centroids = (glm::vec3*)malloc(glm::max(numPrimitives, 1) * sizeof(glm::vec3));
+    b.order = (int*)malloc(glm::max(numPrimitives, 1) * sizeof(int));
+    b.nodes = (BvhBuildNode*)malloc(glm::max(2 * numPrimitives - 1, 1) * sizeof(BvhBuildNode));
+    b.numNodes = 1;
+    for (int i = 0; i < numPrimitives; i++)
+    {
+        b.centroids[i] = 0.5f * (primMin[i] + primMax[i]);
+        b.order[i] = i;
+    }
+    bvhBuildRecursive(&b, 0, 0, numPrimitives);
+
+    // a 4-wide node swallows at least one binary inner node
+    bvh->nodes = (BvhNode*)malloc(glm::max(numPrimitives, 1) * sizeof(BvhNode));
+    bvh->numNodes = 0;
+    bvhCollapse(bvh, &b, 0);
+    bvh->primitives = b.order;
+    bvh->numPrimitives = numPrimitives;
+    bvh->triangles = NULL;
+    bvh->boundsMin = b.nodes[0].min;
+    bvh->boundsMax = b.nodes[0].max;
+    free(b.centroids);
+    free(b.nodes);
+}
+
+void bvhBuildTriangles(Bvh* bvh, const float* positions, size_t stride, const unsigned int* indices, int numIndices)
+{
+    int numTriangles = numIndices / 3;
+    glm::vec3* primMin = (glm::vec3*)malloc(glm::max(numTriangles, 1) * sizeof(glm::vec3));
+    glm::vec3* primMax = (glm::vec3*)malloc(glm::max(numTriangles, 1) * sizeof(glm::vec3));
+    auto vertex = [&](unsigned int index) {
+        const float* p = (const float*)((const char*)positions + index * stride);
+        return glm::vec3(p[0], p[1], p[2]);
+    };
+    for (int t = 0; t < numTriangles; t++)
+    {
+        glm::vec3 a = vertex(indices[3 * t]), b = vertex(indices[3 * t + 1]), c = vertex(indices[3 * t + 2]);
+        primMin[t] = glm::min(a, glm::min(b, c));
+        primMax[t] = glm::max(a, glm::max(b, c));
+    }
+    bvhBuild(bvh, primMin, primMax, numTriangles);
+    free(primMin);
+    free(primMax);
+
+    bvh->triangles = (BvhTriangle*)malloc(glm::max(numTriangles, 1) * sizeof(BvhTriangle));
+    for (int i = 0; i < numTriangles; i++)
+    {
+        int t = bvh->primitives[i];
+        glm::vec3 a = vertex(indices[3 * t]), b = vertex(indices[3 * t + 1]), c = vertex(indices[3 * t + 2]);
+        bvh->triangles[i] = {a, b - a, c - a};
+    }
+}
+
+// Model space tree over the full detail level of a mesh.
+void bvhBuildMesh(Bvh* bvh, const Mesh* mesh)
+{
+    bvhBuildTriangles(bvh, &mesh->vertices[0].Position.x, sizeof(Vertex), mesh->indices + mesh->lods[0].indexOffset, mesh->lods[0].indexCount);
+}
+
+void bvhDestroy(Bvh* bvh)
+{
+    free(bvh->nodes);
+    free(bvh->primitives);
+    free(bvh->triangles);
+    memset(bvh, 0, sizeof(*bvh));
+}
+
+// ---- traversal ---------------------------------------------------------------------------------
+
+struct BvhRay {
+    glm::vec3 origin, direction, invDirection;
+    int nearX, nearY, nearZ;    // float offsets into BvhNode of the slab each ray enters first
+    int farX, farY, farZ;
+};
+
+static BvhRay bvhMakeRay(const glm::vec3& origin, const glm::vec3& direction)
+{
+    BvhRay ray;
+    ray.origin = origin;
+    ray.direction = direction;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        // keep the sign of zero components so 1/d stays finite and slabs never produce NaN
+        float d = direction[axis];
+        if (fabsf(d) < 1e-20f) d = signbit(d) ? -1e-20f : 1e-20f;
+        ray.invDirection[axis] = 1.0f / d;
+    }
+    // minX, minY, minZ, maxX, maxY, maxZ are 4 floats apart
+    ray.nearX = ray.invDirection.x >= 0.0f ? 0 : 12;
+    ray.nearY = ray.invDirection.y >= 0.0f ? 4 : 16;
+    ray.nearZ = ray.invDirection.z >= 0.0f ? 8 : 20;
+    ray.farX = ray.invDirection.x >= 0.0f ? 12 : 0;
+    ray.farY = ray.invDirection.y >= 0.0f ? 16 : 4;
+    ray.farZ = ray.invDirection.z >= 0.0f ? 20 : 8;
+    return ray;
+}
+
+// Slab test of the ray against the four children; returns a bit per child entered before tFar.
+static inline int bvhIntersectNode(const BvhNode* node, const BvhRay& ray, float tFar, float tNear[4])
+{
+    const float* base = (const float*)node;
+#if BVH_SIMD
+    __m128 ox = _mm_set1_ps(ray.origin.x), oy = _mm_set1_ps(ray.origin.y), oz = _mm_set1_ps(ray.origin.z);
+    __m128 ix = _mm_set1_ps(ray.invDirection.x), iy = _mm_set1_ps(ray.invDirection.y), iz = _mm_set1_ps(ray.invDirection.z);
+    __m128 nearT = _mm_max_ps(_mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(base + ray.nearX), ox), ix),
+                                         _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(base + ray.nearY), oy), iy)),
+                              _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(base + ray.nearZ), oz), iz), _mm_setzero_ps()));
+    __m128 farT = _mm_min_ps(_mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(base + ray.farX), ox), ix),
+                                        _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(base + ray.farY), oy), iy)),
+                             _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(base + ray.farZ), oz), iz), _mm_set1_ps(tFar)));
+    _mm_storeu_ps(tNear, nearT);
+    return _mm_movemask_ps(_mm_cmple_ps(nearT, farT));
+#else
+    int mask = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        float nearT = glm::max(glm::max((base[ray.nearX + i] - ray.origin.x) * ray.invDirection.x,
+                                        (base[ray.nearY + i] - ray.origin.y) * ray.invDirection.y),
+                               glm::max((base[ray.nearZ + i] - ray.origin.z) * ray.invDirection.z, 0.0f));
+        float farT = glm::min(glm::min((base[ray.farX + i] - ray.origin.x) * ray.invDirection.x,
+                                       (base[ray.farY + i] - ray.origin.y) * ray.invDirection.y),
+                              glm::min((base[ray.farZ + i] - ray.origin.z) * ray.invDirection.z, tFar));
+        tNear[i] = nearT;
+        mask |= (nearT <= farT) << i;
+    }
+    return mask;
+#endif
+}
+
+// Moller-Trumbore, both sides. Updates hit and returns true when closer than hit->t.
+static inline bool bvhIntersectTriangle(const BvhTriangle& tri, const glm::vec3& origin, const glm::vec3& direction, BvhHit* hit)
+{
+    glm::vec3 p = glm::cross(direction, tri.e2);
+    float det = glm::dot(tri.e1, p);
+    if (fabsf(det) < 1e-12f) return false;
+    float inverseDet = 1.0f / det;
+    glm::vec3 s = origin - tri.v0;
+    float u = glm::dot(s, p) * inverseDet;
+    if (u < 0.0f || u > 1.0f) return false;
+    glm::vec3 q = glm::cross(s, tri.e1);
+    float v = glm::dot(direction, q) * inverseDet;
+    if (v < 0.0f || u + v > 1.0f) return false;
+    float t = glm::dot(tri.e2, q) * inverseDet;
+    if (t <= 0.0f || t >= hit->t) return false;
+    hit->t = t;
+    hit->u = u;
+    hit->v = v;
+    return true;
+}
+
+struct BvhStackEntry {
+    int32_t child;
+    float t;                // entry distance, popped entries beyond the closest hit are skipped
+};
+
+// Walks the tree front to back, calling leaf(first, count) for every leaf the ray enters before
+// *tFar. The callback shortens *tFar as it finds hits and returns true to stop.
+template <typename LeafFunction>
+static void bvhTraverse(const Bvh* bvh, const BvhRay& ray, float* tFar, LeafFunction leaf)
+{
+    BvhStackEntry stack[BVH_STACK_SIZE];
+    int top = 0;
+    stack[top++] = {0, 0.0f};
+    while (top > 0)
+    {
+        BvhStackEntry entry = stack[--top];
+        if (entry.t > *tFar) continue;
+        if (entry.child < 0)
+        {
+            if (leaf(BVH_LEAF_FIRST(entry.child), BVH_LEAF_COUNT(entry.child))) return;
+            continue;
+        }
+
+        const BvhNode* node = &bvh->nodes[entry.child];
+        float tNear[4];
+        int mask = bvhIntersectNode(node, ray, *tFar, tNear);
+        // push far to near so the nearest child is popped first
+        BvhStackEntry hits[4];
+        int numHits = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            if (!(mask & (1 << i)) || node->child[i] == BVH_LEAF(0, 0)) continue;
+            BvhStackEntry e = {node->child[i], tNear[i]};
+            int j = numHits++;
+            while (j > 0 && hits[j - 1].t < e.t) { hits[j] = hits[j - 1]; j--; }
+            hits[j] = e;
+        }
+        for (int i = 0; i < numHits && top < BVH_STACK_SIZE; i++) stack[top++] = hits[i];
+    }
+}
+
+static void bvhFinishHit(const Bvh* bvh, const glm::vec3& direction, int leafIndex, BvhHit* hit)
+{
+    const BvhTriangle& tri = bvh->triangles[leafIndex];
+    hit->primitive = bvh->primitives[leafIndex];
+    hit->instance = -1;
+    hit->normal = glm::normalize(glm::cross(tri.e1, tri.e2));
+    if (glm::dot(hit->normal, direction) > 0.0f) hit->normal = -hit->normal;
+}
+
+// Closest hit along origin + t * direction for 0 < t < tMax. direction need not be normalized.
+bool bvhIntersect(const Bvh* bvh, const glm::vec3& origin, const glm::vec3& direction, float tMax, BvhHit* hit)
+{
+    BvhRay ray = bvhMakeRay(origin, direction);
+    hit->t = tMax;
+    int closest = -1;
+    bvhTraverse(bvh, ray, &hit->t, [&](int first, int count) {
+        for (int i = first; i < first + count; i++)
+            if (bvhIntersectTriangle(bvh->triangles[i], origin, direction, hit)) closest = i;
+        return false;
+    });
+    if (closest < 0) return false;
+    bvhFinishHit(bvh, direction, closest, hit);
+    return true;
+}
+
+// Any hit before tMax; for line of sight.
+bool bvhOccluded(const Bvh* bvh, const glm::vec3& origin, const glm::vec3& direction, float tMax)
+{
+    BvhRay ray = bvhMakeRay(origin, direction);
+    BvhHit hit;
+    hit.t = tMax;
+    bool occluded = false;
+    bvhTraverse(bvh, ray, &hit.t, [&](int first, int count) {
+        for (int i = first; i < first + count; i++)
+            if (bvhIntersectTriangle(bvh->triangles[i], origin, direction, &hit)) { occluded = true; return true; }
+        return false;
+    });
+    return occluded;
+}
+
+// Closest hits for up to BVH_PACKET_SIZE rays traversed together; hits[i].t is tMax where ray i
+// missed. Pays off when the rays are coherent, like a tile of primary rays.
+void bvhIntersectPacket(const Bvh* bvh, const glm::vec3* origins, const glm::vec3* directions, int count, float tMax, BvhHit* hits)
+{
+    BvhRay rays[BVH_PACKET_SIZE];
+    int closest[BVH_PACKET_SIZE];
+    for (int r = 0; r < count; r++)
+    {
+        rays[r] = bvhMakeRay(origins[r], directions[r]);
+        hits[r].t = tMax;
+        closest[r] = -1;
+    }
+
+    struct PacketEntry { int32_t child; uint32_t rays; };
+    PacketEntry stack[BVH_STACK_SIZE];
+    int top = 0;
+    stack[top++] = {0, (1u << count) - 1};
+    while (top > 0)
+    {
+        PacketEntry entry = stack[--top];
+        if (entry.child < 0)
+        {
+            int first = BVH_LEAF_FIRST(entry.child), n = BVH_LEAF_COUNT(entry.child);
+            for (int r = 0; r < count; r++)
+            {
+                if (!(entry.rays & (1u << r))) continue;
+                for (int i = first; i < first + n; i++)
+                    if (bvhIntersectTriangle(bvh->triangles[i], origins[r], directions[r], &hits[r])) closest[r] = i;
+            }
+            continue;
+        }
+
+        const BvhNode* node = &bvh->nodes[entry.child];
+        uint32_t childRays[4] = {0, 0, 0, 0};
+        float childNear[4] = {FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX};
+        for (int r = 0; r < count; r++)
+        {
+            if (!(entry.rays & (1u << r))) continue;
+            float tNear[4];
+            int mask = bvhIntersectNode(node, rays[r], hits[r].t, tNear);
+            for (int i = 0; i < 4; i++)
+                if (mask & (1 << i))
+                {
+                    childRays[i] |= 1u << r;
+                    childNear[i] = glm::min(childNear[i], tNear[i]);
+                }
+        }
+        // push far to near by the closest entry of any ray
+        int order[4], numHits = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            if (!childRays[i] || node->child[i] == BVH_LEAF(0, 0)) continue;
+            int j = numHits++;
+            while (j > 0 && childNear[order[j - 1]] < childNear[i]) { order[j] = order[j - 1]; j--; }
+            order[j] = i;
+        }
+        for (int i = 0; i < numHits && top < BVH_STACK_SIZE; i++) stack[top++] = {node->child[order[i]], childRays[order[i]]};
+    }
+
+    for (int r = 0; r < count; r++)
+        if (closest[r] >= 0) bvhFinishHit(bvh, directions[r], closest[r], &hits[r]);
+        else hits[r].primitive = -1;
+}
+
+// ---- scenes ------------------------------------------------------------------------------------
+
+struct BvhInstance {
+    const Bvh* bvh;
+    glm::mat4 world;
+    glm::mat4 inverseWorld;
+    int id;
+};
+
+struct BvhScene {
+    Bvh top;                // over instance world bounds, primitives index instances
+    std::vector<BvhInstance> instances;
+};
+
+void bvhSceneAdd(BvhScene* scene, const Bvh* bvh, const glm::mat4& world, int id)
+{
+    scene->instances.push_back({bvh, world, glm::inverse(world), id});
+}
+
+void bvhSceneBuild(BvhScene* scene)
+{
+    int n = (int)scene->instances.size();
+    std::vector<glm::vec3> primMin(glm::max(n, 1)), primMax(glm::max(n, 1));
+    for (int i = 0; i < n; i++)
+    {
+        const BvhInstance& instance = scene->instances[i];
+        primMin[i] = glm::vec3(FLT_MAX);
+        primMax[i] = glm::vec3(-FLT_MAX);
+        for (int corner = 0; corner < 8; corner++)
+        {
+            glm::vec3 p = glm::vec3(corner & 1 ? instance.bvh->boundsMax.x : instance.bvh->boundsMin.x,
+                                    corner & 2 ? instance.bvh->boundsMax.y : instance.bvh->boundsMin.y,
+                                    corner & 4 ? instance.bvh->boundsMax.z : instance.bvh->boundsMin.z);
+            glm::vec3 w = glm::vec3(instance.world * glm::vec4(p, 1.0f));
+            primMin[i] = glm::min(primMin[i], w);
+            primMax[i] = glm::max(primMax[i], w);
+        }
+    }
+    bvhBuild(&scene->top, primMin.data(), primMax.data(), n);
+}
+
+void bvhSceneDestroy(BvhScene* scene)
+{
+    bvhDestroy(&scene->top);
+    scene->instances.clear();
+}
+
+// Closest hit over every instance; hit->instance is the id it was added with.
+bool bvhSceneIntersect(const BvhScene* scene, const glm::vec3& origin, const glm::vec3& direction, float tMax, BvhHit* hit)
+{
+    if (scene->instances.empty()) return false;
+    BvhRay ray = bvhMakeRay(origin, direction);
+    hit->t = tMax;
+    bool found = false;
+    bvhTraverse(&scene->top, ray, &hit->t, [&](int first, int count) {
+        for (int i = first; i < first + count; i++)
+        {
+            const BvhInstance& instance = scene->instances[scene->top.primitives[i]];
+            glm::vec3 localOrigin = glm::vec3(instance.inverseWorld * glm::vec4(origin, 1.0f));
+            glm::vec3 localDirection = glm::mat3(instance.inverseWorld) * direction;
+            BvhHit local;
+            if (!bvhIntersect(instance.bvh, localOrigin, localDirection, hit->t, &local)) continue;
+            *hit = local;
+            hit->instance = instance.id;
+            hit->normal = glm::normalize(glm::transpose(glm::mat3(instance.inverseWorld)) * local.normal);
+            found = true;
+        }
+        return false;
+    });
+    return found;
+}
+
+bool bvhSceneOccluded(const BvhScene* scene, const glm::vec3& origin, const glm::vec3& direction, float tMax)
+{
+    if (scene->instances.empty()) return false;
+    BvhRay ray = bvhMakeRay(origin, direction);
+    float tFar = tMax;
+    bool occluded = false;
+    bvhTraverse(&scene->top, ray, &tFar, [&](int first, int count) {
+        for (int i = first; i < first + count; i++)
+        {
+            const BvhInstance& instance = scene->instances[scene->top.primitives[i]];
+            glm::vec3 localOrigin = glm::vec3(instance.inverseWorld * glm::vec4(origin, 1.0f));
+            if (bvhOccluded(instance.bvh, localOrigin, glm::mat3(instance.inverseWorld) * direction, tMax)) { occluded = true; return true; }
+        }
+        return false;
+    });
+    return occluded;
+}
+
+// ---- benchmark ---------------------------------------------------------------------------------
+
+static double bvhElapsedSeconds(std::chrono::steady_clock::time_point start)
+{
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() * 1e-9;
+}
+
+// Builds a tree over a triangle soup and shoots primary rays at it from around its bounds, plus
+// random rays through them. Reports build time, Mrays/s for single rays, packets and occlusion
+// rays, and misses against brute force on a sample of rays.
+void bvhBenchmark(const char* name, const float* positions, size_t stride, const unsigned int* indices, int numIndices)
+{
+    const int imageSize = 512, views = 4, runs = 3, bruteForceRays = 2000;
+    Bvh bvh;
+    auto start = std::chrono::steady_clock::now();
+    bvhBuildTriangles(&bvh, positions, stride, indices, numIndices);
+    double buildSeconds = bvhElapsedSeconds(start);
+    printf("bvh benchmark: %s, %d triangles, %d nodes, SIMD %s, %d workers\n", name, bvh.numPrimitives, bvh.numNodes,
+           BVH_SIMD ? "on" : "off", g_jobs.numWorkers);
+    printf("  build %.2f ms\n", buildSeconds * 1e3);
+
+    glm::vec3 center = 0.5f * (bvh.boundsMin + bvh.boundsMax);
+    float radius = 0.5f * glm::length(bvh.boundsMax - bvh.boundsMin);
+    std::vector<glm::vec3> origins, directions;
+    for (int view = 0; view < views; view++)
+    {
+        float angle = 6.2831853f * view / views;
+        glm::vec3 eye = center + 2.0f * radius * glm::vec3(cosf(angle), 0.3f, sinf(angle));
+        glm::vec3 forward = glm::normalize(center - eye);
+        glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0.0f, 1.0f, 0.0f)));
+        glm::vec3 up = glm::cross(right, forward);
+        // 8x1 tiles so consecutive rays form a packet
+        for (int y = 0; y < imageSize; y++)
+            for (int x = 0; x < imageSize; x++)
+            {
+                float px = (x + 0.5f) / imageSize * 2.0f - 1.0f, py = (y + 0.5f) / imageSize * 2.0f - 1.0f;
+                origins.push_back(eye);
+                directions.push_back(glm::normalize(forward + 0.5f * (px * right + py * up)));
+            }
+    }
+    int numRays = (int)origins.size();
+    std::vector<BvhHit> hits(numRays);
+
+    double best[4] = {1e30, 1e30, 1e30, 1e30};
+    int hitCount = 0;
+    for (int run = 0; run < runs; run++)
+    {
+        start = std::chrono::steady_clock::now();
+        hitCount = 0;
+        for (int i = 0; i < numRays; i++) hitCount += bvhIntersect(&bvh, origins[i], directions[i], FLT_MAX, &hits[i]);
+        best[0] = glm::min(best[0], bvhElapsedSeconds(start));
+
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < numRays; i += BVH_PACKET_SIZE)
+            bvhIntersectPacket(&bvh, &origins[i], &directions[i], glm::min(BVH_PACKET_SIZE, numRays - i), FLT_MAX, &hits[i]);
+        best[1] = glm::min(best[1], bvhElapsedSeconds(start));
+
+        start = std::chrono::steady_clock::now();
+        int occluded = 0;
+        for (int i = 0; i < numRays; i++) occluded += bvhOccluded(&bvh, origins[i], directions[i], FLT_MAX);
+        best[2] = glm::min(best[2], bvhElapsedSeconds(start));
+        (void)occluded;
+    }
+
+    // incoherent: random points inside the bounds in random directions
+    uint32_t rng = 4242;
+    auto rnd = [&rng]() { rng = rng * 1664525u + 1013904223u; return (rng >> 8) * (1.0f / 16777216.0f); };
+    std::vector<glm::vec3> randomOrigins(numRays), randomDirections(numRays);
+    for (int i = 0; i < numRays; i++)
+    {
+        randomOrigins[i] = bvh.boundsMin + (bvh.boundsMax - bvh.boundsMin) * glm::vec3(rnd(), rnd(), rnd());
+        randomDirections[i] = glm::normalize(glm::vec3(rnd() - 0.5f, rnd() - 0.5f, rnd() - 0.5f) + glm::vec3(1e-4f));
+    }
+    for (int run = 0; run < runs; run++)
+    {
+        start = std::chrono::steady_clock::now();
+        BvhHit hit;
+        for (int i = 0; i < numRays; i++) bvhIntersect(&bvh, randomOrigins[i], randomDirections[i], FLT_MAX, &hit);
+        best[3] = glm::min(best[3], bvhElapsedSeconds(start));
+    }
+
+    // every tree hit must be the closest triangle brute force finds, packets included
+    int mismatched = 0;
+    for (int k = 0; k < bruteForceRays; k++)
+    {
+        int i = (int)((long long)k * numRays / bruteForceRays);
+        BvhHit reference;
+        reference.t = FLT_MAX;
+        for (int t = 0; t < bvh.numPrimitives; t++) bvhIntersectTriangle(bvh.triangles[t], origins[i], directions[i], &reference);
+        BvhHit single;
+        bool hitSingle = bvhIntersect(&bvh, origins[i], directions[i], FLT_MAX, &single);
+        float expected = reference.t < FLT_MAX ? reference.t : FLT_MAX;
+        if ((hitSingle ? single.t : FLT_MAX) != expected || hits[i].t != expected) mismatched++;
+    }
+
+    printf("  %d primary rays, %.1f%% hit\n", numRays, 100.0 * hitCount / numRays);
+    printf("  closest hit     %8.2f Mrays/s\n", numRays / best[0] * 1e-6);
+    printf("  packets of %d    %8.2f Mrays/s\n", BVH_PACKET_SIZE, numRays / best[1] * 1e-6);
+    printf("  occlusion       %8.2f Mrays/s\n", numRays / best[2] * 1e-6);
+    printf("  incoherent      %8.2f Mrays/s\n", numRays / best[3] * 1e-6);
+    printf("  brute force mismatches: %d of %d\n", mismatched, bruteForceRays);
+    bvhDestroy(&bvh);
+}
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef CPUFEATURES_H
+#define CPUFEATURES_H
+
+// x86 instruction set extensions past the SSE2 every x64 CPU has, read once with cpuid. Kernels that
+// need one are compiled for it with CPU_TARGET and picked at run time, so a default build (no /arch
+// or -m flags) still runs them where the CPU has them.
+//
+//     static CPU_TARGET("ssse3") void decodeSsse3(...) { ... _mm_shuffle_epi8 ... }
+//     if (cpuFeatures().ssse3) decodeSsse3(...); else decodeScalar(...);
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CPU_X86 1
+#else
+#define CPU_X86 0
+#endif
+
+#if CPU_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// MSVC compiles any intrinsic without a flag; gcc and clang need the ISA enabled on the function.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define CPU_TARGET(isa)
+#else
+#define CPU_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+struct CpuFeatures {
+    bool ssse3;
+    bool sse41;
+    bool avx2;      // and the OS saves the YMM registers
+};
+
+static void cpuId(int leaf, unsigned int regs[4])
+{
+    regs[0] = regs[1] = regs[2] = regs[3] = 0;
+#if CPU_X86 && defined(_MSC_VER)
+    int r[4];
+    __cpuidex(r, leaf, 0);
+    for (int i = 0; i < 4; i++) regs[i] = (unsigned int)r[i];
+#elif CPU_X86
+    __cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#else
+    (void)leaf;
+#endif
+}
+
+// Extended control register 0: which register states the OS saves on a context switch.
+static unsigned long long cpuXgetbv()
+{
+#if CPU_X86 && defined(_MSC_VER)
+    return _xgetbv(0);
+#elif CPU_X86
+    unsigned int eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((unsigned long long)edx << 32) | eax;
+#else
+    return 0;
+#endif
+}
+
+static CpuFeatures cpuDetect()
+{
+    CpuFeatures features = {};
+    unsigned int regs[4];
+    cpuId(0, regs);
+    unsigned int maxLeaf = regs[0];
+    if (maxLeaf >= 1)
+    {
+        cpuId(1, regs);
+        features.ssse3 = (regs[2] >> 9) & 1;
+        features.sse41 = (regs[2] >> 19) & 1;
+        bool osxsave = (regs[2] >> 27) & 1, avx = (regs[2] >> 28) & 1;
+        bool ymmSaved = osxsave && (cpuXgetbv() & 6) == 6;
+        if (avx && ymmSaved && maxLeaf >= 7)
+        {
+            cpuId(7, regs);
+            features.avx2 = (regs[1] >> 5) & 1;
+        }
+    }
+    return features;
+}
+
+const CpuFeatures& cpuFeatures()
+{
+    static const CpuFeatures features = cpuDetect();
+    return features;
+}
+
+#endif
@@ -0,0 +1,280 @@
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+#include <glad/glad.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "shader.hpp"
+#include "meshcache.hpp"
+#include "profiler.hpp"
+#include "renderstats.hpp"
+
+// Image based lighting from the skybox cubemap.
+// Diffuse: the sky is projected into order 2 (9 coefficient) spherical harmonics and convolved with the
+// cosine lobe, so irradiance for a normal is a handful of multiply-adds in fragment.glsl. The basis
+// constants are folded into the uploaded coefficients. The projection reads back a small mip of the
+// uploaded cubemap (so it sees exactly the texels the skybox draws) and is cached next to the faces in
+// ENVIRONMENT_CACHE_NAME, keyed on the size and time of all six face files.
+// Specular: a second cubemap holds the sky prefiltered with GGX lobes, one roughness per mip, built on
+// the GPU at startup; fragment.glsl picks the mip from the material's roughness.
+//
+// Once, after the skybox cubemap is loaded:
+//     environmentInit(&environment, cubemapTexture, faces);
+// Per frame, with the lit shader in use:
+//     environmentBind(&environment, modelShader, ENVIRONMENT_TEXTURE_UNIT);
+
+#define ENVIRONMENT_CACHE_NAME "ambient.shl2"
+#define ENVIRONMENT_CACHE_VERSION 1
+#define ENVIRONMENT_PROJECTION_SIZE 128 // largest face size read back for the projection
+#define ENVIRONMENT_SPECULAR_SIZE 128   // face size of the sharpest prefiltered mip
+#define ENVIRONMENT_SPECULAR_MIPS 6     // roughness 0 to 1
+#define ENVIRONMENT_TEXTURE_UNIT 10
+
+struct EnvironmentLighting {
+    float sh[9][3];             // irradiance / pi, basis constants folded in
+    unsigned int specularMap;   // prefiltered cubemap, ENVIRONMENT_SPECULAR_MIPS levels
+    int specularMips;
+};
+
+struct EnvironmentCacheHeader {
+    char magic[4];
+    uint32_t version;
+    int64_t sourceSize[6];
+    int64_t sourceTime[6];
+    float sh[9][3];
+};
+
+// Folded constants: the real SH basis of order 2 times the cosine lobe convolution (pi, 2pi/3, pi/4)
+// over pi. Index order matches EvaluateSHIrradiance in fragment.glsl: 1, y, z, x, xy, yz, 3z^2-1, xz, x^2-y^2.
+static const float g_sh_basis[9] = {0.282095f, 0.488603f, 0.488603f, 0.488603f, 1.092548f, 1.092548f, 0.315392f, 1.092548f, 0.546274f};
+static const float g_sh_lobe[9] = {1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f};
+
+static void shEvaluateBasis(float x, float y, float z, float out[9])
+{
+    out[0] = g_sh_basis[0];
+    out[1] = g_sh_basis[1] * y;
+    out[2] = g_sh_basis[2] * z;
+    out[3] = g_sh_basis[3] * x;
+    out[4] = g_sh_basis[4] * x * y;
+    out[5] = g_sh_basis[5] * y * z;
+    out[6] = g_sh_basis[6] * (3.0f * z * z - 1.0f);
+    out[7] = g_sh_basis[7] * x * z;
+    out[8] = g_sh_basis[8] * (x * x - y * y);
+}
+
+// Direction through texel (u, v) in [-1, 1] of a GL cubemap face, rows stored top down.
+static void cubeFaceDirection(int face, float u, float v, float* x, float* y, float* z)
+{
+    switch (face) {
+        case 0: *x =  1.0f; *y = -v;    *z = -u;    break;
+        case 1: *x = -1.0f; *y = -v;    *z =  u;    break;
+        case 2: *x =  u;    *y =  1.0f; *z =  v;    break;
+        case 3: *x =  u;    *y = -1.0f; *z = -v;    break;
+        case 4: *x =  u;    *y = -v;    *z =  1.0f; break;
+        default: *x = -u;   *y = -v;    *z = -1.0f; break;
+    }
+}
+
+// Projects a cubemap (RGB8 sRGB faces of size x size, from glGetTexImage) into irradiance coefficients.
+static void environmentProjectSH(unsigned char* const faces[6], int size, float sh[9][3])
+{
+    float toLinear[256];
+    for (int i = 0; i < 256; i++)
+    {
+        float c = i / 255.0f;
+        toLinear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+    }
+
+    double sum[9][3] = {};
+    double totalWeight = 0.0;
+    for (int face = 0; face < 6; face++)
+        for (int row = 0; row < size; row++)
+            for (int column = 0; column < size; column++)
+            {
+                float u = 2.0f * (column + 0.5f) / size - 1.0f;
+                float v = 2.0f * (row + 0.5f) / size - 1.0f;
+                float x, y, z;
+                cubeFaceDirection(face, u, v, &x, &y, &z);
+                float length2 = x * x + y * y + z * z;
+                float inverseLength = 1.0f / sqrtf(length2);
+                // solid angle of the texel, up to the constant 4 / size^2
+                float weight = inverseLength / length2;
+
+                float basis[9];
+                shEvaluateBasis(x * inverseLength, y * inverseLength, z * inverseLength, basis);
+                const unsigned char* texel = faces[face] + 3 * (row * size + column);
+                for (int k = 0; k < 9; k++)
+                    for (int c = 0; c < 3; c++)
+                        sum[k][c] += (double)(toLinear[texel[c]] * basis[k] * weight);
+                totalWeight += weight;
+            }
+
+    // normalize so the weights cover the 4 pi of the sphere exactly
+    double scale = 12.566370614359172 / totalWeight;
+    for (int k = 0; k < 9; k++)
+        for (int c = 0; c < 3; c++)
+            sh[k][c] = (float)(sum[k][c] * scale) * g_sh_lobe[k] * g_sh_basis[k];
+}
+
+static bool environmentLoadCache(const char* cachePath, const EnvironmentCacheHeader* expected, float sh[9][3])
+{
+    VfsFile file;
+    if (!vfsOpen(cachePath, &file)) return false;
+    EnvironmentCacheHeader header;
+    bool ok = file.size >= sizeof(header);
+    if (ok) memcpy(&header, file.data, sizeof(header));
+    vfsClose(&file);
+    if (!ok || memcmp(header.magic, expected->magic, 4) != 0 || header.version != expected->version ||
+        memcmp(header.sourceSize, expected->sourceSize, sizeof(header.sourceSize)) != 0 ||
+        memcmp(header.sourceTime, expected->sourceTime, sizeof(header.sourceTime)) != 0)
+        return false;
+    memcpy(sh, header.sh, sizeof(header.sh));
+    return true;
+}
+
+static void environmentComputeSH(unsigned int cubemap, float sh[9][3])
+{
+    PROFILE_ZONE("environmentComputeSH");
+    glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+    int size = 0, level = 0;
+    glGetTexLevelParameteriv(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_TEXTURE_WIDTH, &size);
+    while (size > ENVIRONMENT_PROJECTION_SIZE) { size /= 2; level++; }
+
+    // sRGB texels come back undecoded; the projection converts them
+    unsigned char* faces[6];
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    for (int face = 0; face < 6; face++)
+    {
+        faces[face] = (unsigned char*)malloc((size_t)size * size * 3);
+        glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGB, GL_UNSIGNED_BYTE, faces[face]);
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+    environmentProjectSH(faces, size, sh);
+    for (int face = 0; face < 6; face++) free(faces[face]);
+}
+
+static void environmentPrefilter(EnvironmentLighting* env, unsigned int cubemap)
+{
+    PROFILE_ZONE("environmentPrefilter");
+    env->specularMips = ENVIRONMENT_SPECULAR_MIPS;
+    glGenTextures(1, &env->specularMap);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, env->specularMap);
+    glTexStorage2D(GL_TEXTURE_CUBE_MAP, env->specularMips, GL_RGBA16F, ENVIRONMENT_SPECULAR_SIZE, ENVIRONMENT_SPECULAR_SIZE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    RENDER_STAT_ADD(RENDER_STAT_BUFFER_BYTES, (uint64_t)ENVIRONMENT_SPECULAR_SIZE * ENVIRONMENT_SPECULAR_SIZE * 6 * 8 * 4 / 3);
+
+    GLint savedViewport[4], savedFramebuffer;
+    glGetIntegerv(GL_VIEWPORT, savedViewport);
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &savedFramebuffer);
+
+    Shader prefilter = createShaderFromFile("shaders/fullscreen_vertex.glsl", "shaders/prefilter_frag.glsl");
+    unsigned int fbo, emptyVAO;
+    glGenFramebuffers(1, &fbo);
+    glGenVertexArrays(1, &emptyVAO);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glBindVertexArray(emptyVAO);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+
+    int sourceSize = 0;
+    glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+    glGetTexLevelParameteriv(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_TEXTURE_WIDTH, &sourceSize);
+    useShader(prefilter);
+    setInt(prefilter, "source", 0);
+    setFloat(prefilter, "sourceSize", (float)sourceSize);
+    for (int mip = 0; mip < env->specularMips; mip++)
+    {
+        int size = ENVIRONMENT_SPECULAR_SIZE >> mip;
+        glViewport(0, 0, size, size);
+        setFloat(prefilter, "roughness", (float)mip / (float)(env->specularMips - 1));
+        setFloat(prefilter, "size", (float)size);
+        for (int face = 0; face < 6; face++)
+        {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, env->specularMap, mip);
+            setInt(prefilter, "face", face);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            RENDER_STAT_ADD(RENDER_STAT_DRAW_CALLS, 1);
+        }
+    }
+
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, savedFramebuffer);
+    glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteVertexArrays(1, &emptyVAO);
+    useShader({0});
+    deleteShader(prefilter);
+}
+
+// Builds the lighting for `cubemap`, whose faces were loaded from `faces` (+X, -X, +Y, -Y, +Z, -Z).
+// Gives the cubemap a mip chain: the SH readback and the prefilter both sample it.
+void environmentInit(EnvironmentLighting* env, unsigned int cubemap, const char* faces[6])
+{
+    PROFILE_ZONE("environmentInit");
+    memset(env, 0, sizeof(*env));
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+    EnvironmentCacheHeader header = {};
+    memcpy(header.magic, "SHL2", 4);
+    header.version = ENVIRONMENT_CACHE_VERSION;
+    for (int face = 0; face < 6; face++)
+    {
+        long long size, time;
+        meshCacheSourceStamp(faces[face], &size, &time);
+        header.sourceSize[face] = size;
+        header.sourceTime[face] = time;
+    }
+
+    char cachePath[512];
+    const char* slash = strrchr(faces[0], '/');
+    int directoryLength = slash ? (int)(slash - faces[0]) + 1 : 0;
+    snprintf(cachePath, sizeof(cachePath), "%.*s%s", directoryLength, faces[0], ENVIRONMENT_CACHE_NAME);
+
+    if (!environmentLoadCache(cachePath, &header, env->sh))
+    {
+        environmentComputeSH(cubemap, env->sh);
+        memcpy(header.sh, env->sh, sizeof(header.sh));
+        FILE* file = fopen(cachePath, "wb");
+        if (!file || fwrite(&header, sizeof(header), 1, file) != 1)
+            printf("ERROR::ENVIRONMENT::CACHE_WRITE_FAILED: %s\n", cachePath);
+        if (file) fclose(file);
+    }
+
+    environmentPrefilter(env, cubemap);
+}
+
+void environmentDestroy(EnvironmentLighting* env)
+{
+    glDeleteTextures(1, &env->specularMap);
+}
+
+// Binds the prefiltered map to `textureUnit` and uploads the coefficients; `shader` must be in use.
+void environmentBind(const EnvironmentLighting* env, Shader shader, int textureUnit)
+{
+    glActiveTexture(GL_TEXTURE0 + textureUnit);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, env->specularMap);
+    glActiveTexture(GL_TEXTURE0);
+    RENDER_STAT_ADD(RENDER_STAT_TEXTURE_BINDS, 1);
+
+    setInt(shader, "environmentMap", textureUnit);
+    setFloat(shader, "environmentMips", (float)env->specularMips);
+    RENDER_STAT_ADD(RENDER_STAT_UNIFORM_UPLOADS, 1);
+    glUniform3fv(glGetUniformLocation(shader.ID, "shIrradiance"), 9, &env->sh[0][0]);
+}
+
+#endif
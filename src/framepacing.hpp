@@ -0,0 +1,165 @@
+#ifndef FRAMEPACING_H
+#define FRAMEPACING_H
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include "benchmark.hpp"
+#include "profiler.hpp"
+
+// Frame pacing.
+//  - vsync: off / on / adaptive (late frames tear instead of waiting a full interval; needs
+//    *_EXT_swap_control_tear, falls back to on).
+//  - frame cap: sleeps until shortly before the deadline, then spins the rest for precision.
+//  - frames in flight: a fence is inserted after every swap and the CPU waits on the oldest one
+//    before it starts a frame, so it can never run more than maxFramesInFlight frames ahead.
+// Input is sampled right after those waits, and the time from that sample to the frame's fence
+// signalling is reported as "input latency": everything but scan-out of input-to-photon.
+
+#define FRAME_PACING_MAX_IN_FLIGHT 4
+#define FRAME_PACING_SPIN_SECONDS 0.002 // sleep granularity margin, spun instead of slept
+
+enum VSync_Modes {
+    VSYNC_OFF,
+    VSYNC_ON,
+    VSYNC_ADAPTIVE,
+    VSYNC_MODES_MAX
+};
+
+const char * g_vsync_mode_str[VSYNC_MODES_MAX] = {"vsync off", "vsync on", "vsync adaptive"};
+
+struct FramePacing {
+    int vsyncMode;
+    double targetFps;       // 0 = uncapped
+    int maxFramesInFlight;  // 1..FRAME_PACING_MAX_IN_FLIGHT
+    bool adaptiveSupported;
+
+    GLsync fences[FRAME_PACING_MAX_IN_FLIGHT];
+    double inputTimes[FRAME_PACING_MAX_IN_FLIGHT];
+    int head;               // oldest fence
+    int count;
+
+    double nextDeadline;
+    double inputTime;       // input sample of the frame being built
+    double latencyMs;       // last measured input latency
+};
+
+void framePacingSetVsync(FramePacing* pacing, int mode)
+{
+    if (mode == VSYNC_ADAPTIVE && !pacing->adaptiveSupported)
+    {
+        printf("FRAMEPACING: adaptive vsync not supported, using vsync on\n");
+        mode = VSYNC_ON;
+    }
+    pacing->vsyncMode = mode;
+    // negative interval = swap tear extension
+    glfwSwapInterval(mode == VSYNC_OFF ? 0 : (mode == VSYNC_ON ? 1 : -1));
+}
+
+// Steps to the next vsync mode, skipping adaptive when the driver can't do it.
+void framePacingCycleVsync(FramePacing* pacing)
+{
+    int mode = (pacing->vsyncMode + 1) % VSYNC_MODES_MAX;
+    if (mode == VSYNC_ADAPTIVE && !pacing->adaptiveSupported)
+        mode = (mode + 1) % VSYNC_MODES_MAX;
+    framePacingSetVsync(pacing, mode);
+}
+
+// Needs the window's context to be current.
+void framePacingInit(FramePacing* pacing, int vsyncMode, double targetFps, int maxFramesInFlight)
+{
+    memset(pacing, 0, sizeof(*pacing));
+    pacing->adaptiveSupported = glfwExtensionSupported("WGL_EXT_swap_control_tear") ||
+                                glfwExtensionSupported("GLX_EXT_swap_control_tear");
+    pacing->targetFps = targetFps;
+    pacing->maxFramesInFlight = maxFramesInFlight;
+    framePacingSetVsync(pacing, vsyncMode);
+}
+
+static void framePacingRetireOldest(FramePacing* pacing, double now)
+{
+    glDeleteSync(pacing->fences[pacing->head]);
+    pacing->latencyMs = (now - pacing->inputTimes[pacing->head]) * 1000.0;
+    benchmarkAdd(&g_benchmark, "input latency", pacing->latencyMs);
+    pacing->head = (pacing->head + 1) % FRAME_PACING_MAX_IN_FLIGHT;
+    pacing->count--;
+}
+
+// Call at the top of the frame, right before glfwPollEvents.
+// Applies the frame cap and the frames-in-flight bound, then stamps the input sample time, so the
+// events the poll returns are the ones the frame's latency is measured from.
+void framePacingBeginFrame(FramePacing* pacing)
+{
+    PROFILE_ZONE("frame pacing");
+
+    if (pacing->targetFps > 0.0)
+    {
+        double now = glfwGetTime();
+        if (pacing->nextDeadline > now)
+        {
+            double remaining = pacing->nextDeadline - now;
+            if (remaining > FRAME_PACING_SPIN_SECONDS)
+                std::this_thread::sleep_for(std::chrono::duration<double>(remaining - FRAME_PACING_SPIN_SECONDS));
+            while (glfwGetTime() < pacing->nextDeadline) {}
+            pacing->nextDeadline += 1.0 / pacing->targetFps;
+        }
+        else
+        {
+            // missed the slot, don't try to catch up
+            pacing->nextDeadline = now + 1.0 / pacing->targetFps;
+        }
+    }
+
+    // collect frames the GPU already finished
+    while (pacing->count > 0)
+    {
+        GLenum status = glClientWaitSync(pacing->fences[pacing->head], 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break;
+        framePacingRetireOldest(pacing, glfwGetTime());
+    }
+
+    // block on the oldest frame when too many are queued
+    while (pacing->count >= pacing->maxFramesInFlight)
+    {
+        GLenum status = glClientWaitSync(pacing->fences[pacing->head], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+        if (status == GL_WAIT_FAILED) {
+            fprintf(stderr, "ERROR::FRAMEPACING::FENCE_WAIT_FAILED\n");
+        }
+        framePacingRetireOldest(pacing, glfwGetTime());
+    }
+
+    pacing->inputTime = glfwGetTime();
+}
+
+// Call right after the buffer swap.
+void framePacingEndFrame(FramePacing* pacing)
+{
+    if (pacing->count >= FRAME_PACING_MAX_IN_FLIGHT) return;
+    int slot = (pacing->head + pacing->count) % FRAME_PACING_MAX_IN_FLIGHT;
+    pacing->fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    pacing->inputTimes[slot] = pacing->inputTime;
+    pacing->count++;
+}
+
+void framePacingDescribe(const FramePacing* pacing, char* out, size_t size)
+{
+    char cap[32];
+    if (pacing->targetFps > 0.0) snprintf(cap, sizeof(cap), "cap %.0f fps", pacing->targetFps);
+    else snprintf(cap, sizeof(cap), "uncapped");
+    snprintf(out, size, "%s, %s, %d frame%s in flight", g_vsync_mode_str[pacing->vsyncMode], cap,
+             pacing->maxFramesInFlight, pacing->maxFramesInFlight == 1 ? "" : "s");
+}
+
+void framePacingDestroy(FramePacing* pacing)
+{
+    while (pacing->count > 0)
+    {
+        glDeleteSync(pacing->fences[pacing->head]);
+        pacing->head = (pacing->head + 1) % FRAME_PACING_MAX_IN_FLIGHT;
+        pacing->count--;
+    }
+}
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+#include "../thirdparty/glm/glm.hpp"
+
+// View frustum as six inward-facing planes (xyz = normal, w = distance), extracted from a
+// view-projection matrix, with the sphere and box tests the culling stages share.
+
+enum Frustum_Planes {
+    FRUSTUM_LEFT,
+    FRUSTUM_RIGHT,
+    FRUSTUM_BOTTOM,
+    FRUSTUM_TOP,
+    FRUSTUM_NEAR,
+    FRUSTUM_FAR,
+    FRUSTUM_PLANES_MAX
+};
+
+struct Frustum {
+    glm::vec4 planes[FRUSTUM_PLANES_MAX];
+};
+
+// Gribb/Hartmann: planes are sums and differences of the rows of the matrix.
+Frustum frustumFromMatrix(const glm::mat4& viewProjection)
+{
+    Frustum frustum;
+    glm::vec4 row0 = glm::vec4(viewProjection[0][0], viewProjection[1][0], viewProjection[2][0], viewProjection[3][0]);
+    glm::vec4 row1 = glm::vec4(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1], viewProjection[3][1]);
+    glm::vec4 row2 = glm::vec4(viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2]);
+    glm::vec4 row3 = glm::vec4(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+    frustum.planes[FRUSTUM_LEFT] = row3 + row0;
+    frustum.planes[FRUSTUM_RIGHT] = row3 - row0;
+    frustum.planes[FRUSTUM_BOTTOM] = row3 + row1;
+    frustum.planes[FRUSTUM_TOP] = row3 - row1;
+    frustum.planes[FRUSTUM_NEAR] = row3 + row2;
+    frustum.planes[FRUSTUM_FAR] = row3 - row2;
+    for (int i = 0; i < FRUSTUM_PLANES_MAX; i++)
+        frustum.planes[i] /= glm::length(glm::vec3(frustum.planes[i]));
+    return frustum;
+}
+
+bool frustumTestSphere(const Frustum& frustum, const glm::vec3& center, float radius)
+{
+    for (int i = 0; i < FRUSTUM_PLANES_MAX; i++)
+        if (glm::dot(glm::vec3(frustum.planes[i]), center) + frustum.planes[i].w < -radius) return false;
+    return true;
+}
+
+bool frustumTestBox(const Frustum& frustum, const glm::vec3& boxMin, const glm::vec3& boxMax)
+{
+    for (int i = 0; i < FRUSTUM_PLANES_MAX; i++)
+    {
+        glm::vec3 n = glm::vec3(frustum.planes[i]);
+        // the corner furthest along the plane normal
+        glm::vec3 p = glm::vec3(n.x >= 0.0f ? boxMax.x : boxMin.x, n.y >= 0.0f ? boxMax.y : boxMin.y, n.z >= 0.0f ? boxMax.z : boxMin.z);
+        if (glm::dot(n, p) + frustum.planes[i].w < 0.0f) return false;
+    }
+    return true;
+}
+
+// True when the box is entirely inside, so everything in it can skip its own test.
+bool frustumContainsBox(const Frustum& frustum, const glm::vec3& boxMin, const glm::vec3& boxMax)
+{
+    for (int i = 0; i < FRUSTUM_PLANES_MAX; i++)
+    {
+        glm::vec3 n = glm::vec3(frustum.planes[i]);
+        // the corner furthest against the plane normal
+        glm::vec3 p = glm::vec3(n.x >= 0.0f ? boxMin.x : boxMax.x, n.y >= 0.0f ? boxMin.y : boxMax.y, n.z >= 0.0f ? boxMin.z : boxMax.z);
+        if (glm::dot(n, p) + frustum.planes[i].w < 0.0f) return false;
+    }
+    return true;
+}
+
+#endif
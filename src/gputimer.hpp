@@ -0,0 +1,140 @@
+#ifndef GPUTIMER_H
+#define GPUTIMER_H
+#include <glad/glad.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "benchmark.hpp"
+#include "profiler.hpp"
+
+// GPU time per render pass.
+// Each pass is bracketed by two GL_TIMESTAMP queries. Queries live in a ring of GPU_TIMER_FRAMES
+// frames; results are only read back for the slot about to be reused and only if the driver reports
+// them available, so reading never stalls the pipeline (a late frame is dropped instead).
+// Finished passes go to the benchmark report and to a "GPU" track in the profiler trace.
+
+#define GPU_TIMER_FRAMES 4
+
+enum GpuPass_Types {
+    GPU_PASS_SHADOWS,
+    GPU_PASS_OPAQUE,
+    GPU_PASS_VEGETATION,
+    GPU_PASS_LIGHT_CUBES,
+    GPU_PASS_BACKPACK,
+    GPU_PASS_SKYBOX,
+    GPU_PASS_TRANSPARENT,
+    GPU_PASS_MSAA_BLIT,
+    GPU_PASS_TONEMAP,
+    GPU_PASS_MAX
+};
+
+const char * g_gpu_pass_str[GPU_PASS_MAX] = {"gpu shadows", "gpu opaque", "gpu vegetation", "gpu light cubes", "gpu backpack", "gpu skybox", "gpu transparent", "gpu msaa blit", "gpu tonemap"};
+
+struct GpuTimer {
+    unsigned int queries[GPU_TIMER_FRAMES][GPU_PASS_MAX][2];
+    bool issued[GPU_TIMER_FRAMES][GPU_PASS_MAX];
+    int frame;              // ring slot being recorded
+    bool enabled;
+
+    double passMs[GPU_PASS_MAX];    // last resolved value per pass
+    int64_t gpuToCpuNs;             // offset from the GL timestamp clock to profilerNow()
+    int framesSinceCalibration;
+#if PROFILER_ENABLED
+    ProfileThread* track;
+#endif
+};
+
+static void gpuTimerCalibrate(GpuTimer* timer)
+{
+#if PROFILER_ENABLED
+    GLint64 gpuNow = 0;
+    glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+    timer->gpuToCpuNs = (int64_t)profilerNow() - (int64_t)gpuNow;
+#else
+    timer->gpuToCpuNs = 0;
+#endif
+}
+
+void gpuTimerInit(GpuTimer* timer)
+{
+    memset(timer, 0, sizeof(*timer));
+
+    // Some implementations expose the entry points but a zero-width counter.
+    GLint bits = 0;
+    glGetQueryiv(GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &bits);
+    if (bits == 0)
+    {
+        printf("GPUTIMER: GL_TIMESTAMP not supported, GPU pass timing disabled\n");
+        return;
+    }
+
+    glGenQueries(GPU_TIMER_FRAMES * GPU_PASS_MAX * 2, &timer->queries[0][0][0]);
+    timer->enabled = true;
+    gpuTimerCalibrate(timer);
+#if PROFILER_ENABLED
+    timer->track = profilerCreateTrack("GPU");
+#endif
+}
+
+void gpuTimerBegin(GpuTimer* timer, int pass)
+{
+    if (!timer->enabled) return;
+    glQueryCounter(timer->queries[timer->frame][pass][0], GL_TIMESTAMP);
+}
+
+void gpuTimerEnd(GpuTimer* timer, int pass)
+{
+    if (!timer->enabled) return;
+    glQueryCounter(timer->queries[timer->frame][pass][1], GL_TIMESTAMP);
+    timer->issued[timer->frame][pass] = true;
+}
+
+static void gpuTimerResolve(GpuTimer* timer, int slot)
+{
+    for (int pass = 0; pass < GPU_PASS_MAX; pass++)
+    {
+        if (!timer->issued[slot][pass]) continue;
+        timer->issued[slot][pass] = false;
+
+        GLint available = 0;
+        glGetQueryObjectiv(timer->queries[slot][pass][1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) continue; // still in flight after GPU_TIMER_FRAMES, drop it
+
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(timer->queries[slot][pass][0], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(timer->queries[slot][pass][1], GL_QUERY_RESULT, &end);
+        if (end < begin) continue;
+
+        timer->passMs[pass] = (end - begin) / 1e6;
+        benchmarkAdd(&g_benchmark, g_gpu_pass_str[pass], timer->passMs[pass]);
+#if PROFILER_ENABLED
+        profilerRecordTrack(timer->track, g_gpu_pass_str[pass],
+                            (uint64_t)((int64_t)begin + timer->gpuToCpuNs),
+                            (uint64_t)((int64_t)end + timer->gpuToCpuNs));
+#endif
+    }
+}
+
+// Call once per frame after the last pass. Advances the ring and collects the oldest frame.
+void gpuTimerFrame(GpuTimer* timer)
+{
+    if (!timer->enabled) return;
+    timer->frame = (timer->frame + 1) % GPU_TIMER_FRAMES;
+    gpuTimerResolve(timer, timer->frame);
+
+    // the two clocks drift apart slowly; re-sync now and then
+    if (++timer->framesSinceCalibration >= 600)
+    {
+        gpuTimerCalibrate(timer);
+        timer->framesSinceCalibration = 0;
+    }
+}
+
+void gpuTimerDestroy(GpuTimer* timer)
+{
+    if (!timer->enabled) return;
+    glDeleteQueries(GPU_TIMER_FRAMES * GPU_PASS_MAX * 2, &timer->queries[0][0][0]);
+    timer->enabled = false;
+}
+
+#endif
@@ -0,0 +1,566 @@
+#ifndef HOTRELOAD_H
+#define HOTRELOAD_H
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include "shader.hpp"
+#include "texture.hpp"
+#include "model.hpp"
+#include "streaming.hpp"
+#include "profiler.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// Asset hot-reload.
+// A watcher thread listens for file changes (inotify on Linux, mtime polling elsewhere) and
+// queues the matching asset. A cook thread does the CPU work (file read, image decode, Assimp
+// import and mesh build) and hands the result back to the GL thread, which only uploads and swaps it
+// in from hotReloadUpdate() between frames. Only the asset whose file changed is re-cooked.
+//
+// Handles stay valid across a reload:
+//  - Shader: the program ID inside the registered Shader is replaced once the new program links.
+//            Compiles go through GL_KHR_parallel_shader_compile when available and are polled
+//            each frame, so the frame loop never waits on the compiler. Without the extension the link
+//            status is only read HOTRELOAD_LINK_WAIT_FRAMES frames after the submit: drivers that
+//            compile on a thread of their own are done by then, ones that compile inside
+//            glLinkProgram or the status query still stall that frame.
+//  - Texture: the image is re-specified into the same GL texture name, so every copy of the
+//             Texture struct (mesh texture arrays, model cache) sees the new pixels.
+//  - Model: the cook thread builds meshes, node graph and decoded textures from the new import
+//           (modelBuildSource); the GL thread uploads them over the Model pointer (modelUploadSource). Any
+//           file next to the model (material library, textures) rebuilds all of it, so textures its
+//           material table samples (bindless or packed into arrays, see materials.hpp) are recreated too.
+//  - Streamed asset (streaming.hpp): nothing is cooked, the change invalidates the asset and the streamer
+//           reads it again the next time it is requested, so residency and budgets stay its own.
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+#define HOT_RELOAD_POLL_MS 250
+
+typedef void (*ShaderReloadCallback)(Shader shader);
+
+enum HotAsset_Types {
+    HOT_ASSET_SHADER,
+    HOT_ASSET_TEXTURE,
+    HOT_ASSET_MODEL,
+    HOT_ASSET_STREAM
+};
+
+enum HotAsset_States {
+    HOT_ASSET_IDLE,     // nothing pending
+    HOT_ASSET_QUEUED,   // waiting for the cook thread
+    HOT_ASSET_COOKING,  // cook thread is working on it
+    HOT_ASSET_COOKED,   // waiting for the GL thread
+    HOT_ASSET_LINKING   // program submitted, waiting for the (parallel) compiler
+};
+
+#define HOTRELOAD_LINK_WAIT_FRAMES 2 // frames before reading GL_LINK_STATUS without GL_KHR_parallel_shader_compile
+
+struct HotAsset {
+    int type;
+    int state;      // guarded by HotReload::mutex
+    bool dirty;     // file changed again while a reload was in flight
+
+    char paths[2][512];
+    int numPaths;
+    long long mtimes[2];
+
+    // targets
+    Shader* shader;
+    ShaderReloadCallback onShaderReload;
+    Texture* texture;
+    bool flip_uv;
+    Model* model;
+    Streaming* streaming;
+    StreamAsset* stream;
+
+    // cooked payload, owned by whoever holds the asset in its current state
+    char* sources[2];
+    unsigned char* pixels;
+    int width, height, nrChannels;
+    ModelSource* source;
+    unsigned int pendingProgram;
+    int linkFrames;     // hotReloadUpdate calls since the program was submitted
+};
+
+struct HotReload {
+    std::vector<HotAsset*> assets;
+    std::vector<HotAsset*> cookQueue;
+    std::vector<HotAsset*> cookedQueue;
+    std::vector<HotAsset*> linking;     // GL thread only
+    std::vector<std::string> watchDirs;
+    std::vector<int> watchDescriptors;
+
+    std::mutex mutex;
+    std::condition_variable cookSignal;
+    std::thread watcher;
+    std::thread cooker;
+    std::atomic<bool> running{false};
+
+    int inotifyFd = -1;
+    bool parallelCompile = false;
+};
+
+static HotAsset* hotReloadAddAsset(HotReload* hr, int type)
+{
+    HotAsset* asset = (HotAsset*)calloc(1, sizeof(HotAsset));
+    asset->type = type;
+    asset->state = HOT_ASSET_IDLE;
+    hr->assets.push_back(asset);
+    return asset;
+}
+
+static void hotReloadAddWatchDir(HotReload* hr, const char* path)
+{
+    std::string dir(path);
+    size_t slash = dir.find_last_of('/');
+    dir = (slash == std::string::npos) ? std::string(".") : dir.substr(0, slash);
+    for (const std::string& existing : hr->watchDirs)
+        if (existing == dir) return;
+    hr->watchDirs.push_back(dir);
+}
+
+static long long hotReloadFileTime(const char* path)
+{
+#ifdef __linux__
+    (void)path;
+    return 0;
+#else
+    struct stat info;
+    if (stat(path, &info) != 0) return 0;
+    return (long long)info.st_mtime;
+#endif
+}
+
+void hotReloadWatchShader(HotReload* hr, Shader* shader, const char* vertexPath, const char* fragmentPath, ShaderReloadCallback onReload = NULL)
+{
+    HotAsset* asset = hotReloadAddAsset(hr, HOT_ASSET_SHADER);
+    snprintf(asset->paths[0], sizeof(asset->paths[0]), "%s", vertexPath);
+    snprintf(asset->paths[1], sizeof(asset->paths[1]), "%s", fragmentPath);
+    asset->numPaths = 2;
+    asset->shader = shader;
+    asset->onShaderReload = onReload;
+}
+
+void hotReloadWatchTexture(HotReload* hr, Texture* texture, const char* path, const char* directory, bool flip_uv)
+{
+    HotAsset* asset = hotReloadAddAsset(hr, HOT_ASSET_TEXTURE);
+    snprintf(asset->paths[0], sizeof(asset->paths[0]), "%s/%s", directory, path);
+    asset->numPaths = 1;
+    asset->texture = texture;
+    asset->flip_uv = flip_uv;
+}
+
+// Watches the model file and the files next to it.
+void hotReloadWatchModel(HotReload* hr, Model* model, const char* path)
+{
+    if (!model) return;
+    HotAsset* asset = hotReloadAddAsset(hr, HOT_ASSET_MODEL);
+    snprintf(asset->paths[0], sizeof(asset->paths[0]), "%s", path);
+    asset->numPaths = 1;
+    asset->model = model;
+}
+
+// Watches the file of a 2D texture or model the streamer owns; for a model also the files next to it.
+void hotReloadWatchStream(HotReload* hr, Streaming* sm, StreamAsset* stream)
+{
+    HotAsset* asset = hotReloadAddAsset(hr, HOT_ASSET_STREAM);
+    snprintf(asset->paths[0], sizeof(asset->paths[0]), "%s", stream->paths[0]);
+    asset->numPaths = 1;
+    asset->streaming = sm;
+    asset->stream = stream;
+    asset->model = stream->model;
+}
+
+static bool hotReloadMatches(const HotAsset* asset, const char* path)
+{
+    for (int i = 0; i < asset->numPaths; i++)
+        if (strcmp(asset->paths[i], path) == 0) return true;
+
+    if (asset->model)
+    {
+        // material libraries and textures live next to the model and are only referenced from inside it;
+        // the mesh cache is written there by the reload itself
+        const char* ext = strrchr(path, '.');
+        const char* slash = strrchr(asset->paths[0], '/');
+        size_t dirLength = slash ? (size_t)(slash - asset->paths[0]) : 0;
+        if (slash && strncmp(path, asset->paths[0], dirLength) == 0 && path[dirLength] == '/' &&
+            !strchr(path + dirLength + 1, '/') && !(ext && strcmp(ext, MESH_CACHE_EXTENSION) == 0))
+            return true;
+    }
+    return false;
+}
+
+// Called by the watcher thread for every changed file.
+static void hotReloadNotify(HotReload* hr, const char* path)
+{
+    std::lock_guard<std::mutex> lock(hr->mutex);
+    for (HotAsset* asset : hr->assets)
+    {
+        if (!hotReloadMatches(asset, path)) continue;
+        if (asset->state == HOT_ASSET_IDLE)
+        {
+            printf("HOTRELOAD::CHANGED: %s\n", path);
+            asset->state = HOT_ASSET_QUEUED;
+            hr->cookQueue.push_back(asset);
+            hr->cookSignal.notify_one();
+        }
+        else if (asset->state != HOT_ASSET_QUEUED)
+        {
+            asset->dirty = true;
+        }
+    }
+}
+
+static void hotReloadWatcherThread(HotReload* hr)
+{
+    PROFILE_THREAD_NAME("hotreload watcher");
+#ifdef __linux__
+    alignas(struct inotify_event) char buffer[4096];
+    while (hr->running)
+    {
+        struct pollfd pfd = { hr->inotifyFd, POLLIN, 0 };
+        if (poll(&pfd, 1, HOT_RELOAD_POLL_MS) <= 0) continue;
+
+        ssize_t length = read(hr->inotifyFd, buffer, sizeof(buffer));
+        for (char* ptr = buffer; length > 0 && ptr < buffer + length; )
+        {
+            const struct inotify_event* event = (const struct inotify_event*)ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+            if (event->len == 0) continue;
+
+            for (size_t i = 0; i < hr->watchDescriptors.size(); i++)
+            {
+                if (hr->watchDescriptors[i] != event->wd) continue;
+                std::string path = hr->watchDirs[i] + "/" + event->name;
+                hotReloadNotify(hr, path.c_str());
+            }
+        }
+    }
+#else
+    while (hr->running)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(HOT_RELOAD_POLL_MS));
+        std::vector<std::string> changed;
+        {
+            std::lock_guard<std::mutex> lock(hr->mutex);
+            for (HotAsset* asset : hr->assets)
+            {
+                for (int i = 0; i < asset->numPaths; i++)
+                {
+                    long long mtime = hotReloadFileTime(asset->paths[i]);
+                    if (mtime != asset->mtimes[i])
+                    {
+                        asset->mtimes[i] = mtime;
+                        changed.push_back(asset->paths[i]);
+                    }
+                }
+            }
+        }
+        for (const std::string& path : changed)
+            hotReloadNotify(hr, path.c_str());
+    }
+#endif
+}
+
+static void hotReloadCook(HotAsset* asset)
+{
+    PROFILE_ZONE("hotReloadCook");
+    switch (asset->type)
+    {
+        case HOT_ASSET_SHADER:
+            // the loose files that changed, not what a mounted pack holds
+            asset->sources[0] = readFile(asset->paths[0], VFS_LOOSE_ONLY);
+            asset->sources[1] = readFile(asset->paths[1], VFS_LOOSE_ONLY);
+            break;
+
+        case HOT_ASSET_TEXTURE:
+            stbi_set_flip_vertically_on_load_thread(asset->flip_uv);
+            asset->pixels = stbi_load(asset->paths[0], &asset->width, &asset->height, &asset->nrChannels, 0);
+            if (!asset->pixels)
+                printf("ERROR::HOTRELOAD::TEXTURE_DECODE_FAILED: %s\n", asset->paths[0]);
+            break;
+
+        case HOT_ASSET_MODEL:
+        {
+            // the loose file that changed; the model is only read, it keeps drawing until the upload
+            Assimp::Importer importer;
+            const aiScene* scene = importer.ReadFile(asset->paths[0], ASSIMP_LOAD_FLAGS);
+            if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
+                printf("ERROR::HOTRELOAD::ASSIMP::%s\n", importer.GetErrorString());
+                break;
+            }
+            asset->source = new ModelSource();
+            modelBuildSource(asset->model, scene, asset->source);
+            break;
+        }
+
+        case HOT_ASSET_STREAM:
+            break;
+    }
+}
+
+static void hotReloadCookThread(HotReload* hr)
+{
+    PROFILE_THREAD_NAME("hotreload cook");
+    std::unique_lock<std::mutex> lock(hr->mutex);
+    while (hr->running)
+    {
+        hr->cookSignal.wait(lock, [hr] { return !hr->running || !hr->cookQueue.empty(); });
+        if (!hr->running) break;
+
+        HotAsset* asset = hr->cookQueue.front();
+        hr->cookQueue.erase(hr->cookQueue.begin());
+        asset->state = HOT_ASSET_COOKING;
+        asset->dirty = false;
+
+        lock.unlock();
+        hotReloadCook(asset);
+        lock.lock();
+
+        asset->state = HOT_ASSET_COOKED;
+        hr->cookedQueue.push_back(asset);
+    }
+}
+
+void hotReloadStart(HotReload* hr)
+{
+    // GL_KHR_parallel_shader_compile lets the driver compile on its own threads;
+    // we then poll GL_COMPLETION_STATUS_KHR instead of blocking on GL_LINK_STATUS.
+    if (glfwExtensionSupported("GL_KHR_parallel_shader_compile"))
+    {
+        PFNGLMAXSHADERCOMPILERTHREADSKHRPROC maxShaderCompilerThreads =
+            (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+        if (maxShaderCompilerThreads) maxShaderCompilerThreads(0xFFFFFFFFu);
+        hr->parallelCompile = true;
+    }
+
+    for (HotAsset* asset : hr->assets)
+    {
+        for (int i = 0; i < asset->numPaths; i++)
+        {
+            hotReloadAddWatchDir(hr, asset->paths[i]);
+            asset->mtimes[i] = hotReloadFileTime(asset->paths[i]);
+        }
+    }
+
+#ifdef __linux__
+    hr->inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (hr->inotifyFd < 0) {
+        fprintf(stderr, "ERROR::HOTRELOAD::INOTIFY_INIT_FAILED: %s\n", strerror(errno));
+        return;
+    }
+    for (const std::string& dir : hr->watchDirs)
+    {
+        // editors either rewrite the file in place or rename a temp file over it
+        int wd = inotify_add_watch(hr->inotifyFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (wd < 0)
+            fprintf(stderr, "ERROR::HOTRELOAD::WATCH_FAILED: %s (%s)\n", dir.c_str(), strerror(errno));
+        hr->watchDescriptors.push_back(wd);
+    }
+#endif
+
+    hr->running = true;
+    hr->watcher = std::thread(hotReloadWatcherThread, hr);
+    hr->cooker = std::thread(hotReloadCookThread, hr);
+    printf("HOTRELOAD: watching %zu assets in %zu directories (parallel shader compile: %s)\n",
+           hr->assets.size(), hr->watchDirs.size(), hr->parallelCompile ? "yes" : "no");
+}
+
+static void hotReloadFinishShader(HotAsset* asset)
+{
+    unsigned int program = asset->pendingProgram;
+    asset->pendingProgram = 0;
+
+    int success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        // keep running with the old program until the file is fixed
+        checkCompileErrors(program, "PROGRAM");
+        glDeleteProgram(program);
+        return;
+    }
+
+    deleteShader(*asset->shader);
+    asset->shader->ID = program;
+    if (asset->onShaderReload) asset->onShaderReload(*asset->shader);
+    printf("HOTRELOAD::SHADER: %s + %s\n", asset->paths[0], asset->paths[1]);
+}
+
+static void hotReloadSubmitShader(HotReload* hr, HotAsset* asset)
+{
+    char* vertexCode = asset->sources[0];
+    char* fragmentCode = asset->sources[1];
+    asset->sources[0] = asset->sources[1] = NULL;
+    if (!vertexCode || !fragmentCode)
+    {
+        free(vertexCode);
+        free(fragmentCode);
+        return;
+    }
+
+    // No status queries here: those would block until the driver is done.
+    unsigned int vertex = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vertex, 1, (const char**)&vertexCode, NULL);
+    glCompileShader(vertex);
+
+    unsigned int fragment = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fragment, 1, (const char**)&fragmentCode, NULL);
+    glCompileShader(fragment);
+
+    unsigned int program = glCreateProgram();
+    glAttachShader(program, vertex);
+    glAttachShader(program, fragment);
+    glLinkProgram(program);
+    // flagged for deletion, freed together with the program
+    glDeleteShader(vertex);
+    glDeleteShader(fragment);
+
+    free(vertexCode);
+    free(fragmentCode);
+
+    // read the status on a later frame either way, the query blocks until the link is done
+    asset->pendingProgram = program;
+    asset->linkFrames = 0;
+    asset->state = HOT_ASSET_LINKING;
+    hr->linking.push_back(asset);
+}
+
+static void hotReloadFinishTexture(HotAsset* asset)
+{
+    if (asset->pixels)
+    {
+        uploadTextureImage(asset->texture->ID, asset->texture->type, asset->pixels, asset->width, asset->height, asset->nrChannels);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        stbi_image_free(asset->pixels);
+        asset->pixels = NULL;
+        printf("HOTRELOAD::TEXTURE: %s\n", asset->paths[0]);
+    }
+}
+
+static void hotReloadFinishModel(HotAsset* asset)
+{
+    if (asset->source)
+    {
+        modelUploadSource(asset->model, asset->source);
+        delete asset->source;
+        asset->source = NULL;
+        printf("HOTRELOAD::MODEL: %s (%d meshes)\n", asset->paths[0], asset->model->numMeshes);
+    }
+}
+
+// Swaps finished assets in. Call once per frame on the GL thread, outside of any pass.
+void hotReloadUpdate(HotReload* hr)
+{
+    PROFILE_ZONE("hotReloadUpdate");
+    std::vector<HotAsset*> done;
+
+    for (size_t i = 0; i < hr->linking.size(); )
+    {
+        HotAsset* asset = hr->linking[i];
+        int complete = GL_FALSE;
+        if (hr->parallelCompile) glGetProgramiv(asset->pendingProgram, GL_COMPLETION_STATUS_KHR, &complete);
+        else complete = ++asset->linkFrames > HOTRELOAD_LINK_WAIT_FRAMES;
+        if (!complete) { i++; continue; }
+
+        hotReloadFinishShader(asset);
+        hr->linking.erase(hr->linking.begin() + i);
+        done.push_back(asset);
+    }
+
+    std::vector<HotAsset*> cooked;
+    {
+        std::lock_guard<std::mutex> lock(hr->mutex);
+        cooked.swap(hr->cookedQueue);
+    }
+
+    for (HotAsset* asset : cooked)
+    {
+        switch (asset->type)
+        {
+            case HOT_ASSET_SHADER:
+                hotReloadSubmitShader(hr, asset);
+                if (asset->state == HOT_ASSET_LINKING) continue;
+                break;
+            case HOT_ASSET_TEXTURE:
+                hotReloadFinishTexture(asset);
+                break;
+            case HOT_ASSET_MODEL:
+                hotReloadFinishModel(asset);
+                break;
+            case HOT_ASSET_STREAM:
+                streamingInvalidate(asset->streaming, asset->stream);
+                printf("HOTRELOAD::STREAM: %s\n", asset->paths[0]);
+                break;
+        }
+        done.push_back(asset);
+    }
+
+    if (done.empty()) return;
+
+    std::lock_guard<std::mutex> lock(hr->mutex);
+    for (HotAsset* asset : done)
+    {
+        if (asset->dirty)
+        {
+            asset->dirty = false;
+            asset->state = HOT_ASSET_QUEUED;
+            hr->cookQueue.push_back(asset);
+            hr->cookSignal.notify_one();
+        }
+        else
+        {
+            asset->state = HOT_ASSET_IDLE;
+        }
+    }
+}
+
+void hotReloadShutdown(HotReload* hr)
+{
+    {
+        std::lock_guard<std::mutex> lock(hr->mutex);
+        hr->running = false;
+    }
+    hr->cookSignal.notify_all();
+    if (hr->watcher.joinable()) hr->watcher.join();
+    if (hr->cooker.joinable()) hr->cooker.join();
+
+#ifdef __linux__
+    if (hr->inotifyFd >= 0) close(hr->inotifyFd);
+    hr->inotifyFd = -1;
+#endif
+
+    for (HotAsset* asset : hr->assets)
+    {
+        if (asset->pendingProgram) glDeleteProgram(asset->pendingProgram);
+        free(asset->sources[0]);
+        free(asset->sources[1]);
+        if (asset->pixels) stbi_image_free(asset->pixels);
+        if (asset->source) modelFreeSource(asset->source);
+        delete asset->source;
+        free(asset);
+    }
+    hr->assets.clear();
+    hr->cookQueue.clear();
+    hr->cookedQueue.clear();
+    hr->linking.clear();
+}
+
+#endif
@@ -0,0 +1,361 @@
+#ifndef JOBS_H
+#define JOBS_H
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "profiler.hpp"
+
+// Work-stealing job system.
+// Every worker owns a deque: it pushes and pops its own jobs at the back (LIFO, cache-warm) and
+// idle workers steal from the front of a random victim (FIFO, big chunks first). The thread that
+// calls jobsInit() is worker 0; it only runs jobs while it waits in jobsWait(), so the GL thread
+// never gets stuck inside a long job it didn't ask for.
+//
+// Completion is tracked with JobCounter: submitting adds to it, finishing a job subtracts.
+// jobsSubmitAfter() queues a job to start once another counter reaches zero (a dependency).
+// Job names are static strings and show up as profiler zones on the worker threads.
+// Background jobs (jobsSubmitBackground) wait in a queue of their own that only workers other than
+// worker 0 take from, and only when they have nothing else to run.
+
+#define JOBS_MAX_WORKERS 32
+
+typedef void (*JobFunction)(void* data);
+typedef void (*JobRangeFunction)(void* data, int begin, int end);
+
+struct JobCounter;
+
+struct Job {
+    const char* name;
+    JobFunction function;
+    void* data;
+    JobCounter* counter;
+};
+
+struct JobCounter {
+    std::atomic<int> pending{0};
+    std::atomic<int> finishing{0};   // threads still inside jobsFinish(); the counter must outlive them
+    std::mutex lock;
+    std::vector<Job> continuations;  // submitted when pending drops to zero
+};
+
+struct JobWorker {
+    std::mutex lock;
+    std::deque<Job> jobs;
+    std::thread thread;
+    uint32_t rng;
+};
+
+struct JobSystem {
+    JobWorker* workers[JOBS_MAX_WORKERS];
+    int numWorkers;
+    std::atomic<bool> running{false};
+
+    // sleeping for idle workers
+    std::mutex sleepLock;
+    std::condition_variable wake;
+    std::atomic<int> queued{0};
+
+    std::mutex backgroundLock;
+    std::deque<Job> background;
+};
+
+JobSystem g_jobs;
+static thread_local int t_jobWorkerIndex = -1;
+
+static void jobsPush(int workerIndex, const Job& job)
+{
+    JobWorker* worker = g_jobs.workers[workerIndex];
+    {
+        std::lock_guard<std::mutex> lock(worker->lock);
+        worker->jobs.push_back(job);
+    }
+    g_jobs.queued.fetch_add(1, std::memory_order_release);
+    g_jobs.wake.notify_one();
+}
+
+static bool jobsPop(int workerIndex, Job* out)
+{
+    JobWorker* worker = g_jobs.workers[workerIndex];
+    std::lock_guard<std::mutex> lock(worker->lock);
+    if (worker->jobs.empty()) return false;
+    *out = worker->jobs.back();
+    worker->jobs.pop_back();
+    g_jobs.queued.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+}
+
+static bool jobsSteal(int thiefIndex, Job* out)
+{
+    JobWorker* thief = g_jobs.workers[thiefIndex];
+    for (int attempt = 0; attempt < g_jobs.numWorkers; attempt++)
+    {
+        // xorshift32 victim selection
+        thief->rng ^= thief->rng << 13;
+        thief->rng ^= thief->rng >> 17;
+        thief->rng ^= thief->rng << 5;
+        int victimIndex = (int)(thief->rng % (uint32_t)g_jobs.numWorkers);
+        if (victimIndex == thiefIndex) continue;
+
+        JobWorker* victim = g_jobs.workers[victimIndex];
+        std::unique_lock<std::mutex> lock(victim->lock, std::try_to_lock);
+        if (!lock.owns_lock() || victim->jobs.empty()) continue;
+        *out = victim->jobs.front();
+        victim->jobs.pop_front();
+        g_jobs.queued.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+static void jobsSubmitNow(const Job& job)
+{
+    int workerIndex = t_jobWorkerIndex >= 0 ? t_jobWorkerIndex : 0;
+    jobsPush(workerIndex, job);
+}
+
+static void jobsFinish(JobCounter* counter)
+{
+    if (!counter) return;
+    counter->finishing.fetch_add(1, std::memory_order_acq_rel);
+    std::vector<Job> ready;
+    if (counter->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        std::lock_guard<std::mutex> lock(counter->lock);
+        ready.swap(counter->continuations);
+    }
+    // last touch of the counter: a waiter may free it right after this
+    counter->finishing.fetch_sub(1, std::memory_order_release);
+
+    for (const Job& job : ready)
+        jobsSubmitNow(job);
+}
+
+static void jobsExecute(const Job& job)
+{
+#if PROFILER_ENABLED
+    ProfileZone zone(job.name ? job.name : "job");
+#endif
+    job.function(job.data);
+    jobsFinish(job.counter);
+}
+
+// Runs one queued job from the calling worker's deque or a stolen one. Returns false if none was found.
+static bool jobsRunOne(int workerIndex)
+{
+    Job job;
+    if (jobsPop(workerIndex, &job) || jobsSteal(workerIndex, &job))
+    {
+        jobsExecute(job);
+        return true;
+    }
+    return false;
+}
+
+static bool jobsRunBackground()
+{
+    Job job;
+    {
+        std::lock_guard<std::mutex> lock(g_jobs.backgroundLock);
+        if (g_jobs.background.empty()) return false;
+        job = g_jobs.background.front();
+        g_jobs.background.pop_front();
+    }
+    g_jobs.queued.fetch_sub(1, std::memory_order_relaxed);
+    jobsExecute(job);
+    return true;
+}
+
+static void jobsWorkerThread(int workerIndex)
+{
+    t_jobWorkerIndex = workerIndex;
+    char name[32];
+    snprintf(name, sizeof(name), "worker %d", workerIndex);
+    PROFILE_THREAD_NAME(name);
+
+    while (g_jobs.running.load(std::memory_order_acquire))
+    {
+        if (jobsRunOne(workerIndex) || jobsRunBackground()) continue;
+
+        std::unique_lock<std::mutex> lock(g_jobs.sleepLock);
+        g_jobs.wake.wait_for(lock, std::chrono::milliseconds(2), [] {
+            return !g_jobs.running.load(std::memory_order_relaxed) || g_jobs.queued.load(std::memory_order_acquire) > 0;
+        });
+    }
+}
+
+// numThreads = 0 uses one worker per hardware thread, the calling thread included.
+void jobsInit(int numThreads = 0)
+{
+    if (numThreads <= 0) numThreads = (int)std::thread::hardware_concurrency();
+    if (numThreads < 1) numThreads = 1;
+    if (numThreads > JOBS_MAX_WORKERS) numThreads = JOBS_MAX_WORKERS;
+
+    g_jobs.numWorkers = numThreads;
+    for (int i = 0; i < numThreads; i++)
+    {
+        g_jobs.workers[i] = new JobWorker();
+        g_jobs.workers[i]->rng = 0x9E3779B9u * (uint32_t)(i + 1);
+    }
+
+    t_jobWorkerIndex = 0;
+    g_jobs.running = true;
+    for (int i = 1; i < numThreads; i++)
+        g_jobs.workers[i]->thread = std::thread(jobsWorkerThread, i);
+}
+
+void jobsShutdown()
+{
+    g_jobs.running = false;
+    g_jobs.wake.notify_all();
+    for (int i = 1; i < g_jobs.numWorkers; i++)
+        if (g_jobs.workers[i]->thread.joinable()) g_jobs.workers[i]->thread.join();
+    for (int i = 0; i < g_jobs.numWorkers; i++)
+        delete g_jobs.workers[i];
+    g_jobs.numWorkers = 0;
+}
+
+void jobsSubmit(const char* name, JobFunction function, void* data, JobCounter* counter)
+{
+    if (counter) counter->pending.fetch_add(1, std::memory_order_relaxed);
+    Job job = { name, function, data, counter };
+    if (g_jobs.numWorkers == 0)
+    {
+        jobsExecute(job); // no scheduler running: run inline
+        return;
+    }
+    jobsSubmitNow(job);
+}
+
+// Queues a job that starts only once `dependency` has no pending jobs left.
+void jobsSubmitAfter(JobCounter* dependency, const char* name, JobFunction function, void* data, JobCounter* counter)
+{
+    if (counter) counter->pending.fetch_add(1, std::memory_order_relaxed);
+    Job job = { name, function, data, counter };
+    {
+        std::lock_guard<std::mutex> lock(dependency->lock);
+        if (dependency->pending.load(std::memory_order_acquire) > 0)
+        {
+            dependency->continuations.push_back(job);
+            return;
+        }
+    }
+    if (g_jobs.numWorkers == 0) jobsExecute(job);
+    else jobsSubmitNow(job);
+}
+
+// Queues long running work the frame never waits on, such as asset loads. The GL thread does not pick
+// it up while it waits in jobsWait, so a frame cannot stall behind it. Runs inline without other workers.
+void jobsSubmitBackground(const char* name, JobFunction function, void* data, JobCounter* counter)
+{
+    if (counter) counter->pending.fetch_add(1, std::memory_order_relaxed);
+    Job job = { name, function, data, counter };
+    if (g_jobs.numWorkers <= 1)
+    {
+        jobsExecute(job);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(g_jobs.backgroundLock);
+        g_jobs.background.push_back(job);
+    }
+    g_jobs.queued.fetch_add(1, std::memory_order_release);
+    g_jobs.wake.notify_one();
+}
+
+// True once every job counted by the counter has finished; never runs or waits for jobs.
+bool jobsDone(JobCounter* counter)
+{
+    return counter->pending.load(std::memory_order_acquire) == 0 &&
+           counter->finishing.load(std::memory_order_acquire) == 0;
+}
+
+// Waits for the counter to reach zero, running jobs on the calling thread meanwhile.
+void jobsWait(JobCounter* counter)
+{
+    int workerIndex = t_jobWorkerIndex >= 0 ? t_jobWorkerIndex : 0;
+    while (counter->pending.load(std::memory_order_acquire) > 0 ||
+           counter->finishing.load(std::memory_order_acquire) > 0)
+    {
+        if (!jobsRunOne(workerIndex))
+            std::this_thread::yield();
+    }
+}
+
+struct JobRange {
+    JobRangeFunction function;
+    void* data;
+    int begin;
+    int end;
+};
+
+static void jobsRunRange(void* data)
+{
+    JobRange* range = (JobRange*)data;
+    range->function(range->data, range->begin, range->end);
+}
+
+// Splits [0, count) into batches of batchSize and runs them as jobs, then waits for all of them.
+void jobsParallelFor(const char* name, int count, int batchSize, JobRangeFunction function, void* data)
+{
+    if (count <= 0) return;
+    if (batchSize < 1) batchSize = 1;
+    int numBatches = (count + batchSize - 1) / batchSize;
+    if (numBatches == 1 || g_jobs.numWorkers <= 1)
+    {
+#if PROFILER_ENABLED
+        ProfileZone zone(name);
+#endif
+        function(data, 0, count);
+        return;
+    }
+
+    std::vector<JobRange> ranges(numBatches);
+    JobCounter counter;
+    for (int i = 0; i < numBatches; i++)
+    {
+        ranges[i] = { function, data, i * batchSize, (i + 1) * batchSize < count ? (i + 1) * batchSize : count };
+        jobsSubmit(name, jobsRunRange, &ranges[i], &counter);
+    }
+    jobsWait(&counter);
+}
+
+static void jobsEmptyJob(void* data) { (void)data; }
+
+// Measures the cost of submitting, scheduling and completing an empty job.
+void jobsMicroBenchmark(int numJobs)
+{
+    printf("jobs micro-benchmark: %d workers, %d empty jobs per run\n", g_jobs.numWorkers, numJobs);
+    for (int run = 0; run < 5; run++)
+    {
+        JobCounter counter;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < numJobs; i++)
+            jobsSubmit("empty", jobsEmptyJob, NULL, &counter);
+        jobsWait(&counter);
+        auto end = std::chrono::steady_clock::now();
+        double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        printf("  run %d: %8.1f ns/job\n", run, ns / numJobs);
+    }
+
+    // fan-out through parallel-for, the pattern culling and transform updates use
+    std::vector<int> values(numJobs, 1);
+    for (int batch = 16; batch <= 4096; batch *= 16)
+    {
+        auto start = std::chrono::steady_clock::now();
+        jobsParallelFor("bench range", numJobs, batch, [](void* data, int begin, int end) {
+            int* v = (int*)data;
+            for (int i = begin; i < end; i++) v[i] += 1;
+        }, values.data());
+        auto end = std::chrono::steady_clock::now();
+        double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        printf("  parallel-for batch %4d: %8.1f ns/batch\n", batch, ns / ((numJobs + batch - 1) / batch));
+    }
+}
+
+#endif
@@ -5,6 +5,7 @@
 
 #include "shader.hpp"
 #include <string>
+#include <math.h>
 
 typedef enum {
     LIGHT_TYPE_DIRECTIONAL,
@@ -30,6 +31,23 @@ typedef struct {
     float outerCutOff;
 } Light;
 
+// Distance at which attenuation takes the light's brightest channel below 1/256, 0 when it emits nothing
+// or does not fall off (directional lights).
+float lightRange(const Light& light)
+{
+    glm::vec3 brightest = glm::max(light.diffuse, light.specular);
+    float intensity = glm::max(brightest.x, glm::max(brightest.y, brightest.z));
+    if (light.type == LIGHT_TYPE_DIRECTIONAL || intensity <= 0.0f) return 0.0f;
+
+    // constant + linear * d + quadratic * d^2 = 256 * intensity
+    float c = light.constant - 256.0f * intensity;
+    if (light.quadratic > 0.0f)
+        return (-light.linear + sqrtf(light.linear * light.linear - 4.0f * light.quadratic * c)) / (2.0f * light.quadratic);
+    if (light.linear > 0.0f)
+        return -c / light.linear;
+    return 0.0f;
+}
+
 void setLight(const char* name, const Light light, Shader shader) {
     setVec3(shader,(std::string(name) + ".ambient").c_str(), glm::value_ptr(light.ambient));
     setVec3(shader,(std::string(name) + ".diffuse").c_str(), glm::value_ptr(light.diffuse));
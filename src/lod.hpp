@@ -0,0 +1,456 @@
+#ifndef LOD_H
+#define LOD_H
+#include "../thirdparty/glm/glm.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+
+// Level-of-detail generation and selection.
+// lodSimplify reduces an index buffer with quadric-error edge collapses. Vertices are never moved or
+// created: a collapse redirects one vertex to a neighbour, so every LOD indexes the original vertex
+// buffer and a mesh keeps one VBO with all of its LODs appended to one EBO.
+// UV/normal seams show up as several vertices sharing a position. Those stay intact: a seam vertex
+// only collapses along its seam and together with its twin on the other side, open borders only
+// collapse along the border, and anything more tangled is locked.
+// lodSelect picks a level per object from the projected size of its simplification error, with
+// hysteresis so objects near a threshold do not flip between levels every frame.
+
+#define LOD_MAX_LEVELS 6
+#define LOD_REDUCTION 0.5f       // each level targets this fraction of the previous level's triangles
+#define LOD_MIN_REDUCTION 0.85f  // a level must reach at least this much of its target reduction to be kept
+#define LOD_MAX_ERROR 0.05f      // relative to the mesh extent; simplification stops beyond it
+#define LOD_BORDER_WEIGHT 10.0   // pulls collapses towards keeping borders and seams in place
+#define LOD_PIXEL_ERROR 1.0f     // allowed projected error in pixels
+#define LOD_HYSTERESIS 0.25f     // a coarser level must be this much below LOD_PIXEL_ERROR to switch
+
+struct MeshLod {
+    unsigned int indexOffset;   // into the mesh index buffer
+    unsigned int indexCount;
+    float error;                // object-space distance
+};
+
+enum LodVertex_Kinds {
+    LOD_VERTEX_MANIFOLD,  // interior, collapses anywhere
+    LOD_VERTEX_BORDER,    // on an open edge, collapses along it
+    LOD_VERTEX_SEAM,      // one of two vertices at an attribute seam, collapses along it with its twin
+    LOD_VERTEX_LOCKED
+};
+
+struct LodQuadric {
+    double a00, a11, a22, a01, a02, a12;
+    double b0, b1, b2;
+    double c;
+    double w;   // total weight; errors are divided by it so they stay distances squared
+};
+
+static void lodQuadricAdd(LodQuadric* q, const LodQuadric& r)
+{
+    q->a00 += r.a00; q->a11 += r.a11; q->a22 += r.a22;
+    q->a01 += r.a01; q->a02 += r.a02; q->a12 += r.a12;
+    q->b0 += r.b0; q->b1 += r.b1; q->b2 += r.b2;
+    q->c += r.c;
+    q->w += r.w;
+}
+
+// Plane n.p + d = 0 with weight w.
+static LodQuadric lodQuadricPlane(glm::dvec3 n, double d, double w)
+{
+    LodQuadric q;
+    q.a00 = w * n.x * n.x; q.a11 = w * n.y * n.y; q.a22 = w * n.z * n.z;
+    q.a01 = w * n.x * n.y; q.a02 = w * n.x * n.z; q.a12 = w * n.y * n.z;
+    q.b0 = w * n.x * d; q.b1 = w * n.y * d; q.b2 = w * n.z * d;
+    q.c = w * d * d;
+    q.w = w;
+    return q;
+}
+
+static double lodQuadricError(const LodQuadric& q, const glm::vec3& p)
+{
+    double x = p.x, y = p.y, z = p.z;
+    double e = q.a00 * x * x + q.a11 * y * y + q.a22 * z * z
+             + 2.0 * (q.a01 * x * y + q.a02 * x * z + q.a12 * y * z)
+             + 2.0 * (q.b0 * x + q.b1 * y + q.b2 * z) + q.c;
+    return e > 0.0 && q.w > 0.0 ? e / q.w : 0.0;
+}
+
+// Outgoing edges per vertex in compressed rows, rebuilt every pass from the current triangles.
+struct LodAdjacency {
+    unsigned int* offsets;  // numVertices + 1
+    unsigned int* targets;
+};
+
+// Counts are turned into row starts, each start is used as the write cursor of its row (ending up
+// at the next row's start) and the array is shifted back by one.
+static void lodPrefixSum(unsigned int* offsets, unsigned int numVertices)
+{
+    unsigned int sum = 0;
+    for (unsigned int v = 0; v <= numVertices; v++)
+    {
+        unsigned int count = v < numVertices ? offsets[v] : 0;
+        offsets[v] = sum;
+        sum += count;
+    }
+}
+
+static void lodShiftOffsets(unsigned int* offsets, unsigned int numVertices)
+{
+    for (unsigned int v = numVertices; v > 0; v--)
+        offsets[v] = offsets[v - 1];
+    offsets[0] = 0;
+}
+
+static void lodBuildAdjacency(LodAdjacency* adj, const unsigned int* indices, unsigned int numIndices, const unsigned int* remap, unsigned int numVertices)
+{
+    memset(adj->offsets, 0, (numVertices + 1) * sizeof(unsigned int));
+    for (unsigned int i = 0; i < numIndices; i++)
+        adj->offsets[remap ? remap[indices[i]] : indices[i]]++;
+    lodPrefixSum(adj->offsets, numVertices);
+    for (unsigned int i = 0; i < numIndices; i += 3)
+        for (int e = 0; e < 3; e++)
+        {
+            unsigned int a = indices[i + e], b = indices[i + (e + 1) % 3];
+            if (remap) { a = remap[a]; b = remap[b]; }
+            adj->targets[adj->offsets[a]++] = b;
+        }
+    lodShiftOffsets(adj->offsets, numVertices);
+}
+
+// Triangles (first index) around each position.
+static void lodBuildTriangleAdjacency(LodAdjacency* adj, const unsigned int* indices, unsigned int numIndices, const unsigned int* remap, unsigned int numVertices)
+{
+    memset(adj->offsets, 0, (numVertices + 1) * sizeof(unsigned int));
+    for (unsigned int i = 0; i < numIndices; i++)
+        adj->offsets[remap[indices[i]]]++;
+    lodPrefixSum(adj->offsets, numVertices);
+    for (unsigned int i = 0; i < numIndices; i++)
+        adj->targets[adj->offsets[remap[indices[i]]]++] = i - i % 3;
+    lodShiftOffsets(adj->offsets, numVertices);
+}
+
+static bool lodHasEdge(const LodAdjacency* adj, unsigned int a, unsigned int b)
+{
+    for (unsigned int i = adj->offsets[a]; i < adj->offsets[a + 1]; i++)
+        if (adj->targets[i] == b) return true;
+    return false;
+}
+
+// Vertices sharing a bit-identical position get the same remap value (the first of them) and are
+// linked in a cycle through wedge.
+static void lodBuildPositionRemap(unsigned int* remap, unsigned int* wedge, const glm::vec3* positions, unsigned int numVertices)
+{
+    unsigned int tableSize = 1;
+    while (tableSize < numVertices * 2) tableSize *= 2;
+    unsigned int* table = (unsigned int*)malloc(tableSize * sizeof(unsigned int));
+    memset(table, 0xFF, tableSize * sizeof(unsigned int));
+
+    for (unsigned int v = 0; v < numVertices; v++)
+    {
+        unsigned int bits[3];
+        memcpy(bits, &positions[v], sizeof(bits));
+        unsigned int h = (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+        unsigned int slot = h & (tableSize - 1);
+        while (table[slot] != ~0u && memcmp(&positions[table[slot]], &positions[v], sizeof(glm::vec3)) != 0)
+            slot = (slot + 1) & (tableSize - 1);
+        if (table[slot] == ~0u) table[slot] = v;
+
+        unsigned int r = table[slot];
+        remap[v] = r;
+        if (r == v) wedge[v] = v;
+        else
+        {
+            wedge[v] = wedge[r];
+            wedge[r] = v;
+        }
+    }
+    free(table);
+}
+
+struct LodCollapse {
+    unsigned int from, to;
+    float cost;
+};
+
+// Simplifies a triangle list towards targetIndexCount indices, never exceeding maxError (relative to
+// the mesh extent). Writes the result to destination (room for numIndices) and returns its index
+// count. outError receives the object-space error of the result.
+unsigned int lodSimplify(unsigned int* destination, const unsigned int* indices, unsigned int numIndices,
+                         const float* vertexPositions, size_t stride, unsigned int numVertices,
+                         unsigned int targetIndexCount, float maxError, float* outError)
+{
+    *outError = 0.0f;
+    memcpy(destination, indices, numIndices * sizeof(unsigned int));
+    if (numIndices <= targetIndexCount || numVertices == 0) return numIndices;
+
+    // positions scaled into the unit cube so errors are relative to the extent
+    glm::vec3 minP(FLT_MAX), maxP(-FLT_MAX);
+    glm::vec3* positions = (glm::vec3*)malloc(numVertices * sizeof(glm::vec3));
+    for (unsigned int v = 0; v < numVertices; v++)
+    {
+        const float* p = (const float*)((const char*)vertexPositions + v * stride);
+        positions[v] = glm::vec3(p[0], p[1], p[2]);
+        minP = glm::min(minP, positions[v]);
+        maxP = glm::max(maxP, positions[v]);
+    }
+    float extent = glm::max(maxP.x - minP.x, glm::max(maxP.y - minP.y, maxP.z - minP.z));
+    float scale = extent > 0.0f ? 1.0f / extent : 1.0f;
+    for (unsigned int v = 0; v < numVertices; v++)
+        positions[v] = (positions[v] - minP) * scale;
+
+    unsigned int* remap = (unsigned int*)malloc(numVertices * sizeof(unsigned int));
+    unsigned int* wedge = (unsigned int*)malloc(numVertices * sizeof(unsigned int));
+    lodBuildPositionRemap(remap, wedge, positions, numVertices);
+
+    LodAdjacency adj, posAdj, triAdj;
+    LodAdjacency* adjacencies[3] = {&adj, &posAdj, &triAdj};
+    for (int i = 0; i < 3; i++)
+    {
+        adjacencies[i]->offsets = (unsigned int*)malloc((numVertices + 1) * sizeof(unsigned int));
+        adjacencies[i]->targets = (unsigned int*)malloc(numIndices * sizeof(unsigned int));
+    }
+    lodBuildAdjacency(&adj, destination, numIndices, NULL, numVertices);
+    lodBuildAdjacency(&posAdj, destination, numIndices, remap, numVertices);
+
+    // classify vertices by their open edges
+    unsigned char* kind = (unsigned char*)malloc(numVertices);
+    unsigned int* openOut = (unsigned int*)calloc(numVertices, sizeof(unsigned int));
+    unsigned int* openIn = (unsigned int*)calloc(numVertices, sizeof(unsigned int));
+    unsigned char* hasBorder = (unsigned char*)calloc(numVertices, 1);
+    for (unsigned int a = 0; a < numVertices; a++)
+        for (unsigned int i = adj.offsets[a]; i < adj.offsets[a + 1]; i++)
+        {
+            unsigned int b = adj.targets[i];
+            if (lodHasEdge(&adj, b, a)) continue;
+            openOut[a]++;
+            openIn[b]++;
+            if (!lodHasEdge(&posAdj, remap[b], remap[a])) hasBorder[a] = hasBorder[b] = 1;
+        }
+    for (unsigned int v = 0; v < numVertices; v++)
+    {
+        int wedges = 1;
+        for (unsigned int w = wedge[v]; w != v; w = wedge[w]) wedges++;
+        bool single = openOut[v] == 1 && openIn[v] == 1;
+        if (openOut[v] == 0 && openIn[v] == 0) kind[v] = wedges == 1 ? LOD_VERTEX_MANIFOLD : LOD_VERTEX_LOCKED;
+        else if (wedges == 1 && single) kind[v] = LOD_VERTEX_BORDER;
+        else if (wedges == 2 && single && !hasBorder[v] && !hasBorder[wedge[v]] &&
+                 openOut[wedge[v]] == 1 && openIn[wedge[v]] == 1) kind[v] = LOD_VERTEX_SEAM;
+        else kind[v] = LOD_VERTEX_LOCKED;
+    }
+    free(openOut);
+    free(openIn);
+    free(hasBorder);
+
+    // quadrics per position: triangle planes weighted by area, plus planes that hold open edges in place
+    LodQuadric* quadrics = (LodQuadric*)calloc(numVertices, sizeof(LodQuadric));
+    for (unsigned int i = 0; i < numIndices; i += 3)
+    {
+        glm::dvec3 p0 = positions[destination[i]], p1 = positions[destination[i + 1]], p2 = positions[destination[i + 2]];
+        glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+        double area = glm::length(n);
+        if (area == 0.0) continue;
+        n /= area;
+        LodQuadric q = lodQuadricPlane(n, -glm::dot(n, p0), area * 0.5);
+        for (int k = 0; k < 3; k++) lodQuadricAdd(&quadrics[remap[destination[i + k]]], q);
+
+        for (int e = 0; e < 3; e++)
+        {
+            unsigned int a = destination[i + e], b = destination[i + (e + 1) % 3];
+            if (lodHasEdge(&adj, b, a)) continue;
+            glm::dvec3 pa = positions[a], pb = positions[b];
+            glm::dvec3 edge = pb - pa;
+            double length = glm::length(edge);
+            if (length == 0.0) continue;
+            glm::dvec3 en = glm::normalize(glm::cross(edge, n));
+            LodQuadric eq = lodQuadricPlane(en, -glm::dot(en, pa), length * LOD_BORDER_WEIGHT);
+            lodQuadricAdd(&quadrics[remap[a]], eq);
+            lodQuadricAdd(&quadrics[remap[b]], eq);
+        }
+    }
+
+    unsigned int* collapseRemap = (unsigned int*)malloc(numVertices * sizeof(unsigned int));
+    unsigned char* collapseLocked = (unsigned char*)malloc(numVertices);
+    LodCollapse* collapses = (LodCollapse*)malloc(numIndices * 2 * sizeof(LodCollapse));
+    const double maxCost = (double)maxError * maxError;
+    double resultCost = 0.0;
+    unsigned int count = numIndices;
+
+    while (count > targetIndexCount)
+    {
+        lodBuildAdjacency(&adj, destination, count, NULL, numVertices);
+        lodBuildAdjacency(&posAdj, destination, count, remap, numVertices);
+        lodBuildTriangleAdjacency(&triAdj, destination, count, remap, numVertices);
+
+        // the twin of a seam vertex collapsing towards `to`: the wedge of `to` next to the twin
+        auto seamTwinTarget = [&](unsigned int from, unsigned int to) -> unsigned int {
+            unsigned int twin = wedge[from];
+            for (unsigned int w = wedge[to]; w != to; w = wedge[w])
+                if (lodHasEdge(&adj, twin, w) || lodHasEdge(&adj, w, twin)) return w;
+            return ~0u;
+        };
+
+        // rank every allowed collapse along every edge direction
+        unsigned int numCollapses = 0;
+        for (unsigned int i = 0; i < count; i += 3)
+            for (int e = 0; e < 3; e++)
+                for (int dir = 0; dir < 2; dir++)
+                {
+                    unsigned int from = destination[i + (dir ? (e + 1) % 3 : e)];
+                    unsigned int to = destination[i + (dir ? e : (e + 1) % 3)];
+                    if (remap[from] == remap[to]) continue;
+
+                    bool allowed = false;
+                    if (kind[from] == LOD_VERTEX_MANIFOLD) allowed = true;
+                    else if (kind[from] == LOD_VERTEX_BORDER)
+                        allowed = !lodHasEdge(&posAdj, remap[to], remap[from]) || !lodHasEdge(&posAdj, remap[from], remap[to]);
+                    else if (kind[from] == LOD_VERTEX_SEAM)
+                        allowed = (kind[to] == LOD_VERTEX_SEAM || kind[to] == LOD_VERTEX_LOCKED) &&
+                                  (!lodHasEdge(&adj, to, from) || !lodHasEdge(&adj, from, to)) &&
+                                  seamTwinTarget(from, to) != ~0u;
+                    if (!allowed) continue;
+
+                    LodQuadric q = quadrics[remap[from]];
+                    lodQuadricAdd(&q, quadrics[remap[to]]);
+                    collapses[numCollapses++] = {from, to, (float)lodQuadricError(q, positions[to])};
+                }
+        std::sort(collapses, collapses + numCollapses, [](const LodCollapse& a, const LodCollapse& b) { return a.cost < b.cost; });
+
+        for (unsigned int v = 0; v < numVertices; v++) collapseRemap[v] = v;
+        memset(collapseLocked, 0, numVertices);
+
+        // a collapse removes about two triangles; don't overshoot the target within one pass
+        unsigned int budget = (count - targetIndexCount) / 6 + 1;
+        unsigned int applied = 0;
+        for (unsigned int c = 0; c < numCollapses && applied < budget; c++)
+        {
+            const LodCollapse& collapse = collapses[c];
+            if (collapse.cost > maxCost) break;
+            unsigned int rf = remap[collapse.from], rt = remap[collapse.to];
+            if (collapseLocked[rf] || collapseLocked[rt]) continue;
+
+            // reject collapses that flip a triangle around the moving position
+            bool flips = false;
+            glm::vec3 target = positions[collapse.to];
+            for (unsigned int t = triAdj.offsets[rf]; t < triAdj.offsets[rf + 1] && !flips; t++)
+            {
+                unsigned int i = triAdj.targets[t];
+                unsigned int r0 = remap[destination[i]], r1 = remap[destination[i + 1]], r2 = remap[destination[i + 2]];
+                if (r0 != rf && r1 != rf && r2 != rf) continue;
+                if (r0 == rt || r1 == rt || r2 == rt) continue;
+                glm::vec3 p0 = positions[destination[i]], p1 = positions[destination[i + 1]], p2 = positions[destination[i + 2]];
+                glm::vec3 n0 = glm::cross(p1 - p0, p2 - p0);
+                if (r0 == rf) p0 = target;
+                if (r1 == rf) p1 = target;
+                if (r2 == rf) p2 = target;
+                glm::vec3 n1 = glm::cross(p1 - p0, p2 - p0);
+                flips = glm::dot(n0, n1) <= 0.0f;
+            }
+            if (flips) continue;
+
+            collapseRemap[collapse.from] = collapse.to;
+            if (kind[collapse.from] == LOD_VERTEX_SEAM)
+                collapseRemap[wedge[collapse.from]] = seamTwinTarget(collapse.from, collapse.to);
+            lodQuadricAdd(&quadrics[rt], quadrics[rf]);
+            collapseLocked[rf] = collapseLocked[rt] = 1;
+            resultCost = glm::max(resultCost, (double)collapse.cost);
+            applied++;
+        }
+        if (applied == 0) break;
+
+        // redirect collapsed vertices and drop the triangles that became degenerate
+        unsigned int written = 0;
+        for (unsigned int i = 0; i < count; i += 3)
+        {
+            unsigned int a = collapseRemap[destination[i]], b = collapseRemap[destination[i + 1]], c = collapseRemap[destination[i + 2]];
+            if (remap[a] == remap[b] || remap[b] == remap[c] || remap[a] == remap[c]) continue;
+            destination[written++] = a;
+            destination[written++] = b;
+            destination[written++] = c;
+        }
+        count = written;
+    }
+
+    *outError = (float)sqrt(resultCost) * extent;
+
+    free(positions);
+    free(remap);
+    free(wedge);
+    for (int i = 0; i < 3; i++)
+    {
+        free(adjacencies[i]->offsets);
+        free(adjacencies[i]->targets);
+    }
+    free(kind);
+    free(quadrics);
+    free(collapseRemap);
+    free(collapseLocked);
+    free(collapses);
+    return count;
+}
+
+// Builds up to maxLevels LODs, each simplified from the previous one. Returns a malloc'd index
+// buffer holding all levels back to back (level 0 is the input) and fills lods/numLods.
+unsigned int* lodBuildChain(const unsigned int* indices, unsigned int numIndices,
+                            const float* positions, size_t stride, unsigned int numVertices,
+                            int maxLevels, MeshLod* lods, int* numLods, unsigned int* totalIndices)
+{
+    if (maxLevels > LOD_MAX_LEVELS) maxLevels = LOD_MAX_LEVELS;
+    unsigned int capacity = numIndices * (maxLevels > 1 ? 2 : 1);
+    unsigned int* chain = (unsigned int*)malloc(capacity * sizeof(unsigned int));
+    memcpy(chain, indices, numIndices * sizeof(unsigned int));
+    lods[0] = {0, numIndices, 0.0f};
+    *numLods = 1;
+    unsigned int total = numIndices;
+
+    unsigned int* scratch = (unsigned int*)malloc(numIndices * sizeof(unsigned int));
+    for (int level = 1; level < maxLevels; level++)
+    {
+        const MeshLod& prev = lods[level - 1];
+        unsigned int target = (unsigned int)(prev.indexCount / 3 * LOD_REDUCTION) * 3;
+        float error;
+        unsigned int count = lodSimplify(scratch, chain + prev.indexOffset, prev.indexCount, positions, stride, numVertices,
+                                         target, LOD_MAX_ERROR, &error);
+        if (prev.indexCount - count < (prev.indexCount - target) * LOD_MIN_REDUCTION || count == 0) break;
+
+        if (total + count > capacity)
+        {
+            capacity = (total + count) * 2;
+            chain = (unsigned int*)realloc(chain, capacity * sizeof(unsigned int));
+        }
+        memcpy(chain + total, scratch, count * sizeof(unsigned int));
+        lods[level] = {total, count, glm::max(error, prev.error)};
+        total += count;
+        (*numLods)++;
+    }
+    free(scratch);
+    *totalIndices = total;
+    return chain;
+}
+
+struct LodSelection {
+    int level;
+};
+
+// Screen pixels covered by one object-space unit at the given distance.
+float lodPixelsPerUnit(float distance, float fovY, float screenHeight, float objectScale)
+{
+    distance = glm::max(distance, 1e-3f);
+    return objectScale * screenHeight / (2.0f * tanf(fovY * 0.5f) * distance);
+}
+
+// Picks the coarsest level whose error projects below LOD_PIXEL_ERROR. Moving to a coarser level
+// needs an extra LOD_HYSTERESIS margin, moving back to a finer one happens as soon as the current
+// level is over the limit.
+int lodSelect(LodSelection* selection, const float* levelErrors, int numLevels, float pixelsPerUnit)
+{
+    int level = selection->level < numLevels ? selection->level : numLevels - 1;
+    while (level > 0 && levelErrors[level] * pixelsPerUnit > LOD_PIXEL_ERROR)
+        level--;
+    while (level + 1 < numLevels && levelErrors[level + 1] * pixelsPerUnit < LOD_PIXEL_ERROR * (1.0f - LOD_HYSTERESIS))
+        level++;
+    selection->level = level;
+    return level;
+}
+
+#endif
@@ -4,9 +4,33 @@
 #include "light.hpp"
 #include "mesh.hpp"
 #include "model.hpp"
+#include "materials.hpp"
+#include "hotreload.hpp"
+#include "profiler.hpp"
+#include "benchmark.hpp"
+#include "gputimer.hpp"
+#include "renderstats.hpp"
+#include "statsoverlay.hpp"
+#include "framepacing.hpp"
+#include "timestep.hpp"
+#include "jobs.hpp"
+#include "transforms.hpp"
+#include "frustum.hpp"
+#include "meshlet.hpp"
+#include "shadows.hpp"
+#include "shadowatlas.hpp"
+#include "oit.hpp"
+#include "vegetation.hpp"
+#include "environment.hpp"
+#include "occlusion.hpp"
+#include "bvh.hpp"
+#include "octree.hpp"
+#include "streaming.hpp"
 #include <GLFW/glfw3.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
+#include <float.h>
 #include "../thirdparty/glm/gtc/type_ptr.hpp"
 
 // TODO: Find better way to force NVIDIA GPU
@@ -22,6 +46,14 @@ extern "C" {
 #define WINDOW_HEIGHT 900
 #define WINDOW_TITLE "Hello World"
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+#define PROFILE_CAPTURE_FRAMES 10 // frames written per profiler capture (F1)
+#define MAX_FRAMES_IN_FLIGHT 2
+#define SIM_TICK_RATE 60.0          // simulation ticks per second
+#define SIM_MAX_TICKS_PER_FRAME 8
+#define EXPOSURE_RATE 0.06f         // exposure change per second while Q/E is held
+#define BENCH_JOBS_COUNT 100000     // empty jobs per run of --bench-jobs
+#define GRASS_INSTANCES 262144      // grass cards scattered over the floor
+#define CAMERA_COLLISION_RADIUS 0.2f // closest the camera gets to a surface
 
 float deltaTime = 0.0f;	// time between current frame and last frame
 float lastFrame = 0.0f;
@@ -36,6 +68,51 @@ bool sRGB = true;
 
 // lighting
 glm::vec3 lightColor(0.6f, 0.6f, 0.6f);
+const glm::vec3 orbitLightOrigin = glm::vec3( 0.7f,  0.2f,  2.0f);
+
+// simulation: everything that moves is advanced at SIM_TICK_RATE and interpolated for rendering
+struct SceneState {
+    glm::vec3 cameraPosition;
+    glm::vec3 orbitLightPosition;
+    double time;
+};
+FixedTimestep simClock;
+SceneState simPrevious;
+SceneState simCurrent;
+
+// hot reload
+HotReload hotReload;
+
+// render statistics overlay (F2)
+StatsOverlay statsOverlay;
+bool showStats = false;
+
+// frame pacing: F3 vsync mode, F4 frame cap, F5 frames in flight
+FramePacing framePacing;
+const double frameCaps[] = {0.0, 30.0, 60.0, 120.0, 144.0};
+int frameCapIndex = 0;
+
+// software occlusion culling of crates and the backpack (F6)
+OcclusionBuffer occlusion;
+bool occlusionCulling = true;
+
+// ids of scene objects in ray hits and octree queries
+enum SceneObject_Types {
+    SCENE_OBJECT_CRATE,
+    SCENE_OBJECT_FLOOR,
+    SCENE_OBJECT_BACKPACK,
+    SCENE_OBJECT_LIGHT,
+    SCENE_OBJECT_MAX
+};
+const char* g_scene_object_str[SCENE_OBJECT_MAX] = {"crate", "floor", "backpack", "light"};
+#define SCENE_OBJECT_ID(type, index) ((type) << 16 | (index))
+#define SCENE_OBJECT_TYPE(id) ((id) >> 16)
+#define SCENE_OBJECT_INDEX(id) ((id) & 0xffff)
+
+// CPU ray queries over the static scene: camera collision and picking (F7)
+BvhScene rayScene;
+
+#define SCENE_OCTREE_HALF_SIZE 64.0f // objects outside stay correct, they just all land in the root
 
 bool hdr = true;
 bool hdrKeyPressed = false;
@@ -48,20 +125,17 @@ static void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 
 void processInput(GLFWwindow *window)
 {
+    PROFILE_ZONE("processInput");
     static bool lKeyPressedLastFrame = false;
+    static bool f1KeyPressedLastFrame = false;
+    static bool f2KeyPressedLastFrame = false;
+    static bool pacingKeysPressedLastFrame[3] = {false, false, false};
+    static bool f6KeyPressedLastFrame = false;
+    static bool f7KeyPressedLastFrame = false;
 
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
 
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-        ProcessKeyboard(camera,FORWARD, deltaTime);
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-        ProcessKeyboard(camera,BACKWARD, deltaTime);
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-        ProcessKeyboard(camera,LEFT, deltaTime);
-    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-        ProcessKeyboard(camera,RIGHT, deltaTime);
-    
     bool lKeyCurrentlyPressed = glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS;
     if (lKeyCurrentlyPressed && !lKeyPressedLastFrame)
     {
@@ -69,6 +143,61 @@ void processInput(GLFWwindow *window)
     }
     lKeyPressedLastFrame = lKeyCurrentlyPressed;
 
+    bool f1KeyCurrentlyPressed = glfwGetKey(window, GLFW_KEY_F1) == GLFW_PRESS;
+    if (f1KeyCurrentlyPressed && !f1KeyPressedLastFrame)
+    {
+        PROFILE_CAPTURE(PROFILE_CAPTURE_FRAMES);
+    }
+    f1KeyPressedLastFrame = f1KeyCurrentlyPressed;
+
+    bool f2KeyCurrentlyPressed = glfwGetKey(window, GLFW_KEY_F2) == GLFW_PRESS;
+    if (f2KeyCurrentlyPressed && !f2KeyPressedLastFrame)
+    {
+        showStats = !showStats;
+    }
+    f2KeyPressedLastFrame = f2KeyCurrentlyPressed;
+
+    const int pacingKeys[3] = {GLFW_KEY_F3, GLFW_KEY_F4, GLFW_KEY_F5};
+    for (int i = 0; i < 3; i++)
+    {
+        bool pressed = glfwGetKey(window, pacingKeys[i]) == GLFW_PRESS;
+        if (pressed && !pacingKeysPressedLastFrame[i])
+        {
+            if (i == 0) framePacingCycleVsync(&framePacing);
+            if (i == 1)
+            {
+                frameCapIndex = (frameCapIndex + 1) % ARRAY_SIZE(frameCaps);
+                framePacing.targetFps = frameCaps[frameCapIndex];
+            }
+            if (i == 2) framePacing.maxFramesInFlight = framePacing.maxFramesInFlight % FRAME_PACING_MAX_IN_FLIGHT + 1;
+
+            char mode[128];
+            framePacingDescribe(&framePacing, mode, sizeof(mode));
+            printf("Frame pacing: %s\n", mode);
+            benchmarkReset(&g_benchmark); // measure each mode on its own
+        }
+        pacingKeysPressedLastFrame[i] = pressed;
+    }
+
+    bool f6KeyCurrentlyPressed = glfwGetKey(window, GLFW_KEY_F6) == GLFW_PRESS;
+    if (f6KeyCurrentlyPressed && !f6KeyPressedLastFrame)
+    {
+        occlusionCulling = !occlusionCulling;
+        printf("Occlusion culling: %s\n", occlusionCulling ? "on" : "off");
+    }
+    f6KeyPressedLastFrame = f6KeyCurrentlyPressed;
+
+    bool f7KeyCurrentlyPressed = glfwGetKey(window, GLFW_KEY_F7) == GLFW_PRESS;
+    if (f7KeyCurrentlyPressed && !f7KeyPressedLastFrame)
+    {
+        BvhHit hit;
+        if (bvhSceneIntersect(&rayScene, camera.Position, camera.Front, 100.0f, &hit))
+            printf("Pick: %s %d, triangle %d at %.2f\n", g_scene_object_str[SCENE_OBJECT_TYPE(hit.instance)], SCENE_OBJECT_INDEX(hit.instance), hit.primitive, hit.t);
+        else
+            printf("Pick: nothing\n");
+    }
+    f7KeyPressedLastFrame = f7KeyCurrentlyPressed;
+
     if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS && !hdrKeyPressed)
     {
         hdr = !hdr;
@@ -78,19 +207,55 @@ void processInput(GLFWwindow *window)
     {
         hdrKeyPressed = false;
     }
+}
+
+// One fixed simulation step: held keys and scene animation. Toggles stay in processInput.
+void simulateTick(GLFWwindow *window, float dt)
+{
+    PROFILE_ZONE("simulateTick");
+    simPrevious = simCurrent;
+
+    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+        ProcessKeyboard(camera,FORWARD, dt);
+    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+        ProcessKeyboard(camera,BACKWARD, dt);
+    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
+        ProcessKeyboard(camera,LEFT, dt);
+    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+        ProcessKeyboard(camera,RIGHT, dt);
+
+    // stop short of anything in the way, then slide along it with what is left of the move
+    glm::vec3 from = simCurrent.cameraPosition;
+    glm::vec3 move = camera.Position - from;
+    float distance = glm::length(move);
+    BvhHit hit;
+    if (distance > 0.0f && bvhSceneIntersect(&rayScene, from, move / distance, distance + CAMERA_COLLISION_RADIUS, &hit))
+    {
+        float travelled = glm::max(hit.t - CAMERA_COLLISION_RADIUS, 0.0f);
+        camera.Position = from + move / distance * travelled;
+        glm::vec3 rest = move * (1.0f - travelled / distance);
+        glm::vec3 slide = rest - hit.normal * glm::dot(rest, hit.normal);
+        float slideDistance = glm::length(slide);
+        if (slideDistance > 0.0f && !bvhSceneOccluded(&rayScene, camera.Position, slide / slideDistance, slideDistance + CAMERA_COLLISION_RADIUS))
+            camera.Position += slide;
+    }
 
     if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
     {
         if (exposure > 0.0f)
-            exposure -= 0.001f;
+            exposure -= EXPOSURE_RATE * dt;
         else
             exposure = 0.0f;
     }
     else if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
     {
-        exposure += 0.001f;
+        exposure += EXPOSURE_RATE * dt;
     }
-    
+
+    simCurrent.time += dt;
+    simCurrent.cameraPosition = camera.Position;
+    const glm::mat4 rot = glm::rotate(glm::mat4(1.0f), (float)simCurrent.time, glm::vec3(0.0f,1.0f,0.0f));
+    simCurrent.orbitLightPosition = rot * glm::vec4(orbitLightOrigin, 1.0f);
 }
 
 void mouse_callback(GLFWwindow* window, double xposIn, double yposIn)
@@ -119,30 +284,110 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
     ProcessMouseScroll(camera, static_cast<float>(yoffset));
 }
 
+Light makePointLight(const glm::vec3& position, const glm::vec3& lightColor) {
+    Light point = {
+        .type = LIGHT_TYPE_POINT,
+        .position = position,
+        .ambient = glm::vec3(0.0f),
+        .diffuse = lightColor,
+        .specular = glm::vec3(1.0f),
+        .constant = 0.0f,
+        .linear = 0.0f,
+        .quadratic = 1.0f
+    };
+    return point;
+}
+
 void setupLightsForShader(const Shader& shader, const Light& dirLight, const Light spotLight, const glm::vec3& lightColor, const glm::vec3* pointLightPositions, int pointLightCount) {
+    PROFILE_ZONE("setupLights");
     useShader(shader);
     setLight("dirLight", dirLight, shader);
     setLight("spotLight", spotLight, shader);
     for (int i = 0; i < pointLightCount; i++) {
-        Light point = {
-            .type = LIGHT_TYPE_POINT,
-            .position = pointLightPositions[i],
-            .ambient = glm::vec3(0.0f),
-            .diffuse = lightColor,
-            .specular = glm::vec3(1.0f),
-            .constant = 0.0f,
-            .linear = 0.0f,
-            .quadratic = 1.0f
-        };
+        Light point = makePointLight(pointLightPositions[i], lightColor);
         std::string name = "pointLights[" + std::to_string(i) + "]";
         setLight(name.c_str(), point, shader);
     }
     useShader({0});
 }
 
-int main(void)
+int main(int argc, char** argv)
 {
     GLFWwindow* window;
+    PROFILE_THREAD_NAME("main");
+    jobsInit();
+    size_t streamingCpuBudget = STREAMING_CPU_BUDGET;
+    size_t streamingGpuBudget = STREAMING_GPU_BUDGET;
+    bool allowBindless = true;
+
+    // command line benchmarks and tools run without a window and exit
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--cpu-budget-mb") == 0 && i + 1 < argc)
+            streamingCpuBudget = (size_t)atoi(argv[++i]) << 20;
+        else if (strcmp(argv[i], "--gpu-budget-mb") == 0 && i + 1 < argc)
+            streamingGpuBudget = (size_t)atoi(argv[++i]) << 20;
+        else if (strcmp(argv[i], "--no-bindless") == 0)
+            allowBindless = false; // material tables pack texture arrays instead
+        if (strcmp(argv[i], "--pack-assets") == 0)
+        {
+            const char* roots[] = {"assets", "shaders"};
+            bool packed = vfsBuildPack(i + 1 < argc ? argv[i + 1] : VFS_DEFAULT_PACK, roots, ARRAY_SIZE(roots));
+            jobsShutdown();
+            return packed ? 0 : 1;
+        }
+        if (strcmp(argv[i], "--bench-jobs") == 0)
+        {
+            jobsMicroBenchmark(BENCH_JOBS_COUNT);
+            jobsShutdown();
+            return 0;
+        }
+        if (strcmp(argv[i], "--bench-transforms") == 0)
+        {
+            transformsBenchmark();
+            jobsShutdown();
+            return 0;
+        }
+        if (strcmp(argv[i], "--bench-meshcodec") == 0)
+        {
+            meshCodecBenchmark();
+            jobsShutdown();
+            return 0;
+        }
+        if (strcmp(argv[i], "--bench-occlusion") == 0)
+        {
+            occlusionBenchmark();
+            jobsShutdown();
+            return 0;
+        }
+        if (strcmp(argv[i], "--test-occlusion") == 0)
+        {
+            bool passed = occlusionSelfTest();
+            jobsShutdown();
+            return passed ? 0 : 1;
+        }
+        if (strcmp(argv[i], "--bench-bvh") == 0)
+        {
+            bvhBenchmarkModel(i + 1 < argc ? argv[i + 1] : "assets/models/backpack/backpack.obj");
+            jobsShutdown();
+            return 0;
+        }
+        if (strcmp(argv[i], "--bench-octree") == 0)
+        {
+            octreeBenchmark();
+            jobsShutdown();
+            return 0;
+        }
+        if (strcmp(argv[i], "--bench-meshopt") == 0)
+        {
+            meshOptReport(i + 1 < argc ? argv[i + 1] : "assets/models/backpack/backpack.obj");
+            jobsShutdown();
+            return 0;
+        }
+    }
+
+    // a shipped build loads everything from the pack, a development tree has none and reads loose files
+    vfsMount(VFS_DEFAULT_PACK);
 
     if (!glfwInit())
         return -1;
@@ -278,18 +523,31 @@ int main(void)
         printf("ERROR::FRAMEBUFFER:: Framebuffer is not complete! (%s:%d)\n", __FILE__, __LINE__);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
+    WeightedBlendedOIT oit;
+    oitInit(&oit, WINDOW_WIDTH, WINDOW_HEIGHT, 4, rbo);
+
     // Create Shaders
     Shader model_shader = createShaderFromFile("shaders/vertex.glsl","shaders/fragment.glsl");
     Shader light_shader = createShaderFromFile("shaders/vertex.glsl","shaders/light_frag.glsl");
     Shader skybox_shader = createShaderFromFile("shaders/cubemap_vertex.glsl","shaders/cubemap_frag.glsl");
     Shader window_shader = createShaderFromFile("shaders/vertex.glsl","shaders/window.glsl");
     Shader screen_shader = createShaderFromFile("shaders/screen_vertex.glsl","shaders/screen_frag.glsl");
-    // Create Textures
-    Texture crate = createTextureFromFile("container2.png", "assets/textures",TEXTURE_DIFFUSE,true);
-    Texture crate_specular = createTextureFromFile("container2_specular.png", "assets/textures", TEXTURE_SPECULAR, true);
-    Texture grass[] = {createTextureFromFile("grass.png", "assets/textures",TEXTURE_DIFFUSE, true)};
-    Texture wood_floor[] = {createTextureFromFile("wood.png", "assets/textures",TEXTURE_DIFFUSE, true), createSingleColorTexture(TEXTURE_SPECULAR, {150,150,150})};
-    Texture window_red[] = {createTextureFromFile("blending_transparent_window.png", "assets/textures",TEXTURE_DIFFUSE, true)};
+    Shader grass_shader = createShaderFromFile("shaders/vegetation_vertex.glsl","shaders/vegetation_frag.glsl");
+    materialsInit(allowBindless);
+    // Create Textures: placeholders now, the images stream in by priority once the loop runs
+    Streaming streaming;
+    streamingInit(&streaming, streamingCpuBudget, streamingGpuBudget);
+    Texture crate, crate_specular;
+    Texture grass[1];
+    Texture wood_floor[] = {{0}, createSingleColorTexture(TEXTURE_SPECULAR, {150,150,150})};
+    Texture window_red[1];
+    StreamAsset* crateAssets[] = {
+        streamingAddTexture(&streaming, &crate, "container2.png", "assets/textures", TEXTURE_DIFFUSE, true),
+        streamingAddTexture(&streaming, &crate_specular, "container2_specular.png", "assets/textures", TEXTURE_SPECULAR, true),
+    };
+    StreamAsset* grassAsset = streamingAddTexture(&streaming, &grass[0], "grass.png", "assets/textures", TEXTURE_DIFFUSE, true);
+    StreamAsset* floorAsset = streamingAddTexture(&streaming, &wood_floor[0], "wood.png", "assets/textures", TEXTURE_DIFFUSE, true);
+    StreamAsset* windowAsset = streamingAddTexture(&streaming, &window_red[0], "blending_transparent_window.png", "assets/textures", TEXTURE_DIFFUSE, true);
     Texture cubeTextures[] = {
         { crate},
         { crate_specular}
@@ -305,14 +563,21 @@ int main(void)
         "assets/skyboxes/skybox/back.jpg"
     };
 
-    unsigned int cubemapTexture = loadCubemap(faces);
+    unsigned int cubemapTexture;
+    StreamAsset* skyAsset = streamingAddCubemap(&streaming, &cubemapTexture, faces);
     useShader(skybox_shader);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
         setInt(skybox_shader, "skybox", 0);
     useShader({0});
-    
 
-    Model* model_bag = ModelInit("assets/models/backpack/backpack.obj");
+    // built from the sky once it is resident, no ambient or reflections until then
+    EnvironmentLighting environment = {};
+    bool environmentReady = false;
+
+    Model* model_bag = ModelCreateEmpty("assets/models/backpack/backpack.obj", LOD_MAX_LEVELS);
+    StreamAsset* backpackAsset = streamingAddModel(&streaming, model_bag, "assets/models/backpack/backpack.obj");
+    LodSelection backpackLod = {0};
+    MeshletRenderer meshletRenderer;
+    meshletRendererInit(&meshletRenderer);
 
     // Meshs Data
     Vertex cubeVertices[] = {
@@ -465,6 +730,13 @@ int main(void)
         1
     );
 
+    // crates, floor and windows sample their streamed textures through one material table (materials.hpp),
+    // so their draws only differ in the uniforms of the object
+    MaterialTable sceneMaterials = MaterialTable();
+    cubeMesh.material = materialsAddBound(&sceneMaterials, &crate, &crate_specular);
+    quadFloor.material = materialsAddBound(&sceneMaterials, &wood_floor[0], &wood_floor[1]);
+    quadWindow.material = materialsAddBound(&sceneMaterials, &window_red[0], NULL);
+
     // Transformations
     glm::vec3 cubePositions[] = {
         glm::vec3( 0.0f,  0.0f,  0.0f), 
@@ -486,6 +758,28 @@ int main(void)
         glm::vec3( 0.0f,  0.0f, -3.0f),
     };
 
+    // Object transforms, composed by transformsUpdate only when they change
+    TransformStore sceneTransforms;
+    transformStoreInit(&sceneTransforms, 32);
+    int crateTransforms[ARRAY_SIZE(cubePositions)];
+    for (unsigned int i = 0; i < ARRAY_SIZE(cubePositions); i++)
+    {
+        float angle = 20.0f * i;
+        crateTransforms[i] = transformAdd(&sceneTransforms, cubePositions[i],
+            glm::angleAxis(glm::radians(angle), glm::normalize(glm::vec3(1.0f, 0.3f, 0.5f))), glm::vec3(0.5f));
+    }
+    int lightTransforms[ARRAY_SIZE(pointLightPositions)];
+    for (unsigned int i = 0; i < ARRAY_SIZE(pointLightPositions); i++)
+        lightTransforms[i] = transformAdd(&sceneTransforms, pointLightPositions[i], glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(0.1f)); // Make it a smaller cube
+    int floorTransform = transformAdd(&sceneTransforms, glm::vec3(0,-4,0),
+        glm::angleAxis(glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f)), glm::vec3(30.0f, 30.0f, 0.1f));
+    int backpackTransform = transformAdd(&sceneTransforms, glm::vec3( 2.0f,  2.0f,  3.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(1.0f));
+    // overlapping panes, drawn in no particular order by the OIT pass
+    int windowTransforms[4];
+    for (unsigned int i = 0; i < ARRAY_SIZE(windowTransforms); i++)
+        windowTransforms[i] = transformAdd(&sceneTransforms, glm::vec3(-1.0f + 0.4f * i, 2.5f, -4.0f - 0.8f * i),
+            glm::angleAxis(glm::radians(75.0f), glm::vec3(1.0f, 0.0f, 0.0f)), glm::vec3(1.0f));
+
     unsigned int uboMatrices;
     glGenBuffers(1, &uboMatrices);
   
@@ -499,7 +793,7 @@ int main(void)
     Light dirLight = {
         .type = LIGHT_TYPE_DIRECTIONAL,
         .direction = glm::vec3(-0.2f, -1.0f, -0.3f),
-        .ambient = glm::vec3(0.01f),
+        .ambient = glm::vec3(0.25f), // scales the sky lighting from the environment
         .diffuse = glm::vec3(0.5f),
         .specular = glm::vec3(0.0f)
     };
@@ -508,8 +802,122 @@ int main(void)
     setVec3(light_shader, "lightColor", glm::value_ptr(lightColor));
     useShader({0});
 
+    // Directional light shadows; the far cascades cache everything but the orbiting light cube
+    CascadedShadows shadows;
+    cascadedShadowsInit(&shadows, CSM_MAX_CASCADES, CSM_DEFAULT_RESOLUTION);
+    Mesh* shadowBagMeshes = model_bag->meshes; // a hot reload swaps the array: static casters changed
+
+    // Point and spot light shadows share an atlas, tiles are only redrawn for lights that move
+    ShadowAtlas shadowAtlas;
+    shadowAtlasInit(&shadowAtlas);
+    int pointShadows[ARRAY_SIZE(pointLightPositions)];
+    for (unsigned int i = 0; i < ARRAY_SIZE(pointLightPositions); i++)
+        pointShadows[i] = shadowAtlasAddLight(&shadowAtlas, LIGHT_TYPE_POINT);
+    int spotShadow = shadowAtlasAddLight(&shadowAtlas, LIGHT_TYPE_SPOT);
+
+    // Grass field over the floor, culled and drawn on the GPU
+    VegetationField grassField;
+    vegetationInit(&grassField, &quadGrass, GRASS_INSTANCES, glm::vec2(-30.0f), glm::vec2(30.0f), -4.0f, 0.15f, 0.3f, 1234u);
+
+    // CPU depth buffer the crates and the floor are rasterized into every frame
+    occlusionInit(&occlusion);
+
+    // model space trees of the static meshes, placed as instances of rayScene
+    Bvh crateBvh, floorBvh;
+    bvhBuildMesh(&crateBvh, &cubeMesh);
+    bvhBuildMesh(&floorBvh, &quadFloor);
+    std::vector<Bvh> backpackBvhs;
+    Mesh* rayBagMeshes = NULL; // a hot reload swaps the array: rebuild the backpack trees
+    auto buildRayScene = [&]() {
+        for (Bvh& bvh : backpackBvhs) bvhDestroy(&bvh);
+        bvhSceneDestroy(&rayScene);
+        transformsUpdate(&sceneTransforms);
+        const glm::mat4* world = sceneTransforms.world;
+        for (unsigned int i = 0; i < ARRAY_SIZE(crateTransforms); i++)
+            bvhSceneAdd(&rayScene, &crateBvh, world[crateTransforms[i]], SCENE_OBJECT_ID(SCENE_OBJECT_CRATE, i));
+        bvhSceneAdd(&rayScene, &floorBvh, world[floorTransform], SCENE_OBJECT_ID(SCENE_OBJECT_FLOOR, 0));
+
+        backpackBvhs.resize(model_bag->numMeshes);
+        for (int i = 0; i < model_bag->numMeshes; i++) bvhBuildMesh(&backpackBvhs[i], &model_bag->meshes[i]);
+        SceneGraph* graph = &model_bag->graph;
+        sceneGraphUpdate(graph);
+        for (int node = 0; node < graph->numNodes; node++)
+            for (int i = 0; i < graph->numMeshes[node]; i++)
+            {
+                int mesh = graph->meshIndices[graph->firstMesh[node] + i];
+                bvhSceneAdd(&rayScene, &backpackBvhs[mesh], world[backpackTransform] * graph->world[node], SCENE_OBJECT_ID(SCENE_OBJECT_BACKPACK, mesh));
+            }
+        bvhSceneBuild(&rayScene);
+        rayBagMeshes = model_bag->meshes;
+    };
+    buildRayScene();
+
+    // Loose octree over the bounding spheres of the crates and the backpack and the ranges of the point
+    // lights: the view frustum query picks what to draw, a sphere query per object the lights it gets
+    Octree sceneOctree;
+    octreeInit(&sceneOctree, glm::vec3(0.0f), SCENE_OCTREE_HALF_SIZE);
+    for (unsigned int i = 0; i < ARRAY_SIZE(crateTransforms); i++)
+    {
+        const glm::mat4& crateWorld = sceneTransforms.world[crateTransforms[i]];
+        octreeInsert(&sceneOctree, glm::vec3(crateWorld[3]), 0.87f * glm::length(glm::vec3(crateWorld[0])),
+                     SCENE_OBJECT_ID(SCENE_OBJECT_CRATE, i));
+    }
+    int lightObjects[ARRAY_SIZE(pointLightPositions)];
+    for (unsigned int i = 0; i < ARRAY_SIZE(pointLightPositions); i++)
+        lightObjects[i] = octreeInsert(&sceneOctree, pointLightPositions[i], lightRange(makePointLight(pointLightPositions[i], lightColor)),
+                                       SCENE_OBJECT_ID(SCENE_OBJECT_LIGHT, i));
+    int backpackObject = octreeInsert(&sceneOctree, glm::vec3(0.0f), 0.0f, SCENE_OBJECT_ID(SCENE_OBJECT_BACKPACK, 0));
+    std::vector<int> visibleObjects, nearbyObjects;
+    // bit i set when point light i reaches the sphere, fragment.glsl skips the others
+    auto pointLightMask = [&](const glm::vec3& center, float radius) {
+        nearbyObjects.clear();
+        octreeQuerySphere(&sceneOctree, center, radius, &nearbyObjects);
+        int mask = 0;
+        for (int id : nearbyObjects)
+            if (SCENE_OBJECT_TYPE(id) == SCENE_OBJECT_LIGHT) mask |= 1 << SCENE_OBJECT_INDEX(id);
+        return mask;
+    };
+
+    // Hot reload: static uniforms set above are re-applied when a program is swapped
+    hotReloadWatchShader(&hotReload, &model_shader, "shaders/vertex.glsl", "shaders/fragment.glsl");
+    hotReloadWatchShader(&hotReload, &light_shader, "shaders/vertex.glsl", "shaders/light_frag.glsl",
+        [](Shader shader) { useShader(shader); setVec3(shader, "lightColor", glm::value_ptr(lightColor)); useShader({0}); });
+    hotReloadWatchShader(&hotReload, &skybox_shader, "shaders/cubemap_vertex.glsl", "shaders/cubemap_frag.glsl",
+        [](Shader shader) { useShader(shader); setInt(shader, "skybox", 0); useShader({0}); });
+    hotReloadWatchShader(&hotReload, &window_shader, "shaders/vertex.glsl", "shaders/window.glsl");
+    hotReloadWatchShader(&hotReload, &grass_shader, "shaders/vegetation_vertex.glsl", "shaders/vegetation_frag.glsl");
+    hotReloadWatchShader(&hotReload, &oit.composite, "shaders/fullscreen_vertex.glsl", "shaders/oit_composite_frag.glsl",
+        [](Shader shader) { useShader(shader); setInt(shader, "accumTexture", 0); setInt(shader, "revealTexture", 1); useShader({0}); });
+    hotReloadWatchShader(&hotReload, &shadows.shader, "shaders/shadow_vertex.glsl", "shaders/shadow_frag.glsl");
+    hotReloadWatchShader(&hotReload, &shadowAtlas.shader, "shaders/shadow_vertex.glsl", "shaders/shadow_frag.glsl");
+    hotReloadWatchShader(&hotReload, &screen_shader, "shaders/screen_vertex.glsl", "shaders/screen_frag.glsl",
+        [](Shader shader) { useShader(shader); setInt(shader, "texture1", 0); useShader({0}); });
+    for (StreamAsset* asset : crateAssets) hotReloadWatchStream(&hotReload, &streaming, asset);
+    hotReloadWatchStream(&hotReload, &streaming, grassAsset);
+    hotReloadWatchStream(&hotReload, &streaming, floorAsset);
+    hotReloadWatchStream(&hotReload, &streaming, windowAsset);
+    hotReloadWatchStream(&hotReload, &streaming, backpackAsset);
+    hotReloadStart(&hotReload);
+
+    GpuTimer gpuTimer;
+    gpuTimerInit(&gpuTimer);
+    framePacingInit(&framePacing, VSYNC_ON, frameCaps[frameCapIndex], MAX_FRAMES_IN_FLIGHT);
+
+    fixedTimestepInit(&simClock, SIM_TICK_RATE, SIM_MAX_TICKS_PER_FRAME);
+    simCurrent.cameraPosition = camera.Position;
+    simCurrent.orbitLightPosition = orbitLightOrigin;
+    simCurrent.time = 0.0;
+    simPrevious = simCurrent;
+    statsOverlayInit(&statsOverlay);
+    bool firstFrame = true;
+
     while (!glfwWindowShouldClose(window))
     {
+        PROFILE_FRAME();
+        PROFILE_ZONE("frame");
+        framePacingBeginFrame(&framePacing);
+        // input is sampled after the pacing waits, so the latency it reports covers what the poll returns
+        glfwPollEvents();
         
         int screen_width, screen_height;
         glfwGetFramebufferSize(window, &screen_width, &screen_height); // TODO: maybe we can do this only when changes happen on the callback
@@ -524,38 +932,145 @@ int main(void)
 
         frameCount++;
         fpsTimer += deltaTime;
+        benchmarkAdd(&g_benchmark, "frame", deltaTime * 1000.0);
 
         if (fpsTimer >= 1.0f) { // Update every second
             float fps = frameCount / fpsTimer;
             printf("FPS: %.2f\n", fps);
+            char mode[128];
+            framePacingDescribe(&framePacing, mode, sizeof(mode));
+            benchmarkReport(&g_benchmark, mode);
+            streamingReport(&streaming);
             frameCount = 0;
             fpsTimer = 0.0f;
         }
 
         processInput(window);
-
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)screen_width / (float)screen_height, 0.1f, 100.0f);
-        glm::mat4 view = GetViewMatrix(camera);
+        hotReloadUpdate(&hotReload);
+
+        int ticks = fixedTimestepAdvance(&simClock, deltaTime);
+        for (int tick = 0; tick < ticks; tick++)
+            simulateTick(window, (float)simClock.step);
+
+        // render between the last two simulated states; mouse look is not simulated and stays immediate
+        const float simAlpha = fixedTimestepAlpha(&simClock);
+        Camera viewCamera = camera;
+        viewCamera.Position = glm::mix(simPrevious.cameraPosition, simCurrent.cameraPosition, simAlpha);
+        pointLightPositions[0] = glm::mix(simPrevious.orbitLightPosition, simCurrent.orbitLightPosition, simAlpha);
+        transformSetPosition(&sceneTransforms, lightTransforms[0], pointLightPositions[0]);
+        transformsUpdate(&sceneTransforms);
+        octreeMove(&sceneOctree, lightObjects[0], pointLightPositions[0], lightRange(makePointLight(pointLightPositions[0], lightColor)));
+
+        // the bounds change with a hot reload of the model
+        const glm::mat4& backpackWorld = sceneTransforms.world[backpackTransform];
+        glm::vec3 backpackCenter = glm::vec3(backpackWorld * glm::vec4(model_bag->boundsCenter, 1.0f));
+        float backpackScale = glm::length(glm::vec3(backpackWorld[0]));
+        float backpackRadius = model_bag->boundsRadius * backpackScale;
+        octreeMove(&sceneOctree, backpackObject, backpackCenter, backpackRadius);
+
+        glm::mat4 projection = glm::perspective(glm::radians(viewCamera.Zoom), (float)screen_width / (float)screen_height, 0.1f, 100.0f);
+        glm::mat4 view = GetViewMatrix(viewCamera);
         glm::mat4 matrices[2] = { projection, view };
+        Frustum viewFrustum = frustumFromMatrix(projection * view);
         glBindBuffer(GL_UNIFORM_BUFFER, uboMatrices);
         glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(matrices), glm::value_ptr(matrices[0]));
+        RENDER_STAT_ADD(RENDER_STAT_BUFFER_BYTES, sizeof(matrices));
         glBindBuffer(GL_UNIFORM_BUFFER, 0);  
-        
-        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glEnable(GL_DEPTH_TEST);
-        glEnable(GL_CULL_FACE);  
-        glCullFace(GL_BACK);  
-        glFrontFace(GL_CCW);
-        
+        if (model_bag->meshes != rayBagMeshes) buildRayScene();
+
+        visibleObjects.clear();
+        octreeQueryFrustum(&sceneOctree, viewFrustum, &visibleObjects);
+
+        {
+            PROFILE_ZONE("streaming");
+            // texel density: the meshes map UV 0 to 1 across their 2 unit sides, so one texture repeat
+            // covers 2 * scale world units, projected at the nearest distance to the camera
+            const float fovY = glm::radians(viewCamera.Zoom);
+            auto uvPixels = [&](float distance, float scale) {
+                return 2.0f * lodPixelsPerUnit(distance, fovY, (float)screen_height, scale);
+            };
+            streamingRequest(&streaming, skyAsset, 0.0f, true);
+
+            float crateDistance = FLT_MAX, cratePixels = 0.0f;
+            bool crateVisible = false;
+            for (unsigned int i = 0; i < ARRAY_SIZE(crateTransforms); i++)
+            {
+                const glm::mat4& crateWorld = sceneTransforms.world[crateTransforms[i]];
+                float distance = glm::distance(viewCamera.Position, glm::vec3(crateWorld[3]));
+                crateDistance = glm::min(crateDistance, distance);
+                if (!crateVisible) cratePixels = glm::max(cratePixels, uvPixels(distance, glm::length(glm::vec3(crateWorld[0]))));
+            }
+            // only crates in view decide the detail once any is in view
+            for (int id : visibleObjects)
+            {
+                if (SCENE_OBJECT_TYPE(id) != SCENE_OBJECT_CRATE) continue;
+                const glm::mat4& crateWorld = sceneTransforms.world[crateTransforms[SCENE_OBJECT_INDEX(id)]];
+                float pixels = uvPixels(glm::distance(viewCamera.Position, glm::vec3(crateWorld[3])), glm::length(glm::vec3(crateWorld[0])));
+                cratePixels = crateVisible ? glm::max(cratePixels, pixels) : pixels;
+                crateVisible = true;
+            }
+            for (StreamAsset* asset : crateAssets) streamingRequest(&streaming, asset, crateDistance, crateVisible, cratePixels);
+
+            const glm::mat4& floorWorld = sceneTransforms.world[floorTransform];
+            glm::vec3 floorCenter = glm::vec3(floorWorld[3]);
+            float floorScale = glm::length(glm::vec3(floorWorld[0]));
+            float floorRadius = 1.42f * floorScale;
+            float floorDistance = glm::distance(viewCamera.Position, floorCenter) - floorRadius;
+            bool floorVisible = frustumTestSphere(viewFrustum, floorCenter, floorRadius);
+            float groundHeight = glm::max(viewCamera.Position.y - floorCenter.y, 0.5f);
+            streamingRequest(&streaming, floorAsset, floorDistance, floorVisible, uvPixels(groundHeight, floorScale));
+            // the nearest cards stand about right below the camera, at the largest scale of the field
+            streamingRequest(&streaming, grassAsset, floorDistance, floorVisible, uvPixels(groundHeight, 0.3f));
+
+            float windowDistance = FLT_MAX, windowPixels = 0.0f;
+            bool windowVisible = false;
+            for (unsigned int i = 0; i < ARRAY_SIZE(windowTransforms); i++)
+            {
+                const glm::mat4& windowWorld = sceneTransforms.world[windowTransforms[i]];
+                glm::vec3 windowCenter = glm::vec3(windowWorld[3]);
+                float windowScale = glm::length(glm::vec3(windowWorld[0]));
+                float distance = glm::distance(viewCamera.Position, windowCenter);
+                windowDistance = glm::min(windowDistance, distance);
+                windowPixels = glm::max(windowPixels, uvPixels(distance, windowScale));
+                windowVisible = windowVisible || frustumTestSphere(viewFrustum, windowCenter, 1.42f * windowScale);
+            }
+            streamingRequest(&streaming, windowAsset, windowDistance, windowVisible, windowPixels);
+
+            bool backpackInView = false;
+            for (int id : visibleObjects)
+                if (SCENE_OBJECT_TYPE(id) == SCENE_OBJECT_BACKPACK) backpackInView = true;
+            streamingRequest(&streaming, backpackAsset, glm::distance(viewCamera.Position, backpackCenter) - backpackRadius, backpackInView);
+
+            streamingUpdate(&streaming);
+            if (environmentReady != streamingResident(skyAsset))
+            {
+                environmentDestroy(&environment);
+                environment = {};
+                if (streamingResident(skyAsset)) environmentInit(&environment, cubemapTexture, faces);
+                environmentReady = streamingResident(skyAsset);
+            }
+        }
+
+        {
+            PROFILE_ZONE("occlusion");
+            occlusionBegin(&occlusion, projection * view);
+            if (occlusionCulling)
+            {
+                const float* crateVertices = &cubeMesh.vertices[0].Position.x;
+                for (unsigned int i = 0; i < ARRAY_SIZE(crateTransforms); i++)
+                    occlusionAddOccluder(&occlusion, crateVertices, sizeof(Vertex), cubeMesh.indices + cubeMesh.lods[0].indexOffset,
+                                         cubeMesh.lods[0].indexCount, sceneTransforms.world[crateTransforms[i]]);
+                occlusionAddOccluder(&occlusion, &quadFloor.vertices[0].Position.x, sizeof(Vertex), quadFloor.indices + quadFloor.lods[0].indexOffset,
+                                     quadFloor.lods[0].indexCount, sceneTransforms.world[floorTransform]);
+                occlusionRasterize(&occlusion);
+            }
+        }
+
         Light spot = {
             .type = LIGHT_TYPE_SPOT,
-            .position = camera.Position,
-            .direction = camera.Front,
+            .position = viewCamera.Position,
+            .direction = viewCamera.Front,
             .ambient = glm::vec3(0.0f),
             .diffuse = glm::vec3(0.0f),
             .specular = glm::vec3(0.0f),
@@ -566,104 +1081,221 @@ int main(void)
             .outerCutOff = glm::cos(glm::radians(15.0f))
         };
 
-        const glm::vec3 OrinalVec = glm::vec3( 0.7f,  0.2f,  2.0f);
-        const glm::mat4 rot = glm::rotate(glm::mat4(1.0f), currentFrame, glm::vec3(0.0f,1.0f,0.0f));
-        pointLightPositions[0] = rot * glm::vec4(OrinalVec, 1.0f);
+        {
+            PROFILE_ZONE("shadows");
+            gpuTimerBegin(&gpuTimer, GPU_PASS_SHADOWS);
+            if (model_bag->meshes != shadowBagMeshes)
+            {
+                cascadedShadowsInvalidate(&shadows);
+                shadowAtlasInvalidate(&shadowAtlas);
+                shadowBagMeshes = model_bag->meshes;
+            }
+            const glm::mat4* world = sceneTransforms.world;
+            // the floor only receives, and grass cards would cast solid squares without alpha testing
+            auto drawStaticCasters = [&](Shader shader, const Frustum& frustum, int lod) {
+                for (unsigned int i = 0; i < ARRAY_SIZE(crateTransforms); i++)
+                {
+                    const glm::mat4& crate = world[crateTransforms[i]];
+                    if (!frustumTestSphere(frustum, glm::vec3(crate[3]), 0.87f * glm::length(glm::vec3(crate[0])))) continue;
+                    setMat4(shader, "model", glm::value_ptr(crate));
+                    drawMeshDepth(&cubeMesh, 0);
+                }
+                if (frustumTestSphere(frustum, backpackCenter, backpackRadius))
+                    DrawModelDepth(model_bag, &shader, backpackWorld, lod);
+            };
+
+            glm::vec4 dynamicCasters[] = { glm::vec4(pointLightPositions[0], 0.87f * glm::length(glm::vec3(world[lightTransforms[0]][0]))) };
+            cascadedShadowsUpdate(&shadows, view, glm::radians(viewCamera.Zoom), (float)screen_width / (float)screen_height, 0.1f,
+                                  dirLight.direction, dynamicCasters, ARRAY_SIZE(dynamicCasters));
+            ShadowPass pass;
+            while (cascadedShadowsNextPass(&shadows, &pass))
+            {
+                if (pass.staticCasters)
+                {
+                    // coarser cascades cover more screen per texel, the coarser LODs hold up there
+                    drawStaticCasters(pass.shader, pass.frustum, pass.cascade);
+                    for (unsigned int i = 1; i < ARRAY_SIZE(lightTransforms); i++)
+                    {
+                        setMat4(pass.shader, "model", glm::value_ptr(world[lightTransforms[i]]));
+                        drawMeshDepth(&cubeMesh, 0);
+                    }
+                }
+                if (pass.dynamicCasters)
+                {
+                    setMat4(pass.shader, "model", glm::value_ptr(world[lightTransforms[0]]));
+                    drawMeshDepth(&cubeMesh, 0);
+                }
+            }
+
+            // point lights sit inside their own cubes, so those never cast into the atlas
+            for (unsigned int i = 0; i < ARRAY_SIZE(pointLightPositions); i++)
+                shadowAtlasSetLight(&shadowAtlas, pointShadows[i], pointLightPositions[i], glm::vec3(0.0f),
+                                    lightRange(makePointLight(pointLightPositions[i], lightColor)));
+            shadowAtlasSetLight(&shadowAtlas, spotShadow, spot.position, spot.direction, lightRange(spot), spot.outerCutOff);
+            shadowAtlasUpdate(&shadowAtlas, viewFrustum, viewCamera.Position, glm::radians(viewCamera.Zoom), (float)screen_height);
+            ShadowTilePass tile;
+            while (shadowAtlasNextPass(&shadowAtlas, &tile))
+                drawStaticCasters(tile.shader, tile.frustum, 0);
+            gpuTimerEnd(&gpuTimer, GPU_PASS_SHADOWS);
+        }
+        
+        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glEnable(GL_DEPTH_TEST);
+        glEnable(GL_CULL_FACE);  
+        glCullFace(GL_BACK);  
+        glFrontFace(GL_CCW);
+        
         setupLightsForShader(model_shader, dirLight, spot, lightColor, pointLightPositions, ARRAY_SIZE(pointLightPositions));
 
+        gpuTimerBegin(&gpuTimer, GPU_PASS_OPAQUE);
         useShader(model_shader);
+        cascadedShadowsBind(&shadows, model_shader, CSM_TEXTURE_UNIT);
+        shadowAtlasBind(&shadowAtlas, model_shader, SHADOW_ATLAS_TEXTURE_UNIT);
+        environmentBind(&environment, model_shader, ENVIRONMENT_TEXTURE_UNIT);
+        for (unsigned int i = 0; i < ARRAY_SIZE(pointLightPositions); i++)
+            shadowAtlasSetUniforms(&shadowAtlas, model_shader, pointShadows[i], "pointShadowMatrices", "pointShadowTiles", i * 6);
+        shadowAtlasSetUniforms(&shadowAtlas, model_shader, spotShadow, "spotShadowMatrices", "spotShadowTiles", 0);
         {
-
-            activateMesh(&cubeMesh, &model_shader);
+            materialsBind(&sceneMaterials);
             // Transformations View/Projection  -------------------------------------
             //------------------------------------------------------------------------
             
-            setVec3(model_shader, "viewPos", glm::value_ptr(camera.Position));
+            setVec3(model_shader, "viewPos", glm::value_ptr(viewCamera.Position));
 
 
-            for(unsigned int i = 0; i < 10; i++)
             {
-                glm::mat4 model = glm::mat4(1.0f);
-                model = glm::translate(model, cubePositions[i]);
-                float angle = 20.0f * i;
-                model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-                // model = glm::rotate(model, currentFrame, glm::vec3(0.0f, 0.0f, 1.0f));
-                model = glm::scale(model, glm::vec3(0.5f));
-                setMat4(model_shader, "model",  glm::value_ptr(model));
-                drawMesh(&cubeMesh, &model_shader);
+                PROFILE_ZONE("draw crates");
+                for (int id : visibleObjects)
+                {
+                    if (SCENE_OBJECT_TYPE(id) != SCENE_OBJECT_CRATE) continue;
+                    int i = SCENE_OBJECT_INDEX(id);
+                    const glm::mat4& crateWorld = sceneTransforms.world[crateTransforms[i]];
+                    glm::vec3 crateCenter = glm::vec3(crateWorld[3]);
+                    float crateRadius = 0.87f * glm::length(glm::vec3(crateWorld[0]));
+                    if (occlusionCulling && !occlusionTestSphere(&occlusion, crateCenter, crateRadius))
+                    {
+                        RENDER_STAT_ADD(RENDER_STAT_OCCLUSION_CULLED, 1);
+                        continue;
+                    }
+                    setInt(model_shader, "pointLightMask", pointLightMask(crateCenter, crateRadius));
+                    setModelMatrices(model_shader, &sceneTransforms, crateTransforms[i]);
+                    drawMesh(&cubeMesh, &model_shader);
+                }
             }
             
             {
-                activateMesh(&quadGrass, &model_shader);
-                glm::mat4 model = glm::mat4(1.0f);
-                model = glm::translate(model, glm::vec3(0,-3.90 + 1.0,0));
-                setMat4(model_shader, "model",  glm::value_ptr(model));
-                drawMesh(&quadGrass, &model_shader);
-            }
-            {
-                activateMesh(&quadFloor, &model_shader);
-                glm::mat4 model = glm::mat4(1.0f);
-                model = glm::translate(model, glm::vec3(0,-4,0));
-                model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-                // model = glm::rotate(model, glm::radians(180.0f), glm::vec3(0.0f, 0.0f, -1.0f));
-                model = glm::scale(model, glm::vec3(30.0f, 30.0f, 0.1f));
-                setMat4(model_shader, "model",  glm::value_ptr(model));
+                PROFILE_ZONE("draw floor");
+                const glm::mat4& floorWorld = sceneTransforms.world[floorTransform];
+                setInt(model_shader, "pointLightMask", pointLightMask(glm::vec3(floorWorld[3]), 1.42f * glm::length(glm::vec3(floorWorld[0]))));
+                setModelMatrices(model_shader, &sceneTransforms, floorTransform);
                 drawMesh(&quadFloor, &model_shader);
             }
         }
+        gpuTimerEnd(&gpuTimer, GPU_PASS_OPAQUE);
+
+        {
+            PROFILE_ZONE("draw grass");
+            gpuTimerBegin(&gpuTimer, GPU_PASS_VEGETATION);
+            vegetationCull(&grassField, viewFrustum, viewCamera.Position);
+            useShader(grass_shader);
+            setLight("dirLight", dirLight, grass_shader);
+            environmentBind(&environment, grass_shader, ENVIRONMENT_TEXTURE_UNIT);
+            vegetationDraw(&grassField, grass_shader, viewCamera.Position, currentFrame);
+            gpuTimerEnd(&gpuTimer, GPU_PASS_VEGETATION);
+        }
             
 
 
         // Point Light Source
 
+        {
+        PROFILE_ZONE("draw light cubes");
+        gpuTimerBegin(&gpuTimer, GPU_PASS_LIGHT_CUBES);
         useShader(light_shader);
             activateMesh(&cubeMesh, &light_shader);
             for (unsigned int i = 0; i < ARRAY_SIZE(pointLightPositions); i++)
             {
-                glm::mat4 model = glm::mat4(1.0f);
-                model = glm::translate(model, pointLightPositions[i]);
-                model = glm::scale(model, glm::vec3(0.1f)); // Make it a smaller cube
-                setMat4(light_shader, "model",  glm::value_ptr(model));
+                setModelMatrices(light_shader, &sceneTransforms, lightTransforms[i]);
                 drawMesh(&cubeMesh, &light_shader);
 
             }
+        gpuTimerEnd(&gpuTimer, GPU_PASS_LIGHT_CUBES);
+        }
 
         {
+            PROFILE_ZONE("draw backpack");
+            gpuTimerBegin(&gpuTimer, GPU_PASS_BACKPACK);
             useShader(model_shader);
-                glm::mat4 model = glm::mat4(1.0f);
-                model = glm::translate(model, glm::vec3( 2.0f,  2.0f,  3.0f));
-                model = glm::scale(model, glm::vec3(1.0f));
-                setMat4(model_shader, "model",  glm::value_ptr(model));
                 setLight("spotLight", spot, model_shader);
+
+                float pixelsPerUnit = lodPixelsPerUnit(glm::distance(backpackCenter, viewCamera.Position), glm::radians(viewCamera.Zoom), (float)screen_height, backpackScale);
+                // nothing to select from until the model has streamed in
+                int lod = model_bag->numLods > 0 ? lodSelect(&backpackLod, model_bag->lodErrors, model_bag->numLods, pixelsPerUnit) : 0;
     
-                DrawModel(model_bag,&model_shader);
+                // full detail is culled per meshlet, coarser levels are small enough to draw whole
+                bool backpackVisible = false;
+                for (int id : visibleObjects)
+                    if (SCENE_OBJECT_TYPE(id) == SCENE_OBJECT_BACKPACK) backpackVisible = model_bag->numMeshes > 0;
+                if (backpackVisible && occlusionCulling && !occlusionTestSphere(&occlusion, backpackCenter, backpackRadius))
+                {
+                    RENDER_STAT_ADD(RENDER_STAT_OCCLUSION_CULLED, 1);
+                    backpackVisible = false;
+                }
+                setInt(model_shader, "pointLightMask", pointLightMask(backpackCenter, backpackRadius));
+                if (backpackVisible && lod == 0)
+                    DrawModelMeshlets(&meshletRenderer, model_bag, &model_shader, backpackWorld, viewFrustum, viewCamera.Position);
+                else if (backpackVisible)
+                    DrawModel(model_bag, &model_shader, backpackWorld, lod);
+            gpuTimerEnd(&gpuTimer, GPU_PASS_BACKPACK);
         }
         
         {
+            PROFILE_ZONE("draw skybox");
+            gpuTimerBegin(&gpuTimer, GPU_PASS_SKYBOX);
             glDepthFunc(GL_LEQUAL);
             useShader(skybox_shader);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
             drawMesh(&skyboxMesh, &skybox_shader);
             glDepthFunc(GL_LESS);
+            gpuTimerEnd(&gpuTimer, GPU_PASS_SKYBOX);
         }
         
         {
+            PROFILE_ZONE("draw transparent");
+            gpuTimerBegin(&gpuTimer, GPU_PASS_TRANSPARENT);
+            oitBegin(&oit);
             useShader(window_shader);
-            glDepthMask(GL_FALSE);
-                activateMesh(&quadWindow, &window_shader);
-                glm::mat4 model = glm::mat4(1.0f);
-                model = glm::translate(model, glm::vec3(-1.0,2.5,-4.0));
-                model = glm::rotate(model, glm::radians(75.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-                setMat4(window_shader, "model",  glm::value_ptr(model));
-                drawMesh(&quadWindow, &window_shader);
-            glDepthMask(GL_TRUE);
+                // the backpack's meshes without a material may have bound over the slots
+                materialsBind(&sceneMaterials);
+                for (unsigned int i = 0; i < ARRAY_SIZE(windowTransforms); i++)
+                {
+                    setModelMatrices(window_shader, &sceneTransforms, windowTransforms[i]);
+                    drawMesh(&quadWindow, &window_shader);
+                }
+            oitComposite(&oit, framebuffer);
+            gpuTimerEnd(&gpuTimer, GPU_PASS_TRANSPARENT);
         }
 
         // 2. now blit multisampled buffer(s) to normal colorbuffer of intermediate FBO. Image is stored in screenTexture
-        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
-        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, intermediateFBO);
-        glBlitFramebuffer(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT, 0, 0, WINDOW_WIDTH, WINDOW_HEIGHT, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        {
+            PROFILE_ZONE("msaa blit");
+            gpuTimerBegin(&gpuTimer, GPU_PASS_MSAA_BLIT);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, intermediateFBO);
+            glBlitFramebuffer(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT, 0, 0, WINDOW_WIDTH, WINDOW_HEIGHT, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+            gpuTimerEnd(&gpuTimer, GPU_PASS_MSAA_BLIT);
+        }
 
         // // now bind back to default framebuffer and draw a quad plane with the attached framebuffer color texture
+        {
+        PROFILE_ZONE("tonemap");
+        gpuTimerBegin(&gpuTimer, GPU_PASS_TONEMAP);
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
         glDisable(GL_DEPTH_TEST); // disable depth test so screen-space quad isn't discarded due to depth test.
         glClearColor(1.0f, 1.0f, 1.0f, 1.0f); // set clear color to white (not really necessary actually, since we won't be able to see behind the quad anyways)
@@ -679,17 +1311,60 @@ int main(void)
         setFloat(screen_shader, "exposure", exposure);
         glBindVertexArray(quadVAO);
         glDrawArrays(GL_TRIANGLES, 0, 6);
+        RENDER_STAT_ADD(RENDER_STAT_STATE_CHANGES, 1);
+        RENDER_STAT_ADD(RENDER_STAT_DRAW_CALLS, 1);
+        RENDER_STAT_ADD(RENDER_STAT_TRIANGLES, 2);
         glDisable(GL_FRAMEBUFFER_SRGB);
+        gpuTimerEnd(&gpuTimer, GPU_PASS_TONEMAP);
+        }
+        gpuTimerFrame(&gpuTimer);
+        renderStatsFrame(&g_renderStats);
+
+        if (showStats)
+        {
+            PROFILE_ZONE("stats overlay");
+            statsOverlayAddRenderStats(&statsOverlay, &g_renderStats, 10.0f, 10.0f);
+            statsOverlayDraw(&statsOverlay, screen_width, screen_height);
+        }
 
         // useShader(screen_shader);
         // activateMesh(&quadScreen, &screen_shader);
         // drawMesh(&quadScreen, &screen_shader);
 
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        {
+            PROFILE_ZONE("swap");
+            glfwSwapBuffers(window);
+        }
+        if (firstFrame)
+        {
+            printf("STREAMING: first frame after %.1f ms\n", glfwGetTime() * 1000.0);
+            firstFrame = false;
+        }
+        framePacingEndFrame(&framePacing);
     }
     
+    for (Bvh& bvh : backpackBvhs) bvhDestroy(&bvh);
+    bvhDestroy(&crateBvh);
+    bvhDestroy(&floorBvh);
+    bvhSceneDestroy(&rayScene);
+    octreeDestroy(&sceneOctree);
+    occlusionDestroy(&occlusion);
+    environmentDestroy(&environment);
+    vegetationDestroy(&grassField);
+    materialsDestroy(&sceneMaterials);
+    oitDestroy(&oit);
+    shadowAtlasDestroy(&shadowAtlas);
+    cascadedShadowsDestroy(&shadows);
+    meshletRendererDestroy(&meshletRenderer);
+    transformStoreDestroy(&sceneTransforms);
+    framePacingDestroy(&framePacing);
+    statsOverlayDestroy(&statsOverlay);
+    gpuTimerDestroy(&gpuTimer);
+    hotReloadShutdown(&hotReload);
+    streamingDestroy(&streaming);
     deleteShader(model_shader);
+    jobsShutdown();
+    vfsUnmountAll();
 
     glfwTerminate();
     return 0;
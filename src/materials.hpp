@@ -0,0 +1,393 @@
+#ifndef MATERIALS_H
+#define MATERIALS_H
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <stdio.h>
+#include <string.h>
+#include "texture.hpp"
+#include "shader.hpp"
+#include "mesh.hpp"
+#include "renderstats.hpp"
+#include "profiler.hpp"
+
+// Material tables: a model's textures are indexed by material instead of being bound per draw.
+// Every distinct (diffuse, specular) pair of the model's meshes is one MaterialData in a shader storage
+// buffer and the mesh keeps its index. Draws pass index + 1 as their base instance (drawMeshLod, the
+// commands of DrawModelMeshlets), which vertex.glsl hands to the fragment shader as MaterialId; 0 keeps
+// the Material samplers that activateMesh binds. Nothing changes between two draws of a table, so draws
+// from the same buffers can share a multi-draw. fragment.glsl and window.glsl read the table from
+// MATERIAL_BUFFER_BINDING.
+//  - With GL_ARB_bindless_texture the entries hold resident texture handles and nothing is bound.
+//  - Without it (or with --no-bindless) textures of the same size and format are copied into the layers
+//    of one GL_TEXTURE_2D_ARRAY, up to MATERIAL_MAX_ARRAYS of them, bound once per model draw. Originals
+//    no mesh binds anymore are deleted and their Texture ID set to 0.
+// Either way the textures cannot be respecified afterwards (a handle freezes the texture's state, a packed
+// texture has no name left), so hot reload skips them. A mesh with a texture the table cannot sample
+// falls back to activateMesh.
+//  - Streamed textures (streaming.hpp) keep changing their base level and storage but never their name,
+//    so materialsAddBound gives them slots instead: up to MATERIAL_MAX_SLOTS textures per table bound to
+//    units of their own by materialsBind.
+//
+// modelUploadSource builds the table of a model:
+//     materialsBuild(&model->materials, model->textures_loaded, model->textures_loaded_count, model->meshes, model->numMeshes);
+// A table of streamed textures, once:
+//     cubeMesh.material = materialsAddBound(&sceneMaterials, &crate, &crate_specular);
+// Per draw of a table's meshes:
+//     materialsBind(&model->materials);
+//     activateMeshMaterial(mesh, shader); drawMeshLod(mesh, shader, lod);   // for each mesh
+
+#define MATERIAL_MAX 64                 // materials per table
+#define MATERIAL_MAX_TEXTURES 64        // textures per table, as many as a model loads
+#define MATERIAL_MAX_ARRAYS 4           // texture arrays of the fallback, same in fragment.glsl
+#define MATERIAL_ARRAY_TEXTURE_UNIT 11  // above the shadow and environment samplers, binding of materialArrays
+#define MATERIAL_MAX_SLOTS 6            // bound textures per table, same in fragment.glsl and window.glsl
+#define MATERIAL_SLOT_TEXTURE_UNIT 2    // above activateMesh's diffuse and specular, binding of materialSlots
+#define MATERIAL_BUFFER_BINDING 3       // Materials block of fragment.glsl
+#define MATERIAL_SHININESS 32.0f        // what activateMesh sets for meshes with a specular texture
+
+typedef GLuint64 (APIENTRYP PFNGLGETTEXTUREHANDLEARBPROC)(GLuint texture);
+typedef void (APIENTRYP PFNGLMAKETEXTUREHANDLERESIDENTARBPROC)(GLuint64 handle);
+typedef void (APIENTRYP PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC)(GLuint64 handle);
+PFNGLGETTEXTUREHANDLEARBPROC g_glGetTextureHandleARB = NULL;
+PFNGLMAKETEXTUREHANDLERESIDENTARBPROC g_glMakeTextureHandleResidentARB = NULL;
+PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC g_glMakeTextureHandleNonResidentARB = NULL;
+bool g_bindlessTextures = false;
+
+// std430 layout of MaterialData in fragment.glsl
+struct MaterialData {
+    GLuint64 diffuseHandle;         // 0 without bindless textures
+    GLuint64 specularHandle;
+    int diffuseArray, diffuseLayer; // array -1 when the texture is not packed
+    int specularArray, specularLayer;
+    int diffuseSlot, specularSlot;  // index into the table's slots, -1 when sampled another way
+    float shininess;
+    float padding;
+};
+
+// where one texture of the table's list is sampled
+struct MaterialTexture {
+    GLuint64 handle;
+    int array, layer;
+};
+
+struct MaterialTable {
+    unsigned int buffer;
+    MaterialData materials[MATERIAL_MAX];
+    int numMaterials;
+    MaterialTexture textures[MATERIAL_MAX_TEXTURES]; // by index into the texture list the table was built from
+    int numTextures;
+    unsigned int arrays[MATERIAL_MAX_ARRAYS];
+    int numArrays;
+    size_t arrayBytes;
+    unsigned int slots[MATERIAL_MAX_SLOTS]; // texture names materialsBind binds, see materialsAddBound
+    int numSlots;
+};
+
+// Loads GL_ARB_bindless_texture unless allowBindless is false; tables then pack texture arrays.
+void materialsInit(bool allowBindless)
+{
+    if (allowBindless && glfwExtensionSupported("GL_ARB_bindless_texture"))
+    {
+        g_glGetTextureHandleARB = (PFNGLGETTEXTUREHANDLEARBPROC)glfwGetProcAddress("glGetTextureHandleARB");
+        g_glMakeTextureHandleResidentARB = (PFNGLMAKETEXTUREHANDLERESIDENTARBPROC)glfwGetProcAddress("glMakeTextureHandleResidentARB");
+        g_glMakeTextureHandleNonResidentARB = (PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC)glfwGetProcAddress("glMakeTextureHandleNonResidentARB");
+    }
+    g_bindlessTextures = g_glGetTextureHandleARB && g_glMakeTextureHandleResidentARB && g_glMakeTextureHandleNonResidentARB;
+    printf("MATERIALS: %s\n", g_bindlessTextures ? "bindless textures" : "texture arrays");
+}
+
+// Level 0 size and internal format of a 2D texture, 0x0 when it has no image. Binds the texture.
+static void materialsTextureInfo(unsigned int textureID, int* width, int* height, GLint* format)
+{
+    *width = *height = 0;
+    *format = 0;
+    if (!textureID) return;
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, height);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, format);
+    // storage needs a sized format, drivers may report the unsized one uploadTextureImage asked for
+    if (*format == GL_RED) *format = GL_R8;
+    else if (*format == GL_RGB) *format = GL_RGB8;
+    else if (*format == GL_RGBA) *format = GL_RGBA8;
+}
+
+// Texture handles, made resident, for the textures of the list the table has no entry for yet.
+static void materialsAddHandles(MaterialTable* table, const Texture* textures, int numTextures)
+{
+    for (int t = table->numTextures; t < numTextures; t++)
+    {
+        int width, height;
+        GLint format;
+        materialsTextureInfo(textures[t].ID, &width, &height, &format);
+        table->textures[t] = {0, -1, 0};
+        if (width == 0) continue;
+        table->textures[t].handle = g_glGetTextureHandleARB(textures[t].ID);
+        if (table->textures[t].handle) g_glMakeTextureHandleResidentARB(table->textures[t].handle);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// Copies the textures of the list that share a size and format into the layers of one array per group,
+// every level, while arrays are left. The originals are untouched.
+static void materialsPackTextures(MaterialTable* table, const Texture* textures, int numTextures)
+{
+    int width[MATERIAL_MAX_TEXTURES], height[MATERIAL_MAX_TEXTURES];
+    GLint format[MATERIAL_MAX_TEXTURES];
+    for (int t = table->numTextures; t < numTextures; t++)
+    {
+        materialsTextureInfo(textures[t].ID, &width[t], &height[t], &format[t]);
+        table->textures[t] = {0, -1, 0};
+    }
+    GLint maxLayers = 0;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+
+    for (int t = table->numTextures; t < numTextures; t++)
+    {
+        if (table->textures[t].array >= 0 || width[t] == 0) continue;
+        if (table->numArrays == MATERIAL_MAX_ARRAYS)
+        {
+            printf("ERROR::MATERIALS::ARRAYS_FULL: %s is bound per draw\n", textures[t].path);
+            continue;
+        }
+        int members[MATERIAL_MAX_TEXTURES];
+        int layers = 0;
+        for (int u = t; u < numTextures && layers < maxLayers; u++)
+            if (table->textures[u].array < 0 && width[u] == width[t] && height[u] == height[t] && format[u] == format[t])
+                members[layers++] = u;
+
+        int levels = textureMipCount(width[t], height[t]);
+        unsigned int array;
+        glGenTextures(1, &array);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, array);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, format[t], width[t], height[t], layers);
+        // same sampling as uploadTextureImage
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        for (int layer = 0; layer < layers; layer++)
+        {
+            for (int level = 0; level < levels; level++)
+                glCopyImageSubData(textures[members[layer]].ID, GL_TEXTURE_2D, level, 0, 0, 0,
+                                   array, GL_TEXTURE_2D_ARRAY, level, 0, 0, layer,
+                                   glm::max(width[t] >> level, 1), glm::max(height[t] >> level, 1), 1);
+            table->textures[members[layer]].array = table->numArrays;
+            table->textures[members[layer]].layer = layer;
+        }
+        table->arrays[table->numArrays++] = array;
+        table->arrayBytes += (size_t)width[t] * height[t] * 4 * 4 / 3 * layers;
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// Index of a mesh texture in the table's list, matched by path since packed textures have no name. -1 if absent.
+static int materialsFindTexture(const MaterialTable* table, const Texture* textures, const Texture* texture)
+{
+    for (int t = 0; t < table->numTextures; t++)
+        if (strcmp(textures[t].path, texture->path) == 0) return t;
+    return -1;
+}
+
+// True when the table samples texture `index` of its list, which then cannot be respecified.
+bool materialsOwnsTexture(const MaterialTable* table, int index)
+{
+    return index < table->numTextures && (table->textures[index].handle || table->textures[index].array >= 0);
+}
+
+// Points the mesh copies of the list's textures at their current names, 0 for deleted originals.
+static void materialsRefreshMeshTextures(const MaterialTable* table, const Texture* textures, Mesh* meshes, int numMeshes)
+{
+    for (int m = 0; m < numMeshes; m++)
+        for (unsigned int k = 0; k < meshes[m].numTextures; k++)
+        {
+            int t = materialsFindTexture(table, textures, &meshes[m].textures[k]);
+            if (t >= 0) meshes[m].textures[k].ID = textures[t].ID;
+        }
+}
+
+// (Re)creates the buffer with the table's materials.
+static void materialsUpload(MaterialTable* table)
+{
+    if (!table->buffer) glGenBuffers(1, &table->buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, table->buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, glm::max(table->numMaterials, 1) * sizeof(MaterialData), table->materials, GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    RENDER_STAT_ADD(RENDER_STAT_BUFFER_BYTES, table->numMaterials * sizeof(MaterialData));
+}
+
+// Slot of a texture name in the table, taking a new one if it has none. -1 when the slots are full.
+static int materialsFindSlot(MaterialTable* table, unsigned int textureID)
+{
+    for (int i = 0; i < table->numSlots; i++)
+        if (table->slots[i] == textureID) return i;
+    if (table->numSlots == MATERIAL_MAX_SLOTS) return -1;
+    table->slots[table->numSlots] = textureID;
+    return table->numSlots++;
+}
+
+// Adds a material that samples the textures through slots, for textures whose name stays but whose
+// contents and storage change (streamed ones), and uploads the table. Returns the material's index for
+// Mesh::material, or -1 when the table is full: the mesh then keeps binding its textures per draw.
+// specular may be NULL.
+int materialsAddBound(MaterialTable* table, const Texture* diffuse, const Texture* specular)
+{
+    int numSlots = table->numSlots;
+    int diffuseSlot = materialsFindSlot(table, diffuse->ID);
+    int specularSlot = specular ? materialsFindSlot(table, specular->ID) : -1;
+    if (diffuseSlot < 0 || (specular && specularSlot < 0) || table->numMaterials == MATERIAL_MAX)
+    {
+        table->numSlots = numSlots;
+        printf("ERROR::MATERIALS::SLOTS_FULL: %s is bound per draw\n", diffuse->path);
+        return -1;
+    }
+    MaterialData material = {0};
+    material.diffuseArray = material.specularArray = -1;
+    material.diffuseSlot = diffuseSlot;
+    material.specularSlot = specularSlot;
+    material.shininess = MATERIAL_SHININESS;
+    table->materials[table->numMaterials] = material;
+    materialsUpload(table);
+    return table->numMaterials++;
+}
+
+// Gives every mesh the index of its material, adding one per distinct diffuse and specular pair, and
+// uploads the materials. Textures of the list past the table's get handles, or stay unpacked. Call again
+// whenever the meshes are rebuilt against the same texture list (hot reload).
+void materialsAssign(MaterialTable* table, const Texture* textures, int numTextures, Mesh* meshes, int numMeshes)
+{
+    if (numTextures > MATERIAL_MAX_TEXTURES) numTextures = MATERIAL_MAX_TEXTURES;
+    if (g_bindlessTextures)
+    {
+        materialsAddHandles(table, textures, numTextures);
+    }
+    else
+    {
+        for (int t = table->numTextures; t < numTextures; t++) table->textures[t] = {0, -1, 0};
+    }
+    table->numTextures = glm::max(table->numTextures, numTextures);
+
+    table->numMaterials = 0;
+    for (int m = 0; m < numMeshes; m++)
+    {
+        Mesh* mesh = &meshes[m];
+        mesh->material = -1;
+        int diffuse = -1, specular = -1;
+        bool sampled = true;
+        for (unsigned int k = 0; k < mesh->numTextures; k++)
+        {
+            int type = mesh->textures[k].type;
+            if ((type != TEXTURE_DIFFUSE || diffuse >= 0) && (type != TEXTURE_SPECULAR || specular >= 0)) continue;
+            int t = materialsFindTexture(table, textures, &mesh->textures[k]);
+            if (t < 0 || !materialsOwnsTexture(table, t)) sampled = false;
+            if (type == TEXTURE_DIFFUSE) diffuse = t;
+            else specular = t;
+        }
+        if (!sampled) continue;
+
+        MaterialData material = {0};
+        material.diffuseArray = material.specularArray = -1;
+        material.diffuseSlot = material.specularSlot = -1;
+        material.shininess = MATERIAL_SHININESS;
+        if (diffuse >= 0)
+        {
+            material.diffuseHandle = table->textures[diffuse].handle;
+            material.diffuseArray = table->textures[diffuse].array;
+            material.diffuseLayer = table->textures[diffuse].layer;
+        }
+        if (specular >= 0)
+        {
+            material.specularHandle = table->textures[specular].handle;
+            material.specularArray = table->textures[specular].array;
+            material.specularLayer = table->textures[specular].layer;
+        }
+
+        int index = 0;
+        while (index < table->numMaterials && memcmp(&table->materials[index], &material, sizeof(MaterialData)) != 0) index++;
+        if (index == MATERIAL_MAX) continue;
+        if (index == table->numMaterials) table->materials[table->numMaterials++] = material;
+        mesh->material = index;
+    }
+
+    materialsUpload(table);
+    materialsRefreshMeshTextures(table, textures, meshes, numMeshes);
+}
+
+// Builds the table of a freshly uploaded model: handles or packed arrays for its textures, then the
+// materials. Packed originals only meshes on activateMesh still bind are kept.
+void materialsBuild(MaterialTable* table, Texture* textures, int numTextures, Mesh* meshes, int numMeshes)
+{
+    PROFILE_ZONE("materialsBuild");
+    if (numTextures > MATERIAL_MAX_TEXTURES)
+    {
+        printf("ERROR::MATERIALS::TOO_MANY_TEXTURES: %d, the rest are bound per draw\n", numTextures);
+        numTextures = MATERIAL_MAX_TEXTURES;
+    }
+    if (!g_bindlessTextures)
+    {
+        materialsPackTextures(table, textures, numTextures);
+        table->numTextures = numTextures;
+    }
+    materialsAssign(table, textures, numTextures, meshes, numMeshes);
+    if (g_bindlessTextures) return;
+
+    for (int t = 0; t < table->numTextures; t++)
+    {
+        if (table->textures[t].array < 0 || !textures[t].ID) continue;
+        bool bound = false;
+        for (int m = 0; m < numMeshes && !bound; m++)
+            if (meshes[m].material < 0)
+                for (unsigned int k = 0; k < meshes[m].numTextures && !bound; k++)
+                    bound = strcmp(meshes[m].textures[k].path, textures[t].path) == 0;
+        if (bound) continue;
+        glDeleteTextures(1, &textures[t].ID);
+        textures[t].ID = 0;
+    }
+    materialsRefreshMeshTextures(table, textures, meshes, numMeshes);
+}
+
+// Binds the table's buffer, texture arrays and slots, once before drawing its meshes. activateMesh binds
+// over the slots, so bind again after drawing a mesh that has no material.
+void materialsBind(const MaterialTable* table)
+{
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIAL_BUFFER_BINDING, table->buffer);
+    for (int i = 0; i < table->numArrays; i++)
+    {
+        glActiveTexture(GL_TEXTURE0 + MATERIAL_ARRAY_TEXTURE_UNIT + i);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, table->arrays[i]);
+        RENDER_STAT_ADD(RENDER_STAT_TEXTURE_BINDS, 1);
+    }
+    for (int i = 0; i < table->numSlots; i++)
+    {
+        glActiveTexture(GL_TEXTURE0 + MATERIAL_SLOT_TEXTURE_UNIT + i);
+        glBindTexture(GL_TEXTURE_2D, table->slots[i]);
+        RENDER_STAT_ADD(RENDER_STAT_TEXTURE_BINDS, 1);
+    }
+    glActiveTexture(GL_TEXTURE0);
+}
+
+// activateMesh for meshes of a table: nothing when the mesh has a material (its draw selects it),
+// otherwise its textures are bound.
+void activateMeshMaterial(Mesh* mesh, Shader* shader)
+{
+    if (mesh->material < 0) activateMesh(mesh, shader);
+}
+
+// GPU memory of the packed arrays and the material buffer; handles add nothing.
+size_t materialsGpuBytes(const MaterialTable* table)
+{
+    return table->arrayBytes + table->numMaterials * sizeof(MaterialData);
+}
+
+// Releases handles, arrays and the buffer. Textures in the list are left to their owner.
+void materialsDestroy(MaterialTable* table)
+{
+    for (int t = 0; t < table->numTextures; t++)
+        if (table->textures[t].handle) g_glMakeTextureHandleNonResidentARB(table->textures[t].handle);
+    glDeleteTextures(table->numArrays, table->arrays);
+    if (table->buffer) glDeleteBuffers(1, &table->buffer);
+    *table = MaterialTable();
+}
+
+#endif
@@ -3,6 +3,8 @@
 #include "../thirdparty/glm/glm.hpp"
 #include "texture.hpp"
 #include "shader.hpp"
+#include "lod.hpp"
+#include "meshlet.hpp"
 
 struct Vertex {
     glm::vec3 Position;
@@ -12,21 +14,33 @@ struct Vertex {
     glm::vec3 Bitangent;
 } ;
 
-static void setupMesh(struct Mesh* mesh); 
+static void setupMeshes(struct Mesh* meshes, int numMeshes);
 struct Mesh {
     Vertex* vertices;
     unsigned int* indices;
     Texture* textures;
 
     unsigned int numVertices;
-    unsigned int numIndices;
+    unsigned int numIndices;    // every LOD, back to back
     unsigned int numTextures;
 
     unsigned int VAO, VBO, EBO;
+    unsigned int indexType;     // GL_UNSIGNED_SHORT in the EBO when every vertex is reachable with 16 bits
+    unsigned int depthVAO, positionVBO; // position-only stream sharing the EBO, for depth-only passes
+    unsigned int baseVertex, firstIndex; // where the mesh starts in buffers shared with other meshes (setupMeshes)
 
+    MeshLod lods[LOD_MAX_LEVELS];  // lods[0] is the full mesh
+    int numLods;
+
+    Meshlet* meshlets;  // clusters of lods[0], NULL when the mesh was not split
+    int numMeshlets;
+
+    int material;       // index in the MaterialTable it is drawn with (materials.hpp), -1 binds the textures per draw
+
+    // upload false leaves the GL objects to a later setupMeshes over several meshes
     Mesh(Vertex* vertices, unsigned int numVertices,
         unsigned int* indices, unsigned int numIndices,
-        Texture* textures, unsigned int numTextures)
+        Texture* textures, unsigned int numTextures, bool upload = true)
    {
        this->vertices = vertices;
        this->numVertices = numVertices;
@@ -37,23 +51,78 @@ struct Mesh {
        this->textures = textures;
        this->numTextures = numTextures;
 
-       setupMesh(this);
+       this->lods[0] = {0, numIndices, 0.0f};
+       this->numLods = 1;
+
+       this->meshlets = NULL;
+       this->numMeshlets = 0;
+
+       this->material = -1;
+
+       this->baseVertex = 0;
+       this->firstIndex = 0;
+       if (upload) setupMeshes(this, 1);
    }
 
 };
 
-static void setupMesh(Mesh* mesh) {
-    glGenVertexArrays(1, &mesh->VAO);
-    glGenBuffers(1, &mesh->VBO);
-    glGenBuffers(1, &mesh->EBO);
+// Index type of the EBO setupMeshes creates when its largest mesh has that many vertices.
+static unsigned int meshIndexType(unsigned int numVertices)
+{
+    return numVertices <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
 
-    glBindVertexArray(mesh->VAO);
+static unsigned int indexTypeSize(unsigned int indexType)
+{
+    return indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
-    glBufferData(GL_ARRAY_BUFFER, mesh->numVertices * sizeof(Vertex), mesh->vertices, GL_STATIC_DRAW);
+static unsigned int meshIndexSize(const Mesh* mesh)
+{
+    return indexTypeSize(mesh->indexType);
+}
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh->numIndices * sizeof(unsigned int), mesh->indices, GL_STATIC_DRAW);
+// Uploads the meshes into one VAO / VBO / EBO and one position stream, back to back, and records where
+// each starts. Indices stay local to their mesh (drawn with baseVertex), so the EBO is 16-bit whenever
+// every mesh on its own is; draws of any of the meshes then need no rebinding and can share a multi-draw.
+static void setupMeshes(Mesh* meshes, int numMeshes) {
+    unsigned int numVertices = 0, numIndices = 0, maxVertices = 0;
+    for (int m = 0; m < numMeshes; m++) {
+        meshes[m].baseVertex = numVertices;
+        meshes[m].firstIndex = numIndices;
+        numVertices += meshes[m].numVertices;
+        numIndices += meshes[m].numIndices;
+        maxVertices = glm::max(maxVertices, meshes[m].numVertices);
+    }
+    unsigned int VAO, VBO, EBO, depthVAO, positionVBO;
+    unsigned int indexType = meshIndexType(maxVertices);
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &VBO);
+    glGenBuffers(1, &EBO);
+
+    glBindVertexArray(VAO);
+
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(Vertex), NULL, GL_STATIC_DRAW);
+    for (int m = 0; m < numMeshes; m++)
+        glBufferSubData(GL_ARRAY_BUFFER, meshes[m].baseVertex * sizeof(Vertex), meshes[m].numVertices * sizeof(Vertex), meshes[m].vertices);
+    RENDER_STAT_ADD(RENDER_STAT_BUFFER_BYTES, numVertices * sizeof(Vertex));
+
+    // the CPU copy stays 32-bit for the mesh builders; the EBO halves whenever it can
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * indexTypeSize(indexType), NULL, GL_STATIC_DRAW);
+    for (int m = 0; m < numMeshes; m++) {
+        Mesh* mesh = &meshes[m];
+        if (indexType == GL_UNSIGNED_SHORT) {
+            unsigned short* narrow = (unsigned short*)malloc(mesh->numIndices * sizeof(unsigned short));
+            for (unsigned int i = 0; i < mesh->numIndices; i++) narrow[i] = (unsigned short)mesh->indices[i];
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, mesh->firstIndex * sizeof(unsigned short), mesh->numIndices * sizeof(unsigned short), narrow);
+            free(narrow);
+        } else {
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, mesh->firstIndex * sizeof(unsigned int), mesh->numIndices * sizeof(unsigned int), mesh->indices);
+        }
+    }
+    RENDER_STAT_ADD(RENDER_STAT_BUFFER_BYTES, numIndices * indexTypeSize(indexType));
 
     // Vertex Positions
     glEnableVertexAttribArray(0);
@@ -67,7 +136,33 @@ static void setupMesh(Mesh* mesh) {
     glEnableVertexAttribArray(2);
     glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
 
+    // Depth passes only read positions: a packed 12-byte stream fetches a fifth of the interleaved vertex
+    glGenVertexArrays(1, &depthVAO);
+    glGenBuffers(1, &positionVBO);
+    glBindVertexArray(depthVAO);
+
+    glm::vec3* positions = (glm::vec3*)malloc((numVertices > 0 ? numVertices : 1) * sizeof(glm::vec3));
+    for (int m = 0; m < numMeshes; m++)
+        for (unsigned int i = 0; i < meshes[m].numVertices; i++) positions[meshes[m].baseVertex + i] = meshes[m].vertices[i].Position;
+    glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+    glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(glm::vec3), positions, GL_STATIC_DRAW);
+    RENDER_STAT_ADD(RENDER_STAT_BUFFER_BYTES, numVertices * sizeof(glm::vec3));
+    free(positions);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+
     glBindVertexArray(0);
+
+    for (int m = 0; m < numMeshes; m++) {
+        meshes[m].VAO = VAO;
+        meshes[m].VBO = VBO;
+        meshes[m].EBO = EBO;
+        meshes[m].indexType = indexType;
+        meshes[m].depthVAO = depthVAO;
+        meshes[m].positionVBO = positionVBO;
+    }
 }
 
 void activateMesh(Mesh* mesh, Shader* shader)
@@ -93,14 +188,39 @@ void activateMesh(Mesh* mesh, Shader* shader)
         setInt(*shader, uniformName, i);
 
         glBindTexture(GL_TEXTURE_2D, mesh->textures[i].ID);
+        RENDER_STAT_ADD(RENDER_STAT_TEXTURE_BINDS, 1);
     }
     glActiveTexture(GL_TEXTURE0);
 
 }
-void drawMesh(Mesh* mesh, Shader* shader) {
+// Draws one LOD; levels past the mesh's last one fall back to its coarsest. The mesh's material + 1 goes
+// in as the base instance, which vertex.glsl passes on as MaterialId (0 samples the Material uniforms).
+void drawMeshLod(Mesh* mesh, Shader* shader, int lod) {
+    const MeshLod& level = mesh->lods[lod < mesh->numLods ? lod : mesh->numLods - 1];
     glBindVertexArray(mesh->VAO);
-    glDrawElements(GL_TRIANGLES, mesh->numIndices, GL_UNSIGNED_INT, 0);
+    glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, level.indexCount, mesh->indexType,
+                                                  (void*)(size_t)((mesh->firstIndex + level.indexOffset) * meshIndexSize(mesh)),
+                                                  1, mesh->baseVertex, mesh->material + 1);
+    glBindVertexArray(0);
+    RENDER_STAT_ADD(RENDER_STAT_STATE_CHANGES, 1);
+    RENDER_STAT_ADD(RENDER_STAT_DRAW_CALLS, 1);
+    RENDER_STAT_ADD(RENDER_STAT_TRIANGLES, level.indexCount / 3);
+}
+
+// Same as drawMeshLod through the position-only stream; for shaders that only read location 0.
+void drawMeshDepth(Mesh* mesh, int lod) {
+    const MeshLod& level = mesh->lods[lod < mesh->numLods ? lod : mesh->numLods - 1];
+    glBindVertexArray(mesh->depthVAO);
+    glDrawElementsBaseVertex(GL_TRIANGLES, level.indexCount, mesh->indexType,
+                             (void*)(size_t)((mesh->firstIndex + level.indexOffset) * meshIndexSize(mesh)), mesh->baseVertex);
     glBindVertexArray(0);
+    RENDER_STAT_ADD(RENDER_STAT_STATE_CHANGES, 1);
+    RENDER_STAT_ADD(RENDER_STAT_DRAW_CALLS, 1);
+    RENDER_STAT_ADD(RENDER_STAT_TRIANGLES, level.indexCount / 3);
+}
+
+void drawMesh(Mesh* mesh, Shader* shader) {
+    drawMeshLod(mesh, shader, 0);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,327 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "mesh.hpp"
+#include "scenegraph.hpp"
+#include "meshcodec.hpp"
+#include "jobs.hpp"
+#include "profiler.hpp"
+#include "vfs.hpp"
+
+// On-disk cache of an imported model: the meshes as the importer left them (meshlet-ordered,
+// optimized, with their LOD chains), the node hierarchy and the texture table, written next to the
+// source as <path>.meshcache. Vertex and index streams go through meshcodec.hpp; the small tables are
+// stored raw. The cache is keyed on the source file's size and modification time and on the LOD count
+// it was built with, so editing the source or asking for a different LOD count rebuilds it.
+// Loading decodes every mesh on the job system; nothing here touches GL. Reads and source stamps go
+// through vfs.hpp, so a cache packed next to its source is used straight from the pack.
+// Define MESH_CACHE_ENABLED 0 to always import through Assimp.
+
+#ifndef MESH_CACHE_ENABLED
+#define MESH_CACHE_ENABLED 1
+#endif
+
+#define MESH_CACHE_VERSION 1
+#define MESH_CACHE_EXTENSION ".meshcache"
+#define MESH_CACHE_MAX_MESH_TEXTURES 16
+
+struct MeshCacheTexture {
+    int type;
+    char path[512];
+};
+
+struct MeshCacheMesh {
+    Vertex* vertices;
+    unsigned int numVertices;
+    unsigned int* indices;      // every LOD, back to back
+    unsigned int numIndices;
+    MeshLod lods[LOD_MAX_LEVELS];
+    int numLods;
+    Meshlet* meshlets;
+    int numMeshlets;
+    int textures[MESH_CACHE_MAX_MESH_TEXTURES];  // into MeshCacheFile::textures
+    int numTextures;
+
+    // encoded streams inside the file buffer while loading
+    const unsigned char* encodedVertices;
+    size_t vertexBytes;
+    const unsigned char* encodedIndices;
+    size_t indexBytes;
+    bool decoded;
+};
+
+struct MeshCacheFile {
+    long long sourceSize;
+    long long sourceTime;
+    int maxLods;
+    MeshCacheTexture* textures;
+    int numTextures;
+    MeshCacheMesh* meshes;
+    int numMeshes;
+    SceneGraph graph;
+};
+
+struct MeshCacheHeader {
+    char magic[4];
+    uint32_t version;
+    int64_t sourceSize;
+    int64_t sourceTime;
+    int32_t maxLods;
+    int32_t vertexSize;     // sizeof(Vertex) when written
+    int32_t numTextures;
+    int32_t numNodes;
+    int32_t numMeshRefs;
+    int32_t numMeshes;
+};
+
+void meshCachePath(char* out, size_t size, const char* sourcePath)
+{
+    snprintf(out, size, "%s%s", sourcePath, MESH_CACHE_EXTENSION);
+}
+
+// Size and modification time of the source, 0 / 0 if it cannot be read.
+void meshCacheSourceStamp(const char* sourcePath, long long* size, long long* time)
+{
+    vfsStat(sourcePath, size, time);
+}
+
+// ---- writing -----------------------------------------------------------------------------------
+
+static bool meshCacheWriteBytes(FILE* file, const void* data, size_t size)
+{
+    return size == 0 || fwrite(data, 1, size, file) == size;
+}
+
+// The graph arrays and the mesh arrays are only read. Returns false if the file could not be written.
+bool meshCacheWrite(const char* cachePath, const MeshCacheFile* cache)
+{
+    PROFILE_ZONE("meshCacheWrite");
+    FILE* file = fopen(cachePath, "wb");
+    if (!file) {
+        printf("ERROR::MESHCACHE::CANNOT_WRITE: %s\n", cachePath);
+        return false;
+    }
+
+    const SceneGraph* graph = &cache->graph;
+    MeshCacheHeader header = {{'M', 'S', 'H', 'C'}, MESH_CACHE_VERSION, cache->sourceSize, cache->sourceTime, cache->maxLods,
+                              (int32_t)sizeof(Vertex), cache->numTextures, graph->numNodes, graph->numMeshIndices, cache->numMeshes};
+    bool ok = meshCacheWriteBytes(file, &header, sizeof(header));
+    ok = ok && meshCacheWriteBytes(file, cache->textures, cache->numTextures * sizeof(MeshCacheTexture));
+    for (int node = 0; ok && node < graph->numNodes; node++)
+    {
+        int32_t parent = graph->parent[node], numMeshes = graph->numMeshes[node];
+        ok = meshCacheWriteBytes(file, &parent, sizeof(parent)) &&
+             meshCacheWriteBytes(file, graph->names[node], SCENE_NODE_NAME_SIZE) &&
+             meshCacheWriteBytes(file, &graph->local[node], sizeof(glm::mat4)) &&
+             meshCacheWriteBytes(file, &numMeshes, sizeof(numMeshes)) &&
+             meshCacheWriteBytes(file, graph->meshIndices + graph->firstMesh[node], numMeshes * sizeof(int));
+    }
+
+    unsigned char* scratch = NULL;
+    size_t scratchSize = 0;
+    for (int m = 0; ok && m < cache->numMeshes; m++)
+    {
+        const MeshCacheMesh* mesh = &cache->meshes[m];
+        size_t bound = meshCodecVertexBound(mesh->numVertices, sizeof(Vertex)) + meshCodecIndexBound(mesh->numIndices);
+        if (bound > scratchSize) {
+            scratchSize = bound;
+            scratch = (unsigned char*)realloc(scratch, scratchSize);
+        }
+        uint64_t vertexBytes = meshCodecEncodeVertices(scratch, mesh->vertices, mesh->numVertices, sizeof(Vertex));
+        uint64_t indexBytes = meshCodecEncodeIndices(scratch + vertexBytes, mesh->indices, mesh->numIndices);
+
+        ok = meshCacheWriteBytes(file, &mesh->numVertices, sizeof(mesh->numVertices)) &&
+             meshCacheWriteBytes(file, &mesh->numIndices, sizeof(mesh->numIndices)) &&
+             meshCacheWriteBytes(file, &mesh->numLods, sizeof(mesh->numLods)) &&
+             meshCacheWriteBytes(file, mesh->lods, mesh->numLods * sizeof(MeshLod)) &&
+             meshCacheWriteBytes(file, &mesh->numMeshlets, sizeof(mesh->numMeshlets)) &&
+             meshCacheWriteBytes(file, mesh->meshlets, mesh->numMeshlets * sizeof(Meshlet)) &&
+             meshCacheWriteBytes(file, &mesh->numTextures, sizeof(mesh->numTextures)) &&
+             meshCacheWriteBytes(file, mesh->textures, mesh->numTextures * sizeof(int)) &&
+             meshCacheWriteBytes(file, &vertexBytes, sizeof(vertexBytes)) &&
+             meshCacheWriteBytes(file, &indexBytes, sizeof(indexBytes)) &&
+             meshCacheWriteBytes(file, scratch, vertexBytes + indexBytes);
+    }
+    free(scratch);
+    fclose(file);
+
+    if (!ok) {
+        printf("ERROR::MESHCACHE::WRITE_FAILED: %s\n", cachePath);
+        remove(cachePath);
+    }
+    return ok;
+}
+
+// ---- reading -----------------------------------------------------------------------------------
+
+struct MeshCacheReader {
+    const unsigned char* data;
+    size_t size;
+    size_t offset;
+    bool ok;
+};
+
+static const unsigned char* meshCacheTake(MeshCacheReader* reader, size_t size)
+{
+    if (!reader->ok || size > reader->size - reader->offset) {
+        reader->ok = false;
+        return NULL;
+    }
+    const unsigned char* at = reader->data + reader->offset;
+    reader->offset += size;
+    return at;
+}
+
+static void meshCacheRead(MeshCacheReader* reader, void* out, size_t size)
+{
+    const unsigned char* at = meshCacheTake(reader, size);
+    if (at) memcpy(out, at, size);
+}
+
+static void meshCacheDecodeJob(void* data, int begin, int end)
+{
+    MeshCacheMesh* meshes = (MeshCacheMesh*)data;
+    for (int m = begin; m < end; m++)
+    {
+        MeshCacheMesh* mesh = &meshes[m];
+        mesh->decoded = meshCodecDecodeVertices(mesh->vertices, mesh->numVertices, sizeof(Vertex), mesh->encodedVertices, mesh->vertexBytes) &&
+                        meshCodecDecodeIndices(mesh->indices, mesh->numIndices, mesh->encodedIndices, mesh->indexBytes);
+        // an index past the vertex buffer would have the GPU read out of bounds
+        for (unsigned int i = 0; mesh->decoded && i < mesh->numIndices; i++)
+            mesh->decoded = mesh->indices[i] < mesh->numVertices;
+    }
+}
+
+void meshCacheFree(MeshCacheFile* cache)
+{
+    for (int m = 0; m < cache->numMeshes; m++)
+    {
+        free(cache->meshes[m].vertices);
+        free(cache->meshes[m].indices);
+        free(cache->meshes[m].meshlets);
+    }
+    free(cache->meshes);
+    free(cache->textures);
+    sceneGraphDestroy(&cache->graph);
+    memset(cache, 0, sizeof(*cache));
+}
+
+// Loads the cache if it exists and matches the source stamp and maxLods. On success the caller owns
+// everything in *cache (hand it over or meshCacheFree it).
+bool meshCacheLoad(const char* cachePath, long long sourceSize, long long sourceTime, int maxLods, MeshCacheFile* cache)
+{
+    PROFILE_ZONE("meshCacheLoad");
+    memset(cache, 0, sizeof(*cache));
+    VfsFile file;
+    if (!vfsOpen(cachePath, &file)) return false;
+
+    MeshCacheReader reader = {file.data, file.size, 0, file.size > 0};
+    MeshCacheHeader header;
+    meshCacheRead(&reader, &header, sizeof(header));
+    if (!reader.ok || memcmp(header.magic, "MSHC", 4) != 0 || header.version != MESH_CACHE_VERSION ||
+        header.vertexSize != (int32_t)sizeof(Vertex) || header.sourceSize != sourceSize || header.sourceTime != sourceTime ||
+        header.maxLods != maxLods || header.numTextures < 0 || header.numNodes <= 0 || header.numMeshRefs < 0 || header.numMeshes < 0) {
+        vfsClose(&file);
+        return false;
+    }
+
+    cache->sourceSize = header.sourceSize;
+    cache->sourceTime = header.sourceTime;
+    cache->maxLods = header.maxLods;
+    cache->numTextures = header.numTextures;
+    cache->textures = (MeshCacheTexture*)malloc((header.numTextures > 0 ? header.numTextures : 1) * sizeof(MeshCacheTexture));
+    meshCacheRead(&reader, cache->textures, header.numTextures * sizeof(MeshCacheTexture));
+
+    // nodes were written in graph order, so adding them back keeps the depth sort
+    sceneGraphInit(&cache->graph, header.numNodes, header.numMeshRefs);
+    for (int node = 0; reader.ok && node < header.numNodes; node++)
+    {
+        int32_t parent, numMeshes;
+        char name[SCENE_NODE_NAME_SIZE];
+        glm::mat4 local;
+        meshCacheRead(&reader, &parent, sizeof(parent));
+        meshCacheRead(&reader, name, sizeof(name));
+        meshCacheRead(&reader, &local, sizeof(local));
+        meshCacheRead(&reader, &numMeshes, sizeof(numMeshes));
+        name[SCENE_NODE_NAME_SIZE - 1] = '\0';
+        if (!reader.ok || parent < SCENE_NO_PARENT || parent >= node || numMeshes < 0 ||
+            numMeshes > header.numMeshRefs - cache->graph.numMeshIndices) {
+            reader.ok = false;
+            break;
+        }
+        sceneGraphAddNode(&cache->graph, parent, name, local);
+        for (int i = 0; reader.ok && i < numMeshes; i++)
+        {
+            int32_t meshIndex = -1;
+            meshCacheRead(&reader, &meshIndex, sizeof(meshIndex));
+            if (meshIndex < 0 || meshIndex >= header.numMeshes) reader.ok = false;
+            else sceneGraphAddMesh(&cache->graph, node, meshIndex);
+        }
+    }
+
+    cache->numMeshes = header.numMeshes;
+    cache->meshes = (MeshCacheMesh*)calloc(header.numMeshes > 0 ? header.numMeshes : 1, sizeof(MeshCacheMesh));
+    for (int m = 0; reader.ok && m < header.numMeshes; m++)
+    {
+        MeshCacheMesh* mesh = &cache->meshes[m];
+        uint64_t vertexBytes = 0, indexBytes = 0;
+        meshCacheRead(&reader, &mesh->numVertices, sizeof(mesh->numVertices));
+        meshCacheRead(&reader, &mesh->numIndices, sizeof(mesh->numIndices));
+        meshCacheRead(&reader, &mesh->numLods, sizeof(mesh->numLods));
+        if (mesh->numLods < 1 || mesh->numLods > LOD_MAX_LEVELS) { reader.ok = false; break; }
+        meshCacheRead(&reader, mesh->lods, mesh->numLods * sizeof(MeshLod));
+        meshCacheRead(&reader, &mesh->numMeshlets, sizeof(mesh->numMeshlets));
+        if (mesh->numMeshlets < 0) { reader.ok = false; break; }
+        const unsigned char* meshlets = meshCacheTake(&reader, mesh->numMeshlets * sizeof(Meshlet));
+        meshCacheRead(&reader, &mesh->numTextures, sizeof(mesh->numTextures));
+        if (mesh->numTextures < 0 || mesh->numTextures > MESH_CACHE_MAX_MESH_TEXTURES) { reader.ok = false; break; }
+        meshCacheRead(&reader, mesh->textures, mesh->numTextures * sizeof(int));
+        meshCacheRead(&reader, &vertexBytes, sizeof(vertexBytes));
+        meshCacheRead(&reader, &indexBytes, sizeof(indexBytes));
+        mesh->encodedVertices = meshCacheTake(&reader, vertexBytes);
+        mesh->vertexBytes = vertexBytes;
+        mesh->encodedIndices = meshCacheTake(&reader, indexBytes);
+        mesh->indexBytes = indexBytes;
+        if (!reader.ok) break;
+
+        for (int t = 0; t < mesh->numTextures; t++)
+            if (mesh->textures[t] < 0 || mesh->textures[t] >= header.numTextures) reader.ok = false;
+        for (int level = 0; level < mesh->numLods; level++)
+            if ((uint64_t)mesh->lods[level].indexOffset + mesh->lods[level].indexCount > mesh->numIndices) reader.ok = false;
+        for (int i = 0; i < mesh->numMeshlets; i++)
+        {
+            Meshlet meshlet;
+            memcpy(&meshlet, meshlets + i * sizeof(Meshlet), sizeof(Meshlet));
+            if ((uint64_t)meshlet.indexOffset + meshlet.indexCount > mesh->numIndices) reader.ok = false;
+        }
+        mesh->vertices = (Vertex*)malloc((mesh->numVertices > 0 ? mesh->numVertices : 1) * sizeof(Vertex));
+        mesh->indices = (unsigned int*)malloc((mesh->numIndices > 0 ? mesh->numIndices : 1) * sizeof(unsigned int));
+        mesh->meshlets = mesh->numMeshlets > 0 ? (Meshlet*)malloc(mesh->numMeshlets * sizeof(Meshlet)) : NULL;
+        if (mesh->meshlets) memcpy(mesh->meshlets, meshlets, mesh->numMeshlets * sizeof(Meshlet));
+    }
+
+    if (reader.ok)
+    {
+        PROFILE_ZONE("decode meshes");
+        jobsParallelFor("decode meshes", cache->numMeshes, 1, meshCacheDecodeJob, cache->meshes);
+        for (int m = 0; m < cache->numMeshes; m++) reader.ok = reader.ok && cache->meshes[m].decoded;
+    }
+    for (int m = 0; m < cache->numMeshes; m++)
+    {
+        cache->meshes[m].encodedVertices = NULL;
+        cache->meshes[m].encodedIndices = NULL;
+    }
+    vfsClose(&file);
+
+    if (!reader.ok) {
+        printf("ERROR::MESHCACHE::CORRUPT: %s\n", cachePath);
+        meshCacheFree(cache);
+        return false;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,474 @@
+#ifndef MESHCODEC_H
+#define MESHCODEC_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <chrono>
+#include "cpufeatures.hpp"
+
+// Compact geometry encoding for the mesh cache, built so decoding is a few SIMD ops per 16 bytes.
+// Indices: each index minus the previous one, zigzag encoded (small negative deltas stay small) and
+// stored Stream-VByte style: 2-bit lengths for 4 values in one control byte, the 1-4 byte values packed
+// after all control bytes. A decode step is one shuffle per 4 indices plus a prefix sum.
+// Vertices: split into byte planes per block of 16 vertices (byte k of every vertex together). Each
+// plane stores zigzagged byte deltas from the previous vertex at 0, 2, 4 or 8 bits per value, chosen
+// per plane and block. Exponent and sign bytes of floats barely change between neighbouring vertices
+// and mostly drop to 0 or 2 bits. Decoding expands and prefix-sums each plane in a register, then
+// transposes 16 planes at a time back into vertices.
+// Both streams end in MESHCODEC_PADDING zero bytes so the decoder can always load 16 bytes.
+// The vertex decoder only needs SSE2. The index shuffle is SSSE3, compiled with CPU_TARGET and used
+// when cpuid reports it (cpufeatures.hpp), so no compiler flag is needed for either.
+// Define MESHCODEC_SIMD 0 to force the scalar decoder.
+
+#ifndef MESHCODEC_SIMD
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MESHCODEC_SIMD 1
+#else
+#define MESHCODEC_SIMD 0
+#endif
+#endif
+
+#if MESHCODEC_SIMD
+#include <immintrin.h>
+#endif
+
+#define MESHCODEC_PADDING 16
+#define MESHCODEC_BLOCK_VERTICES 16
+#define MESHCODEC_MAX_STRIDE 256
+
+#if MESHCODEC_SIMD
+// Lengths and pshufb masks for every index control byte.
+struct MeshCodecTables {
+    unsigned char length[256];
+    unsigned char shuffle[256][16];
+};
+
+static const MeshCodecTables& meshCodecTables()
+{
+    static const MeshCodecTables tables = []() {
+        MeshCodecTables t;
+        for (int control = 0; control < 256; control++)
+        {
+            int offset = 0;
+            for (int value = 0; value < 4; value++)
+            {
+                int bytes = ((control >> (value * 2)) & 3) + 1;
+                for (int b = 0; b < 4; b++)
+                    t.shuffle[control][value * 4 + b] = b < bytes ? (unsigned char)(offset + b) : 0x80;
+                offset += bytes;
+            }
+            t.length[control] = (unsigned char)offset;
+        }
+        return t;
+    }();
+    return tables;
+}
+#endif
+
+// ---- indices -----------------------------------------------------------------------------------
+
+size_t meshCodecIndexBound(unsigned int numIndices)
+{
+    return (numIndices + 3) / 4 + (size_t)numIndices * 4 + MESHCODEC_PADDING;
+}
+
+// Returns the encoded size; out needs meshCodecIndexBound(numIndices) bytes.
+size_t meshCodecEncodeIndices(unsigned char* out, const unsigned int* indices, unsigned int numIndices)
+{
+    unsigned int numControl = (numIndices + 3) / 4;
+    unsigned char* control = out;
+    unsigned char* data = out + numControl;
+    memset(control, 0, numControl);
+
+    unsigned int previous = 0;
+    for (unsigned int i = 0; i < numIndices; i++)
+    {
+        int delta = (int)(indices[i] - previous);
+        unsigned int value = ((unsigned int)delta << 1) ^ (unsigned int)(delta >> 31);
+        previous = indices[i];
+
+        int bytes = value < (1u << 8) ? 1 : value < (1u << 16) ? 2 : value < (1u << 24) ? 3 : 4;
+        control[i / 4] |= (unsigned char)((bytes - 1) << ((i % 4) * 2));
+        for (int b = 0; b < bytes; b++) *data++ = (unsigned char)(value >> (b * 8));
+    }
+    memset(data, 0, MESHCODEC_PADDING);
+    return (size_t)(data - out) + MESHCODEC_PADDING;
+}
+
+#if MESHCODEC_SIMD
+// Whole groups of 4 indices, one pshufb each. Advances *data and returns how many indices were
+// decoded, -1 if the stream ran out.
+static CPU_TARGET("ssse3") int meshCodecDecodeIndicesSsse3(unsigned int* out, unsigned int numIndices, const unsigned char* control,
+                                                           const unsigned char** data, const unsigned char* dataEnd)
+{
+    const MeshCodecTables& tables = meshCodecTables();
+    const unsigned char* read = *data;
+    __m128i previous = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi32(1);
+    unsigned int i = 0;
+    for (; i + 4 <= numIndices; i += 4)
+    {
+        unsigned char c = control[i / 4];
+        if (read + tables.length[c] > dataEnd) return -1;
+        __m128i value = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)read), _mm_loadu_si128((const __m128i*)tables.shuffle[c]));
+        read += tables.length[c];
+
+        __m128i delta = _mm_xor_si128(_mm_srli_epi32(value, 1), _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(value, one)));
+        delta = _mm_add_epi32(delta, _mm_slli_si128(delta, 4));
+        delta = _mm_add_epi32(delta, _mm_slli_si128(delta, 8));
+        __m128i result = _mm_add_epi32(delta, previous);
+        _mm_storeu_si128((__m128i*)(out + i), result);
+        previous = _mm_shuffle_epi32(result, 0xFF);
+    }
+    *data = read;
+    return (int)i;
+}
+#endif
+
+// Returns false if the stream is too short for numIndices.
+bool meshCodecDecodeIndices(unsigned int* out, unsigned int numIndices, const unsigned char* in, size_t size)
+{
+    unsigned int numControl = (numIndices + 3) / 4;
+    if (size < numControl + MESHCODEC_PADDING) return false;
+    const unsigned char* control = in;
+    const unsigned char* data = in + numControl;
+    const unsigned char* dataEnd = in + size - MESHCODEC_PADDING;
+
+    unsigned int i = 0;
+#if MESHCODEC_SIMD
+    if (cpuFeatures().ssse3)
+    {
+        int decoded = meshCodecDecodeIndicesSsse3(out, numIndices, control, &data, dataEnd);
+        if (decoded < 0) return false;
+        i = (unsigned int)decoded;
+    }
+#endif
+    unsigned int last = i > 0 ? out[i - 1] : 0;
+    for (; i < numIndices; i++)
+    {
+        int bytes = ((control[i / 4] >> ((i % 4) * 2)) & 3) + 1;
+        if (data + bytes > dataEnd) return false;
+        unsigned int value = 0;
+        for (int b = 0; b < bytes; b++) value |= (unsigned int)data[b] << (b * 8);
+        data += bytes;
+        last += (value >> 1) ^ (0u - (value & 1));
+        out[i] = last;
+    }
+    return true;
+}
+
+// ---- vertices ----------------------------------------------------------------------------------
+
+size_t meshCodecVertexBound(unsigned int numVertices, size_t stride)
+{
+    size_t blocks = (numVertices + MESHCODEC_BLOCK_VERTICES - 1) / MESHCODEC_BLOCK_VERTICES;
+    return blocks * ((stride + 3) / 4 + stride * MESHCODEC_BLOCK_VERTICES) + MESHCODEC_PADDING;
+}
+
+// stride must be a multiple of 4 up to MESHCODEC_MAX_STRIDE. Returns the encoded size (0 for an
+// unsupported stride); out needs meshCodecVertexBound(numVertices, stride) bytes.
+size_t meshCodecEncodeVertices(unsigned char* out, const void* vertices, unsigned int numVertices, size_t stride)
+{
+    if (stride == 0 || stride % 4 != 0 || stride > MESHCODEC_MAX_STRIDE) return 0;
+    const unsigned char* source = (const unsigned char*)vertices;
+    unsigned char previous[MESHCODEC_MAX_STRIDE] = {0};
+    unsigned char* write = out;
+
+    for (unsigned int base = 0; base < numVertices; base += MESHCODEC_BLOCK_VERTICES)
+    {
+        unsigned char* control = write;
+        write += (stride + 3) / 4;
+        memset(control, 0, (stride + 3) / 4);
+        for (size_t k = 0; k < stride; k++)
+        {
+            unsigned char values[MESHCODEC_BLOCK_VERTICES];
+            unsigned char maxValue = 0;
+            for (int v = 0; v < MESHCODEC_BLOCK_VERTICES; v++)
+            {
+                // the last vertex repeats to fill a partial block, which keeps its deltas at 0
+                unsigned int vertex = base + v < numVertices ? base + v : numVertices - 1;
+                unsigned char byte = source[vertex * stride + k];
+                unsigned char delta = (unsigned char)(byte - previous[k]);
+                values[v] = (unsigned char)((delta << 1) ^ (unsigned char)((signed char)delta >> 7));
+                previous[k] = byte;
+                if (values[v] > maxValue) maxValue = values[v];
+            }
+
+            int mode = maxValue == 0 ? 0 : maxValue < 4 ? 1 : maxValue < 16 ? 2 : 3;
+            control[k / 4] |= (unsigned char)(mode << ((k % 4) * 2));
+            if (mode == 1)
+            {
+                // byte j holds values j, j + 4, j + 8, j + 12 from the low bits up
+                for (int j = 0; j < 4; j++)
+                    *write++ = (unsigned char)(values[j] | values[j + 4] << 2 | values[j + 8] << 4 | values[j + 12] << 6);
+            }
+            else if (mode == 2)
+            {
+                // byte j holds value j in the low nibble and j + 8 in the high one
+                for (int j = 0; j < 8; j++)
+                    *write++ = (unsigned char)(values[j] | values[j + 8] << 4);
+            }
+            else if (mode == 3)
+            {
+                memcpy(write, values, MESHCODEC_BLOCK_VERTICES);
+                write += MESHCODEC_BLOCK_VERTICES;
+            }
+        }
+    }
+    memset(write, 0, MESHCODEC_PADDING);
+    return (size_t)(write - out) + MESHCODEC_PADDING;
+}
+
+#if MESHCODEC_SIMD
+// Expands one plane to 16 zigzagged bytes. Returns the bytes consumed.
+static int meshCodecLoadPlane(__m128i* plane, int mode, const unsigned char* data)
+{
+    const __m128i mask2 = _mm_set1_epi8(3), mask4 = _mm_set1_epi8(15);
+    if (mode == 0)
+    {
+        *plane = _mm_setzero_si128();
+        return 0;
+    }
+    if (mode == 1)
+    {
+        int packed;
+        memcpy(&packed, data, 4);
+        __m128i x = _mm_cvtsi32_si128(packed);
+        __m128i a0 = _mm_and_si128(x, mask2);
+        __m128i a1 = _mm_and_si128(_mm_srli_epi16(x, 2), mask2);
+        __m128i a2 = _mm_and_si128(_mm_srli_epi16(x, 4), mask2);
+        __m128i a3 = _mm_and_si128(_mm_srli_epi16(x, 6), mask2);
+        *plane = _mm_unpacklo_epi64(_mm_unpacklo_epi32(a0, a1), _mm_unpacklo_epi32(a2, a3));
+        return 4;
+    }
+    if (mode == 2)
+    {
+        __m128i x = _mm_loadl_epi64((const __m128i*)data);
+        *plane = _mm_unpacklo_epi64(_mm_and_si128(x, mask4), _mm_and_si128(_mm_srli_epi16(x, 4), mask4));
+        return 8;
+    }
+    *plane = _mm_loadu_si128((const __m128i*)data);
+    return 16;
+}
+
+// Interleaves planes k..k+3 into one 32-bit word per vertex: words[q] holds vertices 4q..4q+3.
+static void meshCodecInterleavePlanes(__m128i words[4], const unsigned char (*planes)[MESHCODEC_BLOCK_VERTICES], size_t k)
+{
+    __m128i p0 = _mm_load_si128((const __m128i*)planes[k]);
+    __m128i p1 = _mm_load_si128((const __m128i*)planes[k + 1]);
+    __m128i p2 = _mm_load_si128((const __m128i*)planes[k + 2]);
+    __m128i p3 = _mm_load_si128((const __m128i*)planes[k + 3]);
+    __m128i t0 = _mm_unpacklo_epi8(p0, p1), t1 = _mm_unpackhi_epi8(p0, p1);
+    __m128i t2 = _mm_unpacklo_epi8(p2, p3), t3 = _mm_unpackhi_epi8(p2, p3);
+    words[0] = _mm_unpacklo_epi16(t0, t2);
+    words[1] = _mm_unpackhi_epi16(t0, t2);
+    words[2] = _mm_unpacklo_epi16(t1, t3);
+    words[3] = _mm_unpackhi_epi16(t1, t3);
+}
+#endif
+
+// Returns false if the stream is too short or the stride unsupported.
+bool meshCodecDecodeVertices(void* vertices, unsigned int numVertices, size_t stride, const unsigned char* in, size_t size)
+{
+    if (stride == 0 || stride % 4 != 0 || stride > MESHCODEC_MAX_STRIDE || size < MESHCODEC_PADDING) return false;
+    unsigned char* out = (unsigned char*)vertices;
+    const unsigned char* read = in;
+    const unsigned char* end = in + size - MESHCODEC_PADDING;
+    size_t numControl = (stride + 3) / 4;
+#if MESHCODEC_SIMD
+    alignas(16) unsigned char planes[MESHCODEC_MAX_STRIDE][MESHCODEC_BLOCK_VERTICES];
+#endif
+    alignas(16) unsigned char partial[MESHCODEC_MAX_STRIDE * MESHCODEC_BLOCK_VERTICES];
+    unsigned char previous[MESHCODEC_MAX_STRIDE] = {0};
+
+    for (unsigned int base = 0; base < numVertices; base += MESHCODEC_BLOCK_VERTICES)
+    {
+        if (read + numControl > end) return false;
+        const unsigned char* control = read;
+        read += numControl;
+        unsigned int count = numVertices - base < MESHCODEC_BLOCK_VERTICES ? numVertices - base : MESHCODEC_BLOCK_VERTICES;
+        unsigned char* target = count == MESHCODEC_BLOCK_VERTICES ? out + (size_t)base * stride : partial;
+
+#if MESHCODEC_SIMD
+        const __m128i one = _mm_set1_epi8(1), low7 = _mm_set1_epi8(0x7F);
+        for (size_t k = 0; k < stride; k++)
+        {
+            int mode = (control[k / 4] >> ((k % 4) * 2)) & 3;
+            static const int modeBytes[4] = {0, 4, 8, 16};
+            if (read + modeBytes[mode] > end) return false;
+            __m128i x;
+            read += meshCodecLoadPlane(&x, mode, read);
+
+            __m128i delta = _mm_xor_si128(_mm_and_si128(_mm_srli_epi16(x, 1), low7), _mm_sub_epi8(_mm_setzero_si128(), _mm_and_si128(x, one)));
+            delta = _mm_add_epi8(delta, _mm_slli_si128(delta, 1));
+            delta = _mm_add_epi8(delta, _mm_slli_si128(delta, 2));
+            delta = _mm_add_epi8(delta, _mm_slli_si128(delta, 4));
+            delta = _mm_add_epi8(delta, _mm_slli_si128(delta, 8));
+            __m128i value = _mm_add_epi8(delta, _mm_set1_epi8((char)previous[k]));
+            _mm_store_si128((__m128i*)planes[k], value);
+            previous[k] = planes[k][MESHCODEC_BLOCK_VERTICES - 1];
+        }
+
+        // back to vertex order: 16 planes at a time give every vertex 16 contiguous bytes
+        size_t k = 0;
+        for (; k + 16 <= stride; k += 16)
+        {
+            __m128i words[4][4];
+            for (int g = 0; g < 4; g++) meshCodecInterleavePlanes(words[g], planes, k + g * 4);
+            for (int q = 0; q < 4; q++)
+            {
+                __m128 r0 = _mm_castsi128_ps(words[0][q]), r1 = _mm_castsi128_ps(words[1][q]);
+                __m128 r2 = _mm_castsi128_ps(words[2][q]), r3 = _mm_castsi128_ps(words[3][q]);
+                _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                _mm_storeu_ps((float*)(target + (q * 4) * stride + k), r0);
+                _mm_storeu_ps((float*)(target + (q * 4 + 1) * stride + k), r1);
+                _mm_storeu_ps((float*)(target + (q * 4 + 2) * stride + k), r2);
+                _mm_storeu_ps((float*)(target + (q * 4 + 3) * stride + k), r3);
+            }
+        }
+        for (; k < stride; k += 4)
+        {
+            __m128i words[4];
+            meshCodecInterleavePlanes(words, planes, k);
+            alignas(16) uint32_t lanes[MESHCODEC_BLOCK_VERTICES];
+            for (int q = 0; q < 4; q++) _mm_store_si128((__m128i*)(lanes + q * 4), words[q]);
+            for (int v = 0; v < MESHCODEC_BLOCK_VERTICES; v++)
+                memcpy(target + v * stride + k, &lanes[v], 4);
+        }
+#else
+        for (size_t k = 0; k < stride; k++)
+        {
+            int mode = (control[k / 4] >> ((k % 4) * 2)) & 3;
+            unsigned char values[MESHCODEC_BLOCK_VERTICES] = {0};
+            if (mode == 1)
+            {
+                if (read + 4 > end) return false;
+                for (int v = 0; v < MESHCODEC_BLOCK_VERTICES; v++) values[v] = (read[v % 4] >> ((v / 4) * 2)) & 3;
+                read += 4;
+            }
+            else if (mode == 2)
+            {
+                if (read + 8 > end) return false;
+                for (int v = 0; v < MESHCODEC_BLOCK_VERTICES; v++) values[v] = (read[v % 8] >> ((v / 8) * 4)) & 15;
+                read += 8;
+            }
+            else if (mode == 3)
+            {
+                if (read + 16 > end) return false;
+                memcpy(values, read, MESHCODEC_BLOCK_VERTICES);
+                read += 16;
+            }
+            unsigned char byte = previous[k];
+            for (int v = 0; v < MESHCODEC_BLOCK_VERTICES; v++)
+            {
+                byte += (unsigned char)((values[v] >> 1) ^ (0u - (values[v] & 1)));
+                target[v * stride + k] = byte;
+            }
+            previous[k] = byte;
+        }
+#endif
+        if (target == partial) memcpy(out + (size_t)base * stride, partial, count * stride);
+    }
+    return true;
+}
+
+// ---- benchmark ---------------------------------------------------------------------------------
+
+static double meshCodecElapsedNs(std::chrono::steady_clock::time_point start)
+{
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Encodes a tessellated sphere with the engine's vertex layout (position, normal, uv, tangent,
+// bitangent: 56 bytes) and reports size and decode throughput against a raw copy.
+void meshCodecBenchmark()
+{
+    const int rings = 512, segments = 1024;
+    const size_t stride = 14 * sizeof(float);
+    unsigned int numVertices = (rings + 1) * (segments + 1);
+    unsigned int numIndices = rings * segments * 6;
+    float* vertices = (float*)malloc(numVertices * stride);
+    unsigned int* indices = (unsigned int*)malloc(numIndices * sizeof(unsigned int));
+    for (int r = 0; r <= rings; r++)
+    {
+        for (int s = 0; s <= segments; s++)
+        {
+            float theta = 3.14159265f * r / rings, phi = 6.2831853f * s / segments;
+            float* v = vertices + (r * (segments + 1) + s) * 14;
+            float n[3] = {sinf(theta) * cosf(phi), sinf(theta) * sinf(phi), cosf(theta)};
+            float t[3] = {-sinf(phi), cosf(phi), 0.0f};
+            float b[3] = {n[1] * t[2] - n[2] * t[1], n[2] * t[0] - n[0] * t[2], n[0] * t[1] - n[1] * t[0]};
+            for (int c = 0; c < 3; c++)
+            {
+                v[c] = n[c] * 2.0f;
+                v[3 + c] = n[c];
+                v[8 + c] = t[c];
+                v[11 + c] = b[c];
+            }
+            v[6] = (float)s / segments;
+            v[7] = (float)r / rings;
+        }
+    }
+    unsigned int* index = indices;
+    for (int r = 0; r < rings; r++)
+    {
+        for (int s = 0; s < segments; s++)
+        {
+            unsigned int a = r * (segments + 1) + s, b = a + segments + 1;
+            *index++ = a; *index++ = b; *index++ = a + 1;
+            *index++ = a + 1; *index++ = b; *index++ = b + 1;
+        }
+    }
+
+    unsigned char* encodedVertices = (unsigned char*)malloc(meshCodecVertexBound(numVertices, stride));
+    unsigned char* encodedIndices = (unsigned char*)malloc(meshCodecIndexBound(numIndices));
+    size_t vertexBytes = meshCodecEncodeVertices(encodedVertices, vertices, numVertices, stride);
+    size_t indexBytes = meshCodecEncodeIndices(encodedIndices, indices, numIndices);
+
+    float* decodedVertices = (float*)malloc(numVertices * stride);
+    unsigned int* decodedIndices = (unsigned int*)malloc(numIndices * sizeof(unsigned int));
+    const int runs = 10;
+    double best[4] = {1e30, 1e30, 1e30, 1e30};
+    bool ok = true;
+    for (int run = 0; run < runs; run++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        memcpy(decodedVertices, vertices, numVertices * stride);
+        best[0] = fmin(best[0], meshCodecElapsedNs(start));
+
+        start = std::chrono::steady_clock::now();
+        ok &= meshCodecDecodeVertices(decodedVertices, numVertices, stride, encodedVertices, vertexBytes);
+        best[1] = fmin(best[1], meshCodecElapsedNs(start));
+
+        start = std::chrono::steady_clock::now();
+        memcpy(decodedIndices, indices, numIndices * sizeof(unsigned int));
+        best[2] = fmin(best[2], meshCodecElapsedNs(start));
+
+        start = std::chrono::steady_clock::now();
+        ok &= meshCodecDecodeIndices(decodedIndices, numIndices, encodedIndices, indexBytes);
+        best[3] = fmin(best[3], meshCodecElapsedNs(start));
+    }
+    ok &= memcmp(decodedVertices, vertices, numVertices * stride) == 0;
+    ok &= memcmp(decodedIndices, indices, numIndices * sizeof(unsigned int)) == 0;
+
+    double rawVertexBytes = (double)numVertices * stride, rawIndexBytes = (double)numIndices * sizeof(unsigned int);
+    printf("mesh codec benchmark: %u vertices, %u indices, SIMD %d (SSSE3 indices %s), best of %d runs\n", numVertices, numIndices,
+           MESHCODEC_SIMD, MESHCODEC_SIMD && cpuFeatures().ssse3 ? "yes" : "no", runs);
+    printf("  %-8s %12s %12s %7s %14s %14s\n", "stream", "raw bytes", "encoded", "ratio", "memcpy GB/s", "decode GB/s");
+    printf("  %-8s %12.0f %12zu %7.3f %14.2f %14.2f\n", "vertices", rawVertexBytes, vertexBytes, vertexBytes / rawVertexBytes,
+           rawVertexBytes / best[0], rawVertexBytes / best[1]);
+    printf("  %-8s %12.0f %12zu %7.3f %14.2f %14.2f\n", "indices", rawIndexBytes, indexBytes, indexBytes / rawIndexBytes,
+           rawIndexBytes / best[2], rawIndexBytes / best[3]);
+    printf("  round trip %s\n", ok ? "ok" : "FAILED");
+
+    free(vertices);
+    free(indices);
+    free(encodedVertices);
+    free(encodedIndices);
+    free(decodedVertices);
+    free(decodedIndices);
+}
+
+#endif
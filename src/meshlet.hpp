@@ -0,0 +1,307 @@
+#ifndef MESHLET_H
+#define MESHLET_H
+#include <glad/glad.h>
+#include "../thirdparty/glm/glm.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include "frustum.hpp"
+#include "meshopt.hpp"
+
+// Meshlets: small clusters of up to MESHLET_MAX_VERTICES vertices / MESHLET_MAX_TRIANGLES triangles.
+// buildMeshlets reorders a mesh's triangles so every cluster is a contiguous index range and records
+// a bounding sphere and a normal cone per cluster. Each frame meshletCull drops clusters that are
+// outside the frustum or face entirely away from the camera and writes one indirect draw command per
+// survivor, so a single large mesh is culled piece by piece and still drawn with one
+// glMultiDrawElementsIndirect.
+
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+
+struct Meshlet {
+    unsigned int indexOffset;   // into the mesh index buffer (LOD 0)
+    unsigned int indexCount;
+    glm::vec3 center;           // bounding sphere, mesh space
+    float radius;
+    glm::vec3 coneAxis;         // average facing direction
+    float coneCutoff;           // sine of the cone half-angle; 1 = never backface culled
+};
+
+// Same layout as the GL DrawElementsIndirectCommand
+struct MeshletDrawCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+static glm::vec3 meshletPosition(const float* positions, size_t stride, unsigned int v)
+{
+    const float* p = (const float*)((const char*)positions + v * stride);
+    return glm::vec3(p[0], p[1], p[2]);
+}
+
+static void meshletComputeBounds(Meshlet* meshlet, const unsigned int* indices, const float* positions, size_t stride)
+{
+    glm::vec3 minP(FLT_MAX), maxP(-FLT_MAX);
+    glm::vec3 normalSum(0.0f);
+    for (unsigned int i = 0; i < meshlet->indexCount; i += 3)
+    {
+        glm::vec3 p0 = meshletPosition(positions, stride, indices[i]);
+        glm::vec3 p1 = meshletPosition(positions, stride, indices[i + 1]);
+        glm::vec3 p2 = meshletPosition(positions, stride, indices[i + 2]);
+        minP = glm::min(minP, glm::min(p0, glm::min(p1, p2)));
+        maxP = glm::max(maxP, glm::max(p0, glm::max(p1, p2)));
+        glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+        float length = glm::length(n);
+        if (length > 0.0f) normalSum += n / length;
+    }
+
+    meshlet->center = (minP + maxP) * 0.5f;
+    meshlet->radius = 0.0f;
+    for (unsigned int i = 0; i < meshlet->indexCount; i++)
+        meshlet->radius = glm::max(meshlet->radius, glm::distance(meshlet->center, meshletPosition(positions, stride, indices[i])));
+
+    meshlet->coneCutoff = 1.0f;
+    meshlet->coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+    float axisLength = glm::length(normalSum);
+    if (axisLength == 0.0f) return;
+    meshlet->coneAxis = normalSum / axisLength;
+
+    float minDot = 1.0f;
+    for (unsigned int i = 0; i < meshlet->indexCount; i += 3)
+    {
+        glm::vec3 p0 = meshletPosition(positions, stride, indices[i]);
+        glm::vec3 p1 = meshletPosition(positions, stride, indices[i + 1]);
+        glm::vec3 p2 = meshletPosition(positions, stride, indices[i + 2]);
+        glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+        float length = glm::length(n);
+        if (length > 0.0f) minDot = glm::min(minDot, glm::dot(n / length, meshlet->coneAxis));
+    }
+    // normals spread over more than a hemisphere: the cluster is visible from everywhere
+    if (minDot > 0.0f) meshlet->coneCutoff = sqrtf(1.0f - minDot * minDot);
+}
+
+// Greedily grows clusters over shared vertices: the next triangle is the neighbour that adds the
+// fewest new vertices, ties going to the one facing closest to the cluster so far. Reorders
+// indices[0, numIndices) in place and returns the number of meshlets written to *outMeshlets (malloc'd).
+int buildMeshlets(unsigned int* indices, unsigned int numIndices, const float* positions, size_t stride,
+                  unsigned int numVertices, Meshlet** outMeshlets)
+{
+    unsigned int numTriangles = numIndices / 3;
+    *outMeshlets = NULL;
+    if (numTriangles == 0) return 0;
+
+    // triangles around each vertex
+    unsigned int* triOffsets = (unsigned int*)calloc(numVertices + 1, sizeof(unsigned int));
+    unsigned int* triList = (unsigned int*)malloc(numIndices * sizeof(unsigned int));
+    for (unsigned int i = 0; i < numIndices; i++) triOffsets[indices[i] + 1]++;
+    for (unsigned int v = 0; v < numVertices; v++) triOffsets[v + 1] += triOffsets[v];
+    unsigned int* cursor = (unsigned int*)malloc(numVertices * sizeof(unsigned int));
+    memcpy(cursor, triOffsets, numVertices * sizeof(unsigned int));
+    for (unsigned int i = 0; i < numIndices; i++) triList[cursor[indices[i]]++] = i / 3;
+    free(cursor);
+
+    glm::vec3* normals = (glm::vec3*)malloc(numTriangles * sizeof(glm::vec3));
+    for (unsigned int t = 0; t < numTriangles; t++)
+    {
+        glm::vec3 p0 = meshletPosition(positions, stride, indices[t * 3]);
+        glm::vec3 p1 = meshletPosition(positions, stride, indices[t * 3 + 1]);
+        glm::vec3 p2 = meshletPosition(positions, stride, indices[t * 3 + 2]);
+        glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+        float length = glm::length(n);
+        normals[t] = length > 0.0f ? n / length : glm::vec3(0.0f);
+    }
+
+    unsigned char* used = (unsigned char*)calloc(numTriangles, 1);
+    int* vertexMeshlet = (int*)malloc(numVertices * sizeof(int)); // meshlet that last took the vertex
+    for (unsigned int v = 0; v < numVertices; v++) vertexMeshlet[v] = -1;
+
+    unsigned int* ordered = (unsigned int*)malloc(numIndices * sizeof(unsigned int));
+    int capacity = (numTriangles + MESHLET_MAX_TRIANGLES - 1) / MESHLET_MAX_TRIANGLES * 2;
+    Meshlet* meshlets = (Meshlet*)malloc(capacity * sizeof(Meshlet));
+    int numMeshlets = 0;
+    unsigned int written = 0;
+    unsigned int seed = 0;
+
+    while (written < numIndices)
+    {
+        while (used[seed]) seed++;
+        if (numMeshlets == capacity)
+        {
+            capacity *= 2;
+            meshlets = (Meshlet*)realloc(meshlets, capacity * sizeof(Meshlet));
+        }
+        Meshlet* meshlet = &meshlets[numMeshlets];
+        meshlet->indexOffset = written;
+        unsigned int meshletVertices[MESHLET_MAX_VERTICES];
+        int numMeshletVertices = 0;
+        int numMeshletTriangles = 0;
+        glm::vec3 facing(0.0f);
+
+        unsigned int next = seed;
+        while (next != ~0u)
+        {
+            used[next] = 1;
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int v = indices[next * 3 + k];
+                if (vertexMeshlet[v] != numMeshlets)
+                {
+                    vertexMeshlet[v] = numMeshlets;
+                    meshletVertices[numMeshletVertices++] = v;
+                }
+                ordered[written++] = v;
+            }
+            numMeshletTriangles++;
+            facing += normals[next];
+            if (numMeshletTriangles == MESHLET_MAX_TRIANGLES) break;
+
+            // best unused neighbour that still fits
+            next = ~0u;
+            int bestNew = 4;
+            float bestFacing = -FLT_MAX;
+            for (int i = 0; i < numMeshletVertices; i++)
+            {
+                unsigned int v = meshletVertices[i];
+                for (unsigned int t = triOffsets[v]; t < triOffsets[v + 1]; t++)
+                {
+                    unsigned int tri = triList[t];
+                    if (used[tri]) continue;
+                    int newVertices = 0;
+                    for (int k = 0; k < 3; k++)
+                        newVertices += vertexMeshlet[indices[tri * 3 + k]] != numMeshlets;
+                    if (numMeshletVertices + newVertices > MESHLET_MAX_VERTICES) continue;
+                    float alignment = glm::dot(normals[tri], facing);
+                    if (newVertices < bestNew || (newVertices == bestNew && alignment > bestFacing))
+                    {
+                        next = tri;
+                        bestNew = newVertices;
+                        bestFacing = alignment;
+                    }
+                }
+            }
+        }
+
+        meshlet->indexCount = written - meshlet->indexOffset;
+        numMeshlets++;
+    }
+
+    memcpy(indices, ordered, numIndices * sizeof(unsigned int));
+    for (int m = 0; m < numMeshlets; m++)
+        meshletComputeBounds(&meshlets[m], indices + meshlets[m].indexOffset, positions, stride);
+
+    free(triOffsets);
+    free(triList);
+    free(normals);
+    free(used);
+    free(vertexMeshlet);
+    free(ordered);
+    *outMeshlets = meshlets;
+    return numMeshlets;
+}
+
+// Orders the triangles inside every meshlet for the vertex cache and sorts the meshlets themselves
+// for overdraw (see meshopt.hpp). Meshlets keep their triangles; their offsets are updated.
+void meshletOptimize(unsigned int* indices, Meshlet* meshlets, int numMeshlets, const float* positions, size_t stride, unsigned int numVertices)
+{
+    if (numMeshlets == 0) return;
+    unsigned int* offsets = (unsigned int*)malloc(numMeshlets * sizeof(unsigned int));
+    unsigned int* counts = (unsigned int*)malloc(numMeshlets * sizeof(unsigned int));
+    for (int m = 0; m < numMeshlets; m++)
+    {
+        offsets[m] = meshlets[m].indexOffset;
+        counts[m] = meshlets[m].indexCount;
+    }
+    meshOptVertexCacheRanges(indices, offsets, counts, numMeshlets, numVertices, MESHOPT_CACHE_SIZE);
+
+    unsigned int numIndices = offsets[numMeshlets - 1] + counts[numMeshlets - 1];
+    unsigned int* order = (unsigned int*)malloc(numMeshlets * sizeof(unsigned int));
+    meshOptOverdraw(indices, numIndices, positions, stride, offsets, numMeshlets, order);
+
+    Meshlet* sorted = (Meshlet*)malloc(numMeshlets * sizeof(Meshlet));
+    unsigned int offset = 0;
+    for (int m = 0; m < numMeshlets; m++)
+    {
+        sorted[m] = meshlets[order[m]];
+        sorted[m].indexOffset = offset;
+        offset += sorted[m].indexCount;
+    }
+    memcpy(meshlets, sorted, numMeshlets * sizeof(Meshlet));
+
+    free(offsets);
+    free(counts);
+    free(order);
+    free(sorted);
+}
+
+// Tests meshlets placed with `world` (uniform scale `scale`) against the frustum and the camera
+// position and appends a draw command for each visible one. Returns how many were appended.
+int meshletCull(const Meshlet* meshlets, int numMeshlets, const glm::mat4& world, float scale,
+                const Frustum& frustum, const glm::vec3& cameraPosition, MeshletDrawCommand* out)
+{
+    int visible = 0;
+    for (int m = 0; m < numMeshlets; m++)
+    {
+        const Meshlet& meshlet = meshlets[m];
+        glm::vec3 center = glm::vec3(world * glm::vec4(meshlet.center, 1.0f));
+        float radius = meshlet.radius * scale;
+        if (!frustumTestSphere(frustum, center, radius)) continue;
+
+        if (meshlet.coneCutoff < 1.0f)
+        {
+            // every triangle faces away if the whole sphere is behind the cone
+            glm::vec3 axis = glm::normalize(glm::vec3(world * glm::vec4(meshlet.coneAxis, 0.0f)));
+            glm::vec3 toCenter = center - cameraPosition;
+            if (glm::dot(toCenter, axis) >= meshlet.coneCutoff * glm::length(toCenter) + radius) continue;
+        }
+
+        out[visible++] = {meshlet.indexCount, 1, meshlet.indexOffset, 0, 0};
+    }
+    return visible;
+}
+
+// Frame-local storage for culled draw commands and the GL buffer they are submitted from.
+struct MeshletRenderer {
+    unsigned int indirectBuffer;
+    MeshletDrawCommand* commands;
+    int numCommands;
+    int capacity;
+};
+
+void meshletRendererInit(MeshletRenderer* renderer)
+{
+    memset(renderer, 0, sizeof(*renderer));
+    glGenBuffers(1, &renderer->indirectBuffer);
+}
+
+// Returns room for `count` more commands.
+MeshletDrawCommand* meshletRendererReserve(MeshletRenderer* renderer, int count)
+{
+    if (renderer->numCommands + count > renderer->capacity)
+    {
+        renderer->capacity = (renderer->numCommands + count) * 2;
+        renderer->commands = (MeshletDrawCommand*)realloc(renderer->commands, renderer->capacity * sizeof(MeshletDrawCommand));
+    }
+    return renderer->commands + renderer->numCommands;
+}
+
+// Uploads every command recorded this frame in one go and leaves the buffer bound for drawing.
+void meshletRendererUpload(MeshletRenderer* renderer)
+{
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, renderer->indirectBuffer);
+    size_t size = renderer->numCommands * sizeof(MeshletDrawCommand);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, size, NULL, GL_STREAM_DRAW); // orphan
+    glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, size, renderer->commands);
+}
+
+void meshletRendererDestroy(MeshletRenderer* renderer)
+{
+    glDeleteBuffers(1, &renderer->indirectBuffer);
+    free(renderer->commands);
+    memset(renderer, 0, sizeof(*renderer));
+}
+
+#endif
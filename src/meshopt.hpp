@@ -0,0 +1,431 @@
+#ifndef MESHOPT_H
+#define MESHOPT_H
+#include "../thirdparty/glm/glm.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <algorithm>
+
+// Post-import index and vertex ordering, and the metrics that show whether it worked.
+// meshOptVertexCache reorders triangles for the post-transform vertex cache (Tipsify: fan around a
+// vertex that is still cached, fall back to the most recent dead end). The runs it produces are split
+// further by meshOptSplitClusters and sorted by meshOptOverdraw so triangles facing out of the mesh
+// draw first and hide the ones behind them. meshOptVertexFetch then renumbers vertices in order of
+// first use so the vertex fetch walks the VBO forwards.
+// meshOptAnalyzeCache / meshOptAnalyzeOverdraw measure ACMR, ATVR and overdraw on a FIFO cache and
+// a small software rasterizer, for the before/after report.
+
+#define MESHOPT_CACHE_SIZE 16            // post-transform cache entries assumed when ordering and measuring
+#define MESHOPT_OVERDRAW_THRESHOLD 1.05f // a cluster may split once its ACMR is within this factor of the whole run's
+#define MESHOPT_OVERDRAW_GRID 256        // resolution of each overdraw analysis view
+
+struct MeshOptStats {
+    float acmr;      // cache misses per triangle: 3 is no reuse, around 0.5-0.7 is good for a regular mesh
+    float atvr;      // cache misses per referenced vertex: 1 is ideal
+    float overdraw;  // pixels shaded per pixel covered, over six axis-aligned views
+};
+
+static glm::vec3 meshOptPosition(const float* positions, size_t stride, unsigned int v)
+{
+    const float* p = (const float*)((const char*)positions + v * stride);
+    return glm::vec3(p[0], p[1], p[2]);
+}
+
+// FIFO cache simulation. cacheTime is per vertex and starts zeroed; time starts at cacheSize and
+// advances once per miss, so a vertex is cached while fewer than cacheSize misses happened since it was
+// loaded. Returns the time after the last index (misses = returned time - starting time).
+static unsigned int meshOptSimulateCache(const unsigned int* indices, unsigned int numIndices, unsigned int* cacheTime,
+                                         unsigned int time, int cacheSize)
+{
+    for (unsigned int i = 0; i < numIndices; i++)
+    {
+        unsigned int v = indices[i];
+        if (time - cacheTime[v] >= (unsigned int)cacheSize) cacheTime[v] = time++;
+    }
+    return time;
+}
+
+// Tipsify on vertices already numbered 0..numVertices-1. Writes the start of every run that began at
+// a dead end to clusters (if not NULL) and returns how many runs there are.
+static int meshOptTipsify(unsigned int* destination, const unsigned int* indices, unsigned int numIndices,
+                          unsigned int numVertices, int cacheSize, unsigned int* clusters)
+{
+    unsigned int numTriangles = numIndices / 3;
+    if (numTriangles == 0) return 0;
+
+    // triangles around each vertex
+    unsigned int* offsets = (unsigned int*)calloc(numVertices + 1, sizeof(unsigned int));
+    unsigned int* adjacency = (unsigned int*)malloc(numIndices * sizeof(unsigned int));
+    unsigned int* live = (unsigned int*)malloc(numVertices * sizeof(unsigned int));
+    for (unsigned int i = 0; i < numIndices; i++) offsets[indices[i] + 1]++;
+    for (unsigned int v = 0; v < numVertices; v++)
+    {
+        live[v] = offsets[v + 1];
+        offsets[v + 1] += offsets[v];
+    }
+    unsigned int* cursor = (unsigned int*)malloc(numVertices * sizeof(unsigned int));
+    memcpy(cursor, offsets, numVertices * sizeof(unsigned int));
+    for (unsigned int i = 0; i < numIndices; i++) adjacency[cursor[indices[i]]++] = i / 3;
+    free(cursor);
+
+    unsigned int* cacheTime = (unsigned int*)calloc(numVertices, sizeof(unsigned int));
+    unsigned char* emitted = (unsigned char*)calloc(numTriangles, 1);
+    unsigned int* deadEnd = (unsigned int*)malloc(numIndices * sizeof(unsigned int));
+    unsigned int deadEndTop = 0;
+    unsigned int time = cacheSize + 1;
+    unsigned int scan = 0;
+    unsigned int written = 0;
+    int numClusters = 0;
+
+    while (scan < numVertices && live[scan] == 0) scan++;
+    unsigned int fan = scan;
+    if (clusters) clusters[numClusters] = 0;
+    numClusters++;
+
+    while (fan != ~0u)
+    {
+        // emit every remaining triangle around the fanning vertex; their vertices are the candidates
+        unsigned int candidates = deadEndTop;
+        for (unsigned int a = offsets[fan]; a < offsets[fan + 1]; a++)
+        {
+            unsigned int tri = adjacency[a];
+            if (emitted[tri]) continue;
+            emitted[tri] = 1;
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int v = indices[tri * 3 + k];
+                destination[written++] = v;
+                deadEnd[deadEndTop++] = v;
+                live[v]--;
+                if (time - cacheTime[v] > (unsigned int)cacheSize) cacheTime[v] = time++;
+            }
+        }
+
+        // the oldest candidate that stays cached while its remaining triangles are emitted
+        unsigned int next = ~0u;
+        int bestPriority = -1;
+        for (unsigned int c = candidates; c < deadEndTop; c++)
+        {
+            unsigned int v = deadEnd[c];
+            if (live[v] == 0) continue;
+            int priority = 0;
+            if (time - cacheTime[v] + 2 * live[v] <= (unsigned int)cacheSize) priority = (int)(time - cacheTime[v]);
+            if (priority > bestPriority)
+            {
+                next = v;
+                bestPriority = priority;
+            }
+        }
+
+        if (next == ~0u)
+        {
+            // dead end: most recently used vertex with triangles left, else the next one in input order
+            while (deadEndTop > 0 && next == ~0u)
+            {
+                unsigned int v = deadEnd[--deadEndTop];
+                if (live[v] > 0) next = v;
+            }
+            while (next == ~0u && scan < numVertices)
+            {
+                if (live[scan] > 0) next = scan;
+                else scan++;
+            }
+            if (next != ~0u)
+            {
+                if (clusters) clusters[numClusters] = written;
+                numClusters++;
+            }
+        }
+        fan = next;
+    }
+
+    free(offsets);
+    free(adjacency);
+    free(live);
+    free(cacheTime);
+    free(emitted);
+    free(deadEnd);
+    return numClusters;
+}
+
+// Tipsify on one range, with its vertices renumbered through localIds (all ~0u on entry and on exit).
+static int meshOptVertexCacheRange(unsigned int* indices, unsigned int numIndices, unsigned int* localIds,
+                                   int cacheSize, unsigned int* clusters)
+{
+    unsigned int* local = (unsigned int*)malloc(numIndices * sizeof(unsigned int));
+    unsigned int* global = (unsigned int*)malloc(numIndices * sizeof(unsigned int));
+    unsigned int* ordered = (unsigned int*)malloc(numIndices * sizeof(unsigned int));
+    unsigned int numLocal = 0;
+    for (unsigned int i = 0; i < numIndices; i++)
+    {
+        unsigned int v = indices[i];
+        if (localIds[v] == ~0u)
+        {
+            localIds[v] = numLocal;
+            global[numLocal++] = v;
+        }
+        local[i] = localIds[v];
+    }
+
+    int numClusters = meshOptTipsify(ordered, local, numIndices, numLocal, cacheSize, clusters);
+    for (unsigned int i = 0; i < numIndices; i++) indices[i] = global[ordered[i]];
+    for (unsigned int v = 0; v < numLocal; v++) localIds[global[v]] = ~0u;
+
+    free(local);
+    free(global);
+    free(ordered);
+    return numClusters;
+}
+
+// Reorders the triangles of indices[0, numIndices) in place for a cache of cacheSize entries. Writes the
+// start of every run that began at a dead end (where the cache is effectively cold) to clusters, which
+// needs room for numIndices / 3, when it is not NULL. Returns the number of runs.
+int meshOptVertexCache(unsigned int* indices, unsigned int numIndices, unsigned int numVertices, int cacheSize,
+                       unsigned int* clusters)
+{
+    unsigned int* localIds = (unsigned int*)malloc(numVertices * sizeof(unsigned int));
+    memset(localIds, 0xff, numVertices * sizeof(unsigned int));
+    int numClusters = meshOptVertexCacheRange(indices, numIndices, localIds, cacheSize, clusters);
+    free(localIds);
+    return numClusters;
+}
+
+// Same, for independent ranges [offsets[r], offsets[r] + counts[r]) that must keep their triangles (meshlets).
+void meshOptVertexCacheRanges(unsigned int* indices, const unsigned int* offsets, const unsigned int* counts, int numRanges,
+                              unsigned int numVertices, int cacheSize)
+{
+    unsigned int* localIds = (unsigned int*)malloc(numVertices * sizeof(unsigned int));
+    memset(localIds, 0xff, numVertices * sizeof(unsigned int));
+    for (int r = 0; r < numRanges; r++)
+        meshOptVertexCacheRange(indices + offsets[r], counts[r], localIds, cacheSize, NULL);
+    free(localIds);
+}
+
+// Splits each cluster (start offsets, ascending) wherever the triangles since the last split already
+// reach the cluster's own cache efficiency within threshold, so the overdraw sort gets smaller pieces
+// that cost almost no cache reuse. Writes the new starts to outClusters (room for numIndices / 3) and
+// returns how many there are.
+int meshOptSplitClusters(unsigned int* outClusters, const unsigned int* indices, unsigned int numIndices, unsigned int numVertices,
+                         const unsigned int* clusters, int numClusters, int cacheSize, float threshold)
+{
+    unsigned int* cacheTime = (unsigned int*)calloc(numVertices, sizeof(unsigned int));
+    unsigned int time = cacheSize;
+    int count = 0;
+    for (int c = 0; c < numClusters; c++)
+    {
+        unsigned int start = clusters[c];
+        unsigned int end = c + 1 < numClusters ? clusters[c + 1] : numIndices;
+
+        // a cold cache at every cluster start: advancing time by cacheSize expires every entry
+        time += cacheSize;
+        unsigned int begin = time;
+        time = meshOptSimulateCache(indices + start, end - start, cacheTime, time, cacheSize);
+        float clusterAcmr = (float)(time - begin) / ((end - start) / 3);
+
+        time += cacheSize;
+        unsigned int runStart = start;
+        unsigned int runTime = time;
+        outClusters[count++] = start;
+        for (unsigned int i = start; i < end; i += 3)
+        {
+            time = meshOptSimulateCache(indices + i, 3, cacheTime, time, cacheSize);
+            float runAcmr = (float)(time - runTime) / ((i + 3 - runStart) / 3);
+            if (i + 3 < end && runAcmr <= clusterAcmr * threshold)
+            {
+                outClusters[count++] = i + 3;
+                runStart = i + 3;
+                time += cacheSize;
+                runTime = time;
+            }
+        }
+    }
+    free(cacheTime);
+    return count;
+}
+
+// Sorts clusters (start offsets, ascending) so the ones facing away from the mesh centre come first:
+// those are the outer surfaces, and drawing them early lets depth testing reject what is behind them.
+// Triangle order inside a cluster is kept. Writes the old index of every cluster in its new position
+// to order (if not NULL).
+void meshOptOverdraw(unsigned int* indices, unsigned int numIndices, const float* positions, size_t stride,
+                     const unsigned int* clusters, int numClusters, unsigned int* order)
+{
+    if (numClusters == 0) return;
+
+    glm::vec3 meshCenter(0.0f);
+    float meshArea = 0.0f;
+    glm::vec3* centers = (glm::vec3*)malloc(numClusters * sizeof(glm::vec3));
+    glm::vec3* normals = (glm::vec3*)malloc(numClusters * sizeof(glm::vec3));
+    for (int c = 0; c < numClusters; c++)
+    {
+        unsigned int start = clusters[c];
+        unsigned int end = c + 1 < numClusters ? clusters[c + 1] : numIndices;
+        glm::vec3 center(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for (unsigned int i = start; i < end; i += 3)
+        {
+            glm::vec3 p0 = meshOptPosition(positions, stride, indices[i]);
+            glm::vec3 p1 = meshOptPosition(positions, stride, indices[i + 1]);
+            glm::vec3 p2 = meshOptPosition(positions, stride, indices[i + 2]);
+            glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+            float triangleArea = glm::length(n);
+            center += (p0 + p1 + p2) * (triangleArea / 3.0f);
+            normal += n;
+            area += triangleArea;
+        }
+        meshCenter += center;
+        meshArea += area;
+        centers[c] = area > 0.0f ? center / area : meshOptPosition(positions, stride, indices[start]);
+        float length = glm::length(normal);
+        normals[c] = length > 0.0f ? normal / length : glm::vec3(0.0f);
+    }
+    if (meshArea > 0.0f) meshCenter /= meshArea;
+
+    float* keys = (float*)malloc(numClusters * sizeof(float));
+    unsigned int* sorted = (unsigned int*)malloc(numClusters * sizeof(unsigned int));
+    for (int c = 0; c < numClusters; c++)
+    {
+        keys[c] = glm::dot(centers[c] - meshCenter, normals[c]);
+        sorted[c] = c;
+    }
+    std::stable_sort(sorted, sorted + numClusters, [keys](unsigned int a, unsigned int b) { return keys[a] > keys[b]; });
+
+    unsigned int* ordered = (unsigned int*)malloc(numIndices * sizeof(unsigned int));
+    unsigned int written = 0;
+    for (int c = 0; c < numClusters; c++)
+    {
+        unsigned int start = clusters[sorted[c]];
+        unsigned int end = sorted[c] + 1 < (unsigned int)numClusters ? clusters[sorted[c] + 1] : numIndices;
+        memcpy(ordered + written, indices + start, (end - start) * sizeof(unsigned int));
+        written += end - start;
+    }
+    memcpy(indices, ordered, numIndices * sizeof(unsigned int));
+    if (order) memcpy(order, sorted, numClusters * sizeof(unsigned int));
+
+    free(centers);
+    free(normals);
+    free(keys);
+    free(sorted);
+    free(ordered);
+}
+
+// Full pass over one independent index range (an LOD level): vertex cache order, then the resulting
+// runs split and sorted for overdraw.
+void meshOptOptimize(unsigned int* indices, unsigned int numIndices, const float* positions, size_t stride, unsigned int numVertices)
+{
+    if (numIndices < 3) return;
+    unsigned int* clusters = (unsigned int*)malloc((numIndices / 3) * sizeof(unsigned int));
+    unsigned int* split = (unsigned int*)malloc((numIndices / 3) * sizeof(unsigned int));
+    int numClusters = meshOptVertexCache(indices, numIndices, numVertices, MESHOPT_CACHE_SIZE, clusters);
+    int numSplit = meshOptSplitClusters(split, indices, numIndices, numVertices, clusters, numClusters, MESHOPT_CACHE_SIZE, MESHOPT_OVERDRAW_THRESHOLD);
+    meshOptOverdraw(indices, numIndices, positions, stride, split, numSplit, NULL);
+    free(clusters);
+    free(split);
+}
+
+// Renumbers vertices in order of first use. remap[old] is the new index (unreferenced vertices go
+// last, in their old order); indices are rewritten. Returns the number of referenced vertices.
+unsigned int meshOptVertexFetch(unsigned int* remap, unsigned int* indices, unsigned int numIndices, unsigned int numVertices)
+{
+    memset(remap, 0xff, numVertices * sizeof(unsigned int));
+    unsigned int next = 0;
+    for (unsigned int i = 0; i < numIndices; i++)
+    {
+        unsigned int v = indices[i];
+        if (remap[v] == ~0u) remap[v] = next++;
+        indices[i] = remap[v];
+    }
+    unsigned int referenced = next;
+    for (unsigned int v = 0; v < numVertices; v++)
+        if (remap[v] == ~0u) remap[v] = next++;
+    return referenced;
+}
+
+void meshOptAnalyzeCache(MeshOptStats* stats, const unsigned int* indices, unsigned int numIndices, unsigned int numVertices, int cacheSize)
+{
+    unsigned int* cacheTime = (unsigned int*)calloc(numVertices, sizeof(unsigned int));
+    unsigned int misses = meshOptSimulateCache(indices, numIndices, cacheTime, cacheSize, cacheSize) - cacheSize;
+    unsigned int referenced = 0;
+    for (unsigned int v = 0; v < numVertices; v++) referenced += cacheTime[v] != 0;
+    free(cacheTime);
+
+    stats->acmr = numIndices >= 3 ? (float)misses / (numIndices / 3) : 0.0f;
+    stats->atvr = referenced > 0 ? (float)misses / referenced : 0.0f;
+}
+
+// Rasterizes the front faces into a depth buffer from each side of the bounding box, counting every
+// pixel that passes the depth test. Returns shaded / covered pixels over all six views (1 = no overdraw).
+float meshOptAnalyzeOverdraw(const unsigned int* indices, unsigned int numIndices, const float* positions, size_t stride)
+{
+    if (numIndices < 3) return 0.0f;
+
+    glm::vec3 minP(FLT_MAX), maxP(-FLT_MAX);
+    for (unsigned int i = 0; i < numIndices; i++)
+    {
+        glm::vec3 p = meshOptPosition(positions, stride, indices[i]);
+        minP = glm::min(minP, p);
+        maxP = glm::max(maxP, p);
+    }
+    glm::vec3 extent = maxP - minP;
+    float size = glm::max(extent.x, glm::max(extent.y, extent.z));
+    if (size <= 0.0f) return 0.0f;
+    float scale = (MESHOPT_OVERDRAW_GRID - 1) / size;
+
+    const int grid = MESHOPT_OVERDRAW_GRID;
+    float* depth = (float*)malloc(grid * grid * sizeof(float));
+    unsigned long long shaded = 0, covered = 0;
+    for (int view = 0; view < 6; view++)
+    {
+        int axis = view >> 1;
+        float direction = (view & 1) ? -1.0f : 1.0f;  // looking along +axis or -axis
+        int uAxis = (axis + 1) % 3, vAxis = (axis + 2) % 3;
+        for (int p = 0; p < grid * grid; p++) depth[p] = FLT_MAX;
+
+        for (unsigned int i = 0; i + 2 < numIndices; i += 3)
+        {
+            glm::vec3 p[3];
+            for (int k = 0; k < 3; k++) p[k] = (meshOptPosition(positions, stride, indices[i + k]) - minP) * scale;
+            glm::vec3 n = glm::cross(p[1] - p[0], p[2] - p[0]);
+            if (n[axis] * direction >= 0.0f) continue;  // back facing from this side
+
+            float x[3], y[3], z[3];
+            for (int k = 0; k < 3; k++)
+            {
+                x[k] = p[k][uAxis];
+                y[k] = p[k][vAxis];
+                z[k] = p[k][axis] * direction;
+            }
+            float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+            if (area == 0.0f) continue;
+            float invArea = 1.0f / area;
+
+            int x0 = glm::max(0, (int)glm::min(x[0], glm::min(x[1], x[2])));
+            int x1 = glm::min(grid - 1, (int)glm::max(x[0], glm::max(x[1], x[2])));
+            int y0 = glm::max(0, (int)glm::min(y[0], glm::min(y[1], y[2])));
+            int y1 = glm::min(grid - 1, (int)glm::max(y[0], glm::max(y[1], y[2])));
+            for (int py = y0; py <= y1; py++)
+            {
+                for (int px = x0; px <= x1; px++)
+                {
+                    float cx = px + 0.5f, cy = py + 0.5f;
+                    // barycentrics; the sign of area cancels so both windings work
+                    float w0 = ((x[1] - cx) * (y[2] - cy) - (x[2] - cx) * (y[1] - cy)) * invArea;
+                    float w1 = ((x[2] - cx) * (y[0] - cy) - (x[0] - cx) * (y[2] - cy)) * invArea;
+                    float w2 = 1.0f - w0 - w1;
+                    if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f) continue;
+                    float d = w0 * z[0] + w1 * z[1] + w2 * z[2];
+                    float& stored = depth[py * grid + px];
+                    if (d >= stored) continue;
+                    covered += stored == FLT_MAX;
+                    stored = d;
+                    shaded++;
+                }
+            }
+        }
+    }
+    free(depth);
+    return covered > 0 ? (float)shaded / covered : 0.0f;
+}
+
+#endif
@@ -4,9 +4,20 @@
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <assimp/IOStream.hpp>
+#include <assimp/IOSystem.hpp>
 #include "mesh.hpp"
+#include "materials.hpp"
 #include "shader.hpp"
 #include "texture.hpp"
+#include "scenegraph.hpp"
+#include "transforms.hpp"
+#include "frustum.hpp"
+#include "meshlet.hpp"
+#include "meshopt.hpp"
+#include "meshcache.hpp"
+#include "bvh.hpp"
+#include "profiler.hpp"
 
 #define MAX_TEXTURES 64
 
@@ -23,60 +34,344 @@
     aiProcess_CalcTangentSpace |         \
     aiProcess_FlipUVs)
 
+// Assimp reads the model and the files it references (.mtl) through the VFS, so packed entries are
+// copied out of the mapping instead of opened. Give an importer one with SetIOHandler(new VfsIOSystem()).
+struct VfsIOStream : public Assimp::IOStream
+{
+    VfsFile file;
+    size_t position = 0;
+
+    ~VfsIOStream() override { vfsClose(&file); }
+
+    size_t Read(void* buffer, size_t size, size_t count) override
+    {
+        if (size == 0) return 0;
+        size_t available = (file.size - position) / size;
+        if (count > available) count = available;
+        memcpy(buffer, file.data + position, size * count);
+        position += size * count;
+        return count;
+    }
+    size_t Write(const void*, size_t, size_t) override { return 0; }
+    aiReturn Seek(size_t offset, aiOrigin origin) override
+    {
+        size_t base = origin == aiOrigin_SET ? 0 : origin == aiOrigin_CUR ? position : file.size;
+        if (offset > file.size - base) return aiReturn_FAILURE;
+        position = base + offset;
+        return aiReturn_SUCCESS;
+    }
+    size_t Tell() const override { return position; }
+    size_t FileSize() const override { return file.size; }
+    void Flush() override {}
+};
+
+struct VfsIOSystem : public Assimp::IOSystem
+{
+    bool Exists(const char* path) const override { return vfsExists(path); }
+    char getOsSeparator() const override { return '/'; }
+    Assimp::IOStream* Open(const char* path, const char* mode = "rb") override
+    {
+        if (strchr(mode, 'w') || strchr(mode, 'a')) return NULL;
+        VfsIOStream* stream = new VfsIOStream();
+        if (!vfsOpen(path, &stream->file)) {
+            delete stream;
+            return NULL;
+        }
+        return stream;
+    }
+    void Close(Assimp::IOStream* stream) override { delete stream; }
+};
+
 struct Model 
 {
     Mesh* meshes;
     int numMeshes;
     int textures_loaded_count = 0;
     Texture textures_loaded[MAX_TEXTURES];
+    MaterialTable materials; // how meshes sample textures_loaded, see materials.hpp
     char directory[256];
+    SceneGraph graph; // the aiNode hierarchy, nodes reference meshes by index
+
+    // LODs: requested levels at import, levels actually built, and the model-space error of each
+    int maxLods;
+    int numLods;
+    float lodErrors[LOD_MAX_LEVELS];
+    glm::vec3 boundsCenter;
+    float boundsRadius;
 };
 
-void DrawModel(Model* model, Shader* shader)
+// Draws every node's meshes with transform * node world matrix as the "model" uniform (plus its normal matrix).
+// Textures come from the model's material table, bound once; each draw carries its material (drawMeshLod).
+void DrawModel(Model* model, Shader* shader, const glm::mat4& transform, int lod = 0)
 {
-    for(int mesh_idx = 0; mesh_idx < model->numMeshes; mesh_idx++)
+    sceneGraphUpdate(&model->graph);
+    SceneGraph* graph = &model->graph;
+    materialsBind(&model->materials);
+    for(int node = 0; node < graph->numNodes; node++)
     {
-        Mesh* currMesh = model->meshes + mesh_idx;
-        activateMesh(currMesh, shader);
-        drawMesh(currMesh, shader);
+        if (graph->numMeshes[node] == 0) continue;
+        setModelMatrix(*shader, transform * graph->world[node]);
+        for(int i = 0; i < graph->numMeshes[node]; i++)
+        {
+            Mesh* currMesh = model->meshes + graph->meshIndices[graph->firstMesh[node] + i];
+            activateMeshMaterial(currMesh, shader);
+            drawMeshLod(currMesh, shader, lod);
+        }
     }
-
 }  
 
-int loadMaterialTextures(aiMaterial *mat, aiTextureType type, int texture_type, Texture *out_textures,  Model *model)
+// Depth-only DrawModel: sets just "model" and draws the position streams, no textures bound.
+void DrawModelDepth(Model* model, Shader* shader, const glm::mat4& transform, int lod = 0)
+{
+    sceneGraphUpdate(&model->graph);
+    SceneGraph* graph = &model->graph;
+    for(int node = 0; node < graph->numNodes; node++)
+    {
+        if (graph->numMeshes[node] == 0) continue;
+        glm::mat4 world = transform * graph->world[node];
+        setMat4(*shader, "model", glm::value_ptr(world));
+        for(int i = 0; i < graph->numMeshes[node]; i++)
+            drawMeshDepth(model->meshes + graph->meshIndices[graph->firstMesh[node] + i], lod);
+    }
+}
+
+// One glMultiDrawElementsIndirect over `count` uploaded commands from `first`, in the buffers the
+// model's meshes share.
+static void drawModelCommands(const Model* model, int first, int count)
+{
+    if (count == 0) return;
+    glBindVertexArray(model->meshes->VAO);
+    glMultiDrawElementsIndirect(GL_TRIANGLES, model->meshes->indexType, (void*)(first * sizeof(MeshletDrawCommand)), count, 0);
+    glBindVertexArray(0);
+    RENDER_STAT_ADD(RENDER_STAT_STATE_CHANGES, 1);
+    RENDER_STAT_ADD(RENDER_STAT_DRAW_CALLS, 1);
+}
+
+// Full-detail draw with per-meshlet culling: every mesh that was split into meshlets is culled against
+// the frustum and camera cone by cone, and a mesh without meshlets gets one command for all of lods[0].
+// Commands point into the buffers the meshes share and carry their mesh's material as base instance, so
+// the survivors of the whole model go to the GPU in one upload and each node is one
+// glMultiDrawElementsIndirect, split only around meshes that bind their own textures. `cameraPosition`
+// is in world space.
+void DrawModelMeshlets(MeshletRenderer* renderer, Model* model, Shader* shader, const glm::mat4& transform,
+                       const Frustum& frustum, const glm::vec3& cameraPosition)
+{
+    sceneGraphUpdate(&model->graph);
+    SceneGraph* graph = &model->graph;
+
+    // commands per mesh reference, in graph order
+    int* visible = (int*)malloc((graph->numMeshIndices > 0 ? graph->numMeshIndices : 1) * sizeof(int));
+    renderer->numCommands = 0;
+    for(int node = 0; node < graph->numNodes; node++)
+    {
+        glm::mat4 world = transform * graph->world[node];
+        float scale = glm::max(glm::length(glm::vec3(world[0])), glm::max(glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2]))));
+        for(int i = 0; i < graph->numMeshes[node]; i++)
+        {
+            int ref = graph->firstMesh[node] + i;
+            Mesh* currMesh = model->meshes + graph->meshIndices[ref];
+            MeshletDrawCommand* commands = meshletRendererReserve(renderer, glm::max(currMesh->numMeshlets, 1));
+            if (currMesh->numMeshlets == 0)
+            {
+                commands[0] = {currMesh->lods[0].indexCount, 1, currMesh->lods[0].indexOffset, 0, 0};
+                visible[ref] = 1;
+            }
+            else
+            {
+                visible[ref] = meshletCull(currMesh->meshlets, currMesh->numMeshlets, world, scale, frustum, cameraPosition, commands);
+                RENDER_STAT_ADD(RENDER_STAT_MESHLETS_DRAWN, visible[ref]);
+                RENDER_STAT_ADD(RENDER_STAT_MESHLETS_CULLED, currMesh->numMeshlets - visible[ref]);
+            }
+            for(int c = 0; c < visible[ref]; c++)
+            {
+                commands[c].firstIndex += currMesh->firstIndex;
+                commands[c].baseVertex = currMesh->baseVertex;
+                commands[c].baseInstance = currMesh->material + 1;
+                RENDER_STAT_ADD(RENDER_STAT_TRIANGLES, commands[c].count / 3);
+            }
+            renderer->numCommands += visible[ref];
+        }
+    }
+    meshletRendererUpload(renderer);
+
+    materialsBind(&model->materials);
+    int first = 0;
+    for(int node = 0; node < graph->numNodes; node++)
+    {
+        if (graph->numMeshes[node] == 0) continue;
+        setModelMatrix(*shader, transform * graph->world[node]);
+        int run = first; // start of the commands not drawn yet
+        for(int i = 0; i < graph->numMeshes[node]; i++)
+        {
+            int ref = graph->firstMesh[node] + i;
+            Mesh* currMesh = model->meshes + graph->meshIndices[ref];
+            if (currMesh->material < 0 && visible[ref] > 0)
+            {
+                drawModelCommands(model, run, first - run);
+                activateMesh(currMesh, shader);
+                drawModelCommands(model, first, visible[ref]);
+                run = first + visible[ref];
+            }
+            first += visible[ref];
+        }
+        drawModelCommands(model, run, first - run);
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    free(visible);
+}
+
+// Frees the GPU buffers (shared by all of them, see setupMeshes) and CPU arrays of meshes created by
+// uploadModelCache. Textures are shared through the model cache and stay alive.
+void releaseModelMeshes(Mesh* meshes, int numMeshes)
+{
+    if (numMeshes > 0)
+    {
+        glDeleteVertexArrays(1, &meshes->VAO);
+        glDeleteVertexArrays(1, &meshes->depthVAO);
+        glDeleteBuffers(1, &meshes->VBO);
+        glDeleteBuffers(1, &meshes->positionVBO);
+        glDeleteBuffers(1, &meshes->EBO);
+    }
+    for(int mesh_idx = 0; mesh_idx < numMeshes; mesh_idx++)
+    {
+        Mesh* currMesh = meshes + mesh_idx;
+        free(currMesh->vertices);
+        free(currMesh->indices);
+        free(currMesh->textures);
+        free(currMesh->meshlets);
+    }
+    free(meshes);
+}
+
+// Appends the index in the cache's texture table of every texture of one type the material references.
+// Textures the table had no room for are left out.
+static void findMaterialTextures(const aiMaterial *mat, aiTextureType type, const MeshCacheFile *cache, MeshCacheMesh *out)
 {
-    int count = 0;
     for(unsigned int i = 0; i < mat->GetTextureCount(type); i++)
     {
         aiString str;
         mat->GetTexture(type, i, &str);
-        // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-        bool skip = false;
-        for(int j = 0; j < model->textures_loaded_count; j++)
+        for(int j = 0; j < cache->numTextures; j++)
         {
-            if (strcmp(model->textures_loaded[j].path, str.C_Str()) == 0)
-            {
-                out_textures[count++] = model->textures_loaded[j];
-                skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                break;
-            }
+            if (strcmp(cache->textures[j].path, str.C_Str()) != 0) continue;
+            if (out->numTextures < MESH_CACHE_MAX_MESH_TEXTURES) out->textures[out->numTextures++] = j;
+            break;
         }
-        if(!skip)
-        {   // if texture hasn't been loaded already, load it
-            Texture texture =  createTextureFromFile(str.C_Str(), model->directory,texture_type, true);
-            strncpy_s(texture.path, sizeof(texture.path), str.C_Str(), _TRUNCATE);
+    }
+}
+
+// Lists every texture the scene's materials reference once, as loads into the model's texture cache
+// from index `first` on; findMaterialTextures then gives meshes their indices by path. paths holds the
+// names the loads point at. Returns the number of loads.
+int collectModelTextures(const aiScene *scene, Model *model, int first, aiString *paths, TextureLoad *loads)
+{
+    const aiTextureType types[4] = {aiTextureType_DIFFUSE, aiTextureType_SPECULAR, aiTextureType_HEIGHT, aiTextureType_AMBIENT};
+    const int texture_types[4] = {TEXTURE_DIFFUSE, TEXTURE_SPECULAR, TEXTURE_NORMAL, TEXTURE_HEIGHT};
 
-            out_textures[count++] = texture;
-            if (model->textures_loaded_count < MAX_TEXTURES)
+    int count = 0;
+    for(unsigned int m = 0; m < scene->mNumMaterials; m++)
+    {
+        aiMaterial *mat = scene->mMaterials[m];
+        for(int t = 0; t < 4; t++)
+        {
+            for(unsigned int i = 0; i < mat->GetTextureCount(types[t]); i++)
             {
-                model->textures_loaded[model->textures_loaded_count++] = texture;
+                aiString str;
+                mat->GetTexture(types[t], i, &str);
+                bool seen = false;
+                for(int j = 0; j < count && !seen; j++)
+                    seen = strcmp(paths[j].C_Str(), str.C_Str()) == 0;
+                if (seen || first + count >= MAX_TEXTURES) continue;
+
+                paths[count] = str;
+                loads[count] = {0};
+                loads[count].path = paths[count].C_Str();
+                loads[count].directory = model->directory;
+                loads[count].texture_type = texture_types[t];
+                loads[count].flip_uv = true;
+                loads[count].out = &model->textures_loaded[first + count];
+                count++;
             }
         }
     }
     return count;
 }
 
-Mesh processMesh(aiMesh *mesh, const aiScene *scene, Model* model)
+// Meshlets and LOD chain of one aiMesh, built on a worker before the mesh is uploaded.
+struct MeshBuild {
+    const aiMesh* mesh;
+    int maxLevels;
+    unsigned int* indices;      // meshlet-ordered LOD 0 followed by the other levels, NULL if nothing was built
+    unsigned int numIndices;
+    MeshLod lods[LOD_MAX_LEVELS];
+    int numLods;
+    Meshlet* meshlets;
+    int numMeshlets;
+    unsigned int* remap;        // new position of every vertex after the fetch reorder, NULL to keep the order
+
+    bool report;                // measure LOD 0 before and after optimizing
+    MeshOptStats before, after;
+};
+
+static void buildMeshJob(void* data, int begin, int end)
+{
+    MeshBuild* builds = (MeshBuild*)data;
+    for (int i = begin; i < end; i++)
+    {
+        MeshBuild* build = &builds[i];
+        const aiMesh* mesh = build->mesh;
+        build->indices = NULL;
+        build->numLods = 1;
+        build->meshlets = NULL;
+        build->numMeshlets = 0;
+        build->remap = NULL;
+        if (mesh->mPrimitiveTypes != aiPrimitiveType_TRIANGLE) continue;
+
+        const float* positions = &mesh->mVertices[0].x;
+        unsigned int numIndices = mesh->mNumFaces * 3;
+        unsigned int* faces = (unsigned int*)malloc(numIndices * sizeof(unsigned int));
+        for (unsigned int f = 0; f < mesh->mNumFaces; f++)
+            for (int k = 0; k < 3; k++)
+                faces[f * 3 + k] = mesh->mFaces[f].mIndices[k];
+        if (build->report)
+        {
+            meshOptAnalyzeCache(&build->before, faces, numIndices, mesh->mNumVertices, MESHOPT_CACHE_SIZE);
+            build->before.overdraw = meshOptAnalyzeOverdraw(faces, numIndices, positions, sizeof(aiVector3D));
+        }
+
+        // LOD 0 is clustered into meshlets and ordered for the vertex cache and overdraw before the
+        // coarser levels are derived from it
+        build->numMeshlets = buildMeshlets(faces, numIndices, positions, sizeof(aiVector3D), mesh->mNumVertices, &build->meshlets);
+        meshletOptimize(faces, build->meshlets, build->numMeshlets, positions, sizeof(aiVector3D), mesh->mNumVertices);
+        if (build->report)
+        {
+            meshOptAnalyzeCache(&build->after, faces, numIndices, mesh->mNumVertices, MESHOPT_CACHE_SIZE);
+            build->after.overdraw = meshOptAnalyzeOverdraw(faces, numIndices, positions, sizeof(aiVector3D));
+        }
+
+        if (build->maxLevels <= 1)
+        {
+            build->indices = faces;
+            build->numIndices = numIndices;
+        }
+        else
+        {
+            build->indices = lodBuildChain(faces, numIndices, positions, sizeof(aiVector3D), mesh->mNumVertices,
+                                           build->maxLevels, build->lods, &build->numLods, &build->numIndices);
+            free(faces);
+            for (int level = 1; level < build->numLods; level++)
+                meshOptOptimize(build->indices + build->lods[level].indexOffset, build->lods[level].indexCount,
+                                positions, sizeof(aiVector3D), mesh->mNumVertices);
+        }
+
+        // vertices in the order LOD 0 first uses them
+        build->remap = (unsigned int*)malloc(mesh->mNumVertices * sizeof(unsigned int));
+        meshOptVertexFetch(build->remap, build->indices, build->numIndices, mesh->mNumVertices);
+    }
+}
+
+// Vertices, built indices, LODs, meshlets and texture indices of one aiMesh, as the mesh cache stores them.
+void processMesh(const aiMesh *mesh, const aiScene *scene, MeshBuild* build, const MeshCacheFile *cache, MeshCacheMesh *out)
     {
         Vertex* vertices = (Vertex *)malloc(mesh->mNumVertices * sizeof(Vertex));
         unsigned int * indices = (unsigned int *)malloc(mesh->mNumFaces * 3 * sizeof(unsigned int)); // Assuming triangular faces
@@ -124,7 +419,7 @@ Mesh processMesh(aiMesh *mesh, const aiScene *scene, Model* model)
             else
                 vertex.TexCoords = glm::vec2(0.0f, 0.0f);
 
-            vertices[i]= vertex;
+            vertices[build && build->remap ? build->remap[i] : i]= vertex;
         }
         // now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
         unsigned int index = 0;
@@ -136,55 +431,196 @@ Mesh processMesh(aiMesh *mesh, const aiScene *scene, Model* model)
                 indices[index++] = face.mIndices[j];        
         }
         // process materials
-        aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];    
+        aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
         // we assume a convention for sampler names in the shaders. Each diffuse texture should be named
-        // as 'texture_diffuseN' where N is a sequential number ranging from 1 to MAX_SAMPLER_NUMBER. 
+        // as 'texture_diffuseN' where N is a sequential number ranging from 1 to MAX_SAMPLER_NUMBER.
         // Same applies to other texture as the following list summarizes:
         // diffuse: texture_diffuseN
         // specular: texture_specularN
         // normal: texture_normalN
-        Texture* textures = (Texture *)malloc(MAX_TEXTURES * sizeof(Texture));
-        int textureCount = 0;
-        textureCount += loadMaterialTextures(material, aiTextureType_DIFFUSE, TEXTURE_DIFFUSE, textures + textureCount,model);
-        textureCount += loadMaterialTextures(material, aiTextureType_SPECULAR, TEXTURE_SPECULAR, textures + textureCount,model);
-        textureCount += loadMaterialTextures(material, aiTextureType_HEIGHT, TEXTURE_NORMAL, textures + textureCount,model);
-        textureCount += loadMaterialTextures(material, aiTextureType_AMBIENT, TEXTURE_HEIGHT, textures + textureCount,model);
+        out->numTextures = 0;
+        findMaterialTextures(material, aiTextureType_DIFFUSE, cache, out);
+        findMaterialTextures(material, aiTextureType_SPECULAR, cache, out);
+        findMaterialTextures(material, aiTextureType_HEIGHT, cache, out);
+        findMaterialTextures(material, aiTextureType_AMBIENT, cache, out);
+
+        // built indices hold the same triangles as the face list (then the LODs), so they replace it as a whole
+        if (build->indices)
+        {
+            free(indices);
+            indices = build->indices;
+            numIndices = build->numIndices;
+            build->indices = NULL;
+        }
+        free(build->remap);
+        build->remap = NULL;
 
-        // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, numVertices, indices, numIndices, textures, textureCount);
+        out->vertices = vertices;
+        out->numVertices = numVertices;
+        out->indices = indices;
+        out->numIndices = numIndices;
+        out->lods[0] = {0, numIndices, 0.0f};
+        out->numLods = 1;
+        if (build->numLods > 1)
+        {
+            memcpy(out->lods, build->lods, sizeof(out->lods));
+            out->numLods = build->numLods;
+        }
+        out->meshlets = build->meshlets;
+        out->numMeshlets = build->numMeshlets;
+        build->meshlets = NULL;
     }
 
 
-void processNode(aiNode *node, const aiScene *scene, Model *model)
+// aiMatrix4x4 is row-major, glm is column-major
+static glm::mat4 aiToGlm(const aiMatrix4x4& m)
+{
+    return glm::transpose(glm::mat4(m.a1, m.a2, m.a3, m.a4,
+                                    m.b1, m.b2, m.b3, m.b4,
+                                    m.c1, m.c2, m.c3, m.c4,
+                                    m.d1, m.d2, m.d3, m.d4));
+}
+
+static int countNodes(const aiNode *node)
+{
+    int count = 1;
+    for(unsigned int i = 0; i < node->mNumChildren; i++)
+        count += countNodes(node->mChildren[i]);
+    return count;
+}
+
+static int countNodeMeshes(const aiNode *node)
+{
+    int count = node->mNumMeshes;
+    for(unsigned int i = 0; i < node->mNumChildren; i++)
+        count += countNodeMeshes(node->mChildren[i]);
+    return count;
+}
+
+// Bounds and per-level error of the whole model, with node transforms applied. Needs an updated graph.
+static void computeModelBounds(Model *model)
+{
+    SceneGraph* graph = &model->graph;
+    glm::vec3 minP(FLT_MAX), maxP(-FLT_MAX);
+    model->numLods = 1;
+    for(int level = 0; level < LOD_MAX_LEVELS; level++) model->lodErrors[level] = 0.0f;
+    for(int node = 0; node < graph->numNodes; node++)
+    {
+        const glm::mat4& world = graph->world[node];
+        float nodeScale = glm::max(glm::length(glm::vec3(world[0])), glm::max(glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2]))));
+        for(int i = 0; i < graph->numMeshes[node]; i++)
+        {
+            Mesh* mesh = model->meshes + graph->meshIndices[graph->firstMesh[node] + i];
+            for(unsigned int v = 0; v < mesh->numVertices; v++)
+            {
+                glm::vec3 p = glm::vec3(world * glm::vec4(mesh->vertices[v].Position, 1.0f));
+                minP = glm::min(minP, p);
+                maxP = glm::max(maxP, p);
+            }
+            model->numLods = glm::max(model->numLods, mesh->numLods);
+            for(int level = 0; level < LOD_MAX_LEVELS; level++)
+            {
+                float error = mesh->lods[level < mesh->numLods ? level : mesh->numLods - 1].error * nodeScale;
+                model->lodErrors[level] = glm::max(model->lodErrors[level], error);
+            }
+        }
+    }
+    bool empty = minP.x > maxP.x;
+    model->boundsCenter = empty ? glm::vec3(0.0f) : (minP + maxP) * 0.5f;
+    model->boundsRadius = empty ? 0.0f : glm::length(maxP - minP) * 0.5f;
+}
+
+// Builds every aiMesh once (cache->meshes[i] is scene->mMeshes[i]) and the node hierarchy on top of it,
+// the same data a mesh cache hit decodes. Nodes are added breadth-first so the graph arrays come out
+// sorted by depth. The cache's texture table must be filled; its meshes and graph are overwritten.
+// Touches no GL state.
+void processScene(const aiScene *scene, int maxLods, MeshCacheFile *cache)
 {
-    for(unsigned int i = 0; i < node->mNumMeshes; i++)
+    // clustering, simplification and reordering run on the job system, one mesh per job
+    MeshBuild* builds = (MeshBuild*)malloc((scene->mNumMeshes > 0 ? scene->mNumMeshes : 1) * sizeof(MeshBuild));
+    for(unsigned int i = 0; i < scene->mNumMeshes; i++)
     {
-        aiMesh *mesh = scene->mMeshes[node->mMeshes[i]]; 
-        model->meshes[model->numMeshes++] = processMesh(mesh, scene, model);			
+        builds[i].mesh = scene->mMeshes[i];
+        builds[i].maxLevels = maxLods;
+        builds[i].report = false;
     }
-    for(unsigned int i = 0; i < node->mNumChildren; i++)
     {
-        processNode(node->mChildren[i], scene, model);
+        PROFILE_ZONE("build meshlets and LODs");
+        jobsParallelFor("build meshes", scene->mNumMeshes, 1, buildMeshJob, builds);
     }
-}  
 
-Model* ModelInit(const char* path)
+    cache->numMeshes = scene->mNumMeshes;
+    cache->meshes = (MeshCacheMesh*)calloc(scene->mNumMeshes > 0 ? scene->mNumMeshes : 1, sizeof(MeshCacheMesh));
+    for(unsigned int i = 0; i < scene->mNumMeshes; i++)
+        processMesh(scene->mMeshes[i], scene, &builds[i], cache, &cache->meshes[i]);
+    free(builds);
+
+    SceneGraph* graph = &cache->graph;
+    int numNodes = countNodes(scene->mRootNode);
+    sceneGraphInit(graph, numNodes, countNodeMeshes(scene->mRootNode));
+
+    const aiNode** queue = (const aiNode**)malloc(numNodes * sizeof(aiNode*));
+    int* queueParent = (int*)malloc(numNodes * sizeof(int));
+    int head = 0, tail = 0;
+    queue[tail] = scene->mRootNode;
+    queueParent[tail++] = SCENE_NO_PARENT;
+    while (head < tail)
+    {
+        const aiNode *node = queue[head];
+        int index = sceneGraphAddNode(graph, queueParent[head], node->mName.C_Str(), aiToGlm(node->mTransformation));
+        head++;
+        for(unsigned int i = 0; i < node->mNumMeshes; i++)
+            sceneGraphAddMesh(graph, index, node->mMeshes[i]);
+        for(unsigned int i = 0; i < node->mNumChildren; i++)
+        {
+            queue[tail] = node->mChildren[i];
+            queueParent[tail++] = index;
+        }
+    }
+    free(queue);
+    free(queueParent);
+}
+
+// Creates the meshes and node graph of a model from a decoded or freshly built mesh cache, taking over its arrays.
+static void uploadModelCache(Model *model, MeshCacheFile *cache)
 {
-    Assimp::Importer import;
-    const aiScene *scene = import.ReadFile(path, ASSIMP_LOAD_FLAGS);
+    model->meshes = (Mesh*)malloc((cache->numMeshes > 0 ? cache->numMeshes : 1) * sizeof(Mesh));
+    model->numMeshes = 0;
+    for(int m = 0; m < cache->numMeshes; m++)
+    {
+        MeshCacheMesh* cached = &cache->meshes[m];
+        Texture* textures = (Texture *)malloc(MAX_TEXTURES * sizeof(Texture));
+        for(int t = 0; t < cached->numTextures; t++) textures[t] = model->textures_loaded[cached->textures[t]];
 
-    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
-        printf("ERROR::ASSIMP::%s\n", import.GetErrorString());
-        return NULL;
+        Mesh mesh(cached->vertices, cached->numVertices, cached->indices, cached->numIndices, textures, cached->numTextures, false);
+        memcpy(mesh.lods, cached->lods, sizeof(mesh.lods));
+        mesh.numLods = cached->numLods;
+        mesh.meshlets = cached->meshlets;
+        mesh.numMeshlets = cached->numMeshlets;
+        model->meshes[model->numMeshes++] = mesh;
+        cached->vertices = NULL;
+        cached->indices = NULL;
+        cached->meshlets = NULL;
     }
+    if (model->numMeshes > 0) setupMeshes(model->meshes, model->numMeshes);
 
+    model->graph = cache->graph;
+    cache->graph = {0};
+    sceneGraphUpdate(&model->graph);
+    computeModelBounds(model);
+}
+
+// A model with no meshes yet, to be filled by modelUploadSource. maxLods > 1 builds up to that many
+// levels of detail per mesh (see lod.hpp); draw them with DrawModel's lod.
+Model* ModelCreateEmpty(const char* path, int maxLods = 1)
+{
     Model* model = (Model*)malloc(sizeof(Model));
     if (!model) {
         printf("ERROR::Failed to allocate Model\n");
         return NULL;
     }
-
-    model->textures_loaded_count = 0;
+    *model = Model();
+    model->maxLods = maxLods;
 
     const char* last_slash = strrchr(path, '/');
     if (last_slash != NULL) {
@@ -194,17 +630,273 @@ Model* ModelInit(const char* path)
     } else {
         model->directory[0] = '\0';
     }
-    model->numMeshes = scene->mNumMeshes;
-    model->meshes = (Mesh*)malloc(sizeof(Mesh) * model->numMeshes);
-    if (!model->meshes) {
-        printf("ERROR::Failed to allocate Meshes\n");
+    return model;
+}
+
+// Frees the meshes, textures and node graph, keeping the path and LOD settings: the model draws nothing
+// until the next modelUploadSource.
+void modelRelease(Model *model)
+{
+    releaseModelMeshes(model->meshes, model->numMeshes);
+    materialsDestroy(&model->materials);
+    for(int i = 0; i < model->textures_loaded_count; i++)
+        glDeleteTextures(1, &model->textures_loaded[i].ID);
+    sceneGraphDestroy(&model->graph);
+    model->graph = {0};
+    model->meshes = NULL;
+    model->numMeshes = 0;
+    model->textures_loaded_count = 0;
+    model->numLods = 0;
+    model->boundsCenter = glm::vec3(0.0f);
+    model->boundsRadius = 0.0f;
+}
+
+// CPU half of loading a model: the meshes, node graph and texture table (decoded from the mesh cache on
+// a hit, imported and built otherwise) plus the decoded textures. Filled by modelLoadSource on any
+// thread, consumed by modelUploadSource.
+struct ModelSource {
+    MeshCacheFile cache;
+    aiString texturePaths[MAX_TEXTURES];
+    TextureLoad textures[MAX_TEXTURES];     // into model->textures_loaded, from index 0
+    int numTextures;
+    char cachePath[512];
+    long long sourceSize, sourceTime;
+};
+
+void modelFreeSource(ModelSource *source)
+{
+    meshCacheFree(&source->cache);
+    for(int t = 0; t < source->numTextures; t++) stbi_image_free(source->textures[t].data);
+    source->numTextures = 0;
+}
+
+// Lists and decodes the textures the scene's materials reference and builds every mesh (meshlets, LODs,
+// vertex cache and fetch order) and the node graph into the source, as a mesh cache hit would have it.
+// Touches no GL state; the scene is only read. The loads point at the model's texture cache.
+void modelBuildSource(Model *model, const aiScene *scene, ModelSource *source)
+{
+    PROFILE_ZONE("modelBuildSource");
+    source->numTextures = collectModelTextures(scene, model, 0, source->texturePaths, source->textures);
+    MeshCacheFile* cache = &source->cache;
+    memset(cache, 0, sizeof(*cache));
+    cache->maxLods = model->maxLods;
+    cache->numTextures = source->numTextures;
+    cache->textures = (MeshCacheTexture*)malloc((source->numTextures > 0 ? source->numTextures : 1) * sizeof(MeshCacheTexture));
+    for(int t = 0; t < source->numTextures; t++)
+    {
+        cache->textures[t].type = source->textures[t].texture_type;
+        snprintf(cache->textures[t].path, sizeof(cache->textures[t].path), "%s", source->textures[t].path);
+    }
+    decodeTextures(source->textures, source->numTextures);
+    processScene(scene, model->maxLods, cache);
+}
+
+// Reads, decodes and builds everything the model needs without touching GL, so it can run on a worker.
+// A cache miss writes the mesh cache from here. The model is only read (its path and LOD settings);
+// the loads point at its texture cache.
+bool modelLoadSource(Model *model, const char* path, ModelSource *source)
+{
+    PROFILE_ZONE("modelLoadSource");
+    memset(&source->cache, 0, sizeof(source->cache));
+    source->numTextures = 0;
+
+#if MESH_CACHE_ENABLED
+    meshCachePath(source->cachePath, sizeof(source->cachePath), path);
+    meshCacheSourceStamp(path, &source->sourceSize, &source->sourceTime);
+    if (meshCacheLoad(source->cachePath, source->sourceSize, source->sourceTime, model->maxLods, &source->cache))
+    {
+        if (source->cache.numTextures <= MAX_TEXTURES)
+        {
+            source->numTextures = source->cache.numTextures;
+            for(int t = 0; t < source->numTextures; t++)
+            {
+                source->textures[t] = {0};
+                source->textures[t].path = source->cache.textures[t].path;
+                source->textures[t].directory = model->directory;
+                source->textures[t].texture_type = source->cache.textures[t].type;
+                source->textures[t].flip_uv = true;
+                source->textures[t].out = &model->textures_loaded[t];
+            }
+            decodeTextures(source->textures, source->numTextures);
+            return true;
+        }
+        meshCacheFree(&source->cache);
+    }
+#endif
+
+    Assimp::Importer importer;
+    importer.SetIOHandler(new VfsIOSystem()); // owned by the importer
+    const aiScene *scene = importer.ReadFile(path, ASSIMP_LOAD_FLAGS);
+    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
+        printf("ERROR::ASSIMP::%s\n", importer.GetErrorString());
+        return false;
+    }
+    modelBuildSource(model, scene, source);
+#if MESH_CACHE_ENABLED
+    source->cache.sourceSize = source->sourceSize;
+    source->cache.sourceTime = source->sourceTime;
+    meshCacheWrite(source->cachePath, &source->cache);
+#endif
+    return true;
+}
+
+// CPU memory a loaded source holds until it is uploaded. Its indices are 32-bit here whatever the EBO
+// ends up as (setupMeshes narrows them on upload), so they count 4 bytes each.
+size_t modelSourceBytes(const ModelSource *source)
+{
+    size_t bytes = 0;
+    for(int t = 0; t < source->numTextures; t++)
+        if (source->textures[t].data)
+            bytes += (size_t)source->textures[t].width * source->textures[t].height * source->textures[t].nrChannels;
+    for(int m = 0; m < source->cache.numMeshes; m++)
+        bytes += source->cache.meshes[m].numVertices * sizeof(Vertex) + source->cache.meshes[m].numIndices * sizeof(unsigned int) +
+                 source->cache.meshes[m].numMeshlets * sizeof(Meshlet);
+    return bytes;
+}
+
+// GPU memory the source will take once uploaded, what modelGpuBytes then reports: buffers as setupMeshes
+// creates them and textures with their mips. A material table packing the textures moves them, it does not copy.
+size_t modelSourceGpuBytes(const ModelSource *source)
+{
+    size_t bytes = 0;
+    for(int t = 0; t < source->numTextures; t++)
+        if (source->textures[t].data)
+            bytes += (size_t)source->textures[t].width * source->textures[t].height * 4 * 4 / 3;
+    unsigned int maxVertices = 0, numIndices = 0;
+    for(int m = 0; m < source->cache.numMeshes; m++)
+    {
+        bytes += source->cache.meshes[m].numVertices * (sizeof(Vertex) + sizeof(glm::vec3));
+        maxVertices = glm::max(maxVertices, source->cache.meshes[m].numVertices);
+        numIndices += source->cache.meshes[m].numIndices;
+    }
+    // the meshes share one EBO, narrowed only when every one of them fits 16 bits
+    return bytes + numIndices * indexTypeSize(meshIndexType(maxVertices));
+}
+
+// Approximate GPU memory of a model: vertex, position and index buffers, its textures and material table.
+size_t modelGpuBytes(const Model *model)
+{
+    size_t bytes = materialsGpuBytes(&model->materials);
+    for(int m = 0; m < model->numMeshes; m++)
+        bytes += model->meshes[m].numVertices * (sizeof(Vertex) + sizeof(glm::vec3)) + model->meshes[m].numIndices * meshIndexSize(&model->meshes[m]);
+    for(int t = 0; t < model->textures_loaded_count; t++)
+        if (model->textures_loaded[t].ID) bytes += textureGpuBytes(model->textures_loaded[t].ID); // 0 once packed into an array
+    return bytes;
+}
+
+// GL half: replaces whatever the model held with the source's meshes, textures and material table and
+// frees the source. Only creates and fills GL objects; everything CPU-side was done by modelLoadSource.
+void modelUploadSource(Model *model, ModelSource *source)
+{
+    PROFILE_ZONE("modelUploadSource");
+    modelRelease(model);
+    uploadTextures(source->textures, source->numTextures);
+    model->textures_loaded_count = source->numTextures;
+    source->numTextures = 0;
+
+    uploadModelCache(model, &source->cache);
+    modelFreeSource(source);
+    materialsBuild(&model->materials, model->textures_loaded, model->textures_loaded_count, model->meshes, model->numMeshes);
+}
+
+// Loads a model synchronously.
+Model* ModelInit(const char* path, int maxLods = 1)
+{
+    PROFILE_ZONE("ModelInit");
+    Model* model = ModelCreateEmpty(path, maxLods);
+    if (!model) return NULL;
+
+    ModelSource* source = new ModelSource();
+    bool loaded = modelLoadSource(model, path, source);
+    if (loaded) modelUploadSource(model, source);
+    delete source;
+    if (!loaded) {
         free(model);
         return NULL;
     }
+    return model;
+}
 
-    model->numMeshes = 0;
-    processNode(scene->mRootNode, scene, model);
+// Imports a model without uploading it and prints ACMR, ATVR and overdraw of every mesh's full detail
+// level as imported and after the meshlet / cache / overdraw ordering (--bench-meshopt).
+void meshOptReport(const char* path)
+{
+    Assimp::Importer import;
+    import.SetIOHandler(new VfsIOSystem());
+    const aiScene *scene = import.ReadFile(path, ASSIMP_LOAD_FLAGS);
+    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
+        printf("ERROR::ASSIMP::%s\n", import.GetErrorString());
+        return;
+    }
 
-    return model;
+    MeshBuild* builds = (MeshBuild*)malloc(scene->mNumMeshes * sizeof(MeshBuild));
+    for(unsigned int i = 0; i < scene->mNumMeshes; i++)
+    {
+        builds[i].mesh = scene->mMeshes[i];
+        builds[i].maxLevels = 1;
+        builds[i].report = true;
+    }
+    jobsParallelFor("build meshes", scene->mNumMeshes, 1, buildMeshJob, builds);
+
+    printf("mesh optimizer report: %s (cache %d)\n", path, MESHOPT_CACHE_SIZE);
+    printf("%-24s %9s %15s %15s %15s\n", "mesh", "triangles", "ACMR", "ATVR", "overdraw");
+    double triangles = 0.0;
+    MeshOptStats totalBefore = {0}, totalAfter = {0};
+    for(unsigned int i = 0; i < scene->mNumMeshes; i++)
+    {
+        MeshBuild* build = &builds[i];
+        if (build->indices)
+        {
+            unsigned int numTriangles = build->numIndices / 3;
+            printf("%-24.24s %9u %6.3f -> %5.3f %6.3f -> %5.3f %6.3f -> %5.3f\n", scene->mMeshes[i]->mName.C_Str(), numTriangles,
+                   build->before.acmr, build->after.acmr, build->before.atvr, build->after.atvr,
+                   build->before.overdraw, build->after.overdraw);
+            // triangle-weighted averages
+            triangles += numTriangles;
+            totalBefore.acmr += build->before.acmr * numTriangles;
+            totalBefore.atvr += build->before.atvr * numTriangles;
+            totalBefore.overdraw += build->before.overdraw * numTriangles;
+            totalAfter.acmr += build->after.acmr * numTriangles;
+            totalAfter.atvr += build->after.atvr * numTriangles;
+            totalAfter.overdraw += build->after.overdraw * numTriangles;
+        }
+        free(build->indices);
+        free(build->meshlets);
+        free(build->remap);
+    }
+    if (triangles > 0.0)
+    {
+        printf("%-24s %9.0f %6.3f -> %5.3f %6.3f -> %5.3f %6.3f -> %5.3f\n", "all", triangles,
+               totalBefore.acmr / triangles, totalAfter.acmr / triangles, totalBefore.atvr / triangles, totalAfter.atvr / triangles,
+               totalBefore.overdraw / triangles, totalAfter.overdraw / triangles);
+    }
+    free(builds);
+}
+
+// Imports a model without uploading it and runs bvhBenchmark over all of its meshes as one triangle
+// soup (--bench-bvh).
+void bvhBenchmarkModel(const char* path)
+{
+    Assimp::Importer import;
+    import.SetIOHandler(new VfsIOSystem());
+    const aiScene *scene = import.ReadFile(path, ASSIMP_LOAD_FLAGS);
+    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
+        printf("ERROR::ASSIMP::%s\n", import.GetErrorString());
+        return;
+    }
+
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned int> indices;
+    for(unsigned int i = 0; i < scene->mNumMeshes; i++)
+    {
+        const aiMesh* mesh = scene->mMeshes[i];
+        unsigned int base = (unsigned int)positions.size();
+        for(unsigned int v = 0; v < mesh->mNumVertices; v++)
+            positions.push_back(glm::vec3(mesh->mVertices[v].x, mesh->mVertices[v].y, mesh->mVertices[v].z));
+        for(unsigned int f = 0; f < mesh->mNumFaces; f++)
+            if (mesh->mFaces[f].mNumIndices == 3)
+                for(int k = 0; k < 3; k++) indices.push_back(base + mesh->mFaces[f].mIndices[k]);
+    }
+    bvhBenchmark(path, &positions[0].x, sizeof(glm::vec3), indices.data(), (int)indices.size());
 }
 #endif
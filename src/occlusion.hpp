@@ -0,0 +1,669 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+#include "../thirdparty/glm/glm.hpp"
+#include "jobs.hpp"
+#include "profiler.hpp"
+#include "cpufeatures.hpp"
+
+// Masked software occlusion culling (after Hasselgren, Andersson and Akenine-Moller 2016).
+// A handful of big, cheap occluders is rasterized on the CPU into a small depth buffer made of
+// 32x8 pixel tiles. A tile does not store per-pixel depth: it keeps a coverage bit per pixel and two
+// conservative depths, the farthest depth of a reference layer covering the whole tile and the
+// farthest depth of a working layer covering the pixels whose bits are set. A triangle merges its
+// coverage and depth into the working layer; once the working layer covers the tile it becomes the
+// new reference. Tiles are the coarse level of the hierarchy, bits the fine one.
+// Depth is 1/w, so it interpolates linearly in screen space and larger is closer.
+//
+// Coverage is computed a tile at a time with one SIMD lane per pixel row: each edge's crossing
+// point along the row turns into a 32-bit mask with a variable shift. AVX2 does the 8 rows at once
+// with vpsllvd/vpsrlvd; SSE4.1 has no per-lane shift and takes two halves of 4 rows, looking the
+// masks up in a 33-entry table instead. Both are compiled with CPU_TARGET and picked with cpuid at
+// occlusionInit (cpufeatures.hpp), so they need no compiler flag. Rasterization is split into
+// bands of tile rows that run as jobs; bands share no tiles, so no locks are needed.
+// Objects are tested with their screen rectangle and nearest depth, before any GL work is issued.
+//
+// Per frame:
+//     occlusionBegin(&occlusion, projection * view);
+//     occlusionAddOccluder(&occlusion, positions, stride, indices, numIndices, model);   // for each occluder
+//     occlusionRasterize(&occlusion);
+//     if (occlusionTestBox(&occlusion, boxMin, boxMax)) draw...
+// Define OCCLUSION_SIMD 0 to force the scalar coverage path. --test-occlusion checks every path the
+// CPU runs against the scalar one and against known hidden and visible boxes (occlusionSelfTest).
+
+#ifndef OCCLUSION_SIMD
+#if CPU_X86
+#define OCCLUSION_SIMD 1
+#else
+#define OCCLUSION_SIMD 0
+#endif
+#endif
+
+#if OCCLUSION_SIMD
+#include <immintrin.h>
+#endif
+
+#define OCCLUSION_WIDTH 512
+#define OCCLUSION_HEIGHT 288
+#define OCCLUSION_TILE_WIDTH 32         // bits in a row mask
+#define OCCLUSION_TILE_HEIGHT 8         // rows per tile, one SIMD lane each
+#define OCCLUSION_BAND_ROWS 3           // tile rows per raster job
+
+enum Occlusion_Paths {
+    OCCLUSION_PATH_SCALAR,
+    OCCLUSION_PATH_SSE41,
+    OCCLUSION_PATH_AVX2,
+    OCCLUSION_PATH_MAX
+};
+
+const char * g_occlusion_path_str[OCCLUSION_PATH_MAX] = {"scalar", "SSE4.1", "AVX2"};
+
+struct OcclusionTile {
+    uint32_t mask[OCCLUSION_TILE_HEIGHT];   // working layer coverage, bit i is pixel i of the row
+    float zMin[2];                          // farthest 1/w of the reference and the working layer
+};
+
+// Screen space triangle ready to be binned: edge functions a*x + b*y + c >= 0 inside and the
+// depth plane z = zx*x + zy*y + z0.
+struct OcclusionTriangle {
+    float a[3], b[3], c[3];
+    float zx, zy, z0;
+    float zMin;                             // farthest vertex
+    int minX, minY, maxX, maxY;             // pixel bounds, inclusive, clamped to the buffer
+};
+
+struct OcclusionBuffer {
+    OcclusionTile* tiles;
+    int tilesX, tilesY;
+    int width, height;
+    glm::mat4 viewProjection;
+    std::vector<OcclusionTriangle> triangles;
+    int path;                               // Occlusion_Paths of the coverage; the benchmark compares them
+};
+
+// True when this build and CPU can run coverage path `path`.
+bool occlusionPathSupported(int path)
+{
+#if OCCLUSION_SIMD
+    if (path == OCCLUSION_PATH_SSE41) return cpuFeatures().sse41;
+    if (path == OCCLUSION_PATH_AVX2) return cpuFeatures().avx2;
+#endif
+    return path == OCCLUSION_PATH_SCALAR;
+}
+
+void occlusionInit(OcclusionBuffer* buffer, int width = OCCLUSION_WIDTH, int height = OCCLUSION_HEIGHT)
+{
+    buffer->tilesX = (width + OCCLUSION_TILE_WIDTH - 1) / OCCLUSION_TILE_WIDTH;
+    buffer->tilesY = (height + OCCLUSION_TILE_HEIGHT - 1) / OCCLUSION_TILE_HEIGHT;
+    buffer->width = buffer->tilesX * OCCLUSION_TILE_WIDTH;
+    buffer->height = buffer->tilesY * OCCLUSION_TILE_HEIGHT;
+    buffer->tiles = (OcclusionTile*)malloc(buffer->tilesX * buffer->tilesY * sizeof(OcclusionTile));
+    buffer->viewProjection = glm::mat4(1.0f);
+    buffer->path = OCCLUSION_PATH_SCALAR;
+    for (int path = OCCLUSION_PATH_MAX - 1; path > OCCLUSION_PATH_SCALAR; path--)
+        if (occlusionPathSupported(path)) { buffer->path = path; break; }
+}
+
+void occlusionDestroy(OcclusionBuffer* buffer)
+{
+    free(buffer->tiles);
+    buffer->tiles = NULL;
+    buffer->triangles.clear();
+}
+
+// Clears the buffer to nothing and starts collecting occluders for `viewProjection` (GL clip space).
+void occlusionBegin(OcclusionBuffer* buffer, const glm::mat4& viewProjection)
+{
+    buffer->viewProjection = viewProjection;
+    buffer->triangles.clear();
+    for (int i = 0; i < buffer->tilesX * buffer->tilesY; i++)
+    {
+        memset(buffer->tiles[i].mask, 0, sizeof(buffer->tiles[i].mask));
+        buffer->tiles[i].zMin[0] = 0.0f;        // infinitely far
+        buffer->tiles[i].zMin[1] = FLT_MAX;     // empty working layer
+    }
+}
+
+static void occlusionSetupTriangle(OcclusionBuffer* buffer, const glm::vec4 clip[3])
+{
+    float x[3], y[3], z[3];
+    for (int i = 0; i < 3; i++)
+    {
+        z[i] = 1.0f / clip[i].w;
+        x[i] = (clip[i].x * z[i] * 0.5f + 0.5f) * buffer->width;
+        y[i] = (clip[i].y * z[i] * 0.5f + 0.5f) * buffer->height;
+    }
+    // counter-clockwise triangles face the camera, the rest are culled like the GL passes do
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (area <= 0.0f) return;
+
+    OcclusionTriangle tri;
+    float minX = fminf(x[0], fminf(x[1], x[2])), maxX = fmaxf(x[0], fmaxf(x[1], x[2]));
+    float minY = fminf(y[0], fminf(y[1], y[2])), maxY = fmaxf(y[0], fmaxf(y[1], y[2]));
+    if (maxX < 0.0f || maxY < 0.0f || minX >= (float)buffer->width || minY >= (float)buffer->height) return;
+    tri.minX = (int)fmaxf(minX, 0.0f);
+    tri.minY = (int)fmaxf(minY, 0.0f);
+    tri.maxX = (int)fminf(maxX, (float)(buffer->width - 1));
+    tri.maxY = (int)fminf(maxY, (float)(buffer->height - 1));
+
+    for (int i = 0; i < 3; i++)
+    {
+        // an edge is set up from the same end in both triangles sharing it, so their crossings round
+        // to the same value with opposite signs and no pixel center on the edge falls between them
+        int p = i, q = (i + 1) % 3;
+        bool flip = y[q] < y[p] || (y[q] == y[p] && x[q] < x[p]);
+        if (flip) { p = q; q = i; }
+        float a = y[p] - y[q], b = x[q] - x[p], c = (y[q] - y[p]) * x[p] - (x[q] - x[p]) * y[p];
+        tri.a[i] = flip ? -a : a;
+        tri.b[i] = flip ? -b : b;
+        tri.c[i] = flip ? -c : c;
+    }
+    // depth plane through the three vertices
+    float inverseArea = 1.0f / area;
+    tri.zx = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) * inverseArea;
+    tri.zy = ((z[2] - z[0]) * (x[1] - x[0]) - (z[1] - z[0]) * (x[2] - x[0])) * inverseArea;
+    tri.z0 = z[0] - tri.zx * x[0] - tri.zy * y[0];
+    tri.zMin = fminf(z[0], fminf(z[1], z[2]));
+    buffer->triangles.push_back(tri);
+}
+
+// Transforms an indexed triangle list and queues its front faces. Triangles crossing the near plane
+// are clipped against it (z = -w in GL clip space) so large occluders like floors keep their
+// visible part.
+void occlusionAddOccluder(OcclusionBuffer* buffer, const float* positions, size_t stride,
+                          const unsigned int* indices, int numIndices, const glm::mat4& model)
+{
+    glm::mat4 mvp = buffer->viewProjection * model;
+    for (int t = 0; t + 2 < numIndices; t += 3)
+    {
+        glm::vec4 clip[3];
+        float distance[3];
+        int inside = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            const float* p = (const float*)((const char*)positions + indices[t + k] * stride);
+            clip[k] = mvp * glm::vec4(p[0], p[1], p[2], 1.0f);
+            distance[k] = clip[k].z + clip[k].w;
+            inside += distance[k] > 0.0f;
+        }
+        if (inside == 3) { occlusionSetupTriangle(buffer, clip); continue; }
+        if (inside == 0) continue;
+
+        // Sutherland-Hodgman against one plane: at most a quad comes out
+        glm::vec4 polygon[4];
+        int count = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            int next = (k + 1) % 3;
+            if (distance[k] > 0.0f) polygon[count++] = clip[k];
+            if ((distance[k] > 0.0f) != (distance[next] > 0.0f))
+                polygon[count++] = glm::mix(clip[k], clip[next], distance[k] / (distance[k] - distance[next]));
+        }
+        for (int k = 1; k + 1 < count; k++)
+        {
+            glm::vec4 fan[3] = {polygon[0], polygon[k], polygon[k + 1]};
+            occlusionSetupTriangle(buffer, fan);
+        }
+    }
+}
+
+// Row masks of the pixels of tile (tileX, tileY) inside all three edges.
+static void occlusionCoverageScalar(const OcclusionTriangle& tri, int tileX, int tileY, uint32_t mask[OCCLUSION_TILE_HEIGHT])
+{
+    float x0 = (float)(tileX * OCCLUSION_TILE_WIDTH) + 0.5f;
+    for (int row = 0; row < OCCLUSION_TILE_HEIGHT; row++)
+    {
+        float y = (float)(tileY * OCCLUSION_TILE_HEIGHT + row) + 0.5f;
+        uint32_t rowMask = ~0u;
+        for (int e = 0; e < 3; e++)
+        {
+            float offset = tri.b[e] * y + tri.c[e];
+            if (tri.a[e] == 0.0f)
+            {
+                if (offset < 0.0f) rowMask = 0;
+                continue;
+            }
+            // pixel centers x0 + i with a * (x0 + i) + offset >= 0
+            float crossing = fminf(fmaxf(-offset / tri.a[e] - x0, -1.0f), 33.0f);
+            if (tri.a[e] > 0.0f)
+            {
+                int first = (int)ceilf(crossing);
+                rowMask &= first <= 0 ? ~0u : first >= 32 ? 0u : ~0u << first;
+            }
+            else
+            {
+                int last = (int)floorf(crossing);
+                rowMask &= last >= 31 ? ~0u : last < 0 ? 0u : ~0u >> (31 - last);
+            }
+        }
+        mask[row] = rowMask;
+    }
+}
+
+#if OCCLUSION_SIMD
+// Masks of the SSE4.1 path: ~0u << k and ~0u >> k for k = 0..32, shifts of 32 giving the empty row.
+struct OcclusionShiftMasks {
+    uint32_t left[33];
+    uint32_t right[33];
+};
+
+static const OcclusionShiftMasks& occlusionShiftMasks()
+{
+    static const OcclusionShiftMasks masks = []() {
+        OcclusionShiftMasks m;
+        for (int k = 0; k < 33; k++)
+        {
+            m.left[k] = k < 32 ? ~0u << k : 0u;
+            m.right[k] = k < 32 ? ~0u >> k : 0u;
+        }
+        return m;
+    }();
+    return masks;
+}
+
+static CPU_TARGET("sse4.1") __m128i occlusionLookupMasks(const uint32_t table[33], __m128i k)
+{
+    return _mm_setr_epi32((int)table[_mm_extract_epi32(k, 0)], (int)table[_mm_extract_epi32(k, 1)],
+                          (int)table[_mm_extract_epi32(k, 2)], (int)table[_mm_extract_epi32(k, 3)]);
+}
+
+static CPU_TARGET("sse4.1") void occlusionCoverageSse41(const OcclusionTriangle& tri, int tileX, int tileY, uint32_t mask[OCCLUSION_TILE_HEIGHT])
+{
+    const OcclusionShiftMasks& masks = occlusionShiftMasks();
+    const __m128 rowOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    __m128 x0 = _mm_set1_ps((float)(tileX * OCCLUSION_TILE_WIDTH) + 0.5f);
+    const __m128i zero = _mm_setzero_si128(), maxShift = _mm_set1_epi32(32);
+    for (int half = 0; half < OCCLUSION_TILE_HEIGHT; half += 4)
+    {
+        __m128 y = _mm_add_ps(_mm_set1_ps((float)(tileY * OCCLUSION_TILE_HEIGHT + half)), rowOffsets);
+        __m128i rowMask = _mm_set1_epi32(-1);
+        for (int e = 0; e < 3; e++)
+        {
+            __m128 offset = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.b[e]), y), _mm_set1_ps(tri.c[e]));
+            if (tri.a[e] == 0.0f)
+            {
+                rowMask = _mm_and_si128(rowMask, _mm_castps_si128(_mm_cmpge_ps(offset, _mm_setzero_ps())));
+                continue;
+            }
+            __m128 crossing = _mm_sub_ps(_mm_div_ps(_mm_sub_ps(_mm_setzero_ps(), offset), _mm_set1_ps(tri.a[e])), x0);
+            crossing = _mm_min_ps(_mm_max_ps(crossing, _mm_set1_ps(-1.0f)), _mm_set1_ps(33.0f));
+            if (tri.a[e] > 0.0f)
+            {
+                __m128i first = _mm_min_epi32(_mm_max_epi32(_mm_cvtps_epi32(_mm_ceil_ps(crossing)), zero), maxShift);
+                rowMask = _mm_and_si128(rowMask, occlusionLookupMasks(masks.left, first));
+            }
+            else
+            {
+                __m128i last = _mm_cvtps_epi32(_mm_floor_ps(crossing));
+                __m128i shift = _mm_min_epi32(_mm_max_epi32(_mm_sub_epi32(_mm_set1_epi32(31), last), zero), maxShift);
+                rowMask = _mm_and_si128(rowMask, occlusionLookupMasks(masks.right, shift));
+            }
+        }
+        _mm_storeu_si128((__m128i*)(mask + half), rowMask);
+    }
+}
+
+static CPU_TARGET("avx2") void occlusionCoverageAvx2(const OcclusionTriangle& tri, int tileX, int tileY, uint32_t mask[OCCLUSION_TILE_HEIGHT])
+{
+    const __m256 rowOffsets = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+    __m256 y = _mm256_add_ps(_mm256_set1_ps((float)(tileY * OCCLUSION_TILE_HEIGHT)), rowOffsets);
+    __m256 x0 = _mm256_set1_ps((float)(tileX * OCCLUSION_TILE_WIDTH) + 0.5f);
+    const __m256i all = _mm256_set1_epi32(-1);
+    __m256i rowMask = all;
+    for (int e = 0; e < 3; e++)
+    {
+        __m256 offset = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(tri.b[e]), y), _mm256_set1_ps(tri.c[e]));
+        if (tri.a[e] == 0.0f)
+        {
+            rowMask = _mm256_and_si256(rowMask, _mm256_castps_si256(_mm256_cmp_ps(offset, _mm256_setzero_ps(), _CMP_GE_OQ)));
+            continue;
+        }
+        __m256 crossing = _mm256_sub_ps(_mm256_div_ps(_mm256_sub_ps(_mm256_setzero_ps(), offset), _mm256_set1_ps(tri.a[e])), x0);
+        crossing = _mm256_min_ps(_mm256_max_ps(crossing, _mm256_set1_ps(-1.0f)), _mm256_set1_ps(33.0f));
+        // variable shifts by 32 or more give zero, which is exactly the empty row
+        if (tri.a[e] > 0.0f)
+        {
+            __m256i first = _mm256_max_epi32(_mm256_cvtps_epi32(_mm256_ceil_ps(crossing)), _mm256_setzero_si256());
+            rowMask = _mm256_and_si256(rowMask, _mm256_sllv_epi32(all, first));
+        }
+        else
+        {
+            __m256i last = _mm256_cvtps_epi32(_mm256_floor_ps(crossing));
+            __m256i shift = _mm256_max_epi32(_mm256_sub_epi32(_mm256_set1_epi32(31), last), _mm256_setzero_si256());
+            rowMask = _mm256_and_si256(rowMask, _mm256_srlv_epi32(all, shift));
+        }
+    }
+    _mm256_storeu_si256((__m256i*)mask, rowMask);
+}
+#endif
+
+// Merges `coverage` at conservative depth `z` into a tile.
+static void occlusionUpdateTile(OcclusionTile* tile, const uint32_t coverage[OCCLUSION_TILE_HEIGHT], float z)
+{
+    // already hidden behind the reference layer
+    if (z <= tile->zMin[0]) return;
+
+    // merging would drag the working layer back further than it is in front of the reference:
+    // drop it and start over from this triangle
+    float dist1 = tile->zMin[1] - z;
+    float dist0 = z - tile->zMin[0];
+    if (tile->zMin[1] != FLT_MAX && dist1 > dist0)
+    {
+        memset(tile->mask, 0, sizeof(tile->mask));
+        tile->zMin[1] = FLT_MAX;
+    }
+
+    uint32_t full = ~0u;
+    for (int row = 0; row < OCCLUSION_TILE_HEIGHT; row++)
+    {
+        tile->mask[row] |= coverage[row];
+        full &= tile->mask[row];
+    }
+    tile->zMin[1] = fminf(tile->zMin[1], z);
+
+    if (full == ~0u)
+    {
+        tile->zMin[0] = tile->zMin[1];
+        tile->zMin[1] = FLT_MAX;
+        memset(tile->mask, 0, sizeof(tile->mask));
+    }
+}
+
+static void occlusionRasterizeRows(OcclusionBuffer* buffer, int tileRowBegin, int tileRowEnd)
+{
+    int bandMinY = tileRowBegin * OCCLUSION_TILE_HEIGHT;
+    int bandMaxY = tileRowEnd * OCCLUSION_TILE_HEIGHT - 1;
+    for (const OcclusionTriangle& tri : buffer->triangles)
+    {
+        if (tri.maxY < bandMinY || tri.minY > bandMaxY) continue;
+        int tileY0 = glm::max(tri.minY / OCCLUSION_TILE_HEIGHT, tileRowBegin);
+        int tileY1 = glm::min(tri.maxY / OCCLUSION_TILE_HEIGHT, tileRowEnd - 1);
+        int tileX0 = tri.minX / OCCLUSION_TILE_WIDTH;
+        int tileX1 = tri.maxX / OCCLUSION_TILE_WIDTH;
+        for (int ty = tileY0; ty <= tileY1; ty++)
+            for (int tx = tileX0; tx <= tileX1; tx++)
+            {
+                uint32_t coverage[OCCLUSION_TILE_HEIGHT];
+                switch (buffer->path)
+                {
+#if OCCLUSION_SIMD
+                case OCCLUSION_PATH_AVX2: occlusionCoverageAvx2(tri, tx, ty, coverage); break;
+                case OCCLUSION_PATH_SSE41: occlusionCoverageSse41(tri, tx, ty, coverage); break;
+#endif
+                default: occlusionCoverageScalar(tri, tx, ty, coverage); break;
+                }
+
+                uint32_t any = 0;
+                for (int row = 0; row < OCCLUSION_TILE_HEIGHT; row++) any |= coverage[row];
+                if (!any) continue;
+
+                // farthest point of the depth plane over the tile, never past the farthest vertex
+                float cornerX = (float)(tx * OCCLUSION_TILE_WIDTH + (tri.zx > 0.0f ? 0 : OCCLUSION_TILE_WIDTH));
+                float cornerY = (float)(ty * OCCLUSION_TILE_HEIGHT + (tri.zy > 0.0f ? 0 : OCCLUSION_TILE_HEIGHT));
+                float z = fmaxf(tri.zx * cornerX + tri.zy * cornerY + tri.z0, tri.zMin);
+                occlusionUpdateTile(&buffer->tiles[ty * buffer->tilesX + tx], coverage, z);
+            }
+    }
+}
+
+// Rasterizes every queued occluder, one job per band of tile rows.
+void occlusionRasterize(OcclusionBuffer* buffer)
+{
+    PROFILE_ZONE("occlusionRasterize");
+    jobsParallelFor("occlusion raster", buffer->tilesY, OCCLUSION_BAND_ROWS, [](void* data, int begin, int end) {
+        occlusionRasterizeRows((OcclusionBuffer*)data, begin, end);
+    }, buffer);
+}
+
+// False when the world space box is hidden behind the rasterized occluders. Boxes crossing the near
+// plane are always visible; boxes off screen are reported hidden, so frustum culling comes first.
+bool occlusionTestBox(const OcclusionBuffer* buffer, const glm::vec3& boxMin, const glm::vec3& boxMax)
+{
+    float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, zMax = 0.0f;
+    for (int corner = 0; corner < 8; corner++)
+    {
+        glm::vec3 p = glm::vec3(corner & 1 ? boxMax.x : boxMin.x, corner & 2 ? boxMax.y : boxMin.y, corner & 4 ? boxMax.z : boxMin.z);
+        glm::vec4 clip = buffer->viewProjection * glm::vec4(p, 1.0f);
+        if (clip.z < -clip.w) return true;
+        float z = 1.0f / clip.w;
+        float x = (clip.x * z * 0.5f + 0.5f) * buffer->width;
+        float y = (clip.y * z * 0.5f + 0.5f) * buffer->height;
+        minX = fminf(minX, x); maxX = fmaxf(maxX, x);
+        minY = fminf(minY, y); maxY = fmaxf(maxY, y);
+        zMax = fmaxf(zMax, z);
+    }
+
+    // pixels whose centers the rectangle touches, widened by one so partially touched pixels count
+    int x0 = glm::max((int)floorf(minX) - 1, 0), x1 = glm::min((int)ceilf(maxX), buffer->width - 1);
+    int y0 = glm::max((int)floorf(minY) - 1, 0), y1 = glm::min((int)ceilf(maxY), buffer->height - 1);
+    if (x0 > x1 || y0 > y1) return false;
+
+    for (int ty = y0 / OCCLUSION_TILE_HEIGHT; ty <= y1 / OCCLUSION_TILE_HEIGHT; ty++)
+        for (int tx = x0 / OCCLUSION_TILE_WIDTH; tx <= x1 / OCCLUSION_TILE_WIDTH; tx++)
+        {
+            const OcclusionTile* tile = &buffer->tiles[ty * buffer->tilesX + tx];
+            if (zMax < tile->zMin[0]) continue;
+            if (zMax >= tile->zMin[1]) return true;
+
+            // behind the working layer: every touched pixel of the tile must be in its mask
+            int first = glm::max(x0 - tx * OCCLUSION_TILE_WIDTH, 0);
+            int last = glm::min(x1 - tx * OCCLUSION_TILE_WIDTH, OCCLUSION_TILE_WIDTH - 1);
+            uint32_t columns = (last >= 31 ? ~0u : ~0u >> (31 - last)) & (~0u << first);
+            int rowBegin = glm::max(y0 - ty * OCCLUSION_TILE_HEIGHT, 0);
+            int rowEnd = glm::min(y1 - ty * OCCLUSION_TILE_HEIGHT, OCCLUSION_TILE_HEIGHT - 1);
+            for (int row = rowBegin; row <= rowEnd; row++)
+                if (columns & ~tile->mask[row]) return true;
+        }
+    return false;
+}
+
+bool occlusionTestSphere(const OcclusionBuffer* buffer, const glm::vec3& center, float radius)
+{
+    return occlusionTestBox(buffer, center - glm::vec3(radius), center + glm::vec3(radius));
+}
+
+// ---- benchmark ---------------------------------------------------------------------------------
+
+static double occlusionElapsedMs(std::chrono::steady_clock::time_point start)
+{
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() * 1e-6;
+}
+
+// unit cube, counter-clockwise from outside
+static const float g_occlusion_cube[8][3] = {{-1,-1,-1}, {1,-1,-1}, {1,1,-1}, {-1,1,-1}, {-1,-1,1}, {1,-1,1}, {1,1,1}, {-1,1,1}};
+static const unsigned int g_occlusion_cube_indices[36] = {0,2,1, 0,3,2, 4,5,6, 4,6,7, 0,1,5, 0,5,4, 3,7,6, 3,6,2, 0,4,7, 0,7,3, 1,2,6, 1,6,5};
+
+// 45 degree, 16:9 perspective from the origin down -Z, near 0.1 and far 100.
+static glm::mat4 occlusionTestProjection()
+{
+    glm::mat4 projection = glm::mat4(0.0f);
+    float f = 1.0f / tanf(0.5f * 0.785398f), aspect = 16.0f / 9.0f, n = 0.1f, far = 100.0f;
+    projection[0][0] = f / aspect; projection[1][1] = f;
+    projection[2][2] = (far + n) / (n - far); projection[2][3] = -1.0f; projection[3][2] = 2.0f * far * n / (n - far);
+    return projection;
+}
+
+// A few hundred random boxes in front of occlusionTestProjection, as cube transforms, and sphere
+// centers behind them.
+static void occlusionRandomScene(std::vector<glm::mat4>* occluders, std::vector<glm::vec3>* tests, int numOccluders, int numTests)
+{
+    uint32_t rng = 777;
+    auto rnd = [&rng]() { rng = rng * 1664525u + 1013904223u; return (rng >> 8) * (1.0f / 16777216.0f); };
+    occluders->resize(numOccluders);
+    for (glm::mat4& m : *occluders)
+    {
+        glm::vec3 size = glm::vec3(0.5f + 2.5f * rnd(), 0.5f + 2.5f * rnd(), 0.3f + rnd());
+        m = glm::mat4(1.0f);
+        m[0][0] = size.x; m[1][1] = size.y; m[2][2] = size.z;
+        m[3] = glm::vec4(rnd() * 40.0f - 20.0f, rnd() * 20.0f - 10.0f, -5.0f - rnd() * 40.0f, 1.0f);
+    }
+    tests->resize(numTests);
+    for (glm::vec3& p : *tests) p = glm::vec3(rnd() * 60.0f - 30.0f, rnd() * 30.0f - 15.0f, -20.0f - rnd() * 60.0f);
+}
+
+// occlusionBegin, then every box as an occluder.
+static void occlusionAddBoxes(OcclusionBuffer* buffer, const glm::mat4& viewProjection, const std::vector<glm::mat4>& boxes)
+{
+    occlusionBegin(buffer, viewProjection);
+    for (const glm::mat4& m : boxes)
+        occlusionAddOccluder(buffer, &g_occlusion_cube[0][0], sizeof(g_occlusion_cube[0]), g_occlusion_cube_indices, 36, m);
+}
+
+// Rasterizes a few hundred random boxes and tests thousands more behind them. Reports raster time
+// with and without jobs, test cost, the share culled, and for every coverage path the CPU runs its
+// single thread raster time and the tiles where it disagrees with the scalar path.
+void occlusionBenchmark()
+{
+    const int numOccluders = 300, numTests = 20000, runs = 5;
+    std::vector<glm::mat4> occluders;
+    std::vector<glm::vec3> tests;
+    occlusionRandomScene(&occluders, &tests, numOccluders, numTests);
+    glm::mat4 projection = occlusionTestProjection();
+
+    OcclusionBuffer buffer, reference;
+    occlusionInit(&buffer);
+    occlusionInit(&reference);
+    reference.path = OCCLUSION_PATH_SCALAR;
+
+    double best[4] = {1e30, 1e30, 1e30, 1e30};
+    int culled = 0;
+    for (int run = 0; run < runs; run++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        occlusionAddBoxes(&buffer, projection, occluders);
+        best[0] = glm::min(best[0], occlusionElapsedMs(start));
+
+        start = std::chrono::steady_clock::now();
+        occlusionRasterizeRows(&buffer, 0, buffer.tilesY);
+        best[1] = glm::min(best[1], occlusionElapsedMs(start));
+
+        occlusionAddBoxes(&buffer, projection, occluders);
+        start = std::chrono::steady_clock::now();
+        occlusionRasterize(&buffer);
+        best[2] = glm::min(best[2], occlusionElapsedMs(start));
+
+        culled = 0;
+        start = std::chrono::steady_clock::now();
+        for (const glm::vec3& p : tests) culled += !occlusionTestSphere(&buffer, p, 0.5f);
+        best[3] = glm::min(best[3], occlusionElapsedMs(start));
+    }
+
+    occlusionAddBoxes(&reference, projection, occluders);
+    occlusionRasterizeRows(&reference, 0, reference.tilesY);
+
+    printf("occlusion benchmark: %dx%d, %s coverage, %d workers, best of %d runs\n", buffer.width, buffer.height,
+           g_occlusion_path_str[buffer.path], g_jobs.numWorkers, runs);
+    printf("  %d occluders, %d triangles after culling and clipping\n", numOccluders, (int)buffer.triangles.size());
+    printf("  setup %.3f ms, raster %.3f ms single thread, %.3f ms with jobs\n", best[0], best[1], best[2]);
+    printf("  %d tests: %.1f ns/test, %.1f%% culled\n", numTests, best[3] * 1e6 / numTests, 100.0 * culled / numTests);
+
+    // every path over the same triangles, single thread
+    printf("  %-8s %12s %14s\n", "coverage", "raster ms", "tiles differ");
+    int defaultPath = buffer.path;
+    for (int path = 0; path < OCCLUSION_PATH_MAX; path++)
+    {
+        if (!occlusionPathSupported(path))
+        {
+            printf("  %-8s %12s %14s\n", g_occlusion_path_str[path], "-", "unavailable");
+            continue;
+        }
+        buffer.path = path;
+        double raster = 1e30;
+        for (int run = 0; run < runs; run++)
+        {
+            occlusionAddBoxes(&buffer, projection, occluders);
+            auto start = std::chrono::steady_clock::now();
+            occlusionRasterizeRows(&buffer, 0, buffer.tilesY);
+            raster = glm::min(raster, occlusionElapsedMs(start));
+        }
+        int mismatched = 0;
+        for (int i = 0; i < buffer.tilesX * buffer.tilesY; i++)
+            mismatched += memcmp(&buffer.tiles[i], &reference.tiles[i], sizeof(OcclusionTile)) != 0;
+        printf("  %-8s %12.3f %9d of %d\n", g_occlusion_path_str[path], raster, mismatched, buffer.tilesX * buffer.tilesY);
+    }
+    buffer.path = defaultPath;
+    occlusionDestroy(&buffer);
+    occlusionDestroy(&reference);
+}
+
+// Checks every coverage path the CPU runs (--test-occlusion); false on any failure:
+//  - the random benchmark scene rasterizes to the same tiles as the scalar path, single thread and
+//    with jobs,
+//  - behind a wall, boxes fully covered are hidden and boxes in front of it, beside it, peeking past
+//    its edge or crossing the near plane are visible.
+bool occlusionSelfTest()
+{
+    std::vector<glm::mat4> occluders;
+    std::vector<glm::vec3> tests;
+    occlusionRandomScene(&occluders, &tests, 300, 0);
+    glm::mat4 projection = occlusionTestProjection();
+
+    // wall 6 x 6 x 0.2 at z = -10; the screen is 14.7 x 8.3 across at z = -20
+    glm::mat4 wall = glm::mat4(1.0f);
+    wall[0][0] = 3.0f; wall[1][1] = 3.0f; wall[2][2] = 0.1f;
+    wall[3] = glm::vec4(0.0f, 0.0f, -10.0f, 1.0f);
+    struct BoxCase { const char* name; glm::vec3 boxMin, boxMax; bool visible; };
+    const BoxCase cases[] = {
+        {"behind the wall",            glm::vec3(-0.5f, -0.5f, -20.5f), glm::vec3(0.5f, 0.5f, -19.5f), false},
+        {"large, behind the wall",     glm::vec3(-2.0f, -2.0f, -25.0f), glm::vec3(2.0f, 2.0f, -15.0f),  false},
+        {"in front of the wall",       glm::vec3(-0.5f, -0.5f, -5.5f),  glm::vec3(0.5f, 0.5f, -4.5f),   true},
+        {"beside the wall",            glm::vec3(9.5f, -0.5f, -20.5f),  glm::vec3(10.5f, 0.5f, -19.5f), true},
+        {"peeking past the wall edge", glm::vec3(5.0f, -0.5f, -20.5f),  glm::vec3(7.0f, 0.5f, -19.5f),  true},
+        {"through the wall",           glm::vec3(-0.5f, -0.5f, -12.0f), glm::vec3(0.5f, 0.5f, -8.0f),   true},
+        {"crossing the near plane",    glm::vec3(-1.0f, -1.0f, -30.0f), glm::vec3(1.0f, 1.0f, 1.0f),    true},
+        {"crossing the near plane, inside the wall's shadow", glm::vec3(-0.5f, -0.5f, -30.0f), glm::vec3(0.5f, 0.5f, -0.05f), true},
+    };
+
+    OcclusionBuffer buffer, reference;
+    occlusionInit(&buffer);
+    occlusionInit(&reference);
+    reference.path = OCCLUSION_PATH_SCALAR;
+    occlusionAddBoxes(&reference, projection, occluders);
+    occlusionRasterizeRows(&reference, 0, reference.tilesY);
+
+    int failures = 0, tiles = buffer.tilesX * buffer.tilesY;
+    for (int path = 0; path < OCCLUSION_PATH_MAX; path++)
+    {
+        if (!occlusionPathSupported(path)) continue;
+        buffer.path = path;
+        int pathFailures = failures;
+        for (int threaded = 0; threaded < 2; threaded++)
+        {
+            occlusionAddBoxes(&buffer, projection, occluders);
+            if (threaded) occlusionRasterize(&buffer);
+            else occlusionRasterizeRows(&buffer, 0, buffer.tilesY);
+            int mismatched = 0;
+            for (int i = 0; i < tiles; i++)
+                mismatched += memcmp(&buffer.tiles[i], &reference.tiles[i], sizeof(OcclusionTile)) != 0;
+            if (mismatched != 0)
+            {
+                printf("ERROR::OCCLUSION::SELF_TEST: %s coverage%s differs from scalar in %d of %d tiles\n",
+                       g_occlusion_path_str[path], threaded ? " with jobs" : "", mismatched, tiles);
+                failures++;
+            }
+        }
+
+        occlusionAddBoxes(&buffer, projection, std::vector<glm::mat4>(1, wall));
+        occlusionRasterize(&buffer);
+        for (const BoxCase& box : cases)
+        {
+            if (occlusionTestBox(&buffer, box.boxMin, box.boxMax) == box.visible) continue;
+            printf("ERROR::OCCLUSION::SELF_TEST: %s coverage, box %s reported %s\n",
+                   g_occlusion_path_str[path], box.name, box.visible ? "hidden" : "visible");
+            failures++;
+        }
+        printf("occlusion self-test: %s coverage %s\n", g_occlusion_path_str[path], failures > pathFailures ? "FAILED" : "ok");
+    }
+    occlusionDestroy(&buffer);
+    occlusionDestroy(&reference);
+    return failures == 0;
+}
+
+#endif
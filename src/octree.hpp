@@ -0,0 +1,453 @@
+#ifndef OCTREE_H
+#define OCTREE_H
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+#include "../thirdparty/glm/glm.hpp"
+#include "frustum.hpp"
+#include "profiler.hpp"
+
+// Loose octree over bounding spheres of moving objects.
+// Every node's bounds are its cell grown to twice the size, so an object can live in any node whose
+// cell contains its center and is at least as big as its radius. The deepest such level is computed
+// directly from the sphere, but objects only sink that far through split nodes: a node holds up to
+// OCTREE_LEAF_OBJECTS objects before it splits and pushes the ones that fit a child down, and a split
+// node whose subtree drops to half that is collapsed back into a leaf. Sparse small objects therefore
+// share a coarse cell instead of each getting a private chain of nodes down to OCTREE_MAX_DEPTH.
+// A move that stays in its node only rewrites the sphere, and remove unlinks the object from its
+// node's list and frees nodes left empty. Nodes and objects come from pools with free lists, so steady
+// state churn allocates nothing.
+// Queries append the values objects were inserted with to a caller's list. Subtrees with no
+// objects are skipped, and nodes entirely inside a frustum are taken whole without further tests.
+// Objects whose center leaves the root cell are kept in the root, which queries always open.
+//
+//     int handle = octreeInsert(&octree, center, radius, value);
+//     octreeMove(&octree, handle, newCenter, radius);      // every time it moves
+//     visible.clear(); octreeQueryFrustum(&octree, viewFrustum, &visible);
+
+#define OCTREE_MAX_DEPTH 8
+#define OCTREE_LEAF_OBJECTS 16 // a leaf with more objects than this splits
+#define OCTREE_NONE -1
+
+struct OctreeNode {
+    glm::vec3 center;       // of the cell; the loose bounds are center +- 2 * halfSize
+    float halfSize;
+    int depth;
+    int cellX, cellY, cellZ;
+    int parent;
+    int children[8];        // bit 0 x, bit 1 y, bit 2 z set for the upper half
+    int firstObject;        // doubly linked through OctreeObject
+    int numObjects;
+    int subtreeObjects;     // this node and everything below it
+    bool split;             // objects that fit a child go down to it; a leaf has no children
+};
+
+struct OctreeObject {
+    glm::vec3 center;
+    float radius;
+    int value;
+    int node;               // OCTREE_NONE while on the free list
+    int prev, next;
+};
+
+struct Octree {
+    glm::vec3 center;
+    float halfSize;
+    std::vector<OctreeNode> nodes;      // nodes[0] is the root
+    std::vector<int> freeNodes;
+    std::vector<OctreeObject> objects;
+    std::vector<int> freeObjects;
+};
+
+static int octreeAllocNode(Octree* tree, int parent, int depth, int cellX, int cellY, int cellZ)
+{
+    int index;
+    if (!tree->freeNodes.empty()) { index = tree->freeNodes.back(); tree->freeNodes.pop_back(); }
+    else { index = (int)tree->nodes.size(); tree->nodes.emplace_back(); }
+
+    OctreeNode* node = &tree->nodes[index];
+    float cellSize = 2.0f * tree->halfSize / (float)(1 << depth);
+    node->halfSize = 0.5f * cellSize;
+    node->center = tree->center - glm::vec3(tree->halfSize) + (glm::vec3((float)cellX, (float)cellY, (float)cellZ) + 0.5f) * cellSize;
+    node->depth = depth;
+    node->cellX = cellX; node->cellY = cellY; node->cellZ = cellZ;
+    node->parent = parent;
+    for (int i = 0; i < 8; i++) node->children[i] = OCTREE_NONE;
+    node->firstObject = OCTREE_NONE;
+    node->numObjects = 0;
+    node->subtreeObjects = 0;
+    node->split = false;
+    return index;
+}
+
+void octreeInit(Octree* tree, const glm::vec3& center, float halfSize, int reserveObjects = 0)
+{
+    tree->center = center;
+    tree->halfSize = halfSize;
+    tree->nodes.clear();
+    tree->freeNodes.clear();
+    tree->objects.clear();
+    tree->freeObjects.clear();
+    tree->objects.reserve(reserveObjects);
+    tree->nodes.reserve(reserveObjects / 2 + 1);
+    octreeAllocNode(tree, OCTREE_NONE, 0, 0, 0, 0);
+}
+
+void octreeDestroy(Octree* tree)
+{
+    tree->nodes = std::vector<OctreeNode>();
+    tree->freeNodes = std::vector<int>();
+    tree->objects = std::vector<OctreeObject>();
+    tree->freeObjects = std::vector<int>();
+}
+
+// Deepest level a sphere may live at, the one whose half cell size covers the radius, and its cell there.
+static void octreeLocate(const Octree* tree, const glm::vec3& center, float radius, int* depth, int cell[3])
+{
+    glm::vec3 local = (center - tree->center + glm::vec3(tree->halfSize)) / (2.0f * tree->halfSize);
+    if (local.x < 0.0f || local.y < 0.0f || local.z < 0.0f || local.x >= 1.0f || local.y >= 1.0f || local.z >= 1.0f)
+    {
+        *depth = 0;
+        cell[0] = cell[1] = cell[2] = 0;
+        return;
+    }
+    int d = radius > 0.0f ? (int)floorf(log2f(tree->halfSize / radius)) : OCTREE_MAX_DEPTH;
+    d = glm::clamp(d, 0, OCTREE_MAX_DEPTH);
+    int cells = 1 << d;
+    for (int axis = 0; axis < 3; axis++) cell[axis] = glm::min((int)(local[axis] * cells), cells - 1);
+    *depth = d;
+}
+
+static int octreeChildIndex(const int cell[3], int shift)
+{
+    return ((cell[0] >> shift) & 1) | (((cell[1] >> shift) & 1) << 1) | (((cell[2] >> shift) & 1) << 2);
+}
+
+static void octreeAppend(Octree* tree, int nodeIndex, int handle)
+{
+    OctreeNode* node = &tree->nodes[nodeIndex];
+    OctreeObject* object = &tree->objects[handle];
+    object->node = nodeIndex;
+    object->prev = OCTREE_NONE;
+    object->next = node->firstObject;
+    if (node->firstObject != OCTREE_NONE) tree->objects[node->firstObject].prev = handle;
+    node->firstObject = handle;
+    node->numObjects++;
+}
+
+static void octreeDetach(Octree* tree, int handle)
+{
+    OctreeObject* object = &tree->objects[handle];
+    OctreeNode* node = &tree->nodes[object->node];
+    if (object->prev != OCTREE_NONE) tree->objects[object->prev].next = object->next;
+    else node->firstObject = object->next;
+    if (object->next != OCTREE_NONE) tree->objects[object->next].prev = object->prev;
+    node->numObjects--;
+    object->node = OCTREE_NONE;
+}
+
+// Turns a leaf into a split node, moving every object that fits a child one level down and
+// splitting the children that end up over the limit in turn.
+static void octreeSplit(Octree* tree, int nodeIndex)
+{
+    tree->nodes[nodeIndex].split = true;
+    int nodeDepth = tree->nodes[nodeIndex].depth;
+    for (int o = tree->nodes[nodeIndex].firstObject; o != OCTREE_NONE;)
+    {
+        int next = tree->objects[o].next;
+        int depth, cell[3];
+        octreeLocate(tree, tree->objects[o].center, tree->objects[o].radius, &depth, cell);
+        if (depth > nodeDepth)
+        {
+            int shift = depth - nodeDepth - 1;
+            int child = octreeChildIndex(cell, shift);
+            int childIndex = tree->nodes[nodeIndex].children[child];
+            if (childIndex == OCTREE_NONE)
+            {
+                childIndex = octreeAllocNode(tree, nodeIndex, nodeDepth + 1, cell[0] >> shift, cell[1] >> shift, cell[2] >> shift);
+                tree->nodes[nodeIndex].children[child] = childIndex;
+            }
+            octreeDetach(tree, o);
+            octreeAppend(tree, childIndex, o);
+            tree->nodes[childIndex].subtreeObjects++;
+        }
+        o = next;
+    }
+    for (int i = 0; i < 8; i++)
+    {
+        int childIndex = tree->nodes[nodeIndex].children[i];
+        if (childIndex != OCTREE_NONE && tree->nodes[childIndex].numObjects > OCTREE_LEAF_OBJECTS) octreeSplit(tree, childIndex);
+    }
+}
+
+// Pulls every object below `nodeIndex` up into it and returns the emptied nodes to the pool.
+static void octreeCollapse(Octree* tree, int nodeIndex, int target)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        int childIndex = tree->nodes[nodeIndex].children[i];
+        if (childIndex == OCTREE_NONE) continue;
+        while (tree->nodes[childIndex].firstObject != OCTREE_NONE)
+        {
+            int o = tree->nodes[childIndex].firstObject;
+            octreeDetach(tree, o);
+            octreeAppend(tree, target, o);
+        }
+        octreeCollapse(tree, childIndex, target);
+        tree->nodes[nodeIndex].children[i] = OCTREE_NONE;
+        tree->freeNodes.push_back(childIndex);
+    }
+    tree->nodes[nodeIndex].split = false;
+}
+
+// Walks down through split nodes towards the object's deepest cell, creating the missing children of
+// split nodes, and stops at the first leaf, which splits if the object takes it over the limit.
+static void octreeLink(Octree* tree, int handle, int depth, const int cell[3])
+{
+    int nodeIndex = 0;
+    tree->nodes[0].subtreeObjects++;
+    for (int level = 1; level <= depth; level++)
+    {
+        if (!tree->nodes[nodeIndex].split) break;
+        int shift = depth - level;
+        int child = octreeChildIndex(cell, shift);
+        int next = tree->nodes[nodeIndex].children[child];
+        if (next == OCTREE_NONE)
+        {
+            next = octreeAllocNode(tree, nodeIndex, level, cell[0] >> shift, cell[1] >> shift, cell[2] >> shift);
+            tree->nodes[nodeIndex].children[child] = next;
+        }
+        nodeIndex = next;
+        tree->nodes[nodeIndex].subtreeObjects++;
+    }
+
+    octreeAppend(tree, nodeIndex, handle);
+    const OctreeNode* node = &tree->nodes[nodeIndex];
+    if (!node->split && node->numObjects > OCTREE_LEAF_OBJECTS && node->depth < OCTREE_MAX_DEPTH) octreeSplit(tree, nodeIndex);
+}
+
+static void octreeUnlink(Octree* tree, int handle)
+{
+    int nodeIndex = tree->objects[handle].node;
+    octreeDetach(tree, handle);
+
+    // walk up, returning nodes whose subtree emptied to the pool and collapsing split nodes that thinned out
+    while (nodeIndex != OCTREE_NONE)
+    {
+        OctreeNode* n = &tree->nodes[nodeIndex];
+        int parent = n->parent;
+        if (--n->subtreeObjects == 0 && parent != OCTREE_NONE)
+        {
+            OctreeNode* p = &tree->nodes[parent];
+            for (int i = 0; i < 8; i++)
+                if (p->children[i] == nodeIndex) p->children[i] = OCTREE_NONE;
+            tree->freeNodes.push_back(nodeIndex);
+        }
+        else if (n->split && n->subtreeObjects <= OCTREE_LEAF_OBJECTS / 2)
+        {
+            octreeCollapse(tree, nodeIndex, nodeIndex);
+        }
+        nodeIndex = parent;
+    }
+}
+
+// Returns a handle for octreeMove and octreeRemove; `value` is what queries report.
+int octreeInsert(Octree* tree, const glm::vec3& center, float radius, int value)
+{
+    int handle;
+    if (!tree->freeObjects.empty()) { handle = tree->freeObjects.back(); tree->freeObjects.pop_back(); }
+    else { handle = (int)tree->objects.size(); tree->objects.emplace_back(); }
+
+    OctreeObject* object = &tree->objects[handle];
+    object->center = center;
+    object->radius = radius;
+    object->value = value;
+    int depth, cell[3];
+    octreeLocate(tree, center, radius, &depth, cell);
+    octreeLink(tree, handle, depth, cell);
+    return handle;
+}
+
+void octreeMove(Octree* tree, int handle, const glm::vec3& center, float radius)
+{
+    OctreeObject* object = &tree->objects[handle];
+    object->center = center;
+    object->radius = radius;
+    int depth, cell[3];
+    octreeLocate(tree, center, radius, &depth, cell);
+    // stay while the node's cell still holds the center, unless a split node now has a child that fits
+    const OctreeNode* node = &tree->nodes[object->node];
+    int shift = depth - node->depth;
+    if (shift >= 0 && (shift == 0 || !node->split) &&
+        node->cellX == cell[0] >> shift && node->cellY == cell[1] >> shift && node->cellZ == cell[2] >> shift) return;
+    octreeUnlink(tree, handle);
+    octreeLink(tree, handle, depth, cell);
+}
+
+void octreeRemove(Octree* tree, int handle)
+{
+    octreeUnlink(tree, handle);
+    tree->freeObjects.push_back(handle);
+}
+
+static void octreeCollect(const Octree* tree, int nodeIndex, std::vector<int>* out)
+{
+    const OctreeNode* node = &tree->nodes[nodeIndex];
+    for (int o = node->firstObject; o != OCTREE_NONE; o = tree->objects[o].next)
+        out->push_back(tree->objects[o].value);
+    for (int i = 0; i < 8; i++)
+        if (node->children[i] != OCTREE_NONE) octreeCollect(tree, node->children[i], out);
+}
+
+static void octreeQueryFrustumNode(const Octree* tree, int nodeIndex, const Frustum& frustum, std::vector<int>* out)
+{
+    const OctreeNode* node = &tree->nodes[nodeIndex];
+    if (node->subtreeObjects == 0) return;
+    if (nodeIndex != 0)
+    {
+        glm::vec3 looseMin = node->center - glm::vec3(2.0f * node->halfSize);
+        glm::vec3 looseMax = node->center + glm::vec3(2.0f * node->halfSize);
+        if (!frustumTestBox(frustum, looseMin, looseMax)) return;
+        if (frustumContainsBox(frustum, looseMin, looseMax)) { octreeCollect(tree, nodeIndex, out); return; }
+    }
+    for (int o = node->firstObject; o != OCTREE_NONE; o = tree->objects[o].next)
+    {
+        const OctreeObject* object = &tree->objects[o];
+        if (frustumTestSphere(frustum, object->center, object->radius)) out->push_back(object->value);
+    }
+    for (int i = 0; i < 8; i++)
+        if (node->children[i] != OCTREE_NONE) octreeQueryFrustumNode(tree, node->children[i], frustum, out);
+}
+
+// Appends the value of every object whose sphere intersects the frustum.
+void octreeQueryFrustum(const Octree* tree, const Frustum& frustum, std::vector<int>* out)
+{
+    PROFILE_ZONE("octreeQueryFrustum");
+    octreeQueryFrustumNode(tree, 0, frustum, out);
+}
+
+static void octreeQuerySphereNode(const Octree* tree, int nodeIndex, const glm::vec3& center, float radius, std::vector<int>* out)
+{
+    const OctreeNode* node = &tree->nodes[nodeIndex];
+    if (node->subtreeObjects == 0) return;
+    if (nodeIndex != 0)
+    {
+        glm::vec3 d = glm::max(glm::abs(center - node->center) - glm::vec3(2.0f * node->halfSize), glm::vec3(0.0f));
+        if (glm::dot(d, d) > radius * radius) return;
+    }
+    for (int o = node->firstObject; o != OCTREE_NONE; o = tree->objects[o].next)
+    {
+        const OctreeObject* object = &tree->objects[o];
+        float reach = object->radius + radius;
+        glm::vec3 d = object->center - center;
+        if (glm::dot(d, d) <= reach * reach) out->push_back(object->value);
+    }
+    for (int i = 0; i < 8; i++)
+        if (node->children[i] != OCTREE_NONE) octreeQuerySphereNode(tree, node->children[i], center, radius, out);
+}
+
+// Appends the value of every object whose sphere intersects the given one.
+void octreeQuerySphere(const Octree* tree, const glm::vec3& center, float radius, std::vector<int>* out)
+{
+    octreeQuerySphereNode(tree, 0, center, radius, out);
+}
+
+// ---- benchmark ---------------------------------------------------------------------------------
+
+static double octreeElapsedNs(std::chrono::steady_clock::time_point start)
+{
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Inserts objects of mixed sizes, moves all of them every frame and runs frustum and sphere queries,
+// checking query results against brute force and timing a linear frustum loop over all objects.
+void octreeBenchmark()
+{
+    const int counts[] = {10000, 50000, 100000};
+    const int frames = 20;
+    printf("octree benchmark: %d frames of random walks (ns per object, ns per query)\n", frames);
+    printf("  %8s %8s %8s %8s %10s %10s %10s %8s %10s\n", "count", "insert", "move", "remove", "frustum", "brute", "sphere", "nodes", "mismatches");
+
+    glm::mat4 projection = glm::mat4(0.0f);
+    float f = 1.0f / tanf(0.5f * 0.785398f), near = 0.1f, far = 200.0f;
+    projection[0][0] = f / (16.0f / 9.0f); projection[1][1] = f;
+    projection[2][2] = (far + near) / (near - far); projection[2][3] = -1.0f; projection[3][2] = 2.0f * far * near / (near - far);
+
+    for (int n : counts)
+    {
+        uint32_t rng = 99;
+        auto rnd = [&rng]() { rng = rng * 1664525u + 1013904223u; return (rng >> 8) * (1.0f / 16777216.0f); };
+        std::vector<glm::vec3> centers(n), velocities(n);
+        std::vector<float> radii(n);
+        for (int i = 0; i < n; i++)
+        {
+            centers[i] = glm::vec3(rnd(), rnd(), rnd()) * 400.0f - 200.0f;
+            velocities[i] = glm::vec3(rnd() - 0.5f, rnd() - 0.5f, rnd() - 0.5f) * 2.0f;
+            radii[i] = rnd() < 0.95f ? 0.25f + rnd() : 2.0f + 20.0f * rnd();
+        }
+
+        Octree tree;
+        octreeInit(&tree, glm::vec3(0.0f), 256.0f, n);
+        std::vector<int> handles(n);
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; i++) handles[i] = octreeInsert(&tree, centers[i], radii[i], i);
+        double insertNs = octreeElapsedNs(start);
+
+        double moveNs = 0.0, frustumNs = 0.0, bruteNs = 0.0, sphereNs = 0.0;
+        int mismatches = 0;
+        std::vector<int> result;
+        std::vector<unsigned char> seen(n);
+        for (int frame = 0; frame < frames; frame++)
+        {
+            for (int i = 0; i < n; i++) centers[i] += velocities[i];
+            start = std::chrono::steady_clock::now();
+            for (int i = 0; i < n; i++) octreeMove(&tree, handles[i], centers[i], radii[i]);
+            moveNs += octreeElapsedNs(start);
+
+            float yaw = 6.2831853f * frame / frames;
+            glm::vec3 eye = glm::vec3(0.0f, 10.0f, 0.0f), forward = glm::vec3(cosf(yaw), 0.0f, sinf(yaw));
+            glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0.0f, 1.0f, 0.0f))), up = glm::cross(right, forward);
+            glm::mat4 view = glm::mat4(glm::vec4(right.x, up.x, -forward.x, 0.0f), glm::vec4(right.y, up.y, -forward.y, 0.0f),
+                                       glm::vec4(right.z, up.z, -forward.z, 0.0f),
+                                       glm::vec4(-glm::dot(right, eye), -glm::dot(up, eye), glm::dot(forward, eye), 1.0f));
+            Frustum frustum = frustumFromMatrix(projection * view);
+
+            result.clear();
+            start = std::chrono::steady_clock::now();
+            octreeQueryFrustum(&tree, frustum, &result);
+            frustumNs += octreeElapsedNs(start);
+            memset(seen.data(), 0, n);
+            for (int value : result) seen[value]++;
+            for (int i = 0; i < n; i++) mismatches += seen[i] != (frustumTestSphere(frustum, centers[i], radii[i]) ? 1 : 0);
+
+            result.clear();
+            start = std::chrono::steady_clock::now();
+            for (int i = 0; i < n; i++)
+                if (frustumTestSphere(frustum, centers[i], radii[i])) result.push_back(i);
+            bruteNs += octreeElapsedNs(start);
+
+            glm::vec3 probe = centers[frame * 7919 % n];
+            result.clear();
+            start = std::chrono::steady_clock::now();
+            octreeQuerySphere(&tree, probe, 16.0f, &result);
+            sphereNs += octreeElapsedNs(start);
+            memset(seen.data(), 0, n);
+            for (int value : result) seen[value]++;
+            for (int i = 0; i < n; i++)
+                mismatches += seen[i] != (glm::length(centers[i] - probe) <= radii[i] + 16.0f ? 1 : 0);
+        }
+
+        int nodes = (int)(tree.nodes.size() - tree.freeNodes.size());
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; i++) octreeRemove(&tree, handles[i]);
+        double removeNs = octreeElapsedNs(start);
+        printf("  %8d %8.1f %8.1f %8.1f %10.0f %10.0f %10.0f %8d %10d\n", n, insertNs / n, moveNs / ((double)n * frames), removeNs / n,
+               frustumNs / frames, bruteNs / frames, sphereNs / frames, nodes, mismatches);
+        octreeDestroy(&tree);
+    }
+}
+
+#endif
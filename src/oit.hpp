@@ -0,0 +1,127 @@
+#ifndef OIT_H
+#define OIT_H
+#include <glad/glad.h>
+#include <stdio.h>
+#include <string.h>
+#include "shader.hpp"
+#include "renderstats.hpp"
+
+// Weighted blended order-independent transparency (McGuire and Bavoil 2013).
+// Transparent surfaces are drawn in any order into two targets that share the opaque depth buffer:
+// an accumulation target summing premultiplied color and alpha, each weighted by coverage and depth,
+// and a revealage target multiplying (1 - alpha). Both blends are commutative, so nothing is sorted.
+// The composite pass then lays the weighted average color over the HDR buffer with the total coverage.
+// The targets have the sample count of the HDR buffer and the composite runs per sample.
+//
+// Per frame, after the opaque passes:
+//     oitBegin(&oit);                          // bind the accumulation shader and draw transparent geometry
+//     oitComposite(&oit, hdrFramebuffer);
+// Shaders drawing into the pass write both outputs, see shaders/window.glsl.
+
+struct WeightedBlendedOIT {
+    unsigned int fbo;
+    unsigned int accumTexture;      // RGBA16F: sum of weighted premultiplied color, weighted alpha in a
+    unsigned int revealTexture;     // R8: product of (1 - alpha)
+    unsigned int emptyVAO;          // the composite triangle comes from gl_VertexID
+    Shader composite;
+    int width, height, samples;
+};
+
+static unsigned int createOitTarget(GLenum format, int width, int height, int samples)
+{
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, texture);
+    glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, samples, format, width, height, GL_TRUE);
+    glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
+    return texture;
+}
+
+// `depthRenderbuffer` is the depth buffer of the HDR framebuffer, so transparent fragments behind
+// opaque ones are rejected without writing depth themselves.
+void oitInit(WeightedBlendedOIT* oit, int width, int height, int samples, unsigned int depthRenderbuffer)
+{
+    memset(oit, 0, sizeof(*oit));
+    oit->width = width;
+    oit->height = height;
+    oit->samples = samples;
+
+    oit->accumTexture = createOitTarget(GL_RGBA16F, width, height, samples);
+    oit->revealTexture = createOitTarget(GL_R8, width, height, samples);
+    RENDER_STAT_ADD(RENDER_STAT_BUFFER_BYTES, (uint64_t)width * height * samples * (8 + 1));
+
+    glGenFramebuffers(1, &oit->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, oit->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D_MULTISAMPLE, oit->accumTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D_MULTISAMPLE, oit->revealTexture, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthRenderbuffer);
+    const GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, drawBuffers);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        printf("ERROR::OIT:: Framebuffer is not complete! (%s:%d)\n", __FILE__, __LINE__);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glGenVertexArrays(1, &oit->emptyVAO);
+    oit->composite = createShaderFromFile("shaders/fullscreen_vertex.glsl", "shaders/oit_composite_frag.glsl");
+    useShader(oit->composite);
+    setInt(oit->composite, "accumTexture", 0);
+    setInt(oit->composite, "revealTexture", 1);
+    useShader({0});
+}
+
+void oitDestroy(WeightedBlendedOIT* oit)
+{
+    glDeleteFramebuffers(1, &oit->fbo);
+    glDeleteTextures(1, &oit->accumTexture);
+    glDeleteTextures(1, &oit->revealTexture);
+    glDeleteVertexArrays(1, &oit->emptyVAO);
+    deleteShader(oit->composite);
+}
+
+// Clears the targets and sets up depth-tested, depth-write-free additive/multiplicative blending.
+void oitBegin(WeightedBlendedOIT* oit)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, oit->fbo);
+    const float clearAccum[] = {0.0f, 0.0f, 0.0f, 0.0f};
+    const float clearReveal[] = {1.0f, 0.0f, 0.0f, 0.0f};
+    glClearBufferfv(GL_COLOR, 0, clearAccum);
+    glClearBufferfv(GL_COLOR, 1, clearReveal);
+
+    glEnable(GL_DEPTH_TEST);
+    glDepthMask(GL_FALSE);
+    glDisable(GL_CULL_FACE); // panes are seen from both sides
+    glEnable(GL_BLEND);
+    glBlendFunci(0, GL_ONE, GL_ONE);
+    glBlendFunci(1, GL_ZERO, GL_ONE_MINUS_SRC_COLOR);
+}
+
+// Resolves the pass over `targetFramebuffer` and restores depth writes, culling and the default blend.
+void oitComposite(WeightedBlendedOIT* oit, unsigned int targetFramebuffer)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, targetFramebuffer);
+    glDisable(GL_DEPTH_TEST);
+    // color = average * coverage + background * revealage
+    glBlendFunc(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA);
+
+    useShader(oit->composite);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, oit->accumTexture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, oit->revealTexture);
+    glActiveTexture(GL_TEXTURE0);
+    RENDER_STAT_ADD(RENDER_STAT_TEXTURE_BINDS, 2);
+
+    glBindVertexArray(oit->emptyVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    RENDER_STAT_ADD(RENDER_STAT_STATE_CHANGES, 1);
+    RENDER_STAT_ADD(RENDER_STAT_DRAW_CALLS, 1);
+    RENDER_STAT_ADD(RENDER_STAT_TRIANGLES, 1);
+
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+    glDepthMask(GL_TRUE);
+}
+
+#endif
@@ -0,0 +1,212 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+// Scoped CPU profiler.
+// PROFILE_ZONE("name") records a begin/end pair for the enclosing scope into a ring buffer owned by
+// the calling thread (single producer, no locks on the hot path). profilerCapture(n) arms a capture
+// and the next n frames, delimited by PROFILE_FRAME(), are written as Chrome trace JSON that can be
+// opened in chrome://tracing or ui.perfetto.dev.
+// Define PROFILER_ENABLED 0 before including this header and every macro compiles to nothing.
+
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 1
+#endif
+
+#define PROFILER_CONCAT_(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_(a, b)
+
+#if PROFILER_ENABLED
+
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define PROFILER_RING_SIZE (1 << 16) // events per thread, must be a power of two
+#define PROFILER_MAX_THREADS 64
+#define PROFILER_CAPTURE_FILE "profile_capture.json"
+#define PROFILER_LATE_FRAMES 4 // frames to wait after a capture for late tracks (GPU timers) to land
+
+struct ProfileEvent {
+    const char* name;  // static string, never copied
+    uint64_t begin;    // ns
+    uint64_t end;      // ns
+};
+
+struct ProfileThread {
+    ProfileEvent events[PROFILER_RING_SIZE];
+    std::atomic<uint64_t> written{0};  // total events ever written, the owner is the only writer
+    uint32_t id;
+    char name[32];
+};
+
+struct Profiler {
+    std::mutex registerMutex;  // only taken the first time a thread records
+    ProfileThread* threads[PROFILER_MAX_THREADS];
+    std::atomic<uint32_t> numThreads{0};
+
+    // capture state, driven from the frame thread
+    int captureFramesLeft = 0;
+    int dumpFramesLeft = 0;
+    uint64_t captureBegin = 0;
+    uint64_t captureEnd = 0;
+};
+
+Profiler g_profiler;
+
+static inline uint64_t profilerNow()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static ProfileThread* profilerRegisterThread(const char* name)
+{
+    std::lock_guard<std::mutex> lock(g_profiler.registerMutex);
+    uint32_t index = g_profiler.numThreads.load();
+    if (index >= PROFILER_MAX_THREADS) return NULL;
+
+    ProfileThread* thread = new ProfileThread();
+    thread->id = index;
+    snprintf(thread->name, sizeof(thread->name), "%s", name ? name : "worker");
+    g_profiler.threads[index] = thread;
+    g_profiler.numThreads.store(index + 1, std::memory_order_release);
+    return thread;
+}
+
+static inline ProfileThread* profilerThread()
+{
+    static thread_local ProfileThread* thread = profilerRegisterThread(NULL);
+    return thread;
+}
+
+// Names the calling thread in the trace. Call before its first zone.
+void profilerSetThreadName(const char* name)
+{
+    ProfileThread* thread = profilerThread();
+    if (thread) snprintf(thread->name, sizeof(thread->name), "%s", name);
+}
+
+// Creates an extra timeline (e.g. GPU work) that a single thread feeds with profilerRecordTrack().
+ProfileThread* profilerCreateTrack(const char* name)
+{
+    return profilerRegisterThread(name);
+}
+
+// Records an event measured elsewhere, with timestamps already converted to profilerNow() time.
+void profilerRecordTrack(ProfileThread* track, const char* name, uint64_t begin, uint64_t end)
+{
+    if (!track) return;
+    uint64_t index = track->written.load(std::memory_order_relaxed);
+    ProfileEvent& event = track->events[index & (PROFILER_RING_SIZE - 1)];
+    event.name = name;
+    event.begin = begin;
+    event.end = end;
+    track->written.store(index + 1, std::memory_order_release);
+}
+
+static inline void profilerRecord(const char* name, uint64_t begin, uint64_t end)
+{
+    profilerRecordTrack(profilerThread(), name, begin, end);
+}
+
+struct ProfileZone {
+    const char* name;
+    uint64_t begin;
+
+    explicit ProfileZone(const char* name) : name(name), begin(profilerNow()) {}
+    ~ProfileZone() { profilerRecord(name, begin, profilerNow()); }
+};
+
+static void profilerWriteEscaped(FILE* file, const char* str)
+{
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\') fputc('\\', file);
+        fputc(*str, file);
+    }
+}
+
+static void profilerDump(const char* path, uint64_t begin, uint64_t end)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "ERROR::PROFILER::FAILED_TO_OPEN: %s\n", path);
+        return;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    bool first = true;
+    uint32_t numThreads = g_profiler.numThreads.load(std::memory_order_acquire);
+    for (uint32_t t = 0; t < numThreads; t++)
+    {
+        ProfileThread* thread = g_profiler.threads[t];
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"", first ? "" : ",\n", thread->id);
+        profilerWriteEscaped(file, thread->name);
+        fprintf(file, "\"}}");
+        first = false;
+
+        // The owner keeps writing while we read; the ring is large enough that a capture of a few
+        // frames is not overwritten before the dump reaches it.
+        uint64_t written = thread->written.load(std::memory_order_acquire);
+        uint64_t oldest = written > PROFILER_RING_SIZE ? written - PROFILER_RING_SIZE : 0;
+        for (uint64_t i = oldest; i < written; i++)
+        {
+            const ProfileEvent& event = thread->events[i & (PROFILER_RING_SIZE - 1)];
+            if (event.begin < begin || event.end > end) continue;
+            fprintf(file, ",\n{\"name\":\"");
+            profilerWriteEscaped(file, event.name);
+            fprintf(file, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    thread->id, (event.begin - begin) / 1000.0, (event.end - event.begin) / 1000.0);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    printf("PROFILER: wrote %s (%.2f ms)\n", path, (end - begin) / 1e6);
+}
+
+// Arms a capture of the next numFrames frames.
+void profilerCapture(int numFrames)
+{
+    if (g_profiler.captureFramesLeft > 0 || g_profiler.dumpFramesLeft > 0 || numFrames <= 0) return;
+    g_profiler.captureFramesLeft = numFrames;
+    g_profiler.captureBegin = 0;
+}
+
+// Marks a frame boundary. Call once per frame from the thread that drives the frame.
+void profilerFrame()
+{
+    if (g_profiler.dumpFramesLeft > 0) {
+        if (--g_profiler.dumpFramesLeft == 0)
+            profilerDump(PROFILER_CAPTURE_FILE, g_profiler.captureBegin, g_profiler.captureEnd);
+        return;
+    }
+    if (g_profiler.captureFramesLeft <= 0) return;
+    uint64_t now = profilerNow();
+    if (g_profiler.captureBegin == 0) {
+        g_profiler.captureBegin = now;
+        return;
+    }
+    if (--g_profiler.captureFramesLeft == 0) {
+        g_profiler.captureEnd = now;
+        g_profiler.dumpFramesLeft = PROFILER_LATE_FRAMES;
+    }
+}
+
+#define PROFILE_ZONE(name) ProfileZone PROFILER_CONCAT(profileZone_, __LINE__)(name)
+#define PROFILE_FRAME() profilerFrame()
+#define PROFILE_CAPTURE(frames) profilerCapture(frames)
+#define PROFILE_THREAD_NAME(name) profilerSetThreadName(name)
+
+#else
+
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_FRAME() ((void)0)
+#define PROFILE_CAPTURE(frames) ((void)0)
+#define PROFILE_THREAD_NAME(name) ((void)0)
+
+#endif
+
+#endif
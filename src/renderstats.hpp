@@ -0,0 +1,83 @@
+#ifndef RENDERSTATS_H
+#define RENDERSTATS_H
+#include <stdint.h>
+#include <string.h>
+
+// Per-frame render counters.
+// The GL helpers (useShader, the set* uniform helpers, setupMeshes, activateMesh, drawMesh) bump these
+// as they issue work; renderStatsFrame() closes the frame and keeps a rolling window for averages.
+// Counters are plain integers: only touch them from the GL thread.
+// Define RENDER_STATS_ENABLED 0 to compile the counting out.
+
+#ifndef RENDER_STATS_ENABLED
+#define RENDER_STATS_ENABLED 1
+#endif
+
+#define RENDER_STATS_HISTORY 60 // frames in the rolling average
+
+enum RenderStat_Types {
+    RENDER_STAT_DRAW_CALLS,
+    RENDER_STAT_TRIANGLES,
+    RENDER_STAT_STATE_CHANGES,   // program and vertex array binds
+    RENDER_STAT_UNIFORM_UPLOADS,
+    RENDER_STAT_BUFFER_BYTES,
+    RENDER_STAT_TEXTURE_BINDS,
+    RENDER_STAT_MESHLETS_DRAWN,
+    RENDER_STAT_MESHLETS_CULLED,
+    RENDER_STAT_SHADOW_CASCADES, // cascades redrawn, cached ones excluded
+    RENDER_STAT_SHADOW_TILES,    // shadow atlas tiles redrawn
+    RENDER_STAT_OCCLUSION_CULLED, // objects hidden by the software occlusion buffer
+    RENDER_STAT_MAX
+};
+
+const char * g_render_stat_str[RENDER_STAT_MAX] = {"draw calls", "triangles", "state changes", "uniform uploads", "buffer bytes", "texture binds",
+                                             "meshlets drawn", "meshlets culled", "shadow cascades", "shadow tiles",
+                                             "occlusion culled"};
+
+struct RenderStats {
+    uint64_t current[RENDER_STAT_MAX];   // frame being recorded
+    uint64_t last[RENDER_STAT_MAX];      // last completed frame
+    uint64_t history[RENDER_STATS_HISTORY][RENDER_STAT_MAX];
+    uint64_t historySum[RENDER_STAT_MAX];
+    int historyIndex;
+    int historyCount;
+};
+
+RenderStats g_renderStats;
+
+#if RENDER_STATS_ENABLED
+#define RENDER_STAT_ADD(stat, amount) (g_renderStats.current[(stat)] += (uint64_t)(amount))
+#else
+#define RENDER_STAT_ADD(stat, amount) ((void)0)
+#endif
+
+// Closes the current frame. Call once per frame, after the last draw.
+void renderStatsFrame(RenderStats* stats)
+{
+    uint64_t* slot = stats->history[stats->historyIndex];
+    for (int i = 0; i < RENDER_STAT_MAX; i++)
+    {
+        if (stats->historyCount == RENDER_STATS_HISTORY)
+            stats->historySum[i] -= slot[i];
+        slot[i] = stats->current[i];
+        stats->historySum[i] += slot[i];
+    }
+    memcpy(stats->last, stats->current, sizeof(stats->last));
+    memset(stats->current, 0, sizeof(stats->current));
+
+    stats->historyIndex = (stats->historyIndex + 1) % RENDER_STATS_HISTORY;
+    if (stats->historyCount < RENDER_STATS_HISTORY) stats->historyCount++;
+}
+
+uint64_t renderStatsLast(const RenderStats* stats, int stat)
+{
+    return stats->last[stat];
+}
+
+double renderStatsAverage(const RenderStats* stats, int stat)
+{
+    if (stats->historyCount == 0) return 0.0;
+    return (double)stats->historySum[stat] / stats->historyCount;
+}
+
+#endif
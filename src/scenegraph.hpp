@@ -0,0 +1,139 @@
+#ifndef SCENEGRAPH_H
+#define SCENEGRAPH_H
+#include "../thirdparty/glm/glm.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Transform hierarchy stored as flat arrays.
+// Nodes are kept sorted by depth (a parent always has a lower index than its children), so
+// sceneGraphUpdate is one linear pass with no recursion or pointer chasing: by the time a node is
+// visited its parent's world matrix is already final.
+// sceneGraphSetLocal marks a node dirty; the update recomputes world matrices only for dirty nodes
+// and their descendants, and flags them in `changed` for whoever caches world-space data.
+// Each node can reference a range of mesh indices owned by whatever built the graph.
+
+#define SCENE_NO_PARENT -1
+#define SCENE_NODE_NAME_SIZE 64
+
+struct SceneGraph {
+    int numNodes;
+    int capacity;
+
+    int* parent;            // SCENE_NO_PARENT for roots
+    int* depth;
+    glm::mat4* local;       // relative to the parent
+    glm::mat4* world;
+    unsigned char* dirty;   // local changed since the last update
+    unsigned char* changed; // world recomputed by the last update
+    char (*names)[SCENE_NODE_NAME_SIZE];
+
+    // meshes drawn with the node's world matrix
+    int* firstMesh;
+    int* numMeshes;
+    int* meshIndices;
+    int numMeshIndices;
+    int meshIndexCapacity;
+};
+
+void sceneGraphInit(SceneGraph* graph, int capacity, int meshIndexCapacity)
+{
+    memset(graph, 0, sizeof(*graph));
+    graph->capacity = capacity;
+    graph->parent = (int*)malloc(capacity * sizeof(int));
+    graph->depth = (int*)malloc(capacity * sizeof(int));
+    graph->local = (glm::mat4*)malloc(capacity * sizeof(glm::mat4));
+    graph->world = (glm::mat4*)malloc(capacity * sizeof(glm::mat4));
+    graph->dirty = (unsigned char*)malloc(capacity);
+    graph->changed = (unsigned char*)malloc(capacity);
+    graph->names = (char (*)[SCENE_NODE_NAME_SIZE])malloc(capacity * SCENE_NODE_NAME_SIZE);
+    graph->firstMesh = (int*)malloc(capacity * sizeof(int));
+    graph->numMeshes = (int*)malloc(capacity * sizeof(int));
+    graph->meshIndexCapacity = meshIndexCapacity;
+    graph->meshIndices = (int*)malloc((meshIndexCapacity > 0 ? meshIndexCapacity : 1) * sizeof(int));
+}
+
+void sceneGraphDestroy(SceneGraph* graph)
+{
+    free(graph->parent);
+    free(graph->depth);
+    free(graph->local);
+    free(graph->world);
+    free(graph->dirty);
+    free(graph->changed);
+    free(graph->names);
+    free(graph->firstMesh);
+    free(graph->numMeshes);
+    free(graph->meshIndices);
+    memset(graph, 0, sizeof(*graph));
+}
+
+// Appends a node. Nodes must be added parents first and in order of increasing depth
+// (breadth-first), which keeps the arrays depth-sorted. Returns the node index or -1 when full.
+int sceneGraphAddNode(SceneGraph* graph, int parent, const char* name, const glm::mat4& local)
+{
+    if (graph->numNodes >= graph->capacity) {
+        printf("ERROR::SCENEGRAPH::FULL\n");
+        return -1;
+    }
+    int node = graph->numNodes++;
+    int depth = parent == SCENE_NO_PARENT ? 0 : graph->depth[parent] + 1;
+    if (node > 0 && depth < graph->depth[node - 1]) {
+        printf("ERROR::SCENEGRAPH::NODE_OUT_OF_DEPTH_ORDER: %s\n", name ? name : "");
+    }
+
+    graph->parent[node] = parent;
+    graph->depth[node] = depth;
+    graph->local[node] = local;
+    graph->world[node] = local;
+    graph->dirty[node] = 1;
+    graph->changed[node] = 0;
+    snprintf(graph->names[node], SCENE_NODE_NAME_SIZE, "%s", name ? name : "");
+    graph->firstMesh[node] = graph->numMeshIndices;
+    graph->numMeshes[node] = 0;
+    return node;
+}
+
+// Attaches a mesh to the most recently added node.
+void sceneGraphAddMesh(SceneGraph* graph, int node, int meshIndex)
+{
+    if (node != graph->numNodes - 1 || graph->numMeshIndices >= graph->meshIndexCapacity) {
+        printf("ERROR::SCENEGRAPH::CANNOT_ADD_MESH: node %d\n", node);
+        return;
+    }
+    graph->meshIndices[graph->numMeshIndices++] = meshIndex;
+    graph->numMeshes[node]++;
+}
+
+int sceneGraphFindNode(const SceneGraph* graph, const char* name)
+{
+    for (int node = 0; node < graph->numNodes; node++)
+        if (strcmp(graph->names[node], name) == 0) return node;
+    return -1;
+}
+
+void sceneGraphSetLocal(SceneGraph* graph, int node, const glm::mat4& local)
+{
+    graph->local[node] = local;
+    graph->dirty[node] = 1;
+}
+
+// Recomputes world matrices of dirty nodes and everything below them. Returns how many were updated.
+int sceneGraphUpdate(SceneGraph* graph)
+{
+    int updated = 0;
+    for (int node = 0; node < graph->numNodes; node++)
+    {
+        int parent = graph->parent[node];
+        bool parentChanged = parent != SCENE_NO_PARENT && graph->changed[parent];
+        graph->changed[node] = graph->dirty[node] || parentChanged;
+        graph->dirty[node] = 0;
+        if (!graph->changed[node]) continue;
+
+        graph->world[node] = parent == SCENE_NO_PARENT ? graph->local[node] : graph->world[parent] * graph->local[node];
+        updated++;
+    }
+    return updated;
+}
+
+#endif
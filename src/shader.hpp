@@ -1,15 +1,12 @@
 #ifndef SHADER_H
 #define SHADER_H
+#include "vfs.hpp"
 #include <glad/glad.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-
-#ifdef _WIN32
-#else
-#include <errno.h>  
-#endif
+#include "renderstats.hpp"
 
 struct Shader
 {
@@ -17,49 +14,23 @@ struct Shader
 };
   
 
-char* readFile(const char* filePath) {
-    FILE* file;
-#ifdef _WIN32
-    errno_t err = fopen_s(&file, filePath, "rb");
-    if (err != 0 || file == NULL) {
-        fprintf(stderr, "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: %s (Error code: %d)\n", filePath, err);
-        return NULL;
-    }
-#else
-    file = fopen(filePath, "rb");
-    if (file == NULL) {
-        fprintf(stderr, "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: %s (Error: %s)\n", filePath, strerror(errno));
-        return NULL;
-    }
-#endif
-
-    fseek(file, 0, SEEK_END);
-    long fileSize = ftell(file);
-    fseek(file, 0, SEEK_SET);
-
-    if (fileSize < 0 || fileSize > SIZE_MAX - 1) {
-        fclose(file);
-        fprintf(stderr, "ERROR::SHADER::FILE_SIZE_OVERFLOW\n");
+// Returns a malloc'd, '\0' terminated copy of the file. flags as for vfsOpen.
+char* readFile(const char* filePath, int flags = 0) {
+    VfsFile file;
+    if (!vfsOpen(filePath, &file, flags)) {
+        fprintf(stderr, "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: %s\n", filePath);
         return NULL;
     }
 
-    char* buffer = (char*)malloc((size_t)fileSize + 1);
+    char* buffer = (char*)malloc(file.size + 1);
     if (!buffer) {
-        fclose(file);
+        vfsClose(&file);
         fprintf(stderr, "ERROR::SHADER::MEMORY_ALLOCATION_FAILED\n");
         return NULL;
     }
-
-    size_t bytesRead = fread(buffer, 1, fileSize, file);
-    if (bytesRead != (size_t)fileSize) {
-        fprintf(stderr, "ERROR::SHADER::FILE_READ_FAILED: %s\n", filePath);
-        free(buffer);
-        fclose(file);
-        return NULL;
-    }
-
-    buffer[fileSize] = '\0';
-    fclose(file);
+    memcpy(buffer, file.data, file.size);
+    buffer[file.size] = '\0';
+    vfsClose(&file);
     return buffer;
 }
 
@@ -81,26 +52,34 @@ void checkCompileErrors(unsigned int shader, const char* type) {
     }
 }
 
+// Compiles from VFS views with explicit lengths, so packed sources are never copied.
+static void shaderSourceFromFile(unsigned int shader, const VfsFile* file) {
+    const char* source = (const char*)file->data;
+    GLint length = (GLint)file->size;
+    glShaderSource(shader, 1, &source, &length);
+}
+
 Shader createShaderFromFile(const char* vertexPath, const char* fragmentPath) {
     Shader shader = {0};
-    char* vertexCode = readFile(vertexPath);
-    char* fragmentCode = readFile(fragmentPath);
-
-    if (!vertexCode || !fragmentCode) {
-        fprintf(stderr, "ERROR::SHADER::FAILED_TO_READ_SHADER_FILES\n");
-        if (vertexCode) free(vertexCode);
-        if (fragmentCode) free(fragmentCode);
+    VfsFile vertexCode, fragmentCode;
+    bool vertexRead = vfsOpen(vertexPath, &vertexCode);
+    bool fragmentRead = vfsOpen(fragmentPath, &fragmentCode);
+
+    if (!vertexRead || !fragmentRead) {
+        fprintf(stderr, "ERROR::SHADER::FAILED_TO_READ_SHADER_FILES: %s %s\n", vertexPath, fragmentPath);
+        vfsClose(&vertexCode);
+        vfsClose(&fragmentCode);
         return shader; 
     }
 
     unsigned int vertex, fragment;
     vertex = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex, 1, (const char**)&vertexCode, NULL);
+    shaderSourceFromFile(vertex, &vertexCode);
     glCompileShader(vertex);
     checkCompileErrors(vertex, "VERTEX");
 
     fragment = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment, 1, (const char**)&fragmentCode, NULL);
+    shaderSourceFromFile(fragment, &fragmentCode);
     glCompileShader(fragment);
     checkCompileErrors(fragment, "FRAGMENT");
 
@@ -113,37 +92,73 @@ Shader createShaderFromFile(const char* vertexPath, const char* fragmentPath) {
     glDeleteShader(vertex);
     glDeleteShader(fragment);
 
-    free(vertexCode);
-    free(fragmentCode);
+    vfsClose(&vertexCode);
+    vfsClose(&fragmentCode);
+
+    return shader;
+}
+
+Shader createComputeShaderFromFile(const char* computePath) {
+    Shader shader = {0};
+    VfsFile computeCode;
+    if (!vfsOpen(computePath, &computeCode)) {
+        fprintf(stderr, "ERROR::SHADER::FAILED_TO_READ_SHADER_FILES: %s\n", computePath);
+        return shader;
+    }
+
+    unsigned int compute = glCreateShader(GL_COMPUTE_SHADER);
+    shaderSourceFromFile(compute, &computeCode);
+    glCompileShader(compute);
+    checkCompileErrors(compute, "COMPUTE");
+
+    shader.ID = glCreateProgram();
+    glAttachShader(shader.ID, compute);
+    glLinkProgram(shader.ID);
+    checkCompileErrors(shader.ID, "PROGRAM");
+
+    glDeleteShader(compute);
+    vfsClose(&computeCode);
 
     return shader;
 }
 
 void useShader(Shader shader) {
+    RENDER_STAT_ADD(RENDER_STAT_STATE_CHANGES, 1);
     glUseProgram(shader.ID);
 }
 
 void setBool(Shader shader, const char* name, int value) {
+    RENDER_STAT_ADD(RENDER_STAT_UNIFORM_UPLOADS, 1);
     glUniform1i(glGetUniformLocation(shader.ID, name), (int)value);
 }
 
 void setInt(Shader shader, const char* name, int value) {
+    RENDER_STAT_ADD(RENDER_STAT_UNIFORM_UPLOADS, 1);
     glUniform1i(glGetUniformLocation(shader.ID, name), value);
 }
 
 void setFloat(Shader shader, const char* name, float value) {
+    RENDER_STAT_ADD(RENDER_STAT_UNIFORM_UPLOADS, 1);
     glUniform1f(glGetUniformLocation(shader.ID, name), value);
 }
 
 void setVec3(Shader shader, const char* name, float x, float y, float z) {
+    RENDER_STAT_ADD(RENDER_STAT_UNIFORM_UPLOADS, 1);
     glUniform3f(glGetUniformLocation(shader.ID, name), x, y, z);
 }
 
 void setVec3(Shader shader, const char* name, const float* value) {
+    RENDER_STAT_ADD(RENDER_STAT_UNIFORM_UPLOADS, 1);
     glUniform3fv(glGetUniformLocation(shader.ID, name), 1, value);
 }
 
+void setMat3(Shader shader, const char* name, const float* mat) {
+    RENDER_STAT_ADD(RENDER_STAT_UNIFORM_UPLOADS, 1);
+    glUniformMatrix3fv(glGetUniformLocation(shader.ID, name), 1, GL_FALSE, mat);
+}
+
 void setMat4(Shader shader, const char* name, const float* mat) {
+    RENDER_STAT_ADD(RENDER_STAT_UNIFORM_UPLOADS, 1);
     glUniformMatrix4fv(glGetUniformLocation(shader.ID, name), 1, GL_FALSE, mat);
 }
 
@@ -0,0 +1,480 @@
+#ifndef SHADOWATLAS_H
+#define SHADOWATLAS_H
+#include <glad/glad.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "../thirdparty/glm/glm.hpp"
+#include "../thirdparty/glm/gtc/matrix_transform.hpp"
+#include "../thirdparty/glm/gtc/type_ptr.hpp"
+#include "shader.hpp"
+#include "light.hpp"
+#include "frustum.hpp"
+#include "renderstats.hpp"
+
+// Shadow atlas for point and spot lights.
+// Every shadowed light owns square tiles of one depth texture: six 90 degree faces for a point light,
+// one frustum for a spot light. Tile size follows the light's importance, the on-screen size of its
+// range sphere, rounded to a power of two between SHADOW_ATLAS_MIN_TILE and SHADOW_ATLAS_MAX_TILE,
+// with hysteresis so a light near a boundary keeps its tiles. Lights off screen or without range get
+// none. Tiles come from a quadtree buddy allocator over the atlas, so a light keeps its place until
+// its size changes.
+//
+// A tile is redrawn when its light moved or was resized, or after shadowAtlasInvalidate(); lights that
+// stand still keep their tiles indefinitely. At most SHADOW_ATLAS_BUDGET tiles are drawn per frame,
+// least recently drawn first. A tile that waits keeps the matrix it was drawn with, so its shadows lag
+// behind instead of breaking; a tile that was never drawn is left out and that face stays unshadowed.
+//
+// Per frame:
+//     shadowAtlasSetLight(&atlas, light, position, direction, range, outerCutOff);   // every light
+//     shadowAtlasUpdate(&atlas, viewFrustum, cameraPosition, fovY, screenHeight);
+//     ShadowTilePass pass;
+//     while (shadowAtlasNextPass(&atlas, &pass)) { draw the casters with pass.shader }
+//     useShader(lit); shadowAtlasBind(&atlas, lit, SHADOW_ATLAS_TEXTURE_UNIT);
+//     shadowAtlasSetUniforms(&atlas, lit, light, "pointShadowMatrices", "pointShadowTiles", first); // every light
+
+#define SHADOW_ATLAS_SIZE 4096
+#define SHADOW_ATLAS_MIN_TILE 128
+#define SHADOW_ATLAS_MAX_TILE 1024
+#define SHADOW_ATLAS_LEVELS 6           // log2(SHADOW_ATLAS_SIZE / SHADOW_ATLAS_MIN_TILE) + 1
+#define SHADOW_ATLAS_NODES 1365         // (4^SHADOW_ATLAS_LEVELS - 1) / 3
+#define SHADOW_ATLAS_MAX_LIGHTS 16
+#define SHADOW_ATLAS_BUDGET 8           // tiles drawn per frame
+#define SHADOW_ATLAS_TEXELS_PER_PIXEL 1.0f
+#define SHADOW_ATLAS_HYSTERESIS 0.25f   // a light changes size once it is this far past a power of two
+#define SHADOW_ATLAS_NEAR 0.05f
+#define SHADOW_ATLAS_TEXTURE_UNIT 9
+
+enum AtlasNode_Types {
+    ATLAS_NODE_FREE,
+    ATLAS_NODE_SPLIT,   // some descendant is used
+    ATLAS_NODE_USED
+};
+
+struct ShadowTile {
+    int node;                   // atlas quadtree node, -1 when unallocated
+    glm::vec4 rect;             // xy offset, zw size, in atlas uv
+    glm::mat4 viewProjection;   // for the current light parameters
+    glm::mat4 drawnViewProjection; // what the tile holds
+    Frustum frustum;
+    bool drawn;                 // drawn since it was allocated
+    int64_t lastDrawn;          // frame of the last draw
+};
+
+struct ShadowAtlasLight {
+    LightType type;
+    glm::vec3 position;
+    glm::vec3 direction;
+    float range;
+    float outerCutOff;          // cosine, spot lights only
+    float importance;           // on-screen texels wanted per face, 0 without a tile
+    int requestedSize;          // texels the importance asked for
+    int tileSize;               // texels allocated, smaller than requested when the atlas was full, 0 without tiles
+    int numFaces;
+    ShadowTile faces[6];
+};
+
+struct ShadowTilePass {
+    Shader shader;      // bound with "lightViewProjection" set; callers set "model" per caster
+    Frustum frustum;    // the tile's view volume, for culling casters
+    int light;
+    int face;
+};
+
+struct ShadowAtlas {
+    unsigned int depthTexture;
+    unsigned int fbo;
+    Shader shader;
+    uint8_t nodes[SHADOW_ATLAS_NODES];
+    ShadowAtlasLight lights[SHADOW_ATLAS_MAX_LIGHTS];
+    int numLights;
+    int64_t frame;
+
+    ShadowTile* queue[SHADOW_ATLAS_BUDGET];
+    int queueLights[SHADOW_ATLAS_BUDGET];
+    int queueFaces[SHADOW_ATLAS_BUDGET];
+    int numQueued;
+    int next;
+    GLint savedViewport[4];
+    GLint savedFramebuffer;
+    GLboolean savedCulling;
+
+    int tilesDrawn;     // last update
+    int tilesWaiting;   // last update: dirty tiles left for later frames
+};
+
+// Quadtree nodes are stored level by level, each level in Morton order.
+static int atlasLevelOffset(int level) { return ((1 << (2 * level)) - 1) / 3; }
+
+static glm::vec4 atlasNodeRect(int node)
+{
+    int level = 0;
+    while (level + 1 < SHADOW_ATLAS_LEVELS && node >= atlasLevelOffset(level + 1)) level++;
+    int local = node - atlasLevelOffset(level);
+    int x = 0, y = 0;
+    for (int bit = 0; bit < level; bit++)
+    {
+        x |= ((local >> (2 * bit)) & 1) << bit;
+        y |= ((local >> (2 * bit + 1)) & 1) << bit;
+    }
+    float size = 1.0f / (float)(1 << level);
+    return glm::vec4(x * size, y * size, size, size);
+}
+
+static int atlasAllocNode(ShadowAtlas* atlas, int node, int level, int target)
+{
+    uint8_t state = atlas->nodes[node];
+    if (state == ATLAS_NODE_USED) return -1;
+    if (level == target)
+    {
+        if (state != ATLAS_NODE_FREE) return -1;
+        atlas->nodes[node] = ATLAS_NODE_USED;
+        return node;
+    }
+    int firstChild = atlasLevelOffset(level + 1) + 4 * (node - atlasLevelOffset(level));
+    // fill partially used quadrants before splitting a free one
+    for (int pass = 0; pass < 2; pass++)
+        for (int i = 0; i < 4; i++)
+        {
+            bool free = atlas->nodes[firstChild + i] == ATLAS_NODE_FREE;
+            if ((pass == 0) == (free && level + 1 < target)) continue;
+            int found = atlasAllocNode(atlas, firstChild + i, level + 1, target);
+            if (found >= 0)
+            {
+                atlas->nodes[node] = ATLAS_NODE_SPLIT;
+                return found;
+            }
+        }
+    return -1;
+}
+
+static void atlasFreeNode(ShadowAtlas* atlas, int node)
+{
+    atlas->nodes[node] = ATLAS_NODE_FREE;
+    int level = 0;
+    while (level + 1 < SHADOW_ATLAS_LEVELS && node >= atlasLevelOffset(level + 1)) level++;
+    while (level > 0)
+    {
+        int parent = atlasLevelOffset(level - 1) + (node - atlasLevelOffset(level)) / 4;
+        int firstChild = atlasLevelOffset(level) + 4 * (parent - atlasLevelOffset(level - 1));
+        for (int i = 0; i < 4; i++)
+            if (atlas->nodes[firstChild + i] != ATLAS_NODE_FREE) return;
+        atlas->nodes[parent] = ATLAS_NODE_FREE;
+        node = parent;
+        level--;
+    }
+}
+
+static void atlasFreeLight(ShadowAtlas* atlas, ShadowAtlasLight* light)
+{
+    for (int f = 0; f < light->numFaces; f++)
+    {
+        if (light->faces[f].node >= 0) atlasFreeNode(atlas, light->faces[f].node);
+        light->faces[f].node = -1;
+        light->faces[f].drawn = false;
+    }
+    light->tileSize = 0;
+}
+
+// Allocates every face at `size`, halving down to SHADOW_ATLAS_MIN_TILE while the atlas is too full.
+static void atlasAllocLight(ShadowAtlas* atlas, ShadowAtlasLight* light, int size)
+{
+    for (; size >= SHADOW_ATLAS_MIN_TILE; size /= 2)
+    {
+        int level = 0;
+        while ((SHADOW_ATLAS_SIZE >> level) > size) level++;
+        int f = 0;
+        for (; f < light->numFaces; f++)
+        {
+            light->faces[f].node = atlasAllocNode(atlas, 0, 0, level);
+            if (light->faces[f].node < 0) break;
+        }
+        if (f == light->numFaces)
+        {
+            light->tileSize = size;
+            for (f = 0; f < light->numFaces; f++)
+            {
+                light->faces[f].rect = atlasNodeRect(light->faces[f].node);
+                light->faces[f].drawn = false;
+            }
+            return;
+        }
+        atlasFreeLight(atlas, light);
+    }
+}
+
+void shadowAtlasInit(ShadowAtlas* atlas)
+{
+    memset(atlas, 0, sizeof(*atlas));
+
+    glGenTextures(1, &atlas->depthTexture);
+    glBindTexture(GL_TEXTURE_2D, atlas->depthTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, SHADOW_ATLAS_SIZE, SHADOW_ATLAS_SIZE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    RENDER_STAT_ADD(RENDER_STAT_BUFFER_BYTES, (uint64_t)SHADOW_ATLAS_SIZE * SHADOW_ATLAS_SIZE * sizeof(float));
+
+    glGenFramebuffers(1, &atlas->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, atlas->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, atlas->depthTexture, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        printf("ERROR::SHADOWATLAS:: Framebuffer is not complete! (%s:%d)\n", __FILE__, __LINE__);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    atlas->shader = createShaderFromFile("shaders/shadow_vertex.glsl", "shaders/shadow_frag.glsl");
+}
+
+void shadowAtlasDestroy(ShadowAtlas* atlas)
+{
+    glDeleteFramebuffers(1, &atlas->fbo);
+    glDeleteTextures(1, &atlas->depthTexture);
+    deleteShader(atlas->shader);
+}
+
+// Registers a point or spot light and returns its handle, -1 when the atlas is full.
+int shadowAtlasAddLight(ShadowAtlas* atlas, LightType type)
+{
+    if (atlas->numLights == SHADOW_ATLAS_MAX_LIGHTS || type == LIGHT_TYPE_DIRECTIONAL)
+    {
+        printf("ERROR::SHADOWATLAS::CANNOT_ADD_LIGHT\n");
+        return -1;
+    }
+    ShadowAtlasLight* light = atlas->lights + atlas->numLights;
+    memset(light, 0, sizeof(*light));
+    light->type = type;
+    light->numFaces = type == LIGHT_TYPE_POINT ? 6 : 1;
+    for (int f = 0; f < light->numFaces; f++)
+        light->faces[f].node = -1;
+    return atlas->numLights++;
+}
+
+void shadowAtlasSetLight(ShadowAtlas* atlas, int handle, const glm::vec3& position, const glm::vec3& direction,
+                         float range, float outerCutOff = 0.0f)
+{
+    ShadowAtlasLight* light = atlas->lights + handle;
+    light->position = position;
+    light->direction = direction;
+    light->range = range;
+    light->outerCutOff = outerCutOff;
+}
+
+// The static caster set changed: every tile is redrawn, still under the budget.
+void shadowAtlasInvalidate(ShadowAtlas* atlas)
+{
+    for (int l = 0; l < atlas->numLights; l++)
+        for (int f = 0; f < atlas->lights[l].numFaces; f++)
+            atlas->lights[l].faces[f].drawnViewProjection = glm::mat4(0.0f);
+}
+
+static void computeLightFaces(ShadowAtlasLight* light)
+{
+    // +X, -X, +Y, -Y, +Z, -Z: fragment.glsl picks the face from the major axis in the same order
+    static const glm::vec3 axes[6] = {{1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
+    static const glm::vec3 ups[6] = {{0, -1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}, {0, -1, 0}, {0, -1, 0}};
+    float range = fmaxf(light->range, SHADOW_ATLAS_NEAR * 2.0f);
+
+    if (light->type == LIGHT_TYPE_POINT)
+    {
+        glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, SHADOW_ATLAS_NEAR, range);
+        for (int f = 0; f < 6; f++)
+            light->faces[f].viewProjection = projection * glm::lookAt(light->position, light->position + axes[f], ups[f]);
+    }
+    else
+    {
+        glm::vec3 direction = glm::normalize(light->direction);
+        glm::vec3 up = fabsf(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        float fov = 2.0f * acosf(glm::clamp(light->outerCutOff, 0.0f, 1.0f));
+        glm::mat4 projection = glm::perspective(glm::min(fov, glm::radians(170.0f)), 1.0f, SHADOW_ATLAS_NEAR, range);
+        light->faces[0].viewProjection = projection * glm::lookAt(light->position, light->position + direction, up);
+    }
+    for (int f = 0; f < light->numFaces; f++)
+        light->faces[f].frustum = frustumFromMatrix(light->faces[f].viewProjection);
+}
+
+static int nextPowerOfTwo(float value)
+{
+    int size = SHADOW_ATLAS_MIN_TILE;
+    while (size < SHADOW_ATLAS_MAX_TILE && (float)size < value) size *= 2;
+    return size;
+}
+
+// Sizes and allocates tiles from the lights' on-screen importance and queues the tiles drawn this frame.
+void shadowAtlasUpdate(ShadowAtlas* atlas, const Frustum& viewFrustum, const glm::vec3& cameraPosition, float fovY, float screenHeight)
+{
+    atlas->frame++;
+    float pixelsPerUnit = 0.5f * screenHeight / tanf(fovY * 0.5f);
+
+    // resize first so that every release happens before the allocations that may need the space
+    int order[SHADOW_ATLAS_MAX_LIGHTS];
+    for (int l = 0; l < atlas->numLights; l++)
+    {
+        ShadowAtlasLight* light = atlas->lights + l;
+        order[l] = l;
+        light->importance = 0.0f;
+        if (light->range > 0.0f && frustumTestSphere(viewFrustum, light->position, light->range))
+        {
+            float distance = glm::distance(cameraPosition, light->position);
+            float pixels = distance > light->range ? light->range / distance * pixelsPerUnit : screenHeight;
+            light->importance = pixels * SHADOW_ATLAS_TEXELS_PER_PIXEL;
+        }
+
+        int size = light->importance > 0.0f ? nextPowerOfTwo(light->importance) : 0;
+        if (size != 0 && light->requestedSize != 0)
+        {
+            float current = (float)light->requestedSize;
+            if (light->importance > current * 0.5f * (1.0f - SHADOW_ATLAS_HYSTERESIS) &&
+                light->importance <= current * (1.0f + SHADOW_ATLAS_HYSTERESIS))
+                size = light->requestedSize;
+        }
+        if (size != light->requestedSize) atlasFreeLight(atlas, light);
+        light->requestedSize = size;
+    }
+
+    // most important lights get first pick of the free space
+    for (int i = 1; i < atlas->numLights; i++)
+        for (int j = i; j > 0 && atlas->lights[order[j]].importance > atlas->lights[order[j - 1]].importance; j--)
+        {
+            int swap = order[j]; order[j] = order[j - 1]; order[j - 1] = swap;
+        }
+    for (int i = 0; i < atlas->numLights; i++)
+    {
+        ShadowAtlasLight* light = atlas->lights + order[i];
+        if (light->requestedSize != 0 && light->tileSize == 0)
+            atlasAllocLight(atlas, light, light->requestedSize);
+        if (light->tileSize != 0) computeLightFaces(light);
+    }
+
+    // dirty tiles, least recently drawn first
+    atlas->numQueued = 0;
+    atlas->next = 0;
+    atlas->tilesWaiting = 0;
+    for (int l = 0; l < atlas->numLights; l++)
+    {
+        ShadowAtlasLight* light = atlas->lights + l;
+        if (light->tileSize == 0) continue;
+        for (int f = 0; f < light->numFaces; f++)
+        {
+            ShadowTile* tile = light->faces + f;
+            bool dirty = !tile->drawn || memcmp(&tile->viewProjection, &tile->drawnViewProjection, sizeof(glm::mat4)) != 0;
+            if (!dirty) continue;
+            int64_t age = tile->drawn ? tile->lastDrawn : INT64_MIN;
+
+            int slot = atlas->numQueued;
+            if (slot == SHADOW_ATLAS_BUDGET)
+            {
+                atlas->tilesWaiting++;
+                ShadowTile* newest = atlas->queue[SHADOW_ATLAS_BUDGET - 1];
+                if ((newest->drawn ? newest->lastDrawn : INT64_MIN) <= age) continue;
+                slot = SHADOW_ATLAS_BUDGET - 1;
+            }
+            else
+                atlas->numQueued++;
+            for (; slot > 0; slot--)
+            {
+                ShadowTile* prev = atlas->queue[slot - 1];
+                if ((prev->drawn ? prev->lastDrawn : INT64_MIN) <= age) break;
+                atlas->queue[slot] = prev;
+                atlas->queueLights[slot] = atlas->queueLights[slot - 1];
+                atlas->queueFaces[slot] = atlas->queueFaces[slot - 1];
+            }
+            atlas->queue[slot] = tile;
+            atlas->queueLights[slot] = l;
+            atlas->queueFaces[slot] = f;
+        }
+    }
+    atlas->tilesDrawn = atlas->numQueued;
+    RENDER_STAT_ADD(RENDER_STAT_SHADOW_TILES, atlas->tilesDrawn);
+}
+
+// Steps through the queued tiles: clears and binds one, fills `pass` and returns true; returns false
+// once every tile is drawn, with the viewport, framebuffer and culling state restored.
+bool shadowAtlasNextPass(ShadowAtlas* atlas, ShadowTilePass* pass)
+{
+    if (atlas->next == 0 && atlas->numQueued > 0)
+    {
+        glGetIntegerv(GL_VIEWPORT, atlas->savedViewport);
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &atlas->savedFramebuffer);
+        atlas->savedCulling = glIsEnabled(GL_CULL_FACE);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, atlas->fbo);
+        glEnable(GL_DEPTH_TEST);
+        glDepthMask(GL_TRUE);
+        glEnable(GL_SCISSOR_TEST);
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(2.0f, 4.0f);
+        glDisable(GL_CULL_FACE);
+        useShader(atlas->shader);
+    }
+
+    if (atlas->next < atlas->numQueued)
+    {
+        int slot = atlas->next++;
+        ShadowTile* tile = atlas->queue[slot];
+        int x = (int)(tile->rect.x * SHADOW_ATLAS_SIZE), y = (int)(tile->rect.y * SHADOW_ATLAS_SIZE);
+        int size = (int)(tile->rect.z * SHADOW_ATLAS_SIZE);
+        glViewport(x, y, size, size);
+        glScissor(x, y, size, size);
+        glClear(GL_DEPTH_BUFFER_BIT);
+
+        tile->drawn = true;
+        tile->lastDrawn = atlas->frame;
+        tile->drawnViewProjection = tile->viewProjection;
+        setMat4(atlas->shader, "lightViewProjection", glm::value_ptr(tile->viewProjection));
+        pass->shader = atlas->shader;
+        pass->frustum = tile->frustum;
+        pass->light = atlas->queueLights[slot];
+        pass->face = atlas->queueFaces[slot];
+        return true;
+    }
+
+    if (atlas->numQueued > 0)
+    {
+        glDisable(GL_SCISSOR_TEST);
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        if (atlas->savedCulling) glEnable(GL_CULL_FACE);
+        glBindFramebuffer(GL_FRAMEBUFFER, atlas->savedFramebuffer);
+        glViewport(atlas->savedViewport[0], atlas->savedViewport[1], atlas->savedViewport[2], atlas->savedViewport[3]);
+        atlas->numQueued = 0;
+    }
+    return false;
+}
+
+// Binds the atlas to `textureUnit` as "shadowAtlas"; `shader` must be in use.
+void shadowAtlasBind(const ShadowAtlas* atlas, Shader shader, int textureUnit)
+{
+    glActiveTexture(GL_TEXTURE0 + textureUnit);
+    glBindTexture(GL_TEXTURE_2D, atlas->depthTexture);
+    glActiveTexture(GL_TEXTURE0);
+    RENDER_STAT_ADD(RENDER_STAT_TEXTURE_BINDS, 1);
+    setInt(shader, "shadowAtlas", textureUnit);
+}
+
+// Uploads one light's faces to matricesName[first + face] and tilesName[first + face]. Faces without
+// a drawn tile get a zero rect, which the shader reads as unshadowed.
+void shadowAtlasSetUniforms(const ShadowAtlas* atlas, Shader shader, int handle, const char* matricesName, const char* tilesName, int first)
+{
+    const ShadowAtlasLight* light = atlas->lights + handle;
+    char name[64];
+    for (int f = 0; f < light->numFaces; f++)
+    {
+        const ShadowTile* tile = light->faces + f;
+        bool usable = light->tileSize != 0 && tile->drawn;
+        glm::vec4 rect = usable ? tile->rect : glm::vec4(0.0f);
+        snprintf(name, sizeof(name), "%s[%d]", tilesName, first + f);
+        RENDER_STAT_ADD(RENDER_STAT_UNIFORM_UPLOADS, 1);
+        glUniform4fv(glGetUniformLocation(shader.ID, name), 1, glm::value_ptr(rect));
+        if (!usable) continue;
+        snprintf(name, sizeof(name), "%s[%d]", matricesName, first + f);
+        setMat4(shader, name, glm::value_ptr(tile->drawnViewProjection));
+    }
+}
+
+#endif
@@ -0,0 +1,347 @@
+#ifndef SHADOWS_H
+#define SHADOWS_H
+#include <glad/glad.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "../thirdparty/glm/glm.hpp"
+#include "../thirdparty/glm/gtc/matrix_transform.hpp"
+#include "../thirdparty/glm/gtc/type_ptr.hpp"
+#include "shader.hpp"
+#include "frustum.hpp"
+#include "renderstats.hpp"
+
+// Cascaded shadow maps for the directional light.
+// The view frustum up to CSM_MAX_DISTANCE is cut into slices (a blend of logarithmic and uniform
+// splits) and each slice gets an orthographic light projection around its bounding sphere. The sphere
+// only depends on the field of view, so cascade size is constant while the camera turns, and the
+// projection is snapped to whole shadow texels so edges do not shimmer while it moves. Casters are
+// rasterized with depth clamping: anything between the light and a cascade's near plane is flattened
+// onto it instead of being clipped.
+//
+// The far half of the cascades is cached. Those are fitted with CSM_CACHE_MARGIN of slack and keep
+// their center while the slice still fits, and their static casters live in a second texture array
+// that is only redrawn when the light turns, the cascade recenters or cascadedShadowsInvalidate() is
+// called. Dynamic casters that overlap a cached cascade are drawn over a copy of its static layer.
+//
+// Per frame:
+//     cascadedShadowsUpdate(&csm, view, fovY, aspect, nearPlane, lightDirection, dynamicBounds, numDynamic);
+//     ShadowPass pass;
+//     while (cascadedShadowsNextPass(&csm, &pass)) { draw the casters pass asks for with pass.shader }
+//     useShader(lit); cascadedShadowsBind(&csm, lit, CSM_TEXTURE_UNIT);
+
+#define CSM_MAX_CASCADES 4
+#define CSM_DEFAULT_RESOLUTION 2048
+#define CSM_MAX_DISTANCE 60.0f      // view distance covered by the last cascade
+#define CSM_SPLIT_LAMBDA 0.75f      // 0 = uniform splits, 1 = logarithmic
+#define CSM_CACHE_MARGIN 0.25f      // extra radius of cached cascades, in fractions of the slice radius
+#define CSM_CASTER_DISTANCE 30.0f   // how far towards the light a cascade's depth range reaches
+#define CSM_SLOPE_BIAS 2.0f         // glPolygonOffset factor while rendering casters
+#define CSM_CONSTANT_BIAS 4.0f      // glPolygonOffset units while rendering casters
+#define CSM_TEXTURE_UNIT 8          // above the material samplers
+
+struct ShadowPass {
+    Shader shader;          // bound with "lightViewProjection" set; callers set "model" per caster
+    Frustum frustum;        // cascade volume for culling casters, open towards the light
+    int cascade;
+    bool staticCasters;     // draw everything that does not move
+    bool dynamicCasters;    // draw everything that does
+};
+
+struct ShadowCascade {
+    glm::mat4 viewProjection;
+    Frustum frustum;
+    glm::vec3 center;       // world-space center of the fitted sphere
+    float radius;
+    float splitFar;         // view depth where this cascade hands over to the next
+    float texelSize;        // world units per shadow texel
+    bool staticValid;       // cached cascades: the static layer matches the current fit and light
+    bool liveIsStatic;      // cached cascades: the sampled layer holds the static layer and nothing else
+};
+
+struct ShadowQueued {
+    int cascade;
+    bool toStatic;          // render into the static cache instead of the sampled array
+    bool copyStatic;        // copy the static layer into the sampled layer first
+    bool staticCasters;
+    bool dynamicCasters;
+};
+
+struct CascadedShadows {
+    unsigned int depthArray;    // one layer per cascade, sampled by lit shaders
+    unsigned int staticArray;   // static casters of the cached cascades, from firstCached on
+    unsigned int fbo;
+    Shader shader;
+    int numCascades;
+    int firstCached;
+    int resolution;
+    ShadowCascade cascades[CSM_MAX_CASCADES];
+    glm::vec3 lightDirection;
+
+    ShadowQueued queue[CSM_MAX_CASCADES * 2];
+    int numQueued;
+    int next;
+    GLint savedViewport[4];
+    GLint savedFramebuffer;
+    GLboolean savedCulling;
+
+    int cascadesRendered;   // last update: cascades that drew anything
+    int cascadesCached;     // last update: cascades reused as they were
+};
+
+static unsigned int createShadowArray(int resolution, int layers)
+{
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT32F, resolution, resolution, layers);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    float border[] = {1.0f, 1.0f, 1.0f, 1.0f}; // outside the map is lit
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+    // sampler2DArrayShadow: every fetch is a hardware 2x2 depth comparison
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    RENDER_STAT_ADD(RENDER_STAT_BUFFER_BYTES, (uint64_t)resolution * resolution * layers * sizeof(float));
+    return texture;
+}
+
+void cascadedShadowsInit(CascadedShadows* csm, int numCascades, int resolution)
+{
+    memset(csm, 0, sizeof(*csm));
+    if (numCascades < 2) numCascades = 2;
+    if (numCascades > CSM_MAX_CASCADES) numCascades = CSM_MAX_CASCADES;
+    csm->numCascades = numCascades;
+    csm->firstCached = numCascades / 2;
+    csm->resolution = resolution;
+
+    csm->depthArray = createShadowArray(resolution, numCascades);
+    csm->staticArray = createShadowArray(resolution, numCascades - csm->firstCached);
+
+    glGenFramebuffers(1, &csm->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, csm->fbo);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, csm->depthArray, 0, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        printf("ERROR::SHADOWS:: Framebuffer is not complete! (%s:%d)\n", __FILE__, __LINE__);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    csm->shader = createShaderFromFile("shaders/shadow_vertex.glsl", "shaders/shadow_frag.glsl");
+}
+
+void cascadedShadowsDestroy(CascadedShadows* csm)
+{
+    glDeleteFramebuffers(1, &csm->fbo);
+    glDeleteTextures(1, &csm->depthArray);
+    glDeleteTextures(1, &csm->staticArray);
+    deleteShader(csm->shader);
+}
+
+// The static caster set changed (a model was swapped, something static moved): redraw every cache.
+void cascadedShadowsInvalidate(CascadedShadows* csm)
+{
+    for (int i = 0; i < csm->numCascades; i++)
+        csm->cascades[i].staticValid = false;
+}
+
+// Bounding sphere of the view frustum between view depths d0 and d1, as a distance along the view
+// direction and a radius. k2 is the squared tangent of the half diagonal field of view.
+static void fitSliceSphere(float d0, float d1, float k2, float* depth, float* radius)
+{
+    float z = 0.5f * (d0 + d1) * (1.0f + k2);
+    if (z >= d1) {
+        *depth = d1;
+        *radius = d1 * sqrtf(k2);
+    } else {
+        *depth = z;
+        *radius = sqrtf((d1 - z) * (d1 - z) + d1 * d1 * k2);
+    }
+}
+
+// Orthographic light projection around a sphere, snapped to the texel grid of the light's rotation.
+static void fitCascade(ShadowCascade* cascade, const glm::mat4& lightRotation, int resolution)
+{
+    float r = cascade->radius;
+    cascade->texelSize = 2.0f * r / (float)resolution;
+
+    glm::vec3 c = glm::vec3(lightRotation * glm::vec4(cascade->center, 1.0f));
+    c.x = floorf(c.x / cascade->texelSize) * cascade->texelSize;
+    c.y = floorf(c.y / cascade->texelSize) * cascade->texelSize;
+
+    // the light looks down -z: near reaches CSM_CASTER_DISTANCE past the sphere towards the light
+    glm::mat4 projection = glm::ortho(c.x - r, c.x + r, c.y - r, c.y + r, -c.z - r - CSM_CASTER_DISTANCE, -c.z + r);
+    cascade->viewProjection = projection * lightRotation;
+    cascade->frustum = frustumFromMatrix(cascade->viewProjection);
+    // depth clamping keeps casters in front of the near plane, so culling must not drop them
+    cascade->frustum.planes[FRUSTUM_NEAR] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+}
+
+// Fits the cascades to the camera and queues the passes this frame needs.
+// `dynamicBounds` are world-space spheres (xyz center, w radius) of the casters that move.
+void cascadedShadowsUpdate(CascadedShadows* csm, const glm::mat4& view, float fovY, float aspect, float nearPlane,
+                           const glm::vec3& lightDirection, const glm::vec4* dynamicBounds, int numDynamic)
+{
+    glm::vec3 direction = glm::normalize(lightDirection);
+    if (glm::dot(direction, csm->lightDirection) < 0.99999f)
+        cascadedShadowsInvalidate(csm);
+    csm->lightDirection = direction;
+
+    glm::vec3 up = fabsf(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    glm::mat4 lightRotation = glm::lookAt(glm::vec3(0.0f), direction, up);
+
+    glm::mat4 inverseView = glm::inverse(view);
+    glm::vec3 eye = glm::vec3(inverseView[3]);
+    glm::vec3 forward = -glm::vec3(inverseView[2]);
+    float tanHalf = tanf(fovY * 0.5f);
+    float k2 = tanHalf * tanHalf * (1.0f + aspect * aspect);
+
+    csm->numQueued = 0;
+    csm->next = 0;
+    csm->cascadesRendered = 0;
+    csm->cascadesCached = 0;
+
+    float splitNear = nearPlane;
+    for (int i = 0; i < csm->numCascades; i++)
+    {
+        ShadowCascade* cascade = csm->cascades + i;
+        float p = (float)(i + 1) / (float)csm->numCascades;
+        float logSplit = nearPlane * powf(CSM_MAX_DISTANCE / nearPlane, p);
+        float uniformSplit = nearPlane + (CSM_MAX_DISTANCE - nearPlane) * p;
+        float splitFar = CSM_SPLIT_LAMBDA * logSplit + (1.0f - CSM_SPLIT_LAMBDA) * uniformSplit;
+
+        float depth, radius;
+        fitSliceSphere(splitNear, splitFar, k2, &depth, &radius);
+        radius = ceilf(radius * 16.0f) / 16.0f; // keep the size stable against float noise
+        glm::vec3 center = eye + forward * depth;
+        cascade->splitFar = splitFar;
+        splitNear = splitFar;
+
+        if (i < csm->firstCached)
+        {
+            cascade->center = center;
+            cascade->radius = radius;
+            fitCascade(cascade, lightRotation, csm->resolution);
+            csm->queue[csm->numQueued++] = {i, false, false, true, true};
+            csm->cascadesRendered++;
+            continue;
+        }
+
+        float cachedRadius = radius * (1.0f + CSM_CACHE_MARGIN);
+        bool fits = cascade->radius == cachedRadius && glm::distance(center, cascade->center) + radius <= cachedRadius;
+        if (!fits)
+        {
+            cascade->center = center;
+            cascade->radius = cachedRadius;
+            cascade->staticValid = false;
+        }
+        bool redrawStatic = !cascade->staticValid;
+        if (redrawStatic)
+            fitCascade(cascade, lightRotation, csm->resolution);
+
+        bool overlap = false;
+        for (int d = 0; d < numDynamic && !overlap; d++)
+            overlap = frustumTestSphere(cascade->frustum, glm::vec3(dynamicBounds[d]), dynamicBounds[d].w);
+
+        if (redrawStatic)
+            csm->queue[csm->numQueued++] = {i, true, false, true, false};
+        if (overlap)
+            csm->queue[csm->numQueued++] = {i, false, true, false, true};
+        else if (redrawStatic || !cascade->liveIsStatic)
+            csm->queue[csm->numQueued++] = {i, false, true, false, false};
+        cascade->staticValid = true;
+        cascade->liveIsStatic = !overlap;
+
+        if (redrawStatic || overlap) csm->cascadesRendered++;
+        else csm->cascadesCached++;
+    }
+    RENDER_STAT_ADD(RENDER_STAT_SHADOW_CASCADES, csm->cascadesRendered);
+}
+
+// Steps through the queued passes: binds the target layer and fills `pass`, returning false once
+// every pass ran (the viewport, framebuffer and culling state from before the first call are restored).
+bool cascadedShadowsNextPass(CascadedShadows* csm, ShadowPass* pass)
+{
+    if (csm->next == 0 && csm->numQueued > 0)
+    {
+        glGetIntegerv(GL_VIEWPORT, csm->savedViewport);
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &csm->savedFramebuffer);
+        csm->savedCulling = glIsEnabled(GL_CULL_FACE);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, csm->fbo);
+        glViewport(0, 0, csm->resolution, csm->resolution);
+        glEnable(GL_DEPTH_TEST);
+        glDepthMask(GL_TRUE);
+        glEnable(GL_DEPTH_CLAMP);
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(CSM_SLOPE_BIAS, CSM_CONSTANT_BIAS);
+        glDisable(GL_CULL_FACE); // open quads cast from both sides
+        useShader(csm->shader);
+    }
+
+    while (csm->next < csm->numQueued)
+    {
+        const ShadowQueued& queued = csm->queue[csm->next++];
+        const ShadowCascade* cascade = csm->cascades + queued.cascade;
+        int staticLayer = queued.cascade - csm->firstCached;
+
+        if (queued.copyStatic)
+            glCopyImageSubData(csm->staticArray, GL_TEXTURE_2D_ARRAY, 0, 0, 0, staticLayer,
+                               csm->depthArray, GL_TEXTURE_2D_ARRAY, 0, 0, 0, queued.cascade,
+                               csm->resolution, csm->resolution, 1);
+        if (!queued.staticCasters && !queued.dynamicCasters) continue;
+
+        if (queued.toStatic)
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, csm->staticArray, 0, staticLayer);
+        else
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, csm->depthArray, 0, queued.cascade);
+        if (!queued.copyStatic)
+            glClear(GL_DEPTH_BUFFER_BIT);
+
+        setMat4(csm->shader, "lightViewProjection", glm::value_ptr(cascade->viewProjection));
+        pass->shader = csm->shader;
+        pass->frustum = cascade->frustum;
+        pass->cascade = queued.cascade;
+        pass->staticCasters = queued.staticCasters;
+        pass->dynamicCasters = queued.dynamicCasters;
+        return true;
+    }
+
+    if (csm->numQueued > 0)
+    {
+        glDisable(GL_DEPTH_CLAMP);
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        if (csm->savedCulling) glEnable(GL_CULL_FACE);
+        glBindFramebuffer(GL_FRAMEBUFFER, csm->savedFramebuffer);
+        glViewport(csm->savedViewport[0], csm->savedViewport[1], csm->savedViewport[2], csm->savedViewport[3]);
+        csm->numQueued = 0;
+    }
+    return false;
+}
+
+// Binds the cascades to `textureUnit` and uploads what fragment.glsl needs; `shader` must be in use.
+void cascadedShadowsBind(const CascadedShadows* csm, Shader shader, int textureUnit)
+{
+    glActiveTexture(GL_TEXTURE0 + textureUnit);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, csm->depthArray);
+    glActiveTexture(GL_TEXTURE0);
+    RENDER_STAT_ADD(RENDER_STAT_TEXTURE_BINDS, 1);
+
+    setInt(shader, "shadowMap", textureUnit);
+    setInt(shader, "cascadeCount", csm->numCascades);
+    char name[64];
+    for (int i = 0; i < csm->numCascades; i++)
+    {
+        snprintf(name, sizeof(name), "cascadeMatrices[%d]", i);
+        setMat4(shader, name, glm::value_ptr(csm->cascades[i].viewProjection));
+        snprintf(name, sizeof(name), "cascadeSplits[%d]", i);
+        setFloat(shader, name, csm->cascades[i].splitFar);
+        snprintf(name, sizeof(name), "cascadeTexelSizes[%d]", i);
+        setFloat(shader, name, csm->cascades[i].texelSize);
+    }
+}
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef STATSOVERLAY_H
+#define STATSOVERLAY_H
+#include <glad/glad.h>
+#include <stdio.h>
+#include <string.h>
+#include "shader.hpp"
+#include "renderstats.hpp"
+
+// On-screen text overlay for the render counters.
+// Glyphs come from a built-in 5x7 font baked into a one-row R8 atlas. All text is turned into
+// quads on the CPU and drawn with a single glDrawArrays. The overlay issues its GL calls directly
+// so it does not show up in the counters it displays.
+
+#define OVERLAY_FIRST_CHAR 32
+#define OVERLAY_LAST_CHAR 90
+#define OVERLAY_NUM_GLYPHS (OVERLAY_LAST_CHAR - OVERLAY_FIRST_CHAR + 1)
+#define OVERLAY_CELL_W 6
+#define OVERLAY_CELL_H 8
+#define OVERLAY_SCALE 2.0f
+#define OVERLAY_MAX_CHARS 2048
+
+// One byte per column, bit 0 is the top row.
+static const unsigned char g_overlay_font[OVERLAY_NUM_GLYPHS][5] = {
+    {0x00,0x00,0x00,0x00,0x00}, {0x00,0x00,0x5F,0x00,0x00}, {0x00,0x07,0x00,0x07,0x00}, {0x14,0x7F,0x14,0x7F,0x14}, // space ! " #
+    {0x24,0x2A,0x7F,0x2A,0x12}, {0x23,0x13,0x08,0x64,0x62}, {0x36,0x49,0x55,0x22,0x50}, {0x00,0x05,0x03,0x00,0x00}, // $ % & '
+    {0x00,0x1C,0x22,0x41,0x00}, {0x00,0x41,0x22,0x1C,0x00}, {0x08,0x2A,0x1C,0x2A,0x08}, {0x08,0x08,0x3E,0x08,0x08}, // ( ) * +
+    {0x00,0x50,0x30,0x00,0x00}, {0x08,0x08,0x08,0x08,0x08}, {0x00,0x60,0x60,0x00,0x00}, {0x20,0x10,0x08,0x04,0x02}, // , - . /
+    {0x3E,0x51,0x49,0x45,0x3E}, {0x00,0x42,0x7F,0x40,0x00}, {0x42,0x61,0x51,0x49,0x46}, {0x21,0x41,0x45,0x4B,0x31}, // 0 1 2 3
+    {0x18,0x14,0x12,0x7F,0x10}, {0x27,0x45,0x45,0x45,0x39}, {0x3C,0x4A,0x49,0x49,0x30}, {0x01,0x71,0x09,0x05,0x03}, // 4 5 6 7
+    {0x36,0x49,0x49,0x49,0x36}, {0x06,0x49,0x49,0x29,0x1E}, {0x00,0x36,0x36,0x00,0x00}, {0x00,0x56,0x36,0x00,0x00}, // 8 9 : ;
+    {0x00,0x08,0x14,0x22,0x41}, {0x14,0x14,0x14,0x14,0x14}, {0x41,0x22,0x14,0x08,0x00}, {0x02,0x01,0x51,0x09,0x06}, // < = > ?
+    {0x32,0x49,0x79,0x41,0x3E}, {0x7E,0x11,0x11,0x11,0x7E}, {0x7F,0x49,0x49,0x49,0x36}, {0x3E,0x41,0x41,0x41,0x22}, // @ A B C
+    {0x7F,0x41,0x41,0x22,0x1C}, {0x7F,0x49,0x49,0x49,0x41}, {0x7F,0x09,0x09,0x01,0x01}, {0x3E,0x41,0x41,0x51,0x32}, // D E F G
+    {0x7F,0x08,0x08,0x08,0x7F}, {0x00,0x41,0x7F,0x41,0x00}, {0x20,0x40,0x41,0x3F,0x01}, {0x7F,0x08,0x14,0x22,0x41}, // H I J K
+    {0x7F,0x40,0x40,0x40,0x40}, {0x7F,0x02,0x04,0x02,0x7F}, {0x7F,0x04,0x08,0x10,0x7F}, {0x3E,0x41,0x41,0x41,0x3E}, // L M N O
+    {0x7F,0x09,0x09,0x09,0x06}, {0x3E,0x41,0x51,0x21,0x5E}, {0x7F,0x09,0x19,0x29,0x46}, {0x46,0x49,0x49,0x49,0x31}, // P Q R S
+    {0x01,0x01,0x7F,0x01,0x01}, {0x3F,0x40,0x40,0x40,0x3F}, {0x1F,0x20,0x40,0x20,0x1F}, {0x7F,0x20,0x18,0x20,0x7F}, // T U V W
+    {0x63,0x14,0x08,0x14,0x63}, {0x03,0x04,0x78,0x04,0x03}, {0x61,0x51,0x49,0x45,0x43},                             // X Y Z
+};
+
+struct OverlayVertex {
+    float x, y;
+    float u, v;
+};
+
+struct StatsOverlay {
+    Shader shader;
+    unsigned int fontTexture;
+    unsigned int VAO, VBO;
+    OverlayVertex vertices[OVERLAY_MAX_CHARS * 6];
+    int numVertices;
+};
+
+void statsOverlayInit(StatsOverlay* overlay)
+{
+    overlay->shader = createShaderFromFile("shaders/text_vertex.glsl", "shaders/text_frag.glsl");
+    overlay->numVertices = 0;
+
+    const int atlasWidth = OVERLAY_NUM_GLYPHS * OVERLAY_CELL_W;
+    unsigned char pixels[OVERLAY_NUM_GLYPHS * OVERLAY_CELL_W * OVERLAY_CELL_H] = {0};
+    for (int glyph = 0; glyph < OVERLAY_NUM_GLYPHS; glyph++)
+        for (int col = 0; col < 5; col++)
+            for (int row = 0; row < 7; row++)
+                if (g_overlay_font[glyph][col] & (1 << row))
+                    pixels[row * atlasWidth + glyph * OVERLAY_CELL_W + col] = 255;
+
+    glGenTextures(1, &overlay->fontTexture);
+    glBindTexture(GL_TEXTURE_2D, overlay->fontTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, atlasWidth, OVERLAY_CELL_H, 0, GL_RED, GL_UNSIGNED_BYTE, pixels);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenVertexArrays(1, &overlay->VAO);
+    glGenBuffers(1, &overlay->VBO);
+    glBindVertexArray(overlay->VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, overlay->VBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(overlay->vertices), NULL, GL_STREAM_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(OverlayVertex), (void*)0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(OverlayVertex), (void*)offsetof(OverlayVertex, u));
+    glBindVertexArray(0);
+}
+
+// Appends a line of text at pixel position (x, y), origin top-left. Lowercase is drawn as uppercase.
+void statsOverlayText(StatsOverlay* overlay, float x, float y, const char* text)
+{
+    const float w = OVERLAY_CELL_W * OVERLAY_SCALE;
+    const float h = OVERLAY_CELL_H * OVERLAY_SCALE;
+    for (const char* c = text; *c && overlay->numVertices + 6 <= OVERLAY_MAX_CHARS * 6; c++, x += w)
+    {
+        int ch = (*c >= 'a' && *c <= 'z') ? *c - 'a' + 'A' : *c;
+        if (ch < OVERLAY_FIRST_CHAR || ch > OVERLAY_LAST_CHAR) ch = '?';
+        if (ch == ' ') continue;
+
+        float u0 = (float)(ch - OVERLAY_FIRST_CHAR) / OVERLAY_NUM_GLYPHS;
+        float u1 = (float)(ch - OVERLAY_FIRST_CHAR + 1) / OVERLAY_NUM_GLYPHS;
+        OverlayVertex* v = overlay->vertices + overlay->numVertices;
+        v[0] = {x,     y,     u0, 0.0f};
+        v[1] = {x,     y + h, u0, 1.0f};
+        v[2] = {x + w, y + h, u1, 1.0f};
+        v[3] = {x,     y,     u0, 0.0f};
+        v[4] = {x + w, y + h, u1, 1.0f};
+        v[5] = {x + w, y,     u1, 0.0f};
+        overlay->numVertices += 6;
+    }
+}
+
+// Lays out the counters of the last frame next to their rolling average.
+void statsOverlayAddRenderStats(StatsOverlay* overlay, const RenderStats* stats, float x, float y)
+{
+    char line[128];
+    const float lineHeight = (OVERLAY_CELL_H + 2) * OVERLAY_SCALE;
+    snprintf(line, sizeof(line), "%-16s %10s %12s", "", "frame", "avg");
+    statsOverlayText(overlay, x, y, line);
+    for (int i = 0; i < RENDER_STAT_MAX; i++)
+    {
+        y += lineHeight;
+        snprintf(line, sizeof(line), "%-16s %10llu %12.1f", g_render_stat_str[i],
+                 (unsigned long long)renderStatsLast(stats, i), renderStatsAverage(stats, i));
+        statsOverlayText(overlay, x, y, line);
+    }
+}
+
+// Uploads and draws everything queued this frame in one draw call, then clears the queue.
+void statsOverlayDraw(StatsOverlay* overlay, int screen_width, int screen_height)
+{
+    if (overlay->numVertices == 0) return;
+
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    glUseProgram(overlay->shader.ID);
+    glUniform2f(glGetUniformLocation(overlay->shader.ID, "screenSize"), (float)screen_width, (float)screen_height);
+    glUniform3f(glGetUniformLocation(overlay->shader.ID, "textColor"), 1.0f, 1.0f, 0.2f);
+    glUniform1i(glGetUniformLocation(overlay->shader.ID, "font"), 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, overlay->fontTexture);
+
+    glBindBuffer(GL_ARRAY_BUFFER, overlay->VBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(overlay->vertices), NULL, GL_STREAM_DRAW); // orphan
+    glBufferSubData(GL_ARRAY_BUFFER, 0, overlay->numVertices * sizeof(OverlayVertex), overlay->vertices);
+    glBindVertexArray(overlay->VAO);
+    glDrawArrays(GL_TRIANGLES, 0, overlay->numVertices);
+    glBindVertexArray(0);
+    glUseProgram(0);
+
+    overlay->numVertices = 0;
+}
+
+void statsOverlayDestroy(StatsOverlay* overlay)
+{
+    deleteShader(overlay->shader);
+    glDeleteTextures(1, &overlay->fontTexture);
+    glDeleteBuffers(1, &overlay->VBO);
+    glDeleteVertexArrays(1, &overlay->VAO);
+}
+
+#endif
@@ -0,0 +1,808 @@
+#ifndef STREAMING_H
+#define STREAMING_H
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include "texture.hpp"
+#include "model.hpp"
+#include "jobs.hpp"
+#include "profiler.hpp"
+
+// Asset streaming under memory budgets.
+// Registered assets start as placeholders (a 1x1 texture of a neutral colour, a black sky, a model with
+// no meshes) so the first frame draws without waiting on disk. Every frame the renderer requests the
+// assets it is about to use with the distance to the camera and whether they are in view; the highest
+// request of the frame is the asset's priority. streamingUpdate then, on the GL thread:
+//  - picks up finished loads (file read and decode run on the jobs background queue, see jobs.hpp),
+//  - uploads decoded assets in priority order until STREAMING_UPLOAD_MS is spent (at least one a frame),
+//  - makes room on the GPU by evicting the least recently requested resident assets,
+//  - starts loads for requested assets while the decoded data waiting for upload fits the CPU budget.
+// An evicted asset goes back to its placeholder; textures and cubemaps keep their GL name, so copies
+// of Texture structs and bound ids stay valid, and models keep their Model pointer.
+// streamingInvalidate reads an asset again after its files changed (hot reload): a resident asset keeps
+// drawing what it has until the new data is uploaded over it. A 2D texture gets its resident levels
+// re-decoded and re-uploaded in place; one whose file changed size goes back to its placeholder and
+// streams in again, unless it has sparse storage, which keeps its size.
+//
+// 2D textures stream by mip level. The first load brings in the levels up to STREAMING_MIP_COARSE_SIZE,
+// which then stay resident. Requests carry the screen size of one repeat of the texture, and finer
+// levels are loaded down to about one texel per pixel (the file is decoded again and the chain rebuilt
+// on the worker). GL_TEXTURE_BASE_LEVEL keeps sampling on resident levels; GL_TEXTURE_MIN_LOD starts at
+// the old level after a refinement and fades down, so finer detail blends in instead of popping. Under
+// GPU memory pressure the fine levels of the least recently requested textures are dropped first.
+// With GL_ARB_sparse_texture the texture is immutable storage for the whole chain and only resident
+// levels are committed; without it the levels are mutable images and dropped ones are respecified 0x0.
+//
+// Setup, once:
+//     streamingInit(&streaming, cpuBudget, gpuBudget);
+//     StreamAsset* crateAsset = streamingAddTexture(&streaming, &crate, "container2.png", "assets/textures", TEXTURE_DIFFUSE, true);
+// Per frame:
+//     streamingRequest(&streaming, crateAsset, distance, visible);
+//     streamingUpdate(&streaming);
+
+#define STREAMING_CPU_BUDGET (256ull << 20) // decoded data waiting for upload
+#define STREAMING_GPU_BUDGET (512ull << 20) // resident textures and meshes
+#define STREAMING_UPLOAD_MS 2.0             // GL thread time spent uploading per frame
+#define STREAMING_MAX_IN_FLIGHT 4           // loads on the background queue at once
+#define STREAMING_VISIBLE_BOOST 4.0f        // priority factor of assets in view
+#define STREAMING_MIP_COARSE_SIZE 64        // levels this size and smaller load first and are never dropped
+#define STREAMING_MIP_FADE 0.1f             // MIN_LOD step per frame after finer levels arrive
+#define STREAMING_MIP_RETRY_FRAMES 60       // wait after a refinement that failed or did not fit
+#define STREAMING_MAX_MIPS 16
+
+#ifndef GL_TEXTURE_SPARSE_ARB
+#define GL_TEXTURE_SPARSE_ARB 0x91A6
+#define GL_VIRTUAL_PAGE_SIZE_INDEX_ARB 0x91A7
+#define GL_NUM_SPARSE_LEVELS_ARB 0x91AA
+#define GL_NUM_VIRTUAL_PAGE_SIZES_ARB 0x91A8
+#define GL_VIRTUAL_PAGE_SIZE_X_ARB 0x9195
+#define GL_VIRTUAL_PAGE_SIZE_Y_ARB 0x9196
+#endif
+typedef void (APIENTRYP PFNGLTEXPAGECOMMITMENTARBPROC)(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLint zoffset,
+                                                       GLsizei width, GLsizei height, GLsizei depth, GLboolean commit);
+PFNGLTEXPAGECOMMITMENTARBPROC g_glTexPageCommitmentARB = NULL;
+
+enum StreamAsset_Types {
+    STREAM_ASSET_TEXTURE,
+    STREAM_ASSET_CUBEMAP,
+    STREAM_ASSET_MODEL,
+    STREAM_ASSET_MAX
+};
+
+const char * g_stream_asset_str[STREAM_ASSET_MAX] = {"texture", "cubemap", "model"};
+
+enum StreamAsset_States {
+    STREAM_ASSET_UNLOADED,  // placeholder on the GPU, nothing in memory
+    STREAM_ASSET_LOADING,   // load job on the background queue
+    STREAM_ASSET_LOADED,    // decoded, waiting for its upload
+    STREAM_ASSET_RESIDENT,  // uploaded
+    STREAM_ASSET_FAILED     // the files could not be read, not retried
+};
+
+// neutral colours of placeholders, by texture type: grey albedo, no specular, flat normal, no height
+const unsigned char g_stream_placeholder[TEXTURE_TYPES_MAX][3] = {{128, 128, 128}, {0, 0, 0}, {128, 128, 255}, {0, 0, 0}};
+
+struct StreamAsset {
+    int type;
+    int state;
+    char paths[6][512];
+
+    // targets
+    Texture* texture;
+    bool flip_uv;
+    unsigned int* cubemap;
+    Model* model;
+
+    float priority;         // highest request of frame lastRequest
+    float uvPixels;         // largest screen size of one texture repeat requested that frame, 0 for full detail
+    long long lastRequest;  // -1 until first requested
+    size_t cpuBytes, gpuBytes;
+
+    // filled by the load job
+    JobCounter loading;
+    bool inFlight;          // load job submitted and not collected yet
+    bool ready;             // payload waiting for its upload
+    bool loaded;
+    bool stale;             // files changed while a load was in flight, invalidated again once it is collected
+    bool reloading;         // resident, files changed: the next load is uploaded over what it has
+    bool resized;           // 2D texture whose file no longer matches width[0] x height[0]
+    unsigned char* pixels[6];
+    int width[6], height[6], nrChannels[6];
+    ModelSource* source;
+
+    // mip streaming of 2D textures, width[0] x height[0] is level 0
+    int levels;             // 0 until the first load
+    int coarseBase;         // levels from here on stay resident
+    int residentBase;       // finest level with pixels on the GPU
+    int loadBase, loadEnd;  // levels the load job produces into mips
+    unsigned char* mips[STREAMING_MAX_MIPS];
+    float minLod;
+    bool sparse, tailCommitted;
+    int sparseLevels;
+    long long retryFrame;
+};
+
+struct Streaming {
+    std::vector<StreamAsset*> assets;
+    size_t cpuBudget, gpuBudget;
+    size_t cpuBytes, gpuBytes;
+    long long frame;
+    int inFlight;
+    int uploads, evictions; // since the last streamingReport
+    bool sparseTextures;
+};
+
+void streamingInit(Streaming* sm, size_t cpuBudget = STREAMING_CPU_BUDGET, size_t gpuBudget = STREAMING_GPU_BUDGET)
+{
+    sm->assets.clear();
+    sm->cpuBudget = cpuBudget;
+    sm->gpuBudget = gpuBudget;
+    sm->cpuBytes = 0;
+    sm->gpuBytes = 0;
+    sm->frame = 0;
+    sm->inFlight = 0;
+    sm->uploads = 0;
+    sm->evictions = 0;
+
+    if (glfwExtensionSupported("GL_ARB_sparse_texture"))
+        g_glTexPageCommitmentARB = (PFNGLTEXPAGECOMMITMENTARBPROC)glfwGetProcAddress("glTexPageCommitmentARB");
+    sm->sparseTextures = g_glTexPageCommitmentARB != NULL;
+    printf("STREAMING: cpu budget %.0f MB, gpu budget %.0f MB, sparse textures: %s\n",
+           cpuBudget / 1048576.0, gpuBudget / 1048576.0, sm->sparseTextures ? "yes" : "no");
+}
+
+// Re-specifies a 2D texture or cubemap as 1x1 of `color` and drops its other levels, keeping the name.
+static void streamingPlaceholder(unsigned int textureID, GLenum target, const unsigned char color[3])
+{
+    int faces = target == GL_TEXTURE_CUBE_MAP ? 6 : 1;
+    glBindTexture(target, textureID);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int face = 0; face < faces; face++)
+    {
+        GLenum image = target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : GL_TEXTURE_2D;
+        glTexImage2D(image, 0, GL_RGB8, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, color);
+        for (int level = 1; level < 16; level++)
+            glTexImage2D(image, level, GL_RGB8, 0, 0, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    }
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(target, 0);
+}
+
+static StreamAsset* streamingAddAsset(Streaming* sm, int type)
+{
+    StreamAsset* asset = new StreamAsset();
+    asset->type = type;
+    asset->state = STREAM_ASSET_UNLOADED;
+    asset->lastRequest = -1;
+    sm->assets.push_back(asset);
+    return asset;
+}
+
+// `out` gets a placeholder now and the image once resident. GL thread only.
+StreamAsset* streamingAddTexture(Streaming* sm, Texture* out, const char* path, const char* directory, int texture_type, bool flip_uv)
+{
+    StreamAsset* asset = streamingAddAsset(sm, STREAM_ASSET_TEXTURE);
+    snprintf(asset->paths[0], sizeof(asset->paths[0]), "%s/%s", directory, path);
+    asset->texture = out;
+    asset->flip_uv = flip_uv;
+
+    *out = {0};
+    glGenTextures(1, &out->ID);
+    out->type = texture_type;
+    strncpy_s(out->path, sizeof(out->path), path, _TRUNCATE);
+    streamingPlaceholder(out->ID, GL_TEXTURE_2D, g_stream_placeholder[texture_type]);
+    return asset;
+}
+
+// Six faces (+X, -X, +Y, -Y, +Z, -Z) into one cubemap, black until resident. GL thread only.
+StreamAsset* streamingAddCubemap(Streaming* sm, unsigned int* out, const char* faces[6])
+{
+    StreamAsset* asset = streamingAddAsset(sm, STREAM_ASSET_CUBEMAP);
+    for (int face = 0; face < 6; face++)
+        strncpy_s(asset->paths[face], sizeof(asset->paths[face]), faces[face], _TRUNCATE);
+    asset->cubemap = out;
+
+    const unsigned char black[3] = {0, 0, 0};
+    glGenTextures(1, out);
+    streamingPlaceholder(*out, GL_TEXTURE_CUBE_MAP, black);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, *out);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    return asset;
+}
+
+// `model` comes from ModelCreateEmpty and has no meshes until resident.
+StreamAsset* streamingAddModel(Streaming* sm, Model* model, const char* path)
+{
+    StreamAsset* asset = streamingAddAsset(sm, STREAM_ASSET_MODEL);
+    strncpy_s(asset->paths[0], sizeof(asset->paths[0]), path, _TRUNCATE);
+    asset->model = model;
+    asset->source = new ModelSource();
+    return asset;
+}
+
+// Asks for the asset this frame. Nearer and visible assets load and upload first and are evicted last.
+// uvPixels is how many pixels one repeat of a 2D texture (UV 0 to 1) covers on screen, which picks the
+// finest mip level to stream in; 0 asks for full detail.
+void streamingRequest(Streaming* sm, StreamAsset* asset, float distance, bool visible, float uvPixels = 0.0f)
+{
+    float priority = (visible ? STREAMING_VISIBLE_BOOST : 1.0f) / (1.0f + glm::max(distance, 0.0f));
+    if (asset->lastRequest != sm->frame)
+    {
+        asset->priority = priority;
+        asset->uvPixels = uvPixels;
+    }
+    else
+    {
+        asset->priority = glm::max(asset->priority, priority);
+        asset->uvPixels = (uvPixels <= 0.0f || asset->uvPixels <= 0.0f) ? 0.0f : glm::max(asset->uvPixels, uvPixels);
+    }
+    asset->lastRequest = sm->frame;
+}
+
+bool streamingResident(const StreamAsset* asset)
+{
+    return asset->state == STREAM_ASSET_RESIDENT;
+}
+
+static float streamingPriority(const Streaming* sm, const StreamAsset* asset)
+{
+    return asset->lastRequest == sm->frame ? asset->priority : 0.0f;
+}
+
+static int streamingMipWidth(const StreamAsset* asset, int level) { return glm::max(asset->width[0] >> level, 1); }
+static int streamingMipHeight(const StreamAsset* asset, int level) { return glm::max(asset->height[0] >> level, 1); }
+
+static size_t streamingMipBytes(const StreamAsset* asset, int first, int end)
+{
+    size_t bytes = 0;
+    for (int level = first; level < end; level++)
+        bytes += (size_t)streamingMipWidth(asset, level) * streamingMipHeight(asset, level) * 4;
+    return bytes;
+}
+
+// Finest level a resident texture should have: about one texel per pixel of the largest request,
+// the coarse levels when it was not requested this frame.
+static int streamingWantedBase(const Streaming* sm, const StreamAsset* asset)
+{
+    if (asset->lastRequest != sm->frame) return asset->coarseBase;
+    if (asset->uvPixels <= 0.0f) return 0;
+    float texels = (float)glm::max(asset->width[0], asset->height[0]);
+    int base = (int)floorf(log2f(glm::max(texels / asset->uvPixels, 1.0f)));
+    return glm::min(base, asset->coarseBase);
+}
+
+// Decodes the image as RGBA and builds its chain down to level loadEnd - 1, keeping levels from loadBase.
+// The first load picks the levels (the coarse ones); refinements get them from streamingUpdate.
+static bool streamingLoadTexture(StreamAsset* asset)
+{
+    int width, height, channels;
+    stbi_set_flip_vertically_on_load_thread(asset->flip_uv);
+    unsigned char* image = loadImageFile(asset->paths[0], &width, &height, &channels, 4);
+    if (!image) return false;
+
+    if (asset->levels == 0)
+    {
+        asset->width[0] = width;
+        asset->height[0] = height;
+        asset->nrChannels[0] = 4;
+        asset->levels = glm::min(textureMipCount(width, height), STREAMING_MAX_MIPS);
+        asset->coarseBase = 0;
+        while (asset->coarseBase + 1 < asset->levels &&
+               glm::max(streamingMipWidth(asset, asset->coarseBase), streamingMipHeight(asset, asset->coarseBase)) > STREAMING_MIP_COARSE_SIZE)
+            asset->coarseBase++;
+        asset->loadBase = asset->coarseBase;
+        asset->loadEnd = asset->levels;
+    }
+    else if (width != asset->width[0] || height != asset->height[0])
+    {
+        // the GL thread decides what to do with it, the levels may be dropped while this runs
+        asset->resized = true;
+        stbi_image_free(image);
+        return false;
+    }
+
+    bool srgb = asset->texture->type == TEXTURE_DIFFUSE;
+    unsigned char* level = image;
+    for (int l = 0; l < asset->loadEnd; l++)
+    {
+        unsigned char* next = NULL;
+        if (l + 1 < asset->loadEnd)
+        {
+            next = (unsigned char*)STBI_MALLOC(streamingMipBytes(asset, l + 1, l + 2));
+            downsampleImage(level, streamingMipWidth(asset, l), streamingMipHeight(asset, l), srgb, next);
+        }
+        if (l >= asset->loadBase) asset->mips[l] = level;
+        else stbi_image_free(level);
+        level = next;
+    }
+    return true;
+}
+
+// Runs on a worker from the background queue, touches no GL state.
+static void streamingLoadJob(void* data)
+{
+    StreamAsset* asset = (StreamAsset*)data;
+    PROFILE_ZONE("streamingLoad");
+    switch (asset->type)
+    {
+    case STREAM_ASSET_TEXTURE:
+        asset->loaded = streamingLoadTexture(asset);
+        break;
+    case STREAM_ASSET_CUBEMAP:
+        stbi_set_flip_vertically_on_load_thread(false);
+        asset->loaded = true;
+        for (int face = 0; face < 6; face++)
+        {
+            asset->pixels[face] = loadImageFile(asset->paths[face], &asset->width[face], &asset->height[face], &asset->nrChannels[face]);
+            asset->loaded = asset->loaded && asset->pixels[face] != NULL;
+        }
+        break;
+    case STREAM_ASSET_MODEL:
+        asset->loaded = modelLoadSource(asset->model, asset->paths[0], asset->source);
+        break;
+    }
+}
+
+static void streamingFreePayload(Streaming* sm, StreamAsset* asset)
+{
+    for (int face = 0; face < 6; face++)
+    {
+        stbi_image_free(asset->pixels[face]);
+        asset->pixels[face] = NULL;
+    }
+    for (int level = 0; level < STREAMING_MAX_MIPS; level++)
+    {
+        stbi_image_free(asset->mips[level]);
+        asset->mips[level] = NULL;
+    }
+    if (asset->type == STREAM_ASSET_MODEL && asset->loaded) modelFreeSource(asset->source);
+    asset->loaded = false;
+    asset->ready = false;
+    sm->cpuBytes -= asset->cpuBytes;
+    asset->cpuBytes = 0;
+}
+
+// The asset's files changed: drops what was read from them and reads them again the next time the asset
+// is requested. GL thread only.
+void streamingInvalidate(Streaming* sm, StreamAsset* asset)
+{
+    if (asset->inFlight)
+    {
+        asset->stale = true;
+        return;
+    }
+    if (asset->ready)
+    {
+        streamingFreePayload(sm, asset);
+        if (asset->state == STREAM_ASSET_LOADED) asset->state = STREAM_ASSET_UNLOADED;
+    }
+    if (asset->state == STREAM_ASSET_FAILED) asset->state = STREAM_ASSET_UNLOADED;
+    if (asset->state == STREAM_ASSET_RESIDENT) asset->reloading = true;
+    else asset->levels = 0; // a 2D texture takes its size from the new file
+}
+
+static size_t streamingPayloadBytes(const StreamAsset* asset)
+{
+    if (asset->type == STREAM_ASSET_MODEL) return modelSourceBytes(asset->source);
+    if (asset->type == STREAM_ASSET_TEXTURE) return streamingMipBytes(asset, asset->loadBase, asset->loadEnd);
+    size_t bytes = 0;
+    for (int face = 0; face < 6; face++)
+        if (asset->pixels[face]) bytes += (size_t)asset->width[face] * asset->height[face] * asset->nrChannels[face];
+    return bytes;
+}
+
+// What the upload will take on the GPU: texels padded to 4 bytes plus a third for mips.
+static size_t streamingUploadBytes(const StreamAsset* asset)
+{
+    if (asset->type == STREAM_ASSET_MODEL) return modelSourceGpuBytes(asset->source);
+    if (asset->type == STREAM_ASSET_TEXTURE) return streamingMipBytes(asset, asset->loadBase, asset->loadEnd);
+    size_t bytes = 0;
+    for (int face = 0; face < 6; face++)
+        if (asset->pixels[face]) bytes += (size_t)asset->width[face] * asset->height[face] * 4;
+    return bytes * 4 / 3;
+}
+
+static GLenum streamingTextureFormat(const StreamAsset* asset)
+{
+    return asset->texture->type == TEXTURE_DIFFUSE ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+}
+
+// Commits or releases the pages of one level; levels in the mip tail go together. Texture bound.
+static void streamingCommitLevel(StreamAsset* asset, int level, bool commit)
+{
+    if (!asset->sparse) return;
+    if (level >= asset->sparseLevels)
+    {
+        if (asset->tailCommitted == commit) return;
+        asset->tailCommitted = commit;
+        level = asset->sparseLevels;
+    }
+    g_glTexPageCommitmentARB(GL_TEXTURE_2D, level, 0, 0, 0, streamingMipWidth(asset, level), streamingMipHeight(asset, level), 1,
+                             commit ? GL_TRUE : GL_FALSE);
+}
+
+// Moves sampling up to `base` and frees the finer levels.
+static void streamingDropMips(Streaming* sm, StreamAsset* asset, int base)
+{
+    glBindTexture(GL_TEXTURE_2D, asset->texture->ID);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, base);
+    asset->minLod = glm::max(asset->minLod - (float)(base - asset->residentBase), 0.0f);
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, asset->minLod);
+    for (int level = asset->residentBase; level < base; level++)
+    {
+        if (asset->sparse) streamingCommitLevel(asset, level, false);
+        else glTexImage2D(GL_TEXTURE_2D, level, streamingTextureFormat(asset), 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    size_t bytes = streamingMipBytes(asset, base, asset->levels);
+    sm->gpuBytes -= asset->gpuBytes - bytes;
+    asset->gpuBytes = bytes;
+    asset->residentBase = base;
+    sm->evictions++;
+}
+
+static void streamingEvict(Streaming* sm, StreamAsset* asset)
+{
+    switch (asset->type)
+    {
+    case STREAM_ASSET_TEXTURE:
+        // once loaded, the coarse levels are the placeholder of a texture
+        streamingDropMips(sm, asset, asset->coarseBase);
+        return;
+    case STREAM_ASSET_CUBEMAP:
+    {
+        const unsigned char black[3] = {0, 0, 0};
+        streamingPlaceholder(*asset->cubemap, GL_TEXTURE_CUBE_MAP, black);
+        break;
+    }
+    case STREAM_ASSET_MODEL:
+        modelRelease(asset->model);
+        break;
+    }
+    sm->gpuBytes -= asset->gpuBytes;
+    asset->gpuBytes = 0;
+    asset->state = STREAM_ASSET_UNLOADED;
+    asset->reloading = false;
+    sm->evictions++;
+}
+
+// Back to the placeholder with no levels known, so the next request streams the texture in from scratch.
+static void streamingResetTexture(Streaming* sm, StreamAsset* asset)
+{
+    streamingPlaceholder(asset->texture->ID, GL_TEXTURE_2D, g_stream_placeholder[asset->texture->type]);
+    glBindTexture(GL_TEXTURE_2D, asset->texture->ID);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, 0.0f);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    sm->gpuBytes -= asset->gpuBytes;
+    asset->gpuBytes = 0;
+    asset->levels = 0;
+    asset->residentBase = 0;
+    asset->minLod = 0.0f;
+    asset->state = STREAM_ASSET_UNLOADED;
+    sm->evictions++;
+}
+
+// Frees GPU memory until `bytes` more fit the budget, least recently requested first: the levels of
+// textures finer than what they were asked for, and assets not requested this frame. Leaves `keep` alone.
+static bool streamingMakeRoom(Streaming* sm, size_t bytes, const StreamAsset* keep = NULL)
+{
+    while (sm->gpuBytes + bytes > sm->gpuBudget)
+    {
+        StreamAsset* victim = NULL;
+        int victimBase = 0;
+        for (StreamAsset* asset : sm->assets)
+        {
+            if (asset == keep || asset->state != STREAM_ASSET_RESIDENT) continue;
+            int base = 0;
+            if (asset->type == STREAM_ASSET_TEXTURE)
+            {
+                base = streamingWantedBase(sm, asset);
+                if (asset->residentBase >= base) continue;
+            }
+            else if (asset->lastRequest == sm->frame) continue;
+            if (!victim || asset->lastRequest < victim->lastRequest)
+            {
+                victim = asset;
+                victimBase = base;
+            }
+        }
+        if (!victim) return false;
+        if (victim->type == STREAM_ASSET_TEXTURE) streamingDropMips(sm, victim, victimBase);
+        else streamingEvict(sm, victim);
+    }
+    return true;
+}
+
+// Uploads the levels of the payload that fit the budget, giving up the finest ones first.
+static void streamingUploadTexture(Streaming* sm, StreamAsset* asset)
+{
+    if (asset->reloading)
+    {
+        // new pixels into the levels it has, same sizes and budget; ones dropped meanwhile stay dropped
+        glBindTexture(GL_TEXTURE_2D, asset->texture->ID);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (int level = glm::max(asset->loadBase, asset->residentBase); level < asset->loadEnd; level++)
+            glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, streamingMipWidth(asset, level), streamingMipHeight(asset, level),
+                            GL_RGBA, GL_UNSIGNED_BYTE, asset->mips[level]);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        asset->reloading = false;
+        sm->uploads++;
+        return;
+    }
+    bool first = asset->state != STREAM_ASSET_RESIDENT;
+    if (!first && asset->loadEnd != asset->residentBase) return; // levels were dropped meanwhile, the payload no longer joins up
+    while (asset->loadBase < asset->loadEnd && !streamingMakeRoom(sm, streamingMipBytes(asset, asset->loadBase, asset->loadEnd), asset))
+        asset->loadBase++;
+    if (asset->loadBase == asset->loadEnd)
+    {
+        asset->retryFrame = sm->frame + STREAMING_MIP_RETRY_FRAMES;
+        return;
+    }
+
+    GLenum internalFormat = streamingTextureFormat(asset);
+    glBindTexture(GL_TEXTURE_2D, asset->texture->ID);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (first)
+    {
+        GLint pages = 0, pageX = 0, pageY = 0;
+        if (sm->sparseTextures)
+        {
+            glGetInternalformativ(GL_TEXTURE_2D, internalFormat, GL_NUM_VIRTUAL_PAGE_SIZES_ARB, 1, &pages);
+            glGetInternalformativ(GL_TEXTURE_2D, internalFormat, GL_VIRTUAL_PAGE_SIZE_X_ARB, 1, &pageX);
+            glGetInternalformativ(GL_TEXTURE_2D, internalFormat, GL_VIRTUAL_PAGE_SIZE_Y_ARB, 1, &pageY);
+        }
+        // sparse storage needs level 0 to be whole pages
+        asset->sparse = pages > 0 && pageX > 0 && pageY > 0 && asset->width[0] % pageX == 0 && asset->height[0] % pageY == 0;
+        if (asset->sparse)
+        {
+            // replaces the placeholder image, the name stays
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SPARSE_ARB, GL_TRUE);
+            glTexParameteri(GL_TEXTURE_2D, GL_VIRTUAL_PAGE_SIZE_INDEX_ARB, 0);
+            glTexStorage2D(GL_TEXTURE_2D, asset->levels, internalFormat, asset->width[0], asset->height[0]);
+            glGetTexParameteriv(GL_TEXTURE_2D, GL_NUM_SPARSE_LEVELS_ARB, &asset->sparseLevels);
+        }
+        else
+        {
+            // the 1x1 placeholder stays in level 0 until a finer load replaces it, below the base level
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, asset->levels - 1);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        asset->residentBase = asset->loadEnd;
+        asset->minLod = 0.0f;
+    }
+
+    for (int level = asset->loadBase; level < asset->loadEnd; level++)
+    {
+        int width = streamingMipWidth(asset, level), height = streamingMipHeight(asset, level);
+        if (asset->sparse)
+        {
+            streamingCommitLevel(asset, level, true);
+            glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, asset->mips[level]);
+        }
+        else
+        {
+            glTexImage2D(GL_TEXTURE_2D, level, internalFormat, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, asset->mips[level]);
+        }
+    }
+    // keep sampling at the old detail and let MIN_LOD fade to the new one
+    if (!first) asset->minLod += (float)(asset->residentBase - asset->loadBase);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, asset->loadBase);
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, asset->minLod);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    asset->residentBase = asset->loadBase;
+    sm->gpuBytes -= asset->gpuBytes;
+    asset->gpuBytes = streamingMipBytes(asset, asset->residentBase, asset->levels);
+    sm->gpuBytes += asset->gpuBytes;
+    asset->state = STREAM_ASSET_RESIDENT;
+    sm->uploads++;
+}
+
+static void streamingUpload(Streaming* sm, StreamAsset* asset)
+{
+    PROFILE_ZONE("streamingUpload");
+    if (asset->type == STREAM_ASSET_TEXTURE)
+    {
+        streamingUploadTexture(sm, asset);
+        streamingFreePayload(sm, asset);
+        if (asset->state == STREAM_ASSET_LOADED) asset->state = STREAM_ASSET_UNLOADED; // nothing fit
+        return;
+    }
+    // a reload replaces what the asset has
+    size_t bytes = streamingUploadBytes(asset), replaced = asset->state == STREAM_ASSET_RESIDENT ? asset->gpuBytes : 0;
+    if (!streamingMakeRoom(sm, bytes > replaced ? bytes - replaced : 0, asset))
+    {
+        // stays decoded unless nobody wants it anymore
+        if (asset->lastRequest != sm->frame)
+        {
+            streamingFreePayload(sm, asset);
+            if (asset->state == STREAM_ASSET_LOADED) asset->state = STREAM_ASSET_UNLOADED;
+        }
+        return;
+    }
+    sm->gpuBytes -= replaced;
+    switch (asset->type)
+    {
+    case STREAM_ASSET_CUBEMAP:
+        glBindTexture(GL_TEXTURE_CUBE_MAP, *asset->cubemap);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (int face = 0; face < 6; face++)
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_SRGB8, asset->width[face], asset->height[face], 0,
+                         GL_RGB, GL_UNSIGNED_BYTE, asset->pixels[face]);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        asset->gpuBytes = streamingUploadBytes(asset);
+        break;
+    case STREAM_ASSET_MODEL:
+        modelUploadSource(asset->model, asset->source);
+        asset->gpuBytes = modelGpuBytes(asset->model);
+        break;
+    }
+    streamingFreePayload(sm, asset);
+    sm->gpuBytes += asset->gpuBytes;
+    asset->state = STREAM_ASSET_RESIDENT;
+    asset->reloading = false;
+    sm->uploads++;
+}
+
+// Once per frame on the GL thread, outside of any pass, after the frame's requests.
+void streamingUpdate(Streaming* sm)
+{
+    PROFILE_ZONE("streamingUpdate");
+    auto start = std::chrono::steady_clock::now();
+
+    for (StreamAsset* asset : sm->assets)
+    {
+        if (!asset->inFlight || !jobsDone(&asset->loading)) continue;
+        asset->inFlight = false;
+        sm->inFlight--;
+        if (asset->stale)
+        {
+            // read before the last change, start over
+            asset->stale = false;
+            streamingFreePayload(sm, asset);
+            if (asset->state == STREAM_ASSET_LOADING) asset->state = STREAM_ASSET_UNLOADED;
+            streamingInvalidate(sm, asset);
+            continue;
+        }
+        if (asset->loaded)
+        {
+            asset->cpuBytes = streamingPayloadBytes(asset);
+            sm->cpuBytes += asset->cpuBytes;
+            asset->ready = true;
+            if (asset->state == STREAM_ASSET_LOADING) asset->state = STREAM_ASSET_LOADED;
+        }
+        else if (asset->state == STREAM_ASSET_LOADING)
+        {
+            printf("ERROR::STREAMING::LOAD_FAILED: %s %s\n", g_stream_asset_str[asset->type], asset->paths[0]);
+            streamingFreePayload(sm, asset);
+            asset->state = STREAM_ASSET_FAILED;
+        }
+        else
+        {
+            // a refinement of a resident texture or a reload of a resident asset, which keeps what it has
+            streamingFreePayload(sm, asset);
+            if (asset->resized && !asset->sparse)
+            {
+                streamingResetTexture(sm, asset);
+            }
+            else
+            {
+                if (asset->resized)
+                    printf("ERROR::STREAMING::SIZE_CHANGED: %s no longer fits its sparse storage\n", asset->paths[0]);
+                else if (asset->reloading)
+                    printf("ERROR::STREAMING::RELOAD_FAILED: %s %s\n", g_stream_asset_str[asset->type], asset->paths[0]);
+                asset->retryFrame = sm->frame + STREAMING_MIP_RETRY_FRAMES;
+            }
+            asset->reloading = false;
+        }
+    }
+
+    std::vector<StreamAsset*> order = sm->assets;
+    std::stable_sort(order.begin(), order.end(), [sm](const StreamAsset* a, const StreamAsset* b) {
+        return streamingPriority(sm, a) > streamingPriority(sm, b);
+    });
+
+    // uploads, highest priority first
+    int uploaded = 0;
+    for (StreamAsset* asset : order)
+    {
+        if (!asset->ready) continue;
+        double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (uploaded > 0 && elapsed > STREAMING_UPLOAD_MS) break;
+        streamingUpload(sm, asset);
+        uploaded++;
+    }
+
+    // new loads, and finer levels for textures drawn larger than their resident levels
+    for (StreamAsset* asset : order)
+    {
+        if (sm->inFlight >= STREAMING_MAX_IN_FLIGHT || sm->cpuBytes >= sm->cpuBudget) break;
+        if (asset->lastRequest != sm->frame || asset->inFlight || asset->ready) continue;
+        if (asset->state == STREAM_ASSET_RESIDENT && !asset->reloading)
+        {
+            if (asset->type != STREAM_ASSET_TEXTURE || sm->frame < asset->retryFrame) continue;
+            int wanted = streamingWantedBase(sm, asset);
+            if (wanted >= asset->residentBase) continue;
+            asset->loadBase = wanted;
+            asset->loadEnd = asset->residentBase;
+        }
+        else if (asset->state == STREAM_ASSET_RESIDENT)
+        {
+            // reload: the levels it has, from the changed file
+            asset->loadBase = asset->residentBase;
+            asset->loadEnd = asset->levels;
+        }
+        else if (asset->state == STREAM_ASSET_UNLOADED)
+        {
+            asset->state = STREAM_ASSET_LOADING;
+        }
+        else continue;
+        asset->loaded = false;
+        asset->resized = false;
+        asset->inFlight = true;
+        sm->inFlight++;
+        jobsSubmitBackground("stream asset", streamingLoadJob, asset, &asset->loading);
+    }
+
+    // the budgets may have been lowered, or an upload came out larger than estimated
+    streamingMakeRoom(sm, 0);
+    for (auto it = order.rbegin(); it != order.rend() && sm->cpuBytes > sm->cpuBudget; ++it)
+    {
+        StreamAsset* asset = *it;
+        if (!asset->ready || asset->lastRequest == sm->frame) continue;
+        streamingFreePayload(sm, asset);
+        if (asset->state == STREAM_ASSET_LOADED) asset->state = STREAM_ASSET_UNLOADED;
+    }
+
+    for (StreamAsset* asset : sm->assets)
+    {
+        if (asset->type != STREAM_ASSET_TEXTURE || asset->minLod <= 0.0f) continue;
+        asset->minLod = glm::max(asset->minLod - STREAMING_MIP_FADE, 0.0f);
+        glBindTexture(GL_TEXTURE_2D, asset->texture->ID);
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, asset->minLod);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    sm->frame++;
+}
+
+// One line of counters, then resets the upload and eviction counts.
+void streamingReport(Streaming* sm)
+{
+    int counts[STREAM_ASSET_FAILED + 1] = {0};
+    for (StreamAsset* asset : sm->assets) counts[asset->state]++;
+    printf("STREAMING: %d/%d resident, %d loading, %d waiting, %d failed, cpu %.1f/%.0f MB, gpu %.1f/%.0f MB, %d uploads, %d evictions\n",
+           counts[STREAM_ASSET_RESIDENT], (int)sm->assets.size(), counts[STREAM_ASSET_LOADING], counts[STREAM_ASSET_LOADED],
+           counts[STREAM_ASSET_FAILED], sm->cpuBytes / 1048576.0, sm->cpuBudget / 1048576.0, sm->gpuBytes / 1048576.0,
+           sm->gpuBudget / 1048576.0, sm->uploads, sm->evictions);
+    sm->uploads = 0;
+    sm->evictions = 0;
+}
+
+// Waits for loads in flight and frees what is still decoded. GL objects stay with their owners.
+void streamingDestroy(Streaming* sm)
+{
+    for (StreamAsset* asset : sm->assets)
+    {
+        if (asset->inFlight) jobsWait(&asset->loading);
+        streamingFreePayload(sm, asset);
+        delete asset->source;
+        delete asset;
+    }
+    sm->assets.clear();
+    sm->inFlight = 0;
+}
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef TEXTURE_H
 #define TEXTURE_H
 
+#include "vfs.hpp"
 #define STB_IMAGE_IMPLEMENTATION
 #include "../thirdparty/stb/stb_image.h"
 #include "../thirdparty/glm/glm.hpp"
@@ -8,6 +9,8 @@
 
 
 #include <glad/glad.h>
+#include "profiler.hpp"
+#include "jobs.hpp"
 
 enum Texture_Types {
     TEXTURE_DIFFUSE,
@@ -25,8 +28,129 @@ struct Texture {
     char path[512];
 };
 
+// Uploads decoded pixels into an existing texture object and rebuilds its mip chain.
+// Returns false if the channel count is not supported.
+bool uploadTextureImage(unsigned int textureID, int texture_type, const unsigned char *data, int width, int height, int nrChannels)
+{
+    GLenum internalFormat;
+    GLenum dataFormat;
+    if (nrChannels == 1)
+    {
+        internalFormat = GL_RED;
+        dataFormat = GL_RED;
+
+    }
+    else if (nrChannels == 3)
+    {
+        if (texture_type == TEXTURE_DIFFUSE) {internalFormat = GL_SRGB8;}
+        else {internalFormat = GL_RGB8;}
+        dataFormat = GL_RGB;
+    }
+    else if (nrChannels == 4)
+    {
+        if (texture_type == TEXTURE_DIFFUSE) {internalFormat = GL_SRGB8_ALPHA8;}
+        else {internalFormat = GL_RGBA8;}
+        dataFormat = GL_RGBA;
+    }
+    else
+    {
+        printf("Error: Unsupported number of channels: %d\n", nrChannels);
+        return false;
+    }
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);	
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // Row alignment
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, dataFormat, GL_UNSIGNED_BYTE, data);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    return true;
+}
+
+// Approximate GPU memory of a 2D texture with a full mip chain, counting texels as 4 bytes
+// since drivers pad RGB8 to RGBA8. Binds the texture.
+size_t textureGpuBytes(unsigned int textureID)
+{
+    int width = 0, height = 0;
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+    return (size_t)width * height * 4 * 4 / 3;
+}
+
+// stbi_load through the VFS: packed images decode straight from the mapping.
+// desiredChannels 0 keeps the file's channels, nrChannels always reports the file's.
+unsigned char* loadImageFile(const char* filename, int* width, int* height, int* nrChannels, int desiredChannels = 0)
+{
+    VfsFile file;
+    if (!vfsOpen(filename, &file)) return NULL;
+    unsigned char* data = stbi_load_from_memory(file.data, (int)file.size, width, height, nrChannels, desiredChannels);
+    vfsClose(&file);
+    return data;
+}
+
+// Levels of a full mip chain down to 1x1.
+int textureMipCount(int width, int height)
+{
+    int levels = 1;
+    for (int size = width > height ? width : height; size > 1; size >>= 1) levels++;
+    return levels;
+}
+
+// Halves an RGBA8 image with a 2x2 box filter into dst (max(1, width/2) x max(1, height/2)).
+// sRGB colour is averaged in linear space, alpha as is.
+void downsampleImage(const unsigned char* src, int width, int height, bool srgb, unsigned char* dst)
+{
+    static float toLinear[256];
+    static unsigned char toSrgb[4096];
+    static bool tables = [] {
+        for (int i = 0; i < 256; i++)
+        {
+            float c = i / 255.0f;
+            toLinear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+        }
+        for (int i = 0; i < 4096; i++)
+        {
+            float c = i / 4095.0f;
+            c = c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+            toSrgb[i] = (unsigned char)(c * 255.0f + 0.5f);
+        }
+        return true;
+    }();
+    (void)tables;
+
+    int dstWidth = width > 1 ? width / 2 : 1;
+    int dstHeight = height > 1 ? height / 2 : 1;
+    for (int y = 0; y < dstHeight; y++)
+    {
+        int y0 = glm::min(2 * y, height - 1), y1 = glm::min(2 * y + 1, height - 1);
+        for (int x = 0; x < dstWidth; x++)
+        {
+            int x0 = glm::min(2 * x, width - 1), x1 = glm::min(2 * x + 1, width - 1);
+            const unsigned char* texels[4] = {src + 4 * (y0 * width + x0), src + 4 * (y0 * width + x1),
+                                              src + 4 * (y1 * width + x0), src + 4 * (y1 * width + x1)};
+            unsigned char* out = dst + 4 * (y * dstWidth + x);
+            for (int c = 0; c < 4; c++)
+            {
+                if (srgb && c < 3)
+                {
+                    float sum = toLinear[texels[0][c]] + toLinear[texels[1][c]] + toLinear[texels[2][c]] + toLinear[texels[3][c]];
+                    out[c] = toSrgb[(int)(sum * 0.25f * 4095.0f + 0.5f)];
+                }
+                else
+                {
+                    out[c] = (unsigned char)((texels[0][c] + texels[1][c] + texels[2][c] + texels[3][c] + 2) / 4);
+                }
+            }
+        }
+    }
+}
+
 Texture createTextureFromFile(const char * path, const char *directory, int texture_type, const bool flip_uv)
 {
+    PROFILE_ZONE("createTextureFromFile");
 
     char filename[512];
     snprintf(filename, sizeof(filename), "%s/%s", directory, path);
@@ -37,47 +161,13 @@ Texture createTextureFromFile(const char * path, const char *directory, int text
     
     int width, height, nrChannels;
     stbi_set_flip_vertically_on_load(flip_uv);
-    unsigned char *data = stbi_load(filename, &width, &height, &nrChannels, 0);
+    unsigned char *data = loadImageFile(filename, &width, &height, &nrChannels);
     stbi_set_flip_vertically_on_load(!flip_uv);
 
     printf("Loading image with um of channes %u\n",nrChannels);
     if (data)
     {
-        GLenum internalFormat;
-        GLenum dataFormat;
-        if (nrChannels == 1)
-        {
-            internalFormat = GL_RED;
-            dataFormat = GL_RED;
-
-        }
-        else if (nrChannels == 3)
-        {
-            if (texture_type == TEXTURE_DIFFUSE) {internalFormat = GL_SRGB8;}
-            else {internalFormat = GL_RGB8;}
-            dataFormat = GL_RGB;
-        }
-        else if (nrChannels == 4)
-        {
-            if (texture_type == TEXTURE_DIFFUSE) {internalFormat = GL_SRGB8_ALPHA8;}
-            else {internalFormat = GL_RGBA8;}
-            dataFormat = GL_RGBA;
-        }
-        else
-        {
-            printf("Error: Unsupported number of channels: %d\n", nrChannels);
-            stbi_image_free(data);
-            return texture; 
-        }
-        glBindTexture(GL_TEXTURE_2D, texture.ID);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);	
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // Row alignment
-        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, dataFormat, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        uploadTextureImage(texture.ID, texture_type, data, width, height, nrChannels);
     }
     else
     {
@@ -88,6 +178,75 @@ Texture createTextureFromFile(const char * path, const char *directory, int text
     return texture;
 }
 
+// One entry of a batched load: the file is decoded on a worker, the GL texture is made on the calling thread.
+struct TextureLoad {
+    const char* path;
+    const char* directory;
+    int texture_type;
+    bool flip_uv;
+    Texture* out;
+
+    // filled by the decode job
+    unsigned char* data;
+    int width, height, nrChannels;
+};
+
+static void decodeTextureJob(void* data)
+{
+    TextureLoad* load = (TextureLoad*)data;
+    char filename[512];
+    snprintf(filename, sizeof(filename), "%s/%s", load->directory, load->path);
+    stbi_set_flip_vertically_on_load_thread(load->flip_uv);
+    load->data = loadImageFile(filename, &load->width, &load->height, &load->nrChannels);
+}
+
+// Decodes every entry in parallel on the job system and waits for them. Safe on any thread.
+void decodeTextures(TextureLoad* loads, int count)
+{
+    PROFILE_ZONE("decodeTextures");
+    JobCounter decoded;
+    for (int i = 0; i < count; i++)
+    {
+        loads[i].data = NULL;
+        jobsSubmit("decode texture", decodeTextureJob, &loads[i], &decoded);
+    }
+    jobsWait(&decoded);
+}
+
+// Creates the GL textures of decoded entries and frees their pixels. GL thread only.
+void uploadTextures(TextureLoad* loads, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        TextureLoad* load = &loads[i];
+        Texture texture = {0};
+        glGenTextures(1, &texture.ID);
+        texture.type = load->texture_type;
+        strncpy_s(texture.path, sizeof(texture.path), load->path, _TRUNCATE);
+
+        if (load->data)
+        {
+            uploadTextureImage(texture.ID, load->texture_type, load->data, load->width, load->height, load->nrChannels);
+        }
+        else
+        {
+            printf("Failed to load texture %s/%s\n", load->directory, load->path);
+        }
+        stbi_image_free(load->data);
+        load->data = NULL;
+        *load->out = texture;
+    }
+}
+
+// Same result as calling createTextureFromFile for every entry, but all files are decoded in parallel
+// on the job system. Must be called from the GL thread; only the uploads happen on it.
+void createTexturesFromFiles(TextureLoad* loads, int count)
+{
+    PROFILE_ZONE("createTexturesFromFiles");
+    decodeTextures(loads, count);
+    uploadTextures(loads, count);
+}
+
 unsigned int loadCubemap(const char *faces[6]) 
 {
     unsigned int textureID;
@@ -97,7 +256,7 @@ unsigned int loadCubemap(const char *faces[6])
     int width, height, nrChannels;
 
     for (unsigned int i = 0; i < 6; i++) {
-        unsigned char *data = stbi_load(faces[i], &width, &height, &nrChannels, 0);
+        unsigned char *data = loadImageFile(faces[i], &width, &height, &nrChannels);
         if (data) {
             glTexImage2D(
                 GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
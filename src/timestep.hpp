@@ -0,0 +1,50 @@
+#ifndef TIMESTEP_H
+#define TIMESTEP_H
+
+// Fixed-rate simulation clock.
+// Rendered frame time is added to an accumulator and the simulation runs in whole steps of
+// `step` seconds, so its cost and results don't depend on the frame rate. What is left in the
+// accumulator becomes the interpolation factor between the last two simulated states.
+
+#define TIMESTEP_MAX_FRAME_TIME 0.25 // a longer hitch is dropped instead of simulated
+
+struct FixedTimestep {
+    double step;         // seconds per tick
+    double accumulator;
+    int maxSteps;        // per frame; prevents a slow frame from snowballing into slower ones
+    unsigned long long tick;
+};
+
+void fixedTimestepInit(FixedTimestep* timestep, double ticksPerSecond, int maxSteps)
+{
+    timestep->step = 1.0 / ticksPerSecond;
+    timestep->accumulator = 0.0;
+    timestep->maxSteps = maxSteps;
+    timestep->tick = 0;
+}
+
+// Adds the frame's time and returns how many ticks to simulate this frame.
+int fixedTimestepAdvance(FixedTimestep* timestep, double frameTime)
+{
+    if (frameTime > TIMESTEP_MAX_FRAME_TIME) frameTime = TIMESTEP_MAX_FRAME_TIME;
+    if (frameTime < 0.0) frameTime = 0.0;
+    timestep->accumulator += frameTime;
+
+    int steps = (int)(timestep->accumulator / timestep->step);
+    if (steps > timestep->maxSteps)
+    {
+        steps = timestep->maxSteps;
+        timestep->accumulator = steps * timestep->step; // drop the backlog
+    }
+    timestep->accumulator -= steps * timestep->step;
+    timestep->tick += steps;
+    return steps;
+}
+
+// Blend factor in [0, 1) from the previous to the current simulated state.
+float fixedTimestepAlpha(const FixedTimestep* timestep)
+{
+    return (float)(timestep->accumulator / timestep->step);
+}
+
+#endif
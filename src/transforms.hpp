@@ -0,0 +1,385 @@
+#ifndef TRANSFORMS_H
+#define TRANSFORMS_H
+#include "../thirdparty/glm/glm.hpp"
+#include "../thirdparty/glm/gtc/quaternion.hpp"
+#include "../thirdparty/glm/gtc/matrix_transform.hpp"
+#include "../thirdparty/glm/gtc/matrix_inverse.hpp"
+#include "../thirdparty/glm/gtc/type_ptr.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "shader.hpp"
+#include "jobs.hpp"
+#include "profiler.hpp"
+
+// Transform components in structure-of-arrays layout.
+// Position, rotation (quaternion) and scale live in one float array per component, so the update
+// kernel loads TRANSFORMS_SIMD_WIDTH objects per register and composes their world matrices
+// (T * R * S) and normal matrices (R * S^-1, the inverse transpose of the upper 3x3) together.
+// Groups with no dirty entry are skipped, so static objects cost one byte compare per group.
+// Results are written out as glm::mat4 (the normal matrix in the upper 3x3) ready for upload.
+
+#ifndef TRANSFORMS_SIMD_WIDTH
+#if defined(__AVX__)
+#define TRANSFORMS_SIMD_WIDTH 8
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TRANSFORMS_SIMD_WIDTH 4
+#else
+#define TRANSFORMS_SIMD_WIDTH 1
+#endif
+#endif
+
+#if TRANSFORMS_SIMD_WIDTH > 1
+#include <immintrin.h>
+#endif
+
+#define TRANSFORMS_ALIGNMENT 32
+#define TRANSFORMS_PARALLEL_THRESHOLD 16384 // below this a single thread beats the job fan-out
+#define TRANSFORMS_BATCH_SIZE 4096
+
+struct TransformStore {
+    int count;
+    int capacity;   // multiple of TRANSFORMS_SIMD_WIDTH
+
+    float *px, *py, *pz;
+    float *qx, *qy, *qz, *qw;
+    float *sx, *sy, *sz;
+    unsigned char* dirty;
+
+    glm::mat4* world;
+    glm::mat4* normal;
+};
+
+static void* transformsAlloc(size_t size)
+{
+#if TRANSFORMS_SIMD_WIDTH > 1
+    return _mm_malloc(size, TRANSFORMS_ALIGNMENT);
+#else
+    return malloc(size);
+#endif
+}
+
+static void transformsFree(void* ptr)
+{
+#if TRANSFORMS_SIMD_WIDTH > 1
+    _mm_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+void transformStoreInit(TransformStore* store, int capacity)
+{
+    memset(store, 0, sizeof(*store));
+    capacity = (capacity + TRANSFORMS_SIMD_WIDTH - 1) / TRANSFORMS_SIMD_WIDTH * TRANSFORMS_SIMD_WIDTH;
+    store->capacity = capacity;
+
+    float** components[10] = {&store->px, &store->py, &store->pz, &store->qx, &store->qy, &store->qz, &store->qw,
+                              &store->sx, &store->sy, &store->sz};
+    for (int i = 0; i < 10; i++)
+        *components[i] = (float*)transformsAlloc(capacity * sizeof(float));
+    store->dirty = (unsigned char*)transformsAlloc(capacity);
+    store->world = (glm::mat4*)transformsAlloc(capacity * sizeof(glm::mat4));
+    store->normal = (glm::mat4*)transformsAlloc(capacity * sizeof(glm::mat4));
+
+    // unused slots hold identity so the kernel can run over whole groups
+    for (int i = 0; i < capacity; i++)
+    {
+        store->px[i] = store->py[i] = store->pz[i] = 0.0f;
+        store->qx[i] = store->qy[i] = store->qz[i] = 0.0f;
+        store->qw[i] = 1.0f;
+        store->sx[i] = store->sy[i] = store->sz[i] = 1.0f;
+        store->dirty[i] = 0;
+    }
+}
+
+void transformStoreDestroy(TransformStore* store)
+{
+    float* components[10] = {store->px, store->py, store->pz, store->qx, store->qy, store->qz, store->qw,
+                             store->sx, store->sy, store->sz};
+    for (int i = 0; i < 10; i++)
+        transformsFree(components[i]);
+    transformsFree(store->dirty);
+    transformsFree(store->world);
+    transformsFree(store->normal);
+    memset(store, 0, sizeof(*store));
+}
+
+void transformSet(TransformStore* store, int index, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale)
+{
+    store->px[index] = position.x; store->py[index] = position.y; store->pz[index] = position.z;
+    store->qx[index] = rotation.x; store->qy[index] = rotation.y; store->qz[index] = rotation.z; store->qw[index] = rotation.w;
+    store->sx[index] = scale.x; store->sy[index] = scale.y; store->sz[index] = scale.z;
+    store->dirty[index] = 1;
+}
+
+void transformSetPosition(TransformStore* store, int index, const glm::vec3& position)
+{
+    store->px[index] = position.x; store->py[index] = position.y; store->pz[index] = position.z;
+    store->dirty[index] = 1;
+}
+
+// Returns the new index, or -1 when the store is full.
+int transformAdd(TransformStore* store, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale)
+{
+    if (store->count >= store->capacity) {
+        printf("ERROR::TRANSFORMS::STORE_FULL\n");
+        return -1;
+    }
+    int index = store->count++;
+    transformSet(store, index, position, rotation, scale);
+    return index;
+}
+
+// ---- kernel ------------------------------------------------------------------------------------
+
+#if TRANSFORMS_SIMD_WIDTH == 8
+typedef __m256 tfloat;
+static inline tfloat tLoad(const float* p) { return _mm256_load_ps(p); }
+static inline tfloat tSet(float v) { return _mm256_set1_ps(v); }
+static inline tfloat tAdd(tfloat a, tfloat b) { return _mm256_add_ps(a, b); }
+static inline tfloat tSub(tfloat a, tfloat b) { return _mm256_sub_ps(a, b); }
+static inline tfloat tMul(tfloat a, tfloat b) { return _mm256_mul_ps(a, b); }
+static inline tfloat tDiv(tfloat a, tfloat b) { return _mm256_div_ps(a, b); }
+#elif TRANSFORMS_SIMD_WIDTH == 4
+typedef __m128 tfloat;
+static inline tfloat tLoad(const float* p) { return _mm_load_ps(p); }
+static inline tfloat tSet(float v) { return _mm_set1_ps(v); }
+static inline tfloat tAdd(tfloat a, tfloat b) { return _mm_add_ps(a, b); }
+static inline tfloat tSub(tfloat a, tfloat b) { return _mm_sub_ps(a, b); }
+static inline tfloat tMul(tfloat a, tfloat b) { return _mm_mul_ps(a, b); }
+static inline tfloat tDiv(tfloat a, tfloat b) { return _mm_div_ps(a, b); }
+#else
+typedef float tfloat;
+static inline tfloat tLoad(const float* p) { return *p; }
+static inline tfloat tSet(float v) { return v; }
+static inline tfloat tAdd(tfloat a, tfloat b) { return a + b; }
+static inline tfloat tSub(tfloat a, tfloat b) { return a - b; }
+static inline tfloat tMul(tfloat a, tfloat b) { return a * b; }
+static inline tfloat tDiv(tfloat a, tfloat b) { return a / b; }
+#endif
+
+#if TRANSFORMS_SIMD_WIDTH > 1
+// cols[c][k] holds component k of column c for 4 objects; writes 4 column-major matrices.
+static inline void transformsStore4(glm::mat4* out, __m128 cols[4][4])
+{
+    for (int c = 0; c < 4; c++)
+    {
+        __m128 x = cols[c][0], y = cols[c][1], z = cols[c][2], w = cols[c][3];
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+        _mm_store_ps(&out[0][c][0], x);
+        _mm_store_ps(&out[1][c][0], y);
+        _mm_store_ps(&out[2][c][0], z);
+        _mm_store_ps(&out[3][c][0], w);
+    }
+}
+#endif
+
+static inline void transformsStore(glm::mat4* out, tfloat cols[4][4])
+{
+#if TRANSFORMS_SIMD_WIDTH == 8
+    __m128 lo[4][4], hi[4][4];
+    for (int c = 0; c < 4; c++)
+        for (int k = 0; k < 4; k++)
+        {
+            lo[c][k] = _mm256_castps256_ps128(cols[c][k]);
+            hi[c][k] = _mm256_extractf128_ps(cols[c][k], 1);
+        }
+    transformsStore4(out, lo);
+    transformsStore4(out + 4, hi);
+#elif TRANSFORMS_SIMD_WIDTH == 4
+    transformsStore4(out, cols);
+#else
+    for (int c = 0; c < 4; c++)
+        out[0][c] = glm::vec4(cols[c][0], cols[c][1], cols[c][2], cols[c][3]);
+#endif
+}
+
+// Composes TRANSFORMS_SIMD_WIDTH transforms starting at `first` (aligned to the width).
+static inline void transformsComposeGroup(TransformStore* store, int first)
+{
+    tfloat x = tLoad(store->qx + first), y = tLoad(store->qy + first), z = tLoad(store->qz + first), w = tLoad(store->qw + first);
+    tfloat sx = tLoad(store->sx + first), sy = tLoad(store->sy + first), sz = tLoad(store->sz + first);
+    const tfloat one = tSet(1.0f), two = tSet(2.0f), zero = tSet(0.0f);
+
+    tfloat xx = tMul(x, x), yy = tMul(y, y), zz = tMul(z, z);
+    tfloat xy = tMul(x, y), xz = tMul(x, z), yz = tMul(y, z);
+    tfloat wx = tMul(w, x), wy = tMul(w, y), wz = tMul(w, z);
+
+    // rotation matrix, r[column][row]
+    tfloat r[3][3];
+    r[0][0] = tSub(one, tMul(two, tAdd(yy, zz)));
+    r[0][1] = tMul(two, tAdd(xy, wz));
+    r[0][2] = tMul(two, tSub(xz, wy));
+    r[1][0] = tMul(two, tSub(xy, wz));
+    r[1][1] = tSub(one, tMul(two, tAdd(xx, zz)));
+    r[1][2] = tMul(two, tAdd(yz, wx));
+    r[2][0] = tMul(two, tAdd(xz, wy));
+    r[2][1] = tMul(two, tSub(yz, wx));
+    r[2][2] = tSub(one, tMul(two, tAdd(xx, yy)));
+
+    tfloat scale[3] = {sx, sy, sz};
+    tfloat cols[4][4];
+    for (int c = 0; c < 3; c++)
+    {
+        cols[c][0] = tMul(r[c][0], scale[c]);
+        cols[c][1] = tMul(r[c][1], scale[c]);
+        cols[c][2] = tMul(r[c][2], scale[c]);
+        cols[c][3] = zero;
+    }
+    cols[3][0] = tLoad(store->px + first);
+    cols[3][1] = tLoad(store->py + first);
+    cols[3][2] = tLoad(store->pz + first);
+    cols[3][3] = one;
+    transformsStore(store->world + first, cols);
+
+    for (int c = 0; c < 3; c++)
+    {
+        tfloat inv = tDiv(one, scale[c]);
+        cols[c][0] = tMul(r[c][0], inv);
+        cols[c][1] = tMul(r[c][1], inv);
+        cols[c][2] = tMul(r[c][2], inv);
+    }
+    cols[3][0] = cols[3][1] = cols[3][2] = zero;
+    transformsStore(store->normal + first, cols);
+}
+
+// Updates the dirty transforms in [begin, end). begin must be a multiple of TRANSFORMS_SIMD_WIDTH.
+// Returns the number of groups that were recomposed.
+int transformsUpdateRange(TransformStore* store, int begin, int end)
+{
+    int groups = 0;
+    for (int first = begin; first < end; first += TRANSFORMS_SIMD_WIDTH)
+    {
+        bool anyDirty = false;
+        for (int i = 0; i < TRANSFORMS_SIMD_WIDTH; i++)
+            anyDirty |= store->dirty[first + i] != 0;
+        if (!anyDirty) continue;
+
+        transformsComposeGroup(store, first);
+        memset(store->dirty + first, 0, TRANSFORMS_SIMD_WIDTH);
+        groups++;
+    }
+    return groups;
+}
+
+static void transformsUpdateJob(void* data, int begin, int end)
+{
+    TransformStore* store = (TransformStore*)data;
+    transformsUpdateRange(store, begin * TRANSFORMS_SIMD_WIDTH, end * TRANSFORMS_SIMD_WIDTH);
+}
+
+// Recomposes every dirty transform; large stores are split across the job system.
+void transformsUpdate(TransformStore* store)
+{
+    PROFILE_ZONE("transformsUpdate");
+    int numGroups = (store->count + TRANSFORMS_SIMD_WIDTH - 1) / TRANSFORMS_SIMD_WIDTH;
+    if (store->count < TRANSFORMS_PARALLEL_THRESHOLD)
+    {
+        transformsUpdateRange(store, 0, numGroups * TRANSFORMS_SIMD_WIDTH);
+        return;
+    }
+    jobsParallelFor("transforms", numGroups, TRANSFORMS_BATCH_SIZE / TRANSFORMS_SIMD_WIDTH, transformsUpdateJob, store);
+}
+
+// Uploads the "model" and "normalMatrix" uniforms of a stored transform.
+void setModelMatrices(Shader shader, const TransformStore* store, int index)
+{
+    setMat4(shader, "model", glm::value_ptr(store->world[index]));
+    glm::mat3 normal = glm::mat3(store->normal[index]);
+    setMat3(shader, "normalMatrix", glm::value_ptr(normal));
+}
+
+// Same for a matrix that is not in a store; the normal matrix is derived on the spot.
+void setModelMatrix(Shader shader, const glm::mat4& model)
+{
+    setMat4(shader, "model", glm::value_ptr(model));
+    glm::mat3 normal = glm::inverseTranspose(glm::mat3(model));
+    setMat3(shader, "normalMatrix", glm::value_ptr(normal));
+}
+
+// ---- benchmark ---------------------------------------------------------------------------------
+
+static double transformsElapsedNs(std::chrono::steady_clock::time_point start)
+{
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Marks the first `count` transforms dirty; moving objects are expected to be allocated together.
+static void transformsMarkDirty(TransformStore* store, int count)
+{
+    memset(store->dirty, 1, count);
+}
+
+// Compares the kernel against per-object glm composition for 100k to 1M transforms.
+void transformsBenchmark()
+{
+    const int counts[] = {100000, 250000, 500000, 1000000};
+    const int runs = 5;
+    printf("transforms benchmark: SIMD width %d, %d workers, best of %d runs (ns/transform)\n", TRANSFORMS_SIMD_WIDTH, g_jobs.numWorkers, runs);
+    printf("  %8s %10s %10s %10s %12s %10s\n", "count", "glm", "kernel", "10% dirty", "kernel+jobs", "max err");
+
+    for (int n : counts)
+    {
+        TransformStore store;
+        transformStoreInit(&store, n);
+        uint32_t rng = 12345;
+        auto rnd = [&rng]() { rng = rng * 1664525u + 1013904223u; return (rng >> 8) * (1.0f / 16777216.0f); };
+        for (int i = 0; i < n; i++)
+        {
+            glm::vec3 axis = glm::normalize(glm::vec3(rnd() - 0.5f, rnd() - 0.5f, rnd() - 0.5f) + glm::vec3(0.0f, 1e-3f, 0.0f));
+            transformAdd(&store, glm::vec3(rnd() * 100.0f, rnd() * 100.0f, rnd() * 100.0f),
+                         glm::angleAxis(rnd() * 6.2831853f, axis), glm::vec3(0.5f + rnd(), 0.5f + rnd(), 0.5f + rnd()));
+        }
+
+        glm::mat4* reference = (glm::mat4*)malloc(n * sizeof(glm::mat4));
+        glm::mat3* referenceNormal = (glm::mat3*)malloc(n * sizeof(glm::mat3));
+        double best[4] = {1e30, 1e30, 1e30, 1e30};
+        for (int run = 0; run < runs; run++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < n; i++)
+            {
+                glm::mat4 m = glm::translate(glm::mat4(1.0f), glm::vec3(store.px[i], store.py[i], store.pz[i]));
+                m = m * glm::mat4_cast(glm::quat(store.qw[i], store.qx[i], store.qy[i], store.qz[i]));
+                m = glm::scale(m, glm::vec3(store.sx[i], store.sy[i], store.sz[i]));
+                reference[i] = m;
+                referenceNormal[i] = glm::inverseTranspose(glm::mat3(m));
+            }
+            best[0] = glm::min(best[0], transformsElapsedNs(start));
+
+            transformsMarkDirty(&store, n);
+            start = std::chrono::steady_clock::now();
+            transformsUpdateRange(&store, 0, store.capacity);
+            best[1] = glm::min(best[1], transformsElapsedNs(start));
+
+            transformsMarkDirty(&store, n / 10);
+            start = std::chrono::steady_clock::now();
+            transformsUpdateRange(&store, 0, store.capacity);
+            best[2] = glm::min(best[2], transformsElapsedNs(start));
+
+            transformsMarkDirty(&store, n);
+            start = std::chrono::steady_clock::now();
+            transformsUpdate(&store);
+            best[3] = glm::min(best[3], transformsElapsedNs(start));
+        }
+
+        float maxError = 0.0f;
+        for (int i = 0; i < n; i++)
+            for (int c = 0; c < 4; c++)
+                for (int k = 0; k < 4; k++)
+                {
+                    maxError = glm::max(maxError, glm::abs(store.world[i][c][k] - reference[i][c][k]));
+                    if (c < 3 && k < 3)
+                        maxError = glm::max(maxError, glm::abs(store.normal[i][c][k] - referenceNormal[i][c][k]));
+                }
+
+        printf("  %8d %10.2f %10.2f %10.2f %12.2f %10.2e\n", n, best[0] / n, best[1] / n, best[2] / n, best[3] / n, maxError);
+        free(reference);
+        free(referenceNormal);
+        transformStoreDestroy(&store);
+    }
+}
+
+#endif
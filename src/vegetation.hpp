@@ -0,0 +1,164 @@
+#ifndef VEGETATION_H
+#define VEGETATION_H
+#include <glad/glad.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../thirdparty/glm/glm.hpp"
+#include "../thirdparty/glm/gtc/type_ptr.hpp"
+#include "shader.hpp"
+#include "mesh.hpp"
+#include "frustum.hpp"
+#include "renderstats.hpp"
+
+// GPU-instanced vegetation.
+// A field of grass cards is scattered once over a rectangle of ground (a jittered grid, so coverage is
+// even without clumps) into a static instance buffer. Every frame shaders/vegetation_cull.comp tests
+// each card's bounding sphere against the view frustum and VEGETATION_MAX_DISTANCE, appends survivors
+// to a compacted buffer and counts them straight into the instanceCount of an indirect command; the
+// whole field is then one glDrawElementsIndirect of the card mesh, with no readback.
+// shaders/vegetation_vertex.glsl places, sways and fades each card from its instance.
+//
+// Per frame:
+//     vegetationCull(&field, viewFrustum, cameraPosition);
+//     useShader(grassShader); vegetationDraw(&field, grassShader, cameraPosition, time);
+
+#define VEGETATION_MAX_DISTANCE 40.0f   // cards past this are culled
+#define VEGETATION_FADE_START 28.0f     // cards sink into the ground from here to VEGETATION_MAX_DISTANCE
+#define VEGETATION_WIND_STRENGTH 0.35f  // sway of a card top, in card heights
+#define VEGETATION_CULL_GROUP 256       // local_size_x of vegetation_cull.comp
+#define VEGETATION_CARD_RADIUS 1.6f     // bounding radius of a scale 1 card: its 2x2 quad plus sway
+
+// Matches GrassInstance in the shaders (std430).
+struct GrassInstance {
+    glm::vec4 positionRotation;     // ground position, yaw in radians
+    glm::vec4 params;               // x scale, y wind phase
+};
+
+struct VegetationField {
+    unsigned int instanceBuffer;    // every card, written once
+    unsigned int visibleBuffer;     // cards that passed culling this frame
+    unsigned int commandBuffer;     // one MeshletDrawCommand, instanceCount filled by the compute pass
+    int numInstances;
+    Mesh* card;                     // quad with its base at y = -1, texture v = 0 at the bottom
+    Shader cull;
+};
+
+static uint32_t vegetationHash(uint32_t x)
+{
+    x ^= x >> 16; x *= 0x7feb352dU;
+    x ^= x >> 15; x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+static float vegetationRandom(uint32_t* state)
+{
+    *state = vegetationHash(*state + 0x9e3779b9U);
+    return (float)(*state >> 8) * (1.0f / 16777216.0f);
+}
+
+// Scatters about `numInstances` cards over [areaMin, areaMax] in x/z at height groundY.
+void vegetationInit(VegetationField* field, Mesh* card, int numInstances, glm::vec2 areaMin, glm::vec2 areaMax,
+                    float groundY, float minScale, float maxScale, uint32_t seed)
+{
+    memset(field, 0, sizeof(*field));
+    field->card = card;
+
+    glm::vec2 extent = areaMax - areaMin;
+    int cellsX = (int)ceilf(sqrtf((float)numInstances * extent.x / extent.y));
+    int cellsZ = (numInstances + cellsX - 1) / cellsX;
+    glm::vec2 cell = extent / glm::vec2((float)cellsX, (float)cellsZ);
+    field->numInstances = cellsX * cellsZ;
+
+    GrassInstance* instances = (GrassInstance*)malloc(field->numInstances * sizeof(GrassInstance));
+    uint32_t state = seed;
+    for (int z = 0; z < cellsZ; z++)
+        for (int x = 0; x < cellsX; x++)
+        {
+            GrassInstance* instance = instances + z * cellsX + x;
+            float px = areaMin.x + (x + vegetationRandom(&state)) * cell.x;
+            float pz = areaMin.y + (z + vegetationRandom(&state)) * cell.y;
+            float yaw = vegetationRandom(&state) * 6.2831853f;
+            float scale = minScale + (maxScale - minScale) * vegetationRandom(&state);
+            instance->positionRotation = glm::vec4(px, groundY, pz, yaw);
+            instance->params = glm::vec4(scale, vegetationRandom(&state) * 6.2831853f, 0.0f, 0.0f);
+        }
+
+    glGenBuffers(1, &field->instanceBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, field->instanceBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, field->numInstances * sizeof(GrassInstance), instances, GL_STATIC_DRAW);
+    glGenBuffers(1, &field->visibleBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, field->visibleBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, field->numInstances * sizeof(GrassInstance), NULL, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    RENDER_STAT_ADD(RENDER_STAT_BUFFER_BYTES, 2 * field->numInstances * sizeof(GrassInstance));
+    free(instances);
+
+    MeshletDrawCommand command = {card->lods[0].indexCount, 0, card->lods[0].indexOffset, 0, 0};
+    glGenBuffers(1, &field->commandBuffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, field->commandBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(command), &command, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    field->cull = createComputeShaderFromFile("shaders/vegetation_cull.comp");
+}
+
+void vegetationDestroy(VegetationField* field)
+{
+    glDeleteBuffers(1, &field->instanceBuffer);
+    glDeleteBuffers(1, &field->visibleBuffer);
+    glDeleteBuffers(1, &field->commandBuffer);
+    deleteShader(field->cull);
+}
+
+// Resets the visible count and dispatches the culling pass; the draw that follows waits on it.
+void vegetationCull(VegetationField* field, const Frustum& frustum, const glm::vec3& cameraPosition)
+{
+    const GLuint zero = 0;
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, field->commandBuffer);
+    glBufferSubData(GL_DRAW_INDIRECT_BUFFER, offsetof(MeshletDrawCommand, instanceCount), sizeof(zero), &zero);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    useShader(field->cull);
+    RENDER_STAT_ADD(RENDER_STAT_UNIFORM_UPLOADS, 4);
+    glUniform4fv(glGetUniformLocation(field->cull.ID, "frustumPlanes"), FRUSTUM_PLANES_MAX, glm::value_ptr(frustum.planes[0]));
+    glUniform3fv(glGetUniformLocation(field->cull.ID, "cameraPosition"), 1, glm::value_ptr(cameraPosition));
+    glUniform1f(glGetUniformLocation(field->cull.ID, "maxDistance"), VEGETATION_MAX_DISTANCE);
+    glUniform1ui(glGetUniformLocation(field->cull.ID, "numInstances"), (GLuint)field->numInstances);
+    setFloat(field->cull, "cardRadius", VEGETATION_CARD_RADIUS);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, field->instanceBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, field->visibleBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, field->commandBuffer);
+    glDispatchCompute((field->numInstances + VEGETATION_CULL_GROUP - 1) / VEGETATION_CULL_GROUP, 1, 1);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+// Draws the cards that survived vegetationCull with `shader`, which must be in use. Cards are double
+// sided, so culling is off for the draw.
+void vegetationDraw(VegetationField* field, Shader shader, const glm::vec3& cameraPosition, float time)
+{
+    setVec3(shader, "cameraPosition", glm::value_ptr(cameraPosition));
+    setFloat(shader, "time", time);
+    setFloat(shader, "fadeStart", VEGETATION_FADE_START);
+    setFloat(shader, "fadeEnd", VEGETATION_MAX_DISTANCE);
+    setFloat(shader, "windStrength", VEGETATION_WIND_STRENGTH);
+    activateMesh(field->card, &shader);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, field->visibleBuffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, field->commandBuffer);
+    glDisable(GL_CULL_FACE);
+    glBindVertexArray(field->card->VAO);
+    glDrawElementsIndirect(GL_TRIANGLES, field->card->indexType, (void*)0);
+    glBindVertexArray(0);
+    glEnable(GL_CULL_FACE);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    // the instance count stays on the GPU; triangles are not counted to avoid a readback
+    RENDER_STAT_ADD(RENDER_STAT_STATE_CHANGES, 1);
+    RENDER_STAT_ADD(RENDER_STAT_DRAW_CALLS, 1);
+}
+
+#endif
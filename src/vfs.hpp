@@ -0,0 +1,591 @@
+#ifndef VFS_H
+#define VFS_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "profiler.hpp"
+
+#ifdef _WIN32
+// before glad.h, which then keeps the APIENTRY windows.h defines
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Virtual filesystem over pack files.
+// A pack holds a tree of assets as one file: a header, every entry's data starting on a 4K boundary,
+// and an index sorted by path hash at the end. Mounting maps the whole pack read-only, so opening a
+// stored entry is a binary search and a pointer into the mapping; no file is opened per asset.
+// Entries that compress well (shaders, .obj/.mtl, caches) are stored LZ4 compressed and decoded into
+// a heap buffer on open; images are already compressed and stay zero-copy.
+// Paths not in any mounted pack are read as loose files, which is all that happens in development
+// where no pack exists. Later mounts shadow earlier ones.
+//
+//     vfsMount("assets.pak");                  // at startup, before anything loads
+//     VfsFile file;
+//     if (vfsOpen("shaders/vertex.glsl", &file)) { use(file.data, file.size); vfsClose(&file); }
+//
+// Packs are built with --pack-assets, which stores each file's size and modification time so cache
+// keys (meshCacheSourceStamp) match whether a source comes from the pack or the disk.
+// The codec writes and reads the standard LZ4 block format, without the frame wrapper.
+
+#define VFS_PACK_VERSION 1
+#define VFS_PACK_ALIGNMENT 4096
+#define VFS_MAX_PACKS 4
+#define VFS_MAX_PATH 200
+#define VFS_DEFAULT_PACK "assets.pak"
+
+#ifndef VFS_PACK_COMPRESS
+#define VFS_PACK_COMPRESS 1
+#endif
+
+// vfsOpen flags
+#define VFS_LOOSE_ONLY 1    // skip mounted packs, e.g. hot reload reading the file that just changed
+
+enum VfsCompression_Types {
+    VFS_COMPRESSION_NONE,
+    VFS_COMPRESSION_LZ4,
+    VFS_COMPRESSION_MAX
+};
+const char* g_vfs_compression_str[VFS_COMPRESSION_MAX] = {"none", "lz4"};
+
+struct VfsPackHeader {
+    char magic[4];          // "GLPK"
+    uint32_t version;
+    uint32_t numEntries;
+    uint32_t entrySize;     // sizeof(VfsPackEntry) when written
+    uint64_t indexOffset;
+};
+
+struct VfsPackEntry {
+    uint64_t hash;          // vfsHashPath of the normalized path, entries are sorted on it
+    uint64_t offset;        // of the stored bytes, a multiple of VFS_PACK_ALIGNMENT
+    uint64_t storedSize;
+    uint64_t size;          // after decompression
+    int64_t sourceTime;     // modification time of the packed file
+    uint32_t compression;
+    uint32_t reserved;
+    char path[VFS_MAX_PATH];
+};
+
+struct VfsPack {
+    const unsigned char* base;
+    size_t size;
+    const VfsPackEntry* entries;
+    int numEntries;
+#ifdef _WIN32
+    HANDLE file, mapping;
+#endif
+};
+
+struct Vfs {
+    VfsPack packs[VFS_MAX_PACKS];
+    int numPacks;
+};
+
+Vfs g_vfs;
+
+// An open file: data points into a pack mapping or at `owned`, size bytes, followed by a '\0' when owned.
+struct VfsFile {
+    const unsigned char* data;
+    size_t size;
+    unsigned char* owned;
+};
+
+// ---- paths -------------------------------------------------------------------------------------
+
+// Forward slashes, no "." segments, ".." folded into the parent: "assets\\models/./a/../b.obj" ->
+// "assets/models/b.obj". Returns false when the result does not fit.
+static bool vfsNormalizePath(const char* path, char* out, size_t outSize)
+{
+    if (outSize == 0) return false;
+    size_t length = 0;
+    int depth = 0;  // segments in out that a ".." can take back
+    const char* segment = path;
+    while (*segment)
+    {
+        const char* end = segment;
+        while (*end && *end != '/' && *end != '\\') end++;
+        size_t segmentLength = end - segment;
+        bool parent = segmentLength == 2 && segment[0] == '.' && segment[1] == '.';
+        if (segmentLength == 0 || (segmentLength == 1 && segment[0] == '.')) {
+            // empty or current directory
+        } else if (parent && depth > 0) {
+            while (length > 0 && out[length - 1] != '/') length--;
+            if (length > 0) length--;
+            depth--;
+        } else {
+            if (length + (length > 0) + segmentLength + 1 > outSize) return false;
+            if (length > 0) out[length++] = '/';
+            memcpy(out + length, segment, segmentLength);
+            length += segmentLength;
+            if (!parent) depth++;
+        }
+        segment = *end ? end + 1 : end;
+    }
+    out[length] = '\0';
+    return true;
+}
+
+// FNV-1a
+static uint64_t vfsHashPath(const char* normalizedPath)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (const char* c = normalizedPath; *c; c++)
+    {
+        hash ^= (unsigned char)*c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// ---- LZ4 block codec ---------------------------------------------------------------------------
+
+#define VFS_LZ4_HASH_BITS 14
+#define VFS_LZ4_MIN_MATCH 4
+#define VFS_LZ4_LAST_LITERALS 5     // the block ends with at least this many literals
+#define VFS_LZ4_MATCH_LIMIT 12      // no match starts in the last 12 bytes
+
+static size_t vfsLz4Bound(size_t size) { return size + size / 255 + 16; }
+
+static uint32_t vfsRead32(const unsigned char* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+
+static unsigned char* vfsLz4WriteLength(unsigned char* out, size_t length)
+{
+    while (length >= 255) { *out++ = 255; length -= 255; }
+    *out++ = (unsigned char)length;
+    return out;
+}
+
+static unsigned char* vfsLz4WriteSequence(unsigned char* out, const unsigned char* literals, size_t numLiterals, size_t offset, size_t matchLength)
+{
+    unsigned char* token = out++;
+    *token = (unsigned char)((numLiterals >= 15 ? 15 : numLiterals) << 4);
+    if (numLiterals >= 15) out = vfsLz4WriteLength(out, numLiterals - 15);
+    memcpy(out, literals, numLiterals);
+    out += numLiterals;
+    if (matchLength == 0) return out;   // the last sequence has literals only
+
+    *out++ = (unsigned char)(offset & 0xff);
+    *out++ = (unsigned char)(offset >> 8);
+    size_t length = matchLength - VFS_LZ4_MIN_MATCH;
+    *token |= (unsigned char)(length >= 15 ? 15 : length);
+    if (length >= 15) out = vfsLz4WriteLength(out, length - 15);
+    return out;
+}
+
+// Greedy single-probe compressor; `out` needs vfsLz4Bound(size) bytes. Returns the compressed size.
+// Incompressible stretches are skipped faster the longer they run.
+static size_t vfsLz4Compress(const unsigned char* in, size_t size, unsigned char* out)
+{
+    std::vector<uint32_t> table(1 << VFS_LZ4_HASH_BITS, 0);
+    unsigned char* op = out;
+    size_t anchor = 0, i = 1;
+    if (size > VFS_LZ4_MATCH_LIMIT)
+    {
+        size_t matchStartLimit = size - VFS_LZ4_MATCH_LIMIT, matchEndLimit = size - VFS_LZ4_LAST_LITERALS;
+        unsigned misses = 0;
+        while (i < matchStartLimit)
+        {
+            uint32_t sequence = vfsRead32(in + i);
+            uint32_t h = (sequence * 2654435761u) >> (32 - VFS_LZ4_HASH_BITS);
+            size_t candidate = table[h];
+            table[h] = (uint32_t)i;
+            if (candidate >= i || i - candidate > 65535 || vfsRead32(in + candidate) != sequence)
+            {
+                i += 1 + (misses++ >> 6);
+                continue;
+            }
+            misses = 0;
+
+            // grow backwards over literals, then forwards
+            while (i > anchor && candidate > 0 && in[i - 1] == in[candidate - 1]) { i--; candidate--; }
+            size_t length = VFS_LZ4_MIN_MATCH;
+            while (i + length < matchEndLimit && in[i + length] == in[candidate + length]) length++;
+
+            op = vfsLz4WriteSequence(op, in + anchor, i - anchor, i - candidate, length);
+            i += length;
+            anchor = i;
+            if (i >= 2 && i - 2 < matchStartLimit)
+                table[(vfsRead32(in + i - 2) * 2654435761u) >> (32 - VFS_LZ4_HASH_BITS)] = (uint32_t)(i - 2);
+        }
+    }
+    op = vfsLz4WriteSequence(op, in + anchor, size - anchor, 0, 0);
+    return (size_t)(op - out);
+}
+
+// Decodes exactly `size` bytes; false on any malformed or truncated input.
+static bool vfsLz4Decompress(const unsigned char* in, size_t inSize, unsigned char* out, size_t size)
+{
+    size_t ip = 0, op = 0;
+    while (ip < inSize)
+    {
+        unsigned token = in[ip++];
+        size_t numLiterals = token >> 4;
+        if (numLiterals == 15)
+        {
+            unsigned char extra;
+            do {
+                if (ip >= inSize) return false;
+                extra = in[ip++];
+                numLiterals += extra;
+            } while (extra == 255);
+        }
+        if (numLiterals > inSize - ip || numLiterals > size - op) return false;
+        memcpy(out + op, in + ip, numLiterals);
+        ip += numLiterals;
+        op += numLiterals;
+        if (ip == inSize) break;
+
+        if (inSize - ip < 2) return false;
+        size_t offset = in[ip] | (in[ip + 1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op) return false;
+        size_t length = token & 15;
+        if (length == 15)
+        {
+            unsigned char extra;
+            do {
+                if (ip >= inSize) return false;
+                extra = in[ip++];
+                length += extra;
+            } while (extra == 255);
+        }
+        length += VFS_LZ4_MIN_MATCH;
+        if (length > size - op) return false;
+        // byte by byte: a match may overlap the bytes it produces
+        const unsigned char* match = out + op - offset;
+        for (size_t k = 0; k < length; k++) out[op + k] = match[k];
+        op += length;
+    }
+    return op == size;
+}
+
+// ---- mounting ----------------------------------------------------------------------------------
+
+static void vfsUnmapPack(VfsPack* pack)
+{
+#ifdef _WIN32
+    if (pack->base) UnmapViewOfFile(pack->base);
+    if (pack->mapping) CloseHandle(pack->mapping);
+    if (pack->file != INVALID_HANDLE_VALUE && pack->file) CloseHandle(pack->file);
+#else
+    if (pack->base) munmap((void*)pack->base, pack->size);
+#endif
+    memset(pack, 0, sizeof(*pack));
+}
+
+static bool vfsMapPack(const char* packPath, VfsPack* pack)
+{
+    memset(pack, 0, sizeof(*pack));
+#ifdef _WIN32
+    pack->file = CreateFileA(packPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (pack->file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(pack->file, &fileSize) || fileSize.QuadPart == 0) { vfsUnmapPack(pack); return false; }
+    pack->size = (size_t)fileSize.QuadPart;
+    pack->mapping = CreateFileMappingA(pack->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!pack->mapping) { vfsUnmapPack(pack); return false; }
+    pack->base = (const unsigned char*)MapViewOfFile(pack->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!pack->base) { vfsUnmapPack(pack); return false; }
+#else
+    int fd = open(packPath, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) { close(fd); return false; }
+    void* base = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return false;
+    pack->base = (const unsigned char*)base;
+    pack->size = (size_t)info.st_size;
+#endif
+    return true;
+}
+
+// Maps a pack and validates its index. False without a message when the file does not exist.
+bool vfsMount(const char* packPath)
+{
+    if (g_vfs.numPacks == VFS_MAX_PACKS) {
+        printf("ERROR::VFS::TOO_MANY_PACKS: %s\n", packPath);
+        return false;
+    }
+    VfsPack pack;
+    if (!vfsMapPack(packPath, &pack)) return false;
+
+    VfsPackHeader header;
+    bool ok = pack.size >= sizeof(header);
+    if (ok) memcpy(&header, pack.base, sizeof(header));
+    ok = ok && memcmp(header.magic, "GLPK", 4) == 0 && header.version == VFS_PACK_VERSION && header.entrySize == sizeof(VfsPackEntry) &&
+         header.indexOffset <= pack.size && header.numEntries <= (pack.size - header.indexOffset) / sizeof(VfsPackEntry) &&
+         header.indexOffset % VFS_PACK_ALIGNMENT == 0;
+    if (ok)
+    {
+        pack.entries = (const VfsPackEntry*)(pack.base + header.indexOffset);
+        pack.numEntries = (int)header.numEntries;
+        for (int i = 0; ok && i < pack.numEntries; i++)
+        {
+            const VfsPackEntry* entry = &pack.entries[i];
+            ok = entry->offset <= header.indexOffset && entry->storedSize <= header.indexOffset - entry->offset &&
+                 entry->compression < VFS_COMPRESSION_MAX && memchr(entry->path, '\0', VFS_MAX_PATH) != NULL &&
+                 (entry->compression != VFS_COMPRESSION_NONE || entry->storedSize == entry->size) &&
+                 (i == 0 || pack.entries[i - 1].hash < entry->hash);
+        }
+    }
+    if (!ok) {
+        printf("ERROR::VFS::INVALID_PACK: %s\n", packPath);
+        vfsUnmapPack(&pack);
+        return false;
+    }
+
+    g_vfs.packs[g_vfs.numPacks++] = pack;
+    printf("VFS: mounted %s, %d files\n", packPath, pack.numEntries);
+    return true;
+}
+
+void vfsUnmountAll()
+{
+    for (int i = 0; i < g_vfs.numPacks; i++) vfsUnmapPack(&g_vfs.packs[i]);
+    g_vfs.numPacks = 0;
+}
+
+// Newest mount first.
+static const VfsPackEntry* vfsFind(const char* path, const VfsPack** packOut)
+{
+    if (g_vfs.numPacks == 0) return NULL;
+    char normalized[VFS_MAX_PATH];
+    if (!vfsNormalizePath(path, normalized, sizeof(normalized))) return NULL;
+    uint64_t hash = vfsHashPath(normalized);
+    for (int p = g_vfs.numPacks - 1; p >= 0; p--)
+    {
+        const VfsPack* pack = &g_vfs.packs[p];
+        int low = 0, high = pack->numEntries;
+        while (low < high)
+        {
+            int middle = (low + high) / 2;
+            if (pack->entries[middle].hash < hash) low = middle + 1;
+            else high = middle;
+        }
+        if (low < pack->numEntries && pack->entries[low].hash == hash && strcmp(pack->entries[low].path, normalized) == 0)
+        {
+            *packOut = pack;
+            return &pack->entries[low];
+        }
+    }
+    return NULL;
+}
+
+// ---- files -------------------------------------------------------------------------------------
+
+static bool vfsReadLoose(const char* path, VfsFile* file)
+{
+    FILE* handle = fopen(path, "rb");
+    if (!handle) return false;
+    fseek(handle, 0, SEEK_END);
+    long fileSize = ftell(handle);
+    fseek(handle, 0, SEEK_SET);
+    if (fileSize < 0) { fclose(handle); return false; }
+    file->owned = (unsigned char*)malloc((size_t)fileSize + 1);
+    bool ok = file->owned && fread(file->owned, 1, (size_t)fileSize, handle) == (size_t)fileSize;
+    fclose(handle);
+    if (!ok) { free(file->owned); file->owned = NULL; return false; }
+    file->owned[fileSize] = '\0';
+    file->data = file->owned;
+    file->size = (size_t)fileSize;
+    return true;
+}
+
+// Opens a file from the mounted packs or the disk. Stored pack entries are views into the mapping and
+// stay valid until vfsUnmountAll. Safe to call from any thread once the packs are mounted.
+bool vfsOpen(const char* path, VfsFile* file, int flags = 0)
+{
+    memset(file, 0, sizeof(*file));
+    const VfsPack* pack = NULL;
+    const VfsPackEntry* entry = (flags & VFS_LOOSE_ONLY) ? NULL : vfsFind(path, &pack);
+    if (!entry) return vfsReadLoose(path, file);
+
+    const unsigned char* stored = pack->base + entry->offset;
+    if (entry->compression == VFS_COMPRESSION_NONE)
+    {
+        file->data = stored;
+        file->size = (size_t)entry->size;
+        return true;
+    }
+
+    PROFILE_ZONE("vfsDecompress");
+    file->owned = (unsigned char*)malloc((size_t)entry->size + 1);
+    if (!file->owned || !vfsLz4Decompress(stored, (size_t)entry->storedSize, file->owned, (size_t)entry->size)) {
+        printf("ERROR::VFS::CORRUPT_ENTRY: %s\n", entry->path);
+        free(file->owned);
+        file->owned = NULL;
+        return false;
+    }
+    file->owned[entry->size] = '\0';
+    file->data = file->owned;
+    file->size = (size_t)entry->size;
+    return true;
+}
+
+void vfsClose(VfsFile* file)
+{
+    free(file->owned);
+    memset(file, 0, sizeof(*file));
+}
+
+bool vfsExists(const char* path)
+{
+    const VfsPack* pack;
+    if (vfsFind(path, &pack)) return true;
+    struct stat info;
+    return stat(path, &info) == 0;
+}
+
+// Size and modification time of the file as it was packed, or of the loose file.
+bool vfsStat(const char* path, long long* size, long long* time)
+{
+    const VfsPack* pack;
+    const VfsPackEntry* entry = vfsFind(path, &pack);
+    if (entry) {
+        *size = (long long)entry->size;
+        *time = (long long)entry->sourceTime;
+        return true;
+    }
+    struct stat info;
+    if (stat(path, &info) != 0) {
+        *size = 0;
+        *time = 0;
+        return false;
+    }
+    *size = (long long)info.st_size;
+    *time = (long long)info.st_mtime;
+    return true;
+}
+
+// ---- building ----------------------------------------------------------------------------------
+
+static bool vfsWritePadding(FILE* file, uint64_t* offset)
+{
+    static const unsigned char zeros[VFS_PACK_ALIGNMENT] = {0};
+    size_t padding = (size_t)((VFS_PACK_ALIGNMENT - *offset % VFS_PACK_ALIGNMENT) % VFS_PACK_ALIGNMENT);
+    *offset += padding;
+    return padding == 0 || fwrite(zeros, 1, padding, file) == padding;
+}
+
+// Packs every file under the given directories into packPath (--pack-assets). Paths are stored as
+// found relative to the working directory, the way the loaders ask for them.
+bool vfsBuildPack(const char* packPath, const char* const* roots, int numRoots)
+{
+    PROFILE_ZONE("vfsBuildPack");
+    std::vector<VfsPackEntry> entries;
+    std::vector<std::string> sources;
+    for (int r = 0; r < numRoots; r++)
+    {
+        std::error_code error;
+        for (auto it = std::filesystem::recursive_directory_iterator(roots[r], error); !error && it != std::filesystem::recursive_directory_iterator(); it.increment(error))
+        {
+            if (!it->is_regular_file()) continue;
+            std::string source = it->path().generic_string();
+            VfsPackEntry entry = {};
+            if (!vfsNormalizePath(source.c_str(), entry.path, sizeof(entry.path))) {
+                printf("ERROR::VFS::PATH_TOO_LONG: %s\n", source.c_str());
+                return false;
+            }
+            entry.hash = vfsHashPath(entry.path);
+            entries.push_back(entry);
+            sources.push_back(source);
+        }
+        if (error) printf("ERROR::VFS::CANNOT_LIST: %s (%s)\n", roots[r], error.message().c_str());
+    }
+
+    std::vector<int> order(entries.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = (int)i;
+    std::sort(order.begin(), order.end(), [&](int a, int b) { return entries[a].hash < entries[b].hash; });
+    for (size_t i = 1; i < order.size(); i++)
+        if (entries[order[i]].hash == entries[order[i - 1]].hash) {
+            printf("ERROR::VFS::HASH_COLLISION: %s and %s\n", entries[order[i]].path, entries[order[i - 1]].path);
+            return false;
+        }
+
+    FILE* file = fopen(packPath, "wb");
+    if (!file) {
+        printf("ERROR::VFS::CANNOT_WRITE: %s\n", packPath);
+        return false;
+    }
+    // the header is rewritten once the index offset is known
+    VfsPackHeader header = {};
+    uint64_t offset = sizeof(header);
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && vfsWritePadding(file, &offset);
+
+    uint64_t totalSize = 0, totalStored = 0;
+    std::vector<VfsPackEntry> index;
+    std::vector<unsigned char> compressed;
+    for (size_t i = 0; ok && i < order.size(); i++)
+    {
+        VfsPackEntry entry = entries[order[i]];
+        VfsFile source;
+        long long size, time;
+        if (!vfsStat(sources[order[i]].c_str(), &size, &time) || !vfsOpen(sources[order[i]].c_str(), &source, VFS_LOOSE_ONLY)) {
+            printf("ERROR::VFS::CANNOT_READ: %s\n", sources[order[i]].c_str());
+            ok = false;
+            break;
+        }
+
+        const unsigned char* stored = source.data;
+        size_t storedSize = source.size;
+        entry.compression = VFS_COMPRESSION_NONE;
+#if VFS_PACK_COMPRESS
+        // keep compression only where it saves an eighth, decoding costs more than reading the difference
+        compressed.resize(vfsLz4Bound(source.size));
+        size_t compressedSize = vfsLz4Compress(source.data, source.size, compressed.data());
+        if (source.size >= 256 && compressedSize < source.size - source.size / 8)
+        {
+            stored = compressed.data();
+            storedSize = compressedSize;
+            entry.compression = VFS_COMPRESSION_LZ4;
+        }
+#endif
+        entry.offset = offset;
+        entry.storedSize = storedSize;
+        entry.size = source.size;
+        entry.sourceTime = time;
+        ok = (storedSize == 0 || fwrite(stored, 1, storedSize, file) == storedSize);
+        offset += storedSize;
+        ok = ok && vfsWritePadding(file, &offset);
+        totalSize += entry.size;
+        totalStored += storedSize;
+        index.push_back(entry);
+        vfsClose(&source);
+    }
+
+    memcpy(header.magic, "GLPK", 4);
+    header.version = VFS_PACK_VERSION;
+    header.numEntries = (uint32_t)index.size();
+    header.entrySize = sizeof(VfsPackEntry);
+    header.indexOffset = offset;
+    ok = ok && (index.empty() || fwrite(index.data(), sizeof(VfsPackEntry), index.size(), file) == index.size());
+    ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = (fclose(file) == 0) && ok;
+    if (!ok) {
+        printf("ERROR::VFS::WRITE_FAILED: %s\n", packPath);
+        remove(packPath);
+        return false;
+    }
+    printf("VFS: packed %d files into %s, %.2f MB stored for %.2f MB\n", (int)index.size(), packPath,
+           totalStored / (1024.0 * 1024.0), totalSize / (1024.0 * 1024.0));
+    return true;
+}
+
+#endif